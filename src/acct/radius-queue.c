@@ -0,0 +1,661 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <talloc.h>
+#include <ccan/list/list.h>
+#include <ccan/hash/hash.h>
+
+#include <sec-mod.h>
+#include "acct/radius-queue.h"
+
+#ifdef HAVE_RADIUS
+
+#define SPOOL_ADD 1
+#define SPOOL_DONE 2
+
+/* the spool is rewritten when larger than this and mostly acknowledged
+ * records */
+#define SPOOL_COMPACT_SIZE (1024*1024)
+
+/* at most one message on a full queue in that time */
+#define OVERFLOW_LOG_SECS 60
+
+/* An entry of the spool; followed by len bytes of attributes for
+ * SPOOL_ADD. The file is only read by the host that wrote it. */
+struct spool_hdr_st {
+	uint32_t check; /* hash of the rest of the entry */
+	uint8_t op;
+	uint8_t status;
+	uint16_t len;
+	uint64_t seq;
+	int64_t created;
+	char sid[SAFE_ID_SIZE]; /* of the session, for SPOOL_ADD */
+};
+
+typedef struct acct_rec_st {
+	struct list_node list;
+	struct acct_queue_st *q;
+	uint64_t seq;
+	unsigned status;
+	char sid[SAFE_ID_SIZE];
+	time_t created;
+	uint8_t *attrs;
+	unsigned attrs_len;
+	struct radius_req_st *req; /* set while in flight */
+} acct_rec_st;
+
+struct acct_queue_st {
+	sec_mod_watch_st w; /* must be first */
+	struct radius_client_st *client;
+
+	struct list_head records; /* oldest first */
+	unsigned count;
+	unsigned size;
+	unsigned inflight;
+	uint64_t next_seq;
+	unsigned started;
+
+	/* backoff after a request which no server replied */
+	unsigned failures;
+	time_t retry_at;
+
+	/* dropped since the last message on a full queue */
+	unsigned overflow_dropped;
+	time_t overflow_logged;
+
+	char *spool;
+	int spool_fd;
+	off_t spool_size;
+	off_t live_size; /* of the entries of the queued records */
+	unsigned spool_dirty;
+	time_t last_sync;
+};
+
+static struct {
+	uint64_t sent;
+	uint64_t dropped;
+	uint32_t backlog;
+} totals;
+
+static void pump(struct acct_queue_st *q, time_t now);
+
+static uint32_t entry_check(const struct spool_hdr_st *hdr, const uint8_t *attrs)
+{
+	uint32_t h;
+
+	h = hash_any(&hdr->op, sizeof(*hdr) - offsetof(struct spool_hdr_st, op), 0);
+	if (hdr->op == SPOOL_ADD)
+		h = hash_any(attrs, hdr->len, h);
+	return h;
+}
+
+static void spool_close(struct acct_queue_st *q)
+{
+	if (q->spool_fd != -1) {
+		close(q->spool_fd);
+		q->spool_fd = -1;
+	}
+}
+
+static void spool_write(struct acct_queue_st *q, unsigned op, const acct_rec_st *r)
+{
+	uint8_t buf[sizeof(struct spool_hdr_st) + RADIUS_MAX_PACKET];
+	struct spool_hdr_st hdr;
+	size_t len = sizeof(hdr);
+	ssize_t ret;
+
+	if (q->spool_fd == -1)
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.op = op;
+	hdr.status = r->status;
+	hdr.seq = r->seq;
+	hdr.created = r->created;
+	if (op == SPOOL_ADD) {
+		memcpy(hdr.sid, r->sid, sizeof(hdr.sid));
+		hdr.len = r->attrs_len;
+		memcpy(&buf[len], r->attrs, r->attrs_len);
+		len += r->attrs_len;
+	}
+	hdr.check = entry_check(&hdr, r->attrs);
+	memcpy(buf, &hdr, sizeof(hdr));
+
+	/* a single write, so that a crash leaves at most a truncated entry */
+	ret = write(q->spool_fd, buf, len);
+	if (ret != (ssize_t)len) {
+		syslog(LOG_ERR, "radius-acct: error writing to %s: %s; spooling disabled",
+		       q->spool, ret < 0 ? strerror(errno) : "short write");
+		spool_close(q);
+		return;
+	}
+
+	q->spool_size += len;
+	q->spool_dirty = 1;
+}
+
+/* Rewrites the spool with the queued records only */
+static void spool_rewrite(struct acct_queue_st *q)
+{
+	char tmp[_POSIX_PATH_MAX];
+	acct_rec_st *r;
+	int fd, old;
+
+	if (q->spool_fd == -1)
+		return;
+
+	if (q->count == 0) {
+		if (ftruncate(q->spool_fd, 0) == 0) {
+			q->spool_size = 0;
+			q->live_size = 0;
+		}
+		return;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", q->spool);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		syslog(LOG_ERR, "radius-acct: cannot create %s: %s", tmp, strerror(errno));
+		return;
+	}
+
+	old = q->spool_fd;
+	q->spool_fd = fd;
+	q->spool_size = 0;
+	list_for_each(&q->records, r, list) {
+		spool_write(q, SPOOL_ADD, r);
+	}
+
+	if (q->spool_fd == -1 || fdatasync(fd) != 0 || rename(tmp, q->spool) != 0) {
+		syslog(LOG_ERR, "radius-acct: cannot replace %s", q->spool);
+		if (q->spool_fd != -1)
+			close(fd);
+		unlink(tmp);
+		/* continue with the previous file */
+		q->spool_fd = old;
+		q->spool_size = lseek(old, 0, SEEK_END);
+		return;
+	}
+
+	close(old);
+	q->live_size = q->spool_size;
+	q->spool_dirty = 0;
+}
+
+static acct_rec_st *rec_new(struct acct_queue_st *q, unsigned status, const char *sid,
+			    time_t created, const uint8_t *attrs, unsigned attrs_len)
+{
+	acct_rec_st *r;
+
+	r = talloc_zero(q, acct_rec_st);
+	if (r == NULL)
+		return NULL;
+
+	r->attrs = talloc_memdup(r, attrs, attrs_len);
+	if (r->attrs == NULL) {
+		talloc_free(r);
+		return NULL;
+	}
+
+	r->q = q;
+	r->attrs_len = attrs_len;
+	r->status = status;
+	r->created = created;
+	r->seq = q->next_seq++;
+	if (sid)
+		strlcpy(r->sid, sid, sizeof(r->sid));
+
+	return r;
+}
+
+static void rec_link(struct acct_queue_st *q, acct_rec_st *r)
+{
+	list_add_tail(&q->records, &r->list);
+	q->count++;
+	q->live_size += sizeof(struct spool_hdr_st) + r->attrs_len;
+	totals.backlog++;
+}
+
+static void rec_unlink(struct acct_queue_st *q, acct_rec_st *r)
+{
+	list_del(&r->list);
+	q->count--;
+	q->live_size -= sizeof(struct spool_hdr_st) + r->attrs_len;
+	totals.backlog--;
+}
+
+/* Removes an acknowledged or dropped record */
+static void rec_remove(struct acct_queue_st *q, acct_rec_st *r)
+{
+	spool_write(q, SPOOL_DONE, r);
+	rec_unlink(q, r);
+
+	if (r->req) {
+		/* cancels the transmission */
+		talloc_free(r->req);
+		r->req = NULL;
+		q->inflight--;
+	}
+	talloc_free(r);
+}
+
+/* The interim update of session @sid which is queued and not in flight */
+static acct_rec_st *find_interim(struct acct_queue_st *q, const char *sid)
+{
+	acct_rec_st *r;
+
+	if (sid[0] == 0)
+		return NULL;
+
+	list_for_each(&q->records, r, list) {
+		if (r->req == NULL && r->status == PW_STATUS_ALIVE &&
+		    strcmp(r->sid, sid) == 0)
+			return r;
+	}
+	return NULL;
+}
+
+/* Reads the records of a previous run */
+static void spool_replay(struct acct_queue_st *q)
+{
+	struct list_head early;
+	struct spool_hdr_st hdr;
+	uint8_t attrs[RADIUS_MAX_PACKET];
+	acct_rec_st *r, *victim;
+	unsigned replayed = 0;
+	off_t offset = 0;
+	ssize_t ret;
+
+	/* the records queued before the spool was opened follow */
+	list_head_init(&early);
+	while ((r = list_top(&q->records, acct_rec_st, list)) != NULL) {
+		list_del(&r->list);
+		list_add_tail(&early, &r->list);
+	}
+
+	for (;;) {
+		ret = read(q->spool_fd, &hdr, sizeof(hdr));
+		if (ret == 0)
+			break;
+		if (ret != sizeof(hdr) || hdr.len > sizeof(attrs) ||
+		    (hdr.op != SPOOL_ADD && hdr.op != SPOOL_DONE))
+			goto truncated;
+
+		if (hdr.op == SPOOL_ADD &&
+		    read(q->spool_fd, attrs, hdr.len) != hdr.len)
+			goto truncated;
+
+		if (hdr.check != entry_check(&hdr, attrs))
+			goto truncated;
+		offset += sizeof(hdr) + (hdr.op == SPOOL_ADD ? hdr.len : 0);
+
+		if (hdr.op == SPOOL_DONE) {
+			/* usually one of the oldest */
+			list_for_each(&q->records, r, list) {
+				if (r->seq == hdr.seq) {
+					rec_unlink(q, r);
+					talloc_free(r);
+					replayed--;
+					break;
+				}
+			}
+			continue;
+		}
+
+		hdr.sid[sizeof(hdr.sid) - 1] = 0;
+		r = rec_new(q, hdr.status, hdr.sid, hdr.created, attrs, hdr.len);
+		if (r == NULL)
+			break;
+		r->seq = hdr.seq;
+		if (hdr.seq >= q->next_seq)
+			q->next_seq = hdr.seq + 1;
+		rec_link(q, r);
+		replayed++;
+	}
+
+	if (0) {
+ truncated:
+		syslog(LOG_NOTICE, "radius-acct: ignoring the truncated tail of %s at offset %lu",
+		       q->spool, (unsigned long)offset);
+	}
+
+	/* these supersede the replayed interim updates of their session */
+	while ((r = list_top(&early, acct_rec_st, list)) != NULL) {
+		list_del(&r->list);
+		if (r->status == PW_STATUS_ALIVE &&
+		    (victim = find_interim(q, r->sid)) != NULL) {
+			rec_unlink(q, victim);
+			talloc_free(victim);
+			replayed--;
+		}
+		list_add_tail(&q->records, &r->list);
+		r->seq = q->next_seq++;
+	}
+
+	/* the oldest records do not fit */
+	while (q->count > q->size) {
+		r = list_top(&q->records, acct_rec_st, list);
+		rec_unlink(q, r);
+		talloc_free(r);
+		totals.dropped++;
+	}
+
+	if (replayed > 0)
+		syslog(LOG_INFO, "radius-acct: %u accounting records pending from %s",
+		       replayed, q->spool);
+
+	spool_rewrite(q);
+}
+
+static void spool_open(sec_mod_st *sec, struct acct_queue_st *q)
+{
+	char *name;
+
+	if (q->spool == NULL)
+		return;
+
+	/* each sec-mod instance has its own spool */
+	name = talloc_asprintf(q, "%s.%u", q->spool, (unsigned)sec->sec_mod_instance_id);
+	if (name == NULL)
+		return;
+	talloc_free(q->spool);
+	q->spool = name;
+
+	q->spool_fd = open(q->spool, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (q->spool_fd == -1) {
+		seclog(sec, LOG_ERR, "radius-acct: cannot open %s: %s", q->spool,
+		       strerror(errno));
+		return;
+	}
+
+	spool_replay(q);
+}
+
+static unsigned backoff_secs(unsigned failures)
+{
+	unsigned secs = ACCT_RETRY_MIN_SECS, r = 0;
+
+	while (--failures > 0 && secs < ACCT_RETRY_MAX_SECS)
+		secs *= 2;
+	if (secs > ACCT_RETRY_MAX_SECS)
+		secs = ACCT_RETRY_MAX_SECS;
+
+	/* spread the retries over the second half of the interval */
+	if (gnutls_rnd(GNUTLS_RND_NONCE, &r, sizeof(r)) < 0)
+		r = random();
+	return secs / 2 + r % (secs / 2 + 1);
+}
+
+static void acct_reply(sec_mod_st *sec, void *priv, unsigned code,
+		       const uint8_t *attrs, unsigned attrs_len)
+{
+	acct_rec_st *r = priv;
+	struct acct_queue_st *q = r->q;
+	time_t now = time(NULL);
+
+	talloc_free(r->req);
+	r->req = NULL;
+	q->inflight--;
+
+	if (code == RADIUS_CODE_ACCOUNTING_RESPONSE) {
+		if (q->failures > 0)
+			seclog(sec, LOG_INFO, "radius-acct: accounting server is responding; %u records queued",
+			       q->count - 1);
+		q->failures = 0;
+		q->retry_at = 0;
+		totals.sent++;
+		rec_remove(q, r);
+	} else {
+		/* the record is retried after the backoff, in order; the
+		 * other records in flight fail the same way */
+		if (q->retry_at <= now) {
+			q->failures++;
+			q->retry_at = now + backoff_secs(q->failures);
+			seclog(sec, LOG_NOTICE, "radius-acct: no accounting server replied; retrying in %u secs, %u records queued",
+			       (unsigned)(q->retry_at - now), q->count);
+		}
+	}
+
+	pump(q, now);
+}
+
+static int send_record(struct acct_queue_st *q, acct_rec_st *r, time_t now)
+{
+	uint8_t delay[6];
+	uint32_t v;
+
+	r->req = radius_req_new(r, q->client, RADIUS_CODE_ACCOUNTING_REQUEST,
+				acct_reply, r);
+	if (r->req == NULL)
+		return -1;
+
+	if (radius_req_add_raw(r->req, r->attrs, r->attrs_len) < 0)
+		goto fail;
+
+	/* RFC2866 Acct-Delay-Time; the time spent in the queue */
+	if (now > r->created) {
+		v = htonl(now - r->created);
+		delay[0] = PW_ACCT_DELAY_TIME;
+		delay[1] = sizeof(delay);
+		memcpy(&delay[2], &v, sizeof(v));
+		if (radius_req_add_raw(r->req, delay, sizeof(delay)) < 0)
+			goto fail;
+	}
+
+	if (radius_req_send(r->req) < 0)
+		goto fail;
+
+	q->inflight++;
+	return 0;
+ fail:
+	talloc_free(r->req);
+	r->req = NULL;
+	return -1;
+}
+
+/* Sends the oldest records not in flight */
+static void pump(struct acct_queue_st *q, time_t now)
+{
+	acct_rec_st *r;
+
+	if (!q->started || q->retry_at > now)
+		return;
+
+	list_for_each(&q->records, r, list) {
+		if (q->inflight >= ACCT_QUEUE_WINDOW)
+			break;
+		if (r->req != NULL)
+			continue;
+
+		if (send_record(q, r, now) < 0) {
+			q->failures++;
+			q->retry_at = now + backoff_secs(q->failures);
+			break;
+		}
+	}
+}
+
+static int acct_queue_expire(sec_mod_st *sec, sec_mod_watch_st *w, time_t now)
+{
+	struct acct_queue_st *q = (struct acct_queue_st *)w;
+	int secs = -1;
+
+	if (!q->started) {
+		q->started = 1;
+		spool_open(sec, q);
+	}
+
+	pump(q, now);
+
+	if (q->spool_fd != -1) {
+		if (q->count == 0 && q->spool_size > 0) {
+			spool_rewrite(q);
+		} else if (q->spool_size > SPOOL_COMPACT_SIZE && q->spool_size > 4 * q->live_size) {
+			spool_rewrite(q);
+		}
+
+		if (q->spool_dirty) {
+			if (now > q->last_sync) {
+				if (fdatasync(q->spool_fd) != 0)
+					seclog(sec, LOG_ERR, "radius-acct: error syncing %s: %s",
+					       q->spool, strerror(errno));
+				q->spool_dirty = 0;
+				q->last_sync = now;
+			} else {
+				secs = 1;
+			}
+		}
+	}
+
+	if (q->count > q->inflight && q->retry_at > now) {
+		if (secs == -1 || q->retry_at - now < secs)
+			secs = q->retry_at - now;
+	}
+
+	return secs;
+}
+
+int acct_queue_add(struct acct_queue_st *q, unsigned status_type, const char *sid,
+		   const uint8_t *attrs, unsigned attrs_len)
+{
+	acct_rec_st *r, *victim = NULL;
+	time_t now = time(NULL);
+
+	/* a later interim update supersedes a queued one, including one
+	 * replayed from the spool */
+	if (status_type == PW_STATUS_ALIVE)
+		victim = find_interim(q, sid);
+
+	if (victim == NULL && q->count >= q->size) {
+		if (status_type != PW_STATUS_ALIVE) {
+			list_for_each(&q->records, r, list) {
+				if (r->req == NULL && r->status == PW_STATUS_ALIVE) {
+					victim = r;
+					break;
+				}
+			}
+			if (victim == NULL) {
+				list_for_each(&q->records, r, list) {
+					if (r->req == NULL) {
+						victim = r;
+						break;
+					}
+				}
+			}
+		}
+
+		q->overflow_dropped++;
+		totals.dropped++;
+		if (now >= q->overflow_logged + OVERFLOW_LOG_SECS) {
+			syslog(LOG_WARNING, "radius-acct: the accounting queue is full (%u records); dropped %u records",
+			       q->count, q->overflow_dropped);
+			q->overflow_logged = now;
+			q->overflow_dropped = 0;
+		}
+
+		if (victim == NULL)
+			return -1;
+	}
+
+	r = rec_new(q, status_type, sid, now, attrs, attrs_len);
+	if (r == NULL)
+		return -1;
+
+	if (victim)
+		rec_remove(q, victim);
+
+	rec_link(q, r);
+	spool_write(q, SPOOL_ADD, r);
+
+	pump(q, now);
+	return 0;
+}
+
+static int queue_destructor(struct acct_queue_st *q)
+{
+	acct_rec_st *r;
+
+	list_for_each(&q->records, r, list) {
+		totals.backlog--;
+	}
+
+	if (q->spool_fd != -1) {
+		if (q->spool_dirty)
+			fdatasync(q->spool_fd);
+		close(q->spool_fd);
+	}
+	sec_mod_watch_del(&q->w);
+	return 0;
+}
+
+struct acct_queue_st *acct_queue_new(void *pool, struct radius_client_st *client,
+				     const char *spool, unsigned size)
+{
+	struct acct_queue_st *q;
+
+	q = talloc_zero(pool, struct acct_queue_st);
+	if (q == NULL)
+		return NULL;
+
+	q->client = client;
+	q->size = size ? size : ACCT_QUEUE_DEFAULT_SIZE;
+	q->spool_fd = -1;
+	q->next_seq = 1;
+	list_head_init(&q->records);
+
+	if (spool) {
+		q->spool = talloc_strdup(q, spool);
+		if (q->spool == NULL)
+			goto fail;
+	}
+
+	q->w.fd = -1;
+	q->w.expire = acct_queue_expire;
+	if (sec_mod_watch_add(&q->w) < 0)
+		goto fail;
+	talloc_set_destructor(q, queue_destructor);
+
+	return q;
+ fail:
+	talloc_free(q);
+	return NULL;
+}
+
+void acct_queue_get_stats(uint64_t *sent, uint64_t *dropped, uint32_t *backlog)
+{
+	*sent = totals.sent;
+	*dropped = totals.dropped;
+	*backlog = totals.backlog;
+
+	totals.sent = 0;
+	totals.dropped = 0;
+}
+
+#endif
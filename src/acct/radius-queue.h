@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ACCT_RADIUS_QUEUE_H
+#define ACCT_RADIUS_QUEUE_H
+
+#include <sec-mod.h>
+#include <radius-client.h>
+
+#ifdef HAVE_RADIUS
+
+/* A queue of accounting records sent by the asynchronous RADIUS client.
+ * The records are sent in order, up to ACCT_QUEUE_WINDOW at a time, and
+ * are kept until the server acknowledges them. When no server replies,
+ * sending is suspended with an exponential, jittered, backoff.
+ *
+ * A queued interim update is replaced by a later one of the same session.
+ * When the queue is full new interim updates are dropped, and start or
+ * stop records replace the oldest interim update, or the oldest record.
+ * The drops are logged at most once a minute.
+ *
+ * If a spool file is set, the records are also appended to it, with
+ * their session, and replayed when sec-mod starts, so that records
+ * pending on a restart or crash are not lost; a replayed interim update
+ * is replaced as a queued one. The file is synced once per second.
+ */
+
+#define ACCT_QUEUE_DEFAULT_SIZE 4096
+#define ACCT_QUEUE_WINDOW 32
+
+#define ACCT_RETRY_MIN_SECS 2
+#define ACCT_RETRY_MAX_SECS 300
+
+struct acct_queue_st;
+
+/* @spool may be NULL; the file used is @spool suffixed with the sec-mod
+ * instance number. */
+struct acct_queue_st *acct_queue_new(void *pool, struct radius_client_st *client,
+				     const char *spool, unsigned size);
+
+/* Queues an Accounting-Request of @status_type (PW_STATUS_*) with the
+ * encoded attributes @attrs, for the session @sid. */
+int acct_queue_add(struct acct_queue_st *q, unsigned status_type, const char *sid,
+		   const uint8_t *attrs, unsigned attrs_len);
+
+/* The records acknowledged and dropped since the last call, and the
+ * records queued, of all the queues. */
+void acct_queue_get_stats(uint64_t *sent, uint64_t *dropped, uint32_t *backlog);
+
+#endif
+#endif
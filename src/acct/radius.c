@@ -40,6 +40,7 @@
 #include <sec-mod-acct.h>
 #include "auth/radius.h"
 #include "acct/radius.h"
+#include "acct/radius-queue.h"
 #include "common-config.h"
 
 static void acct_radius_vhost_init(void **_vctx, void *pool, void *additional)
@@ -69,6 +70,16 @@ static void acct_radius_vhost_init(void **_vctx, void *pool, void *additional)
 		fprintf(stderr, "error reading the radius dictionary\n");
 		exit(EXIT_FAILURE);
 	}
+
+	if (config->async) {
+		vctx->client = radius_client_new(vctx, vctx->rh, "acctserver", config->weights);
+		if (vctx->client == NULL)
+			goto fail;
+
+		vctx->queue = acct_queue_new(vctx, vctx->client, config->spool, config->queue_size);
+		if (vctx->queue == NULL)
+			goto fail;
+	}
 	*_vctx = vctx;
 
 	return;
@@ -163,6 +174,23 @@ static void append_acct_standard(struct radius_vhost_ctx *vctx, rc_handle *rh, c
 	rc_avpair_add(rh, send, PW_ACCT_AUTHENTIC, &i, -1, 0);
 }
 
+/* Queues the record for the asynchronous client */
+static int radius_acct_queue(struct radius_vhost_ctx *vctx, unsigned status_type,
+			     const common_acct_info_st *ai, VALUE_PAIR *send)
+{
+	uint8_t attrs[RADIUS_MAX_PACKET - RADIUS_HDR_SIZE];
+	int len;
+
+	len = radius_avpairs_encode(send, attrs, sizeof(attrs));
+	if (len < 0 || acct_queue_add(vctx->queue, status_type, ai->safe_id, attrs, len) < 0) {
+		syslog(LOG_NOTICE, "radius-acct: could not queue accounting record for session %s",
+		       ai->safe_id);
+		return -1;
+	}
+
+	return 0;
+}
+
 static void radius_acct_session_stats(void *_vctx, unsigned auth_method, const common_acct_info_st *ai, stats_st *stats)
 {
 	int ret;
@@ -181,6 +209,11 @@ static void radius_acct_session_stats(void *_vctx, unsigned auth_method, const c
 	append_acct_standard(vctx, vctx->rh, ai, &send);
 	append_stats(vctx->rh, &send, stats);
 
+	if (vctx->queue) {
+		radius_acct_queue(vctx, status_type, ai, send);
+		goto cleanup;
+	}
+
 	ret = rc_aaa(vctx->rh, 0, send, &recvd, NULL, 0, PW_ACCOUNTING_REQUEST);
 
 	if (recvd != NULL)
@@ -222,6 +255,11 @@ static int radius_acct_open_session(void *_vctx, unsigned auth_method, const com
 
 	append_acct_standard(vctx, vctx->rh, ai, &send);
 
+	if (vctx->queue) {
+		ret = radius_acct_queue(vctx, status_type, ai, send);
+		goto cleanup;
+	}
+
 	ret = rc_aaa(vctx->rh, 0, send, &recvd, NULL, 0, PW_ACCOUNTING_REQUEST);
 
 	if (recvd != NULL)
@@ -271,6 +309,11 @@ static void radius_acct_close_session(void *_vctx, unsigned auth_method, const c
 	append_acct_standard(vctx, vctx->rh, ai, &send);
 	append_stats(vctx->rh, &send, stats);
 
+	if (vctx->queue) {
+		radius_acct_queue(vctx, status_type, ai, send);
+		goto cleanup;
+	}
+
 	ret = rc_aaa(vctx->rh, 0, send, &recvd, NULL, 0, PW_ACCOUNTING_REQUEST);
 	if (recvd != NULL)
 		rc_avpair_free(recvd);
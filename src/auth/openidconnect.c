@@ -31,24 +31,104 @@
 #include <jansson.h>
 #include <cjose/cjose.h>
 #include <time.h>
+#include <errno.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <sec-mod.h>
+#include <cloexec.h>
+#include <ccan/hash/hash.h>
+#include <ccan/htable/htable.h>
+#include <ccan/list/list.h>
+#include <ccan/container_of/container_of.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #define MINIMUM_KEY_REFRESH_INTERVAL (900)
 
+// The keys are refreshed as allowed by the Cache-Control or Expires
+// headers of the JWKS, within these bounds, or after the default when
+// there are none
+#define DEFAULT_KEY_CACHE_TIME (3600)
+#define MINIMUM_KEY_CACHE_TIME (60)
+#define MAXIMUM_KEY_CACHE_TIME (86400)
+#define KEY_RETRY_INTERVAL (60)
+#define FETCH_TIMEOUT (30)
+
+#define DEFAULT_TOKEN_CACHE_SIZE (256)
+#define TOKEN_DIGEST_SIZE (32)
+
+#ifdef HAVE_PTHREAD
+// The JWKS is fetched by a thread, so that neither the authentications
+// nor the sec-mod loop wait on the network; the result is handed over
+// through the pipe. The fields below the lock are protected by it.
+typedef struct oidc_refresh_st {
+	pthread_t thread;
+	int pipe[2];
+	char *url;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned requested;
+	unsigned done;
+	json_t *jwks;
+	long cache_time;
+} oidc_refresh_st;
+#endif
+
 typedef struct oidc_vctx_st {
 	json_t *config;
 	json_t *jwks;
 	void * pool;
 	int minimum_jwk_refresh_time;
 	time_t last_jwks_load_time;
+
+	// the keys of jwks, by kid
+	struct htable keys;
+
+	// the timer of the refresh, and the thread if there is one
+	sec_mod_watch_st watch;
+	time_t next_refresh;
+	unsigned refreshing;
+#ifdef HAVE_PTHREAD
+	oidc_refresh_st *refresh;
+#endif
+
+	// the verified tokens, by digest, and most recently used first
+	struct htable tokens;
+	struct list_head token_lru;
+	unsigned ntokens;
+	unsigned max_tokens;
 } oidc_vctx_st;
 
+typedef struct oidc_key_st {
+	const char *kid; // in the jwks
+	cjose_jwk_t *jwk;
+} oidc_key_st;
+
+// A token of which the signature and the claims were verified; it is
+// accepted as is until it expires, or its key is removed
+typedef struct oidc_token_st {
+	uint8_t digest[TOKEN_DIGEST_SIZE];
+	time_t exp;
+	char *kid;
+	char username[MAX_USERNAME_SIZE];
+	struct list_node list;
+} oidc_token_st;
+
 typedef struct oidc_ctx_st {
 	oidc_vctx_st *vctx_st;
 	char username[MAX_USERNAME_SIZE];
 	int token_verified;
 } oidc_ctx_st;
 
-static bool oidc_fetch_oidc_keys(oidc_vctx_st * vctx);
+static json_t *oidc_fetch_oidc_keys(const char *openid_configuration_url,
+				    long *cache_time);
+static bool oidc_install_keys(oidc_vctx_st * vctx, json_t * jwks,
+			      long cache_time);
+static void oidc_clear_keys(oidc_vctx_st * vctx);
+static void oidc_refresh_init(oidc_vctx_st * vctx);
+static size_t oidc_token_rehash(const void *elem, void *priv);
 static bool oidc_verify_token(oidc_vctx_st * vctx, const char *token,
 				size_t token_length,
 				char user_name[MAX_USERNAME_SIZE]);
@@ -58,8 +138,10 @@ static void oidc_vhost_init(void **vctx, void *pool, void *additional)
 	const char *config = (const char *)additional;
 	json_error_t err;
 	struct oidc_vctx_st *vc;
+	json_t *jwks;
+	long cache_time = -1;
 
-	vc = talloc(pool, struct oidc_vctx_st);
+	vc = talloc_zero(pool, struct oidc_vctx_st);
 	if (vc == NULL) {
 		syslog(LOG_ERR, "ocserv-oidc allocation failure!\n");
 		exit(EXIT_FAILURE);
@@ -67,6 +149,8 @@ static void oidc_vhost_init(void **vctx, void *pool, void *additional)
 	vc->config = NULL;
 	vc->jwks = NULL;
 	vc->pool = pool;
+	htable_init(&vc->tokens, oidc_token_rehash, NULL);
+	list_head_init(&vc->token_lru);
 
 	if (config == NULL) {
 		syslog(LOG_ERR, "ocserv-oidc: no configuration passed!\n");
@@ -103,11 +187,24 @@ static void oidc_vhost_init(void **vctx, void *pool, void *additional)
 		vc->minimum_jwk_refresh_time = MINIMUM_KEY_REFRESH_INTERVAL;
 	}
 
-	if (!oidc_fetch_oidc_keys(vc)) {
+	if (json_object_get(vc->config, "verified_token_cache_size")) {
+		vc->max_tokens = json_integer_value(json_object_get(vc->config, "verified_token_cache_size"));
+	} else {
+		vc->max_tokens = DEFAULT_TOKEN_CACHE_SIZE;
+	}
+
+	// before any thread uses curl
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+
+	jwks = oidc_fetch_oidc_keys(json_string_value(json_object_get(vc->config, "openid_configuration_url")),
+				    &cache_time);
+	if (!jwks || !oidc_install_keys(vc, jwks, cache_time)) {
 		syslog(LOG_ERR, "ocserv-oidc: failed to load jwks\n");
 		exit(EXIT_FAILURE);
 	}
 
+	oidc_refresh_init(vc);
+
 	*vctx = (void *)vc;
 }
 
@@ -119,6 +216,9 @@ static void oidc_vhost_deinit(void *ctx)
 		return;
 	}
 
+	oidc_clear_keys(vctx);
+	htable_clear(&vctx->tokens);
+
 	if (vctx->jwks) {
 		json_decref(vctx->jwks);
 		vctx->jwks = NULL;
@@ -195,12 +295,17 @@ const struct auth_mod_st oidc_auth_funcs = {
 
 // Key management
 typedef struct oidc_json_parser_context {
-	void *pool;
 	char *buffer;
 	size_t length;
 	size_t offset;
 } oidc_json_parser_context;
 
+// The cache lifetime given by the response headers
+typedef struct oidc_cache_headers {
+	long max_age;
+	long expires;
+} oidc_cache_headers;
+
 // Callback from CURL for each block as it is downloaded
 static size_t oidc_json_parser_context_callback(char *ptr, size_t size,
 						  size_t nmemb, void *userdata)
@@ -214,9 +319,11 @@ static size_t oidc_json_parser_context_callback(char *ptr, size_t size,
 		return 0;
 	}
 
+	// The buffer is not allocated with talloc, as this may run in the
+	// refresh thread
 	if (context->offset + nmemb > context->length) {
 		size_t new_size = (nmemb + context->length) * 3 / 2;
-		void * new_buffer = talloc_realloc_size(context->pool, context->buffer, new_size);
+		void * new_buffer = realloc(context->buffer, new_size);
 		if (new_buffer) {
 			context->buffer = new_buffer;
 			context->length = new_size;
@@ -231,17 +338,52 @@ static size_t oidc_json_parser_context_callback(char *ptr, size_t size,
 	return nmemb;
 }
 
-// Download a JSON file from the provided URI and return it in a jansson object
-static json_t *oidc_fetch_json_from_uri(void * pool, const char *uri)
+// Callback from CURL for each response header
+static size_t oidc_header_callback(char *ptr, size_t size, size_t nitems,
+				   void *userdata)
+{
+	oidc_cache_headers *headers = (oidc_cache_headers *) userdata;
+	size_t length = size * nitems;
+	char line[256];
+	const char *p;
+	time_t t;
+
+	if (length >= sizeof(line)) {
+		return length;
+	}
+	memcpy(line, ptr, length);
+	line[length] = 0;
+
+	if (strncasecmp(line, "Cache-Control:", 14) == 0) {
+		if ((p = strcasestr(line, "max-age=")) != NULL) {
+			headers->max_age = strtol(p + 8, NULL, 10);
+		} else if (strcasestr(line, "no-cache") || strcasestr(line, "no-store")) {
+			headers->max_age = 0;
+		}
+	} else if (strncasecmp(line, "Expires:", 8) == 0) {
+		t = curl_getdate(line + 8, NULL);
+		if (t != -1) {
+			headers->expires = (t > time(NULL)) ? t - time(NULL) : 0;
+		}
+	}
+
+	return length;
+}
+
+// Download a JSON file from the provided URI and return it in a jansson
+// object; the time it may be cached for is stored in cache_time if
+// given, or -1 if the response does not tell.
+static json_t *oidc_fetch_json_from_uri(const char *uri, long *cache_time)
 {
-	oidc_json_parser_context context = { pool, NULL, 0, 0 };
+	oidc_json_parser_context context = { NULL, 0, 0 };
+	oidc_cache_headers headers = { -1, -1 };
 	json_t *json = NULL;
 	json_error_t err;
 	CURL *curl = NULL;
 	CURLcode res;
 
 	context.length = 4096;
-	context.buffer = talloc_size(context.pool, context.length);
+	context.buffer = malloc(context.length);
 
 	if (context.buffer == NULL) {
 		goto cleanup;
@@ -263,6 +405,18 @@ static json_t *oidc_fetch_json_from_uri(void * pool, const char *uri)
 		goto cleanup;
 	}
 
+	// no alarm() from the resolver in the refresh thread
+	res = curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	if (res == CURLE_OK) {
+		res = curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)FETCH_TIMEOUT);
+	}
+	if (res != CURLE_OK) {
+		syslog(LOG_ERR,
+		       "ocserv-oidc: failed to download JSON document: URI %s, CURLcode %d\n",
+		       uri, res);
+		goto cleanup;
+	}
+
 	res =
 	    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
 			     oidc_json_parser_context_callback);
@@ -281,6 +435,20 @@ static json_t *oidc_fetch_json_from_uri(void * pool, const char *uri)
 		goto cleanup;
 	}
 
+	if (cache_time) {
+		res = curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,
+				       oidc_header_callback);
+		if (res == CURLE_OK) {
+			res = curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+		}
+		if (res != CURLE_OK) {
+			syslog(LOG_ERR,
+			       "ocserv-oidc: failed to download JSON document: URI %s, CURLcode %d\n",
+			       uri, res);
+			goto cleanup;
+		}
+	}
+
 	res = curl_easy_perform(curl);
 	if (res != CURLE_OK) {
 		syslog(LOG_ERR,
@@ -297,9 +465,14 @@ static json_t *oidc_fetch_json_from_uri(void * pool, const char *uri)
 		goto cleanup;
 	}
 
+	// Cache-Control takes precedence over Expires
+	if (cache_time) {
+		*cache_time = (headers.max_age >= 0) ? headers.max_age : headers.expires;
+	}
+
  cleanup:
 	if (context.buffer) {
-		talloc_free(context.buffer);
+		free(context.buffer);
 	}
 
 	if (curl) {
@@ -309,18 +482,14 @@ static json_t *oidc_fetch_json_from_uri(void * pool, const char *uri)
 	return json;
 }
 
-// Download and parse the JWT keys for this virtual server context
-static bool oidc_fetch_oidc_keys(oidc_vctx_st * vctx)
+// Download the JWT keys from the provider; this may run in the refresh
+// thread, and does not access the virtual server context
+static json_t *oidc_fetch_oidc_keys(const char *openid_configuration_url,
+				    long *cache_time)
 {
-	bool result = false;
 	json_t *jwks = NULL;
 	json_t *oidc_config = NULL;
-	json_t *openid_configuration_url =
-	    json_object_get(vctx->config, "openid_configuration_url");
-
 	json_t *array;
-	size_t index;
-	json_t *value;
 
 	if (!openid_configuration_url) {
 		syslog(LOG_ERR,
@@ -329,13 +498,11 @@ static bool oidc_fetch_oidc_keys(oidc_vctx_st * vctx)
 	}
 
 	oidc_config =
-	    oidc_fetch_json_from_uri(vctx->pool,
-					   json_string_value
-				       (openid_configuration_url));
+	    oidc_fetch_json_from_uri(openid_configuration_url, NULL);
 
 	if (!oidc_config) {
 		syslog(LOG_ERR,
-		       "ocserv-oidc: Unable to fetch config doc from %s\n", json_string_value(openid_configuration_url));
+		       "ocserv-oidc: Unable to fetch config doc from %s\n", openid_configuration_url);
 		goto cleanup;
 	}
 
@@ -346,7 +513,7 @@ static bool oidc_fetch_oidc_keys(oidc_vctx_st * vctx)
 		goto cleanup;
 	}
 
-	jwks = oidc_fetch_json_from_uri(vctx->pool, json_string_value(jwks_uri));
+	jwks = oidc_fetch_json_from_uri(json_string_value(jwks_uri), cache_time);
 	if (!jwks) {
 		syslog(LOG_ERR,
 		       "ocserv-oidc: failed to fetch keys from jwks_uri %s\n",
@@ -355,39 +522,449 @@ static bool oidc_fetch_oidc_keys(oidc_vctx_st * vctx)
 	}
 
 	array = json_object_get(jwks, "keys");
-	if (array == NULL) {
+	if (array == NULL || !json_is_array(array)) {
 		syslog(LOG_ERR, "ocserv-oidc: JWK keys malformed\n");
+		json_decref(jwks);
+		jwks = NULL;
 		goto cleanup;
 	}
 
-	// Log the keys obtained
+ cleanup:
+	if (oidc_config) {
+		json_decref(oidc_config);
+	}
+
+	return jwks;
+}
+
+static size_t oidc_key_rehash(const void *elem, void *priv)
+{
+	const oidc_key_st *key = elem;
+
+	return hash_any(key->kid, strlen(key->kid), 0);
+}
+
+static oidc_key_st *oidc_find_key(struct htable *keys, const char *kid)
+{
+	struct htable_iter iter;
+	size_t hash = hash_any(kid, strlen(kid), 0);
+	oidc_key_st *key;
+
+	key = htable_firstval(keys, &iter, hash);
+	while (key != NULL) {
+		if (strcmp(key->kid, kid) == 0) {
+			return key;
+		}
+		key = htable_nextval(keys, &iter, hash);
+	}
+	return NULL;
+}
+
+static void oidc_free_keys(struct htable *keys)
+{
+	struct htable_iter iter;
+	oidc_key_st *key;
+
+	key = htable_first(keys, &iter);
+	while (key != NULL) {
+		cjose_jwk_release(key->jwk);
+		talloc_free(key);
+		key = htable_next(keys, &iter);
+	}
+	htable_clear(keys);
+}
+
+static void oidc_clear_keys(oidc_vctx_st * vctx)
+{
+	if (vctx->jwks) {
+		oidc_free_keys(&vctx->keys);
+	}
+}
+
+static size_t oidc_token_rehash(const void *elem, void *priv)
+{
+	const oidc_token_st *token = elem;
+	size_t hash;
+
+	// the digest is uniform
+	memcpy(&hash, token->digest, sizeof(hash));
+	return hash;
+}
+
+static oidc_token_st *oidc_find_token(oidc_vctx_st * vctx,
+				      const uint8_t digest[TOKEN_DIGEST_SIZE])
+{
+	struct htable_iter iter;
+	oidc_token_st *token;
+	size_t hash;
+
+	memcpy(&hash, digest, sizeof(hash));
+
+	token = htable_firstval(&vctx->tokens, &iter, hash);
+	while (token != NULL) {
+		if (memcmp(token->digest, digest, TOKEN_DIGEST_SIZE) == 0) {
+			return token;
+		}
+		token = htable_nextval(&vctx->tokens, &iter, hash);
+	}
+	return NULL;
+}
+
+static void oidc_remove_token(oidc_vctx_st * vctx, oidc_token_st * token)
+{
+	htable_del(&vctx->tokens, oidc_token_rehash(token, NULL), token);
+	list_del(&token->list);
+	vctx->ntokens--;
+	talloc_free(token);
+}
+
+// Returns true and the user name of the token if it was verified before
+// and has not expired
+static bool oidc_get_verified_token(oidc_vctx_st * vctx,
+				    const uint8_t digest[TOKEN_DIGEST_SIZE],
+				    char user_name[MAX_USERNAME_SIZE])
+{
+	oidc_token_st *token;
+
+	if (vctx->ntokens == 0) {
+		return false;
+	}
+
+	token = oidc_find_token(vctx, digest);
+	if (token == NULL) {
+		return false;
+	}
+
+	if (token->exp < time(NULL)) {
+		oidc_remove_token(vctx, token);
+		return false;
+	}
+
+	list_del(&token->list);
+	list_add(&vctx->token_lru, &token->list);
+
+	strlcpy(user_name, token->username, MAX_USERNAME_SIZE);
+	return true;
+}
+
+static void oidc_add_verified_token(oidc_vctx_st * vctx,
+				    const uint8_t digest[TOKEN_DIGEST_SIZE],
+				    time_t exp, const char *kid,
+				    const char *user_name)
+{
+	oidc_token_st *token;
+
+	if (vctx->max_tokens == 0 || kid == NULL) {
+		return;
+	}
+
+	if (oidc_find_token(vctx, digest) != NULL) {
+		return;
+	}
+
+	// the least recently used is replaced
+	if (vctx->ntokens >= vctx->max_tokens) {
+		oidc_remove_token(vctx, list_tail(&vctx->token_lru, oidc_token_st, list));
+	}
+
+	token = talloc_zero(vctx->pool, oidc_token_st);
+	if (token == NULL) {
+		return;
+	}
+
+	token->kid = talloc_strdup(token, kid);
+	if (token->kid == NULL) {
+		talloc_free(token);
+		return;
+	}
+	memcpy(token->digest, digest, TOKEN_DIGEST_SIZE);
+	token->exp = exp;
+	strlcpy(token->username, user_name, sizeof(token->username));
+
+	if (!htable_add(&vctx->tokens, oidc_token_rehash(token, NULL), token)) {
+		talloc_free(token);
+		return;
+	}
+	list_add(&vctx->token_lru, &token->list);
+	vctx->ntokens++;
+}
+
+// Install a new JWKS, with its keys imported and indexed by kid. The
+// verified tokens signed with a key which is no longer listed are
+// removed.
+static bool oidc_install_keys(oidc_vctx_st * vctx, json_t * jwks,
+			      long cache_time)
+{
+	struct htable keys;
+	oidc_key_st *key;
+	oidc_token_st *token, *next;
+	cjose_err err;
+	json_t *array;
+	size_t index;
+	json_t *value;
+	const char *kid;
+	time_t now = time(NULL);
+
+	array = json_object_get(jwks, "keys");
+	if (array == NULL || !json_is_array(array)) {
+		syslog(LOG_ERR, "ocserv-oidc: JWK keys malformed\n");
+		json_decref(jwks);
+		return false;
+	}
+
+	htable_init(&keys, oidc_key_rehash, NULL);
+
 	json_array_foreach(array, index, value) {
-		json_t *key_kid = json_object_get(value, "kid");
+		kid = json_string_value(json_object_get(value, "kid"));
+		if (kid == NULL) {
+			syslog(LOG_NOTICE, "ocserv-oidc: ignoring JWK with no kid\n");
+			continue;
+		}
+
+		// the first key with a kid is used
+		if (oidc_find_key(&keys, kid) != NULL) {
+			continue;
+		}
+
+		key = talloc_zero(vctx->pool, oidc_key_st);
+		if (key == NULL) {
+			continue;
+		}
+		key->kid = kid;
+		key->jwk = cjose_jwk_import_json(value, &err);
+		if (key->jwk == NULL) {
+			syslog(LOG_NOTICE, "ocserv-oidc: failed to import JWK %s: %s\n",
+			       kid, err.message);
+			talloc_free(key);
+			continue;
+		}
+
+		if (!htable_add(&keys, oidc_key_rehash(key, NULL), key)) {
+			cjose_jwk_release(key->jwk);
+			talloc_free(key);
+			continue;
+		}
+
 		syslog(LOG_INFO,
 		       "ocserv-oidc: fetched new JWK %s\n",
-			   json_string_value(key_kid)
+			   kid
 		       );
 	}
 
+	oidc_clear_keys(vctx);
 	if (vctx->jwks) {
 		json_decref(vctx->jwks);
 	}
+	vctx->jwks = jwks;
+	vctx->keys = keys;
+
+	list_for_each_safe(&vctx->token_lru, token, next, list) {
+		if (oidc_find_key(&vctx->keys, token->kid) == NULL || token->exp < now) {
+			oidc_remove_token(vctx, token);
+		}
+	}
 
-	vctx->last_jwks_load_time = time(NULL);
+	if (cache_time < 0) {
+		cache_time = DEFAULT_KEY_CACHE_TIME;
+	}
+	if (cache_time < vctx->minimum_jwk_refresh_time) {
+		cache_time = vctx->minimum_jwk_refresh_time;
+	}
+	if (cache_time < MINIMUM_KEY_CACHE_TIME) {
+		cache_time = MINIMUM_KEY_CACHE_TIME;
+	}
+	if (cache_time > MAXIMUM_KEY_CACHE_TIME) {
+		cache_time = MAXIMUM_KEY_CACHE_TIME;
+	}
 
-	vctx->jwks = jwks;
-	jwks = NULL;
-	result = true;
+	vctx->last_jwks_load_time = now;
+	vctx->next_refresh = now + cache_time;
+	return true;
+}
 
- cleanup:
-	if (oidc_config) {
-		json_decref(oidc_config);
+// Called with the result of a refresh
+static void oidc_refresh_done(oidc_vctx_st * vctx, json_t * jwks,
+			      long cache_time)
+{
+	vctx->refreshing = 0;
+
+	if (!jwks || !oidc_install_keys(vctx, jwks, cache_time)) {
+		syslog(LOG_NOTICE,
+		       "ocserv-oidc: JWK refresh failed; keeping the current keys\n");
+		vctx->next_refresh = time(NULL) + KEY_RETRY_INTERVAL;
 	}
+}
 
-	if (jwks) {
-		json_decref(jwks);
+#ifdef HAVE_PTHREAD
+static void *oidc_refresh_thread(void *arg)
+{
+	oidc_refresh_st *r = arg;
+	json_t *jwks;
+	long cache_time;
+	ssize_t ret;
+	char c = 0;
+
+	pthread_mutex_lock(&r->lock);
+	for (;;) {
+		while (!r->requested) {
+			pthread_cond_wait(&r->cond, &r->lock);
+		}
+		r->requested = 0;
+		pthread_mutex_unlock(&r->lock);
+
+		cache_time = -1;
+		jwks = oidc_fetch_oidc_keys(r->url, &cache_time);
+
+		pthread_mutex_lock(&r->lock);
+		r->jwks = jwks;
+		r->cache_time = cache_time;
+		r->done = 1;
+
+		ret = write(r->pipe[1], &c, 1);
+		(void)ret;
+	}
+
+	return NULL;
+}
+
+// Called from the sec-mod loop when the thread completes a refresh
+static void oidc_refresh_read(sec_mod_st *sec, sec_mod_watch_st *w)
+{
+	oidc_vctx_st *vctx = container_of(w, oidc_vctx_st, watch);
+	oidc_refresh_st *r = vctx->refresh;
+	json_t *jwks = NULL;
+	long cache_time = -1;
+	unsigned done;
+	char buf[16];
+
+	while (read(r->pipe[0], buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&r->lock);
+	done = r->done;
+	if (done) {
+		jwks = r->jwks;
+		cache_time = r->cache_time;
+		r->jwks = NULL;
+		r->done = 0;
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	if (done) {
+		oidc_refresh_done(vctx, jwks, cache_time);
+	}
+}
+#endif
+
+// Starts a refresh of the keys unless one is running. With the thread
+// it runs in the background; otherwise it is done by the next call of
+// oidc_refresh_expire() from the sec-mod loop, rather than during the
+// authentication.
+static void oidc_request_refresh(oidc_vctx_st * vctx)
+{
+	if (vctx->refreshing) {
+		return;
+	}
+
+#ifdef HAVE_PTHREAD
+	if (vctx->refresh) {
+		pthread_mutex_lock(&vctx->refresh->lock);
+		vctx->refresh->requested = 1;
+		pthread_cond_signal(&vctx->refresh->cond);
+		pthread_mutex_unlock(&vctx->refresh->lock);
+		vctx->refreshing = 1;
+		return;
+	}
+#endif
+
+	vctx->next_refresh = 0;
+}
+
+// Called on every iteration of the sec-mod loop; returns the seconds
+// until the next refresh, or -1 while one is running
+static int oidc_refresh_expire(sec_mod_st *sec, sec_mod_watch_st *w, time_t now)
+{
+	oidc_vctx_st *vctx = container_of(w, oidc_vctx_st, watch);
+	json_t *jwks;
+	long cache_time = -1;
+
+	if (!vctx->refreshing && now >= vctx->next_refresh) {
+#ifdef HAVE_PTHREAD
+		if (vctx->refresh) {
+			oidc_request_refresh(vctx);
+			return -1;
+		}
+#endif
+		jwks = oidc_fetch_oidc_keys(json_string_value(json_object_get(vctx->config, "openid_configuration_url")),
+					    &cache_time);
+		oidc_refresh_done(vctx, jwks, cache_time);
+	}
+
+	if (vctx->refreshing) {
+		return -1;
+	}
+
+	return (vctx->next_refresh > now) ? vctx->next_refresh - now : 0;
+}
+
+static void oidc_refresh_init(oidc_vctx_st * vctx)
+{
+#ifdef HAVE_PTHREAD
+	oidc_refresh_st *r;
+	int ret;
+
+	r = talloc_zero(vctx->pool, oidc_refresh_st);
+	if (r == NULL) {
+		goto fail;
+	}
+
+	r->url = strdup(json_string_value(json_object_get(vctx->config, "openid_configuration_url")));
+	if (r->url == NULL) {
+		goto fail;
+	}
+
+	if (pipe(r->pipe) == -1) {
+		syslog(LOG_ERR, "ocserv-oidc: error creating pipe: %s\n", strerror(errno));
+		goto fail;
+	}
+	set_cloexec_flag(r->pipe[0], 1);
+	set_cloexec_flag(r->pipe[1], 1);
+	set_non_block(r->pipe[0]);
+	set_non_block(r->pipe[1]);
+
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+
+	ret = pthread_create(&r->thread, NULL, oidc_refresh_thread, r);
+	if (ret != 0) {
+		syslog(LOG_ERR, "ocserv-oidc: error creating thread: %s\n", strerror(ret));
+		pthread_mutex_destroy(&r->lock);
+		pthread_cond_destroy(&r->cond);
+		close(r->pipe[0]);
+		close(r->pipe[1]);
+		goto fail;
+	}
+
+	vctx->refresh = r;
+	vctx->watch.fd = r->pipe[0];
+	vctx->watch.read = oidc_refresh_read;
+	goto add;
+
+ fail:
+	syslog(LOG_ERR, "ocserv-oidc: the JWKS will be refreshed from the sec-mod loop\n");
+	if (r) {
+		free(r->url);
+		talloc_free(r);
+	}
+ add:
+#endif
+	if (vctx->watch.read == NULL) {
+		vctx->watch.fd = -1;
+	}
+	vctx->watch.expire = oidc_refresh_expire;
+	if (sec_mod_watch_add(&vctx->watch) < 0) {
+		syslog(LOG_ERR, "ocserv-oidc: cannot schedule the JWK refresh\n");
 	}
-	return result;
 }
 
 static bool oidc_verify_lifetime(json_t * token_claims)
@@ -516,25 +1093,16 @@ static bool oidc_verify_signature(oidc_vctx_st * vctx, cjose_jws_t * jws)
 	bool result = false;
 
 	cjose_err err;
-	cjose_jwk_t *jwk = NULL;
+	oidc_key_st *key;
 	json_t *token_header;
 	json_t *token_kid;
 	json_t *token_typ;
-	json_t *array;
-	size_t index;
-	json_t *value;
 
 	if (vctx->jwks == NULL) {
 		syslog(LOG_NOTICE, "ocserv-oidc: JWK keys not available\n");
 		goto cleanup;
 	}
 
-	array = json_object_get(vctx->jwks, "keys");
-	if (array == NULL) {
-		syslog(LOG_NOTICE, "ocserv-oidc: JWK keys malformed\n");
-		goto cleanup;
-	}
-
 	// Get the token header
 	token_header = cjose_jws_get_protected(jws);
 	if (token_header == NULL) {
@@ -557,33 +1125,28 @@ static bool oidc_verify_signature(oidc_vctx_st * vctx, cjose_jws_t * jws)
 	}
 
 	// Find the signing key in the keys collection
-	json_array_foreach(array, index, value) {
-		json_t *key_kid = json_object_get(value, "kid");
-		if (json_equal(key_kid, token_kid)) {
-			jwk = cjose_jwk_import_json(value, &err);
-			break;
-		}
-	}
+	key = oidc_find_key(&vctx->keys, json_string_value(token_kid));
 
-	if (jwk == NULL) {
+	if (key == NULL) {
 		time_t now;
 		syslog(LOG_NOTICE, "ocserv-oidc: JWK with kid=%s not found\n",
 		       json_string_value(token_kid));
 
-		syslog(LOG_NOTICE, "ocserv-oidc: attempting to download new JWKs");
 		now = time(NULL);
 		if ((now - vctx->last_jwks_load_time) > vctx->minimum_jwk_refresh_time) {
-			oidc_fetch_oidc_keys(vctx);
+			syslog(LOG_NOTICE, "ocserv-oidc: attempting to download new JWKs");
+			oidc_request_refresh(vctx);
 		}
 		else {
 			syslog(LOG_NOTICE, "ocserv-oidc: skipping JWK refresh");
 		}
 
-		// Fail the request and let the client try again.
+		// Fail the request and let the client try again once the
+		// keys are refreshed in the background.
 		goto cleanup;
 	}
 
-	if (!cjose_jws_verify(jws, jwk, &err)) {
+	if (!cjose_jws_verify(jws, key->jwk, &err)) {
 		syslog(LOG_NOTICE, "ocserv-oidc: Token failed validation %s\n",
 		       err.message);
 		goto cleanup;
@@ -592,10 +1155,6 @@ static bool oidc_verify_signature(oidc_vctx_st * vctx, cjose_jws_t * jws)
 	result = true;
 
  cleanup:
-	if (jwk) {
-		cjose_jwk_release(jwk);
-	}
-
 	return result;
 }
 
@@ -608,6 +1167,14 @@ static bool oidc_verify_token(oidc_vctx_st * vctx, const char *token,
 	cjose_err err;
 	cjose_jws_t *jws = NULL;
 	json_t *token_claims = NULL;
+	uint8_t digest[TOKEN_DIGEST_SIZE];
+	bool have_digest;
+
+	// A token verified before is accepted until it expires
+	have_digest = gnutls_hash_fast(GNUTLS_DIG_SHA256, token, token_length, digest) == 0;
+	if (have_digest && oidc_get_verified_token(vctx, digest, user_name)) {
+		return true;
+	}
 
 	jws = cjose_jws_import(token, token_length, &err);
 	if (jws == NULL) {
@@ -650,6 +1217,13 @@ static bool oidc_verify_token(oidc_vctx_st * vctx, const char *token,
 		goto cleanup;
 	}
 
+	if (have_digest) {
+		oidc_add_verified_token(vctx, digest,
+					json_integer_value(json_object_get(token_claims, "exp")),
+					json_string_value(json_object_get(cjose_jws_get_protected(jws), "kid")),
+					user_name);
+	}
+
 	result = true;
 
  cleanup:
@@ -39,25 +39,75 @@
  *
  * As it is now it only provides authentication via PAM, but
  * no session management.
+ *
+ * With the threads option the transactions are instead run by a pool
+ * of threads, so that a PAM module which blocks does not stall the
+ * other authentications of sec-mod. See pam_thread_conv().
  */
 
 #include <security/pam_appl.h>
 #include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
 #include <pwd.h>
 #include <grp.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 #include "auth/pam.h"
 #include "auth-unix.h"
+#include <cloexec.h>
+#include <ccan/list/list.h>
+#include <ccan/container_of/container_of.h>
 
 #define PAM_STACK_SIZE (96*1024)
 
 #define MAX_REPLIES 2
 
+#define PAM_MAX_THREADS 64
+/* transactions queued or running per thread, beyond which the
+ * authentications are rejected */
+#define PAM_MAX_QUEUE_PER_THREAD 16
+/* how long a thread waits for a password asked by a module */
+#define PAM_CONV_TIMEOUT 120
+#define PAM_MSG_SIZE 512
+
 enum {
 	PAM_S_INIT,
 	PAM_S_WAIT_FOR_PASS,
 	PAM_S_COMPLETE,
+	PAM_S_RUNNING, /* a thread has the password */
+	PAM_S_FAILED,
 };
 
+/* Runs the PAM stack; returns a PAM error code */
+static int pam_auth_transaction(pam_handle_t *ph, const char *username, unsigned *changing)
+{
+	int pret;
+
+	pret = pam_authenticate(ph, 0);
+	if (pret != PAM_SUCCESS) {
+		syslog(LOG_INFO, "PAM authenticate error for '%s': %s", username, pam_strerror(ph, pret));
+		return pret;
+	}
+
+	pret = pam_acct_mgmt(ph, 0);
+	if (pret == PAM_NEW_AUTHTOK_REQD) {
+		/* change password */
+		syslog(LOG_INFO, "Password for user '%s' is expired. Attempting to update...", username);
+
+		*changing = 1;
+		pret = pam_chauthtok(ph, PAM_CHANGE_EXPIRED_AUTHTOK);
+	}
+
+	if (pret != PAM_SUCCESS) {
+		syslog(LOG_INFO, "PAM acct-mgmt error for '%s': %s", username, pam_strerror(ph, pret));
+		return pret;
+	}
+
+	return PAM_SUCCESS;
+}
+
 static int ocserv_conv(int msg_size, const struct pam_message **msg,
 		struct pam_response **resp, void *uptr)
 {
@@ -141,36 +191,482 @@ int pret;
 
 	pctx->state = PAM_S_INIT;
 
-	pret = pam_authenticate(pctx->ph, 0);
-	if (pret != PAM_SUCCESS) {
-		syslog(LOG_INFO, "PAM authenticate error for '%s': %s", pctx->username, pam_strerror(pctx->ph, pret));
-		pctx->cr_ret = pret;
-		goto wait;
+	pret = pam_auth_transaction(pctx->ph, pctx->username, &pctx->changing);
+	if (pret == PAM_SUCCESS)
+		pctx->state = PAM_S_COMPLETE;
+	pctx->cr_ret = pret;
+
+	/* give control back to the main process */
+	while (1) {
+		co_resume();
 	}
+}
 
-	pret = pam_acct_mgmt(pctx->ph, 0);
-	if (pret == PAM_NEW_AUTHTOK_REQD) {
-		/* change password */
-		syslog(LOG_INFO, "Password for user '%s' is expired. Attempting to update...", pctx->username);
+#ifdef HAVE_PTHREAD
+
+/* The pool of threads running the transactions. A thread is given a
+ * transaction once its first password is known; it is passed to the
+ * module on its first prompt. On further prompts, e.g., for a one-time
+ * password, the thread posts the prompt to sec-mod, which sends it to
+ * the worker, and waits for the password of the next auth cont.
+ *
+ * The prompts and the results are posted on the done list, and sec-mod
+ * is woken up through the pipe.
+ */
+struct pam_pool_st {
+	sec_mod_watch_st watch;
+
+	pthread_mutex_t lock;
+	pthread_cond_t queued; /* a transaction was queued */
+	pthread_cond_t reply; /* a password was given, or a transaction cancelled */
+	struct list_head queue; /* waiting for a thread */
+	struct list_head done; /* prompts and results for sec-mod */
+	unsigned pending; /* queued or running */
+
+	int pipe[2];
+
+	pthread_t *threads;
+	unsigned nthreads;
+};
+
+enum {
+	PAM_JOB_IDLE, /* not started, or its result is processed */
+	PAM_JOB_QUEUED,
+	PAM_JOB_RUNNING,
+	PAM_JOB_DONE, /* its result is posted */
+};
+
+enum {
+	PAM_EV_PROMPT,
+	PAM_EV_DONE,
+};
+
+/* The transaction is allocated with malloc() rather than talloc, as it
+ * is accessed by the threads, and it is kept until the thread completes
+ * if the session is released in the meantime. The fields below the
+ * lock are protected by the pool lock. */
+struct pam_job_st {
+	struct pam_pool_st *tp;
+	pam_handle_t *ph;
+	struct pam_conv conv;
+	char username[MAX_USERNAME_SIZE];
+
+	/* set by the thread and read by sec-mod once posted */
+	char msg[PAM_MSG_SIZE];
+	unsigned changing;
+	int ret;
+
+	/* lock */
+	struct list_node list;
+	struct pam_ctx_st *pctx; /* NULL once the session is released */
+	unsigned stage; /* PAM_JOB_ */
+	unsigned event; /* PAM_EV_ */
+	unsigned posted; /* in the done list */
+	unsigned cancelled;
+	unsigned have_pass;
+	char password[MAX_PASSWORD_SIZE];
+};
+
+static void pam_job_free(struct pam_job_st *job)
+{
+	pam_end(job->ph, job->ret);
+	safe_memset(job->password, 0, sizeof(job->password));
+	free(job);
+}
+
+/* must be called with the lock held */
+static void pam_pool_post(struct pam_pool_st *tp, struct pam_job_st *job, unsigned event)
+{
+	unsigned notify;
+	ssize_t ret;
+	char c = 0;
+
+	notify = list_empty(&tp->done);
+	/* a prompt not seen by sec-mod is superseded by the result */
+	if (job->posted)
+		list_del(&job->list);
+	list_add_tail(&tp->done, &job->list);
+	job->posted = 1;
+	job->event = event;
+
+	/* the pipe is non-blocking; if it is full sec-mod
+	 * is going to be woken up anyway */
+	if (notify) {
+		ret = write(tp->pipe[1], &c, 1);
+		(void)ret;
+	}
+}
+
+static void pam_msg_append(struct pam_job_st *job, const char *str)
+{
+	size_t len = strlen(job->msg);
+
+	if (str != NULL)
+		strlcpy(job->msg + len, str, sizeof(job->msg) - len);
+}
+
+static void free_replies(struct pam_response *replies, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++) {
+		if (replies[i].resp != NULL) {
+			safe_memset(replies[i].resp, 0, strlen(replies[i].resp));
+			free(replies[i].resp);
+		}
+	}
+	free(replies);
+}
+
+/* The conversation function of the transactions run by the threads */
+static int pam_thread_conv(int msg_size, const struct pam_message **msg,
+		struct pam_response **resp, void *uptr)
+{
+	struct pam_job_st *job = uptr;
+	struct pam_pool_st *tp = job->tp;
+	struct pam_response *replies;
+	struct timespec deadline;
+	unsigned i, failed;
+
+	if (msg_size == 0)
+		return PAM_SUCCESS;
+
+	replies = calloc(1, msg_size*sizeof(*replies));
+	if (replies == NULL)
+		return PAM_BUF_ERR;
+
+	for (i=0;i<msg_size;i++) {
+		switch (msg[i]->msg_style) {
+		case PAM_ERROR_MSG:
+		case PAM_TEXT_INFO:
+			syslog(LOG_DEBUG, "PAM-auth conv info: %s", msg[i]->msg);
+
+			pam_msg_append(job, msg[i]->msg);
+			pam_msg_append(job, " ");
+			break;
+		case PAM_PROMPT_ECHO_OFF:
+		case PAM_PROMPT_ECHO_ON:
+			pam_msg_append(job, msg[i]->msg);
+
+			syslog(LOG_DEBUG, "PAM-auth conv: echo-%s, msg: '%s'", (msg[i]->msg_style==PAM_PROMPT_ECHO_ON)?"on":"off", msg[i]->msg!=NULL?msg[i]->msg:"");
+
+			pthread_mutex_lock(&tp->lock);
+			if (!job->have_pass && !job->cancelled) {
+				pam_pool_post(tp, job, PAM_EV_PROMPT);
+
+				clock_gettime(CLOCK_REALTIME, &deadline);
+				deadline.tv_sec += PAM_CONV_TIMEOUT;
+				while (!job->have_pass && !job->cancelled) {
+					if (pthread_cond_timedwait(&tp->reply, &tp->lock, &deadline) == ETIMEDOUT)
+						break;
+				}
+			}
+
+			if (!job->have_pass) {
+				pthread_mutex_unlock(&tp->lock);
+				syslog(LOG_INFO, "PAM-auth: no password was given for '%s'", job->username);
+				free_replies(replies, msg_size);
+				return PAM_CONV_ERR;
+			}
+
+			failed = 0;
+			if (job->password[0] != 0) {
+				replies[i].resp = strdup(job->password);
+				failed = (replies[i].resp == NULL);
+			}
+			safe_memset(job->password, 0, sizeof(job->password));
+			job->have_pass = 0;
+			job->msg[0] = 0;
+			pthread_mutex_unlock(&tp->lock);
+
+			if (failed) {
+				syslog(LOG_ERR, "Error in memory allocation in PAM");
+				free_replies(replies, msg_size);
+				return PAM_BUF_ERR;
+			}
+			break;
+		}
+	}
 
-		pctx->changing = 1;
-		pret = pam_chauthtok(pctx->ph, PAM_CHANGE_EXPIRED_AUTHTOK);
+	*resp = replies;
+	return PAM_SUCCESS;
+}
+
+static void *pam_thread(void *arg)
+{
+	struct pam_pool_st *tp = arg;
+	struct pam_job_st *job;
+	int ret;
+
+	pthread_mutex_lock(&tp->lock);
+	for (;;) {
+		while (list_empty(&tp->queue))
+			pthread_cond_wait(&tp->queued, &tp->lock);
+
+		job = list_top(&tp->queue, struct pam_job_st, list);
+		list_del(&job->list);
+		job->stage = PAM_JOB_RUNNING;
+		pthread_mutex_unlock(&tp->lock);
+
+		ret = pam_auth_transaction(job->ph, job->username, &job->changing);
+
+		pthread_mutex_lock(&tp->lock);
+		job->ret = ret;
+		job->stage = PAM_JOB_DONE;
+		tp->pending--;
+		pam_pool_post(tp, job, PAM_EV_DONE);
+	}
+
+	return NULL;
+}
+
+/* Called from the sec-mod loop when the threads post prompts or results */
+static void pam_pool_read(sec_mod_st *sec, sec_mod_watch_st *w)
+{
+	struct pam_pool_st *tp = container_of(w, struct pam_pool_st, watch);
+	struct pam_job_st *job;
+	struct pam_ctx_st *pctx;
+	unsigned event;
+	char buf[64];
+	int ret;
+
+	while (read(tp->pipe[0], buf, sizeof(buf)) > 0)
+		;
+
+	for (;;) {
+		pthread_mutex_lock(&tp->lock);
+		job = list_top(&tp->done, struct pam_job_st, list);
+		if (job != NULL) {
+			list_del(&job->list);
+			job->posted = 0;
+			event = job->event;
+			if (event == PAM_EV_DONE)
+				job->stage = PAM_JOB_IDLE;
+		}
+		pthread_mutex_unlock(&tp->lock);
+
+		if (job == NULL)
+			break;
+
+		pctx = job->pctx;
+		if (pctx == NULL) {
+			/* the session was released while the thread ran it */
+			if (event == PAM_EV_DONE)
+				pam_job_free(job);
+			continue;
+		}
+
+		if (event == PAM_EV_PROMPT) {
+			str_reset(&pctx->msg);
+			if (str_append_str(&pctx->msg, job->msg) < 0) {
+				syslog(LOG_ERR, "Error in memory allocation in PAM");
+				ret = ERR_AUTH_FAIL;
+			} else {
+				ret = ERR_AUTH_CONTINUE;
+			}
+			pctx->changing = job->changing;
+			pctx->state = PAM_S_WAIT_FOR_PASS;
+		} else {
+			pctx->cr_ret = job->ret;
+			if (job->ret == PAM_SUCCESS) {
+				pctx->state = PAM_S_COMPLETE;
+				ret = 0;
+			} else {
+				syslog(LOG_NOTICE, "PAM-auth pam_auth_pass: %s", pam_strerror(job->ph, job->ret));
+				pctx->state = PAM_S_FAILED;
+				ret = ERR_AUTH_FAIL;
+			}
+		}
+
+		/* may release the session */
+		sec_auth_resume(sec, pctx->entry, ret);
+	}
+}
+
+static struct pam_pool_st *pam_pool_new(void *pool, unsigned threads)
+{
+	struct pam_pool_st *tp;
+	unsigned i;
+	int ret;
+
+	if (threads > PAM_MAX_THREADS)
+		threads = PAM_MAX_THREADS;
+
+	tp = talloc_zero(pool, struct pam_pool_st);
+	if (tp == NULL)
+		goto fail;
+
+	tp->threads = talloc_array(tp, pthread_t, threads);
+	if (tp->threads == NULL)
+		goto fail;
+
+	if (pipe(tp->pipe) == -1) {
+		syslog(LOG_ERR, "PAM-auth: error creating pipe: %s", strerror(errno));
+		goto fail;
+	}
+	set_cloexec_flag(tp->pipe[0], 1);
+	set_cloexec_flag(tp->pipe[1], 1);
+	set_non_block(tp->pipe[0]);
+	set_non_block(tp->pipe[1]);
+
+	pthread_mutex_init(&tp->lock, NULL);
+	pthread_cond_init(&tp->queued, NULL);
+	pthread_cond_init(&tp->reply, NULL);
+	list_head_init(&tp->queue);
+	list_head_init(&tp->done);
+
+	for (i = 0; i < threads; i++) {
+		ret = pthread_create(&tp->threads[i], NULL, pam_thread, tp);
+		if (ret != 0) {
+			syslog(LOG_ERR, "PAM-auth: error creating thread: %s", strerror(ret));
+			break;
+		}
+		tp->nthreads++;
+	}
+
+	if (tp->nthreads == 0) {
+		pthread_mutex_destroy(&tp->lock);
+		pthread_cond_destroy(&tp->queued);
+		pthread_cond_destroy(&tp->reply);
+		close(tp->pipe[0]);
+		close(tp->pipe[1]);
+		goto fail;
+	}
+
+	tp->watch.fd = tp->pipe[0];
+	tp->watch.read = pam_pool_read;
+	if (sec_mod_watch_add(&tp->watch) < 0) {
+		/* the threads are idle; they are left waiting */
+		syslog(LOG_ERR, "PAM-auth: cannot watch the thread pool");
+		return NULL;
+	}
+
+	syslog(LOG_INFO, "PAM-auth: running the transactions in %u threads", tp->nthreads);
+	return tp;
+
+ fail:
+	syslog(LOG_ERR, "PAM-auth: the transactions will not be run in threads");
+	talloc_free(tp);
+	return NULL;
+}
+
+/* Hands the password of an auth cont to the transaction, starting it on
+ * the first one; the result is given by pam_pool_read(). */
+static int pam_thread_pass(struct pam_ctx_st *pctx, const char *pass, unsigned pass_len)
+{
+	struct pam_job_st *job = pctx->job;
+	struct pam_pool_st *tp = job->tp;
+
+	if (pctx->state != PAM_S_INIT && pctx->state != PAM_S_WAIT_FOR_PASS) {
+		syslog(LOG_NOTICE, "PAM auth: conversation left in wrong state (%d/expecting %d)", pctx->state, PAM_S_WAIT_FOR_PASS);
+		return ERR_AUTH_FAIL;
+	}
+
+	pthread_mutex_lock(&tp->lock);
+	if (pctx->state == PAM_S_INIT) {
+		if (tp->pending >= tp->nthreads * PAM_MAX_QUEUE_PER_THREAD) {
+			pthread_mutex_unlock(&tp->lock);
+			syslog(LOG_WARNING, "PAM-auth: too many pending transactions; rejecting '%s'", pctx->username);
+			return ERR_AUTH_FAIL;
+		}
+		list_add_tail(&tp->queue, &job->list);
+		job->stage = PAM_JOB_QUEUED;
+		tp->pending++;
+		pthread_cond_signal(&tp->queued);
+	} else {
+		pthread_cond_broadcast(&tp->reply);
+	}
+	memcpy(job->password, pass, pass_len);
+	job->password[pass_len] = 0;
+	job->have_pass = 1;
+	pthread_mutex_unlock(&tp->lock);
+
+	pctx->state = PAM_S_RUNNING;
+	return ERR_WAIT_FOR_AUTH;
+}
+
+static void pam_job_release(struct pam_job_st *job)
+{
+	struct pam_pool_st *tp = job->tp;
+	unsigned running = 0;
+
+	pthread_mutex_lock(&tp->lock);
+	switch (job->stage) {
+	case PAM_JOB_QUEUED:
+		list_del(&job->list);
+		tp->pending--;
+		break;
+	case PAM_JOB_RUNNING:
+		if (job->posted) {
+			list_del(&job->list);
+			job->posted = 0;
+		}
+		job->cancelled = 1;
+		pthread_cond_broadcast(&tp->reply);
+		/* fall through */
+	case PAM_JOB_DONE:
+		/* freed by pam_pool_read() */
+		job->pctx = NULL;
+		running = 1;
+		break;
+	default:
+		break;
 	}
+	pthread_mutex_unlock(&tp->lock);
+
+	if (!running)
+		pam_job_free(job);
+}
+
+static int pam_job_start(struct pam_ctx_st *pctx, struct pam_pool_st *tp, const char *username)
+{
+	struct pam_job_st *job;
+	int pret;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		return -1;
+
+	job->tp = tp;
+	job->pctx = pctx;
+	job->conv.conv = pam_thread_conv;
+	job->conv.appdata_ptr = job;
+	strlcpy(job->username, username, sizeof(job->username));
 
+	pret = pam_start(PACKAGE, username, &job->conv, &job->ph);
 	if (pret != PAM_SUCCESS) {
-		syslog(LOG_INFO, "PAM acct-mgmt error for '%s': %s", pctx->username, pam_strerror(pctx->ph, pret));
-		pctx->cr_ret = pret;
-		goto wait;
+		syslog(LOG_NOTICE, "PAM-auth init: %s", pam_strerror(job->ph, pret));
+		free(job);
+		return -1;
 	}
 
-	pctx->state = PAM_S_COMPLETE;
-	pctx->cr_ret = PAM_SUCCESS;
+	pctx->job = job;
+	pctx->ph = job->ph;
+	return 0;
+}
 
- wait:
-	/* give control back to the main process */
-	while (1) {
-		co_resume();
+#endif
+
+static void pam_vhost_init(void **vctx, void *pool, void *additional)
+{
+	pam_cfg_st *config = additional;
+	struct pam_vhost_ctx_st *ctx;
+
+	ctx = talloc_zero(pool, struct pam_vhost_ctx_st);
+	if (ctx == NULL)
+		return;
+
+	ctx->config = config;
+
+	if (config != NULL && config->threads > 0) {
+#ifdef HAVE_PTHREAD
+		ctx->tp = pam_pool_new(ctx, config->threads);
+#else
+		syslog(LOG_WARNING, "PAM-auth: the threads option is set but threads are not supported");
+#endif
 	}
+
+	*vctx = ctx;
 }
 
 static int pam_auth_init(void** ctx, void *pool, void *vctx, const common_auth_init_st *info)
@@ -189,6 +685,15 @@ struct pam_ctx_st * pctx;
 		return -1;
 
 	str_init(&pctx->msg, pctx);
+	pctx->entry = pool;
+
+#ifdef HAVE_PTHREAD
+	if (vctx != NULL && ((struct pam_vhost_ctx_st *)vctx)->tp != NULL) {
+		if (pam_job_start(pctx, ((struct pam_vhost_ctx_st *)vctx)->tp, info->username) < 0)
+			goto fail1;
+		goto started;
+	}
+#endif
 
 	pctx->dc.conv = ocserv_conv;
 	pctx->dc.appdata_ptr = pctx;
@@ -202,6 +707,9 @@ struct pam_ctx_st * pctx;
 	if (pctx->cr == NULL)
 		goto fail2;
 
+#ifdef HAVE_PTHREAD
+ started:
+#endif
 	strlcpy(pctx->username, info->username, sizeof(pctx->username));
 
 	if (info->ip != NULL)
@@ -227,7 +735,9 @@ size_t prompt_hash = 0;
 		return 0;
 	}
 
-	if (pctx->state == PAM_S_INIT) {
+	/* in threads the first prompt is not known before the transaction
+	 * starts; the default one is used */
+	if (pctx->state == PAM_S_INIT && pctx->job == NULL) {
 		/* get the prompt */
 		pctx->cr_ret = PAM_CONV_ERR;
 		co_call(pctx->cr);
@@ -272,6 +782,11 @@ struct pam_ctx_st * pctx = ctx;
 	if (pass == NULL || pass_len+1 > sizeof(pctx->password))
 		return -1;
 
+#ifdef HAVE_PTHREAD
+	if (pctx->job != NULL)
+		return pam_thread_pass(pctx, pass, pass_len);
+#endif
+
 	if (pctx->state != PAM_S_WAIT_FOR_PASS) {
 		syslog(LOG_NOTICE, "PAM auth: conversation left in wrong state (%d/expecting %d)", pctx->state, PAM_S_WAIT_FOR_PASS);
 		return ERR_AUTH_FAIL;
@@ -330,7 +845,12 @@ static void pam_auth_deinit(void* ctx)
 {
 struct pam_ctx_st * pctx = ctx;
 
-	pam_end(pctx->ph, pctx->cr_ret);
+#ifdef HAVE_PTHREAD
+	if (pctx->job != NULL)
+		pam_job_release(pctx->job);
+	else
+#endif
+		pam_end(pctx->ph, pctx->cr_ret);
 	free(pctx->replies);
 	str_clear(&pctx->msg);
 	if (pctx->cr != NULL)
@@ -351,6 +871,7 @@ static void pam_group_list(void *pool, void *_additional, char ***groupname, uns
 
 const struct auth_mod_st pam_auth_funcs = {
   .type = AUTH_TYPE_PAM | AUTH_TYPE_USERNAME_PASS,
+  .vhost_init = pam_vhost_init,
   .auth_init = pam_auth_init,
   .auth_deinit = pam_auth_deinit,
   .auth_msg = pam_auth_msg,
@@ -29,9 +29,15 @@
 #include <security/pam_appl.h>
 #include <str.h>
 #include <pcl.h>
+#include "common-config.h"
 
 extern const struct auth_mod_st pam_auth_funcs;
 
+struct pam_vhost_ctx_st {
+	pam_cfg_st *config;
+	struct pam_pool_st *tp; /* NULL unless the threads option is set */
+};
+
 struct pam_ctx_st {
 	char password[MAX_PASSWORD_SIZE];
 	char username[MAX_USERNAME_SIZE];
@@ -47,6 +53,8 @@ struct pam_ctx_st {
 	unsigned state; /* PAM_S_ */
 	unsigned passwd_counter;
 	size_t prev_prompt_hash;
+	struct pam_job_st *job; /* the transaction, when run by a thread */
+	void *entry; /* the pool given to auth_init() */
 };
 
 #endif
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <talloc.h>
+#include <ccan/hash/hash.h>
+#include "common/common.h"
+#include "auth/plain-index.h"
+
+static int plain_passwd_destructor(plain_passwd_st *db)
+{
+	if (db->data)
+		safe_memset(db->data, 0, db->data_size);
+	return 0;
+}
+
+/* Returns the offset of the slot of @username: either its entry, or
+ * the empty slot it would be stored in */
+static uint32_t find_slot(plain_passwd_st *db, const char *username, size_t len)
+{
+	uint32_t i = hash_any(username, len, 0) & db->mask;
+	uint32_t off;
+
+	while ((off = db->slots[i]) != 0) {
+		if (strcmp(db->data + off - 1, username) == 0)
+			break;
+		i = (i + 1) & db->mask;
+	}
+
+	return i;
+}
+
+/* Terminates the fields of the line starting at @p in place; returns
+ * non-zero if it is a complete entry. The rules follow the scan of the
+ * file in read_auth_pass(). */
+static unsigned parse_line(char *p, char *end)
+{
+	char *sep;
+	unsigned fields = 1;
+	size_t ll = end - p;
+
+	/* as counted by fgets(), with the newline */
+	if (end[0] == '\n')
+		ll++;
+	if (ll <= 4)
+		return 0;
+
+	if (end > p && end[-1] == '\r')
+		end[-1] = 0;
+
+	/* username, groups, and the password up to any further field */
+	while (fields < 4 && (sep = memchr(p, ':', end - p)) != NULL) {
+		*sep = 0;
+		p = sep + 1;
+		fields++;
+	}
+
+	return fields >= 3;
+}
+
+static unsigned count_lines(const char *data, size_t size)
+{
+	unsigned lines = 1;
+	const char *p = data, *end = data + size;
+
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		lines++;
+		p++;
+	}
+	return lines;
+}
+
+plain_passwd_st *plain_passwd_load(void *pool, const char *file)
+{
+	plain_passwd_st *db;
+	struct stat st, st2;
+	char *p, *end, *nl;
+	unsigned lines, size;
+	uint32_t i;
+	ssize_t ret;
+	size_t len, total;
+	int fd;
+
+	fd = open(file, O_RDONLY|O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_size >= UINT32_MAX - 1) {
+		close(fd);
+		return NULL;
+	}
+
+	db = talloc_zero(pool, plain_passwd_st);
+	if (db == NULL)
+		goto fail;
+	talloc_set_destructor(db, plain_passwd_destructor);
+
+	db->dev = st.st_dev;
+	db->ino = st.st_ino;
+	db->size = st.st_size;
+	db->mtime = st.st_mtime;
+	db->ctime = st.st_ctime;
+
+	/* with a terminating NUL after the last line */
+	db->data = talloc_size(db, st.st_size + 1);
+	if (db->data == NULL)
+		goto fail;
+	db->data_size = st.st_size + 1;
+
+	total = 0;
+	while (total < (size_t)st.st_size) {
+		ret = read(fd, db->data + total, st.st_size - total);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			goto fail;
+		total += ret;
+	}
+	db->data[total] = 0;
+
+	/* the file is replaced or truncated while read */
+	if (fstat(fd, &st2) == -1 || st2.st_size != st.st_size ||
+	    st2.st_mtime != st.st_mtime)
+		goto fail;
+	close(fd);
+	fd = -1;
+
+	/* at most half full */
+	lines = count_lines(db->data, total);
+	for (size = 16; size < 2 * lines; size <<= 1)
+		;
+	db->slots = talloc_zero_array(db, uint32_t, size);
+	if (db->slots == NULL)
+		goto fail;
+	db->mask = size - 1;
+
+	p = db->data;
+	end = db->data + total;
+	while (p < end) {
+		nl = memchr(p, '\n', end - p);
+		if (nl == NULL)
+			nl = end;
+
+		if (parse_line(p, nl)) {
+			len = strlen(p);
+			i = find_slot(db, p, len);
+			if (db->slots[i] == 0) {
+				db->slots[i] = (p - db->data) + 1;
+				db->entries++;
+			}
+		}
+
+		*nl = 0;
+		p = nl + 1;
+	}
+
+	return db;
+
+ fail:
+	if (fd != -1)
+		close(fd);
+	talloc_free(db);
+	return NULL;
+}
+
+unsigned plain_passwd_changed(plain_passwd_st *db, const char *file)
+{
+	struct stat st;
+
+	if (stat(file, &st) == -1)
+		return 1;
+
+	return (st.st_ino != db->ino || st.st_dev != db->dev ||
+		st.st_size != db->size || st.st_mtime != db->mtime ||
+		st.st_ctime != db->ctime);
+}
+
+int plain_passwd_lookup(plain_passwd_st *db, const char *username,
+			const char **groups, const char **cpass)
+{
+	uint32_t off;
+	const char *p;
+
+	off = db->slots[find_slot(db, username, strlen(username))];
+	if (off == 0)
+		return -1;
+
+	p = db->data + off - 1;
+	p += strlen(p) + 1;
+	*groups = p;
+	p += strlen(p) + 1;
+	*cpass = p;
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PLAIN_INDEX_H
+#define PLAIN_INDEX_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* An in-memory index of a password file of the plain auth method, with
+ * entries of the form "username:groups:encoded-password". The contents
+ * of the file are kept in a single buffer, with the fields of the entries
+ * terminated in place, and an open addressing table holds the offsets of
+ * the entries; there are no pointers, so the layout can be mapped or
+ * copied as is.
+ *
+ * When a username is listed more than once, the first complete entry is
+ * used, as with a scan of the file.
+ */
+typedef struct plain_passwd_st {
+	char *data;
+	uint32_t data_size;
+
+	uint32_t *slots; /* entry offset + 1, or zero */
+	uint32_t mask;
+	unsigned entries;
+
+	/* the loaded file, to detect changes */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	time_t ctime;
+} plain_passwd_st;
+
+/* Returns NULL if the file cannot be read, or changes while read */
+plain_passwd_st *plain_passwd_load(void *pool, const char *file);
+
+/* Returns non-zero if the file differs from the loaded one */
+unsigned plain_passwd_changed(plain_passwd_st *db, const char *file);
+
+/* Returns 0 and the fields of the entry, or -1 if there is none */
+int plain_passwd_lookup(plain_passwd_st *db, const char *username,
+			const char **groups, const char **cpass);
+
+#endif
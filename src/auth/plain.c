@@ -27,6 +27,7 @@
 #include <vpn.h>
 #include <ctype.h>
 #include "plain.h"
+#include "plain-index.h"
 #include "common-config.h"
 #include "auth/common.h"
 #include <ccan/htable/htable.h>
@@ -55,20 +56,65 @@ struct plain_ctx_st {
 	unsigned failed; /* non-zero if the username is wrong */
 
 	const struct plain_cfg_st *config;
+	struct plain_vhost_ctx_st *vctx;
 };
 
+struct plain_vhost_ctx_st {
+	const struct plain_cfg_st *config;
+	/* the password file, reloaded when it changes; NULL if it
+	 * could not be loaded, in which case the file is scanned */
+	plain_passwd_st *db;
+};
+
+/* Returns the index of the password file, after reloading it if the file
+ * was modified, or NULL if it is unavailable */
+static plain_passwd_st *get_passwd_db(struct plain_vhost_ctx_st *vctx)
+{
+	plain_passwd_st *db;
+
+	if (vctx->db != NULL && !plain_passwd_changed(vctx->db, vctx->config->passwd))
+		return vctx->db;
+
+	/* the old index is kept until the new one is ready, and replaced
+	 * at once */
+	db = plain_passwd_load(vctx, vctx->config->passwd);
+	if (db == NULL) {
+		if (vctx->db != NULL)
+			syslog(LOG_NOTICE, "plain-auth: cannot reload %s; scanning it",
+			       vctx->config->passwd);
+		talloc_free(vctx->db);
+		vctx->db = NULL;
+		return NULL;
+	}
+
+	syslog(LOG_DEBUG, "plain-auth: loaded %u entries of %s", db->entries,
+	       vctx->config->passwd);
+	talloc_free(vctx->db);
+	vctx->db = db;
+	return db;
+}
+
 static void plain_vhost_init(void **vctx, void *pool, void *additional)
 {
 	struct plain_cfg_st *config = additional;
-
-	/* vctx is plain_cfg_st */
+	struct plain_vhost_ctx_st *ctx;
 
 	if (config == NULL) {
 		fprintf(stderr, "plain: no configuration passed!\n");
 		exit(EXIT_FAILURE);
 	}
 
-	*vctx = (void*)config;
+	ctx = talloc_zero(pool, struct plain_vhost_ctx_st);
+	if (ctx == NULL) {
+		fprintf(stderr, "plain: memory error\n");
+		exit(EXIT_FAILURE);
+	}
+	ctx->config = config;
+
+	if (config->passwd != NULL)
+		(void)get_passwd_db(ctx);
+
+	*vctx = ctx;
 
 #ifdef HAVE_LIBOATH
 	oath_init();
@@ -135,6 +181,20 @@ break_group_list(void *pool, char *text,
 	while (p != NULL && *elements < MAX_GROUPS);
 }
 
+/* Looks up the user in the index of the password file, as read_auth_pass() */
+static int read_auth_pass_db(struct plain_ctx_st *pctx, plain_passwd_st *db)
+{
+	const char *groups, *cpass;
+
+	if (plain_passwd_lookup(db, pctx->username, &groups, &cpass) == 0) {
+		break_group_list(pctx, (char*)groups, pctx->groupnames, &pctx->groupnames_size);
+		strlcpy(pctx->cpass, cpass, sizeof(pctx->cpass));
+		pctx->failed = 0;
+	}
+
+	return 0;
+}
+
 /* Returns 0 if the user is successfully authenticated, and sets the appropriate group name.
  */
 static int read_auth_pass(struct plain_ctx_st *pctx)
@@ -144,6 +204,7 @@ static int read_auth_pass(struct plain_ctx_st *pctx)
 	ssize_t ll;
 	char *p, *sp;
 	int ret;
+	plain_passwd_st *db;
 
 	if (pctx->config->passwd == NULL) {
 		/* no password file is set */
@@ -152,6 +213,10 @@ static int read_auth_pass(struct plain_ctx_st *pctx)
 
 	pctx->failed = 1;
 
+	db = get_passwd_db(pctx->vctx);
+	if (db != NULL)
+		return read_auth_pass_db(pctx, db);
+
 	fp = fopen(pctx->config->passwd, "r");
 	if (fp == NULL) {
 		syslog(LOG_ERR,
@@ -239,7 +304,8 @@ static int plain_auth_init(void **ctx, void *pool, void *vctx, const common_auth
 
 	strlcpy(pctx->username, info->username, sizeof(pctx->username));
 	pctx->pass_msg = NULL; /* use default */
-	pctx->config = vctx;
+	pctx->vctx = vctx;
+	pctx->config = pctx->vctx->config;
 
 	/* this doesn't fail on password mismatch but sets p->failed */
 	ret = read_auth_pass(pctx);
@@ -88,6 +88,12 @@ static void radius_vhost_init(void **_vctx, void *pool, void *additional)
 		fprintf(stderr, "error reading the radius dictionary\n");
 		exit(EXIT_FAILURE);
 	}
+
+	if (config->async) {
+		vctx->client = radius_client_new(vctx, vctx->rh, "authserver", config->weights);
+		if (vctx->client == NULL)
+			goto fail;
+	}
 	*_vctx = vctx;
 
 	return;
@@ -127,6 +133,7 @@ static int radius_auth_init(void **ctx, void *pool, void *_vctx, const common_au
 
 	pctx->pass_msg[0] = 0;
 	pctx->vctx = vctx;
+	pctx->entry = pool;
 	pctx->passwd_counter = 0;
 
 	default_realm = rc_conf_str(pctx->vctx->rh, "default_realm");
@@ -252,119 +259,14 @@ static void parse_groupnames(struct radius_ctx_st *pctx, const char *full)
 	}
 }
 
-/* Returns 0 if the user is successfully authenticated, and sets the appropriate group name.
+/* Processes the reply of an Access-Request; @ret is the rc_aaa() result
+ * and pctx->pass_msg holds the Reply-Message.
  */
-static int radius_auth_pass(void *ctx, const char *pass, unsigned pass_len)
+static int radius_auth_result(struct radius_ctx_st *pctx, int ret, VALUE_PAIR *recvd)
 {
-	struct radius_ctx_st *pctx = ctx;
-	VALUE_PAIR *send = NULL, *recvd = NULL;
-	uint32_t service;
 	char route[72];
 	char txt[64];
 	VALUE_PAIR *vp;
-	int ret;
-
-	/* send Access-Request */
-	syslog(LOG_DEBUG, "radius-auth: communicating username (%s) and password", pctx->username);
-	if (rc_avpair_add(pctx->vctx->rh, &send, PW_USER_NAME, pctx->username, -1, 0) == NULL) {
-		syslog(LOG_ERR,
-		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-		       pctx->username);
-		return ERR_AUTH_FAIL;
-	}
-
-	if (rc_avpair_add(pctx->vctx->rh, &send, PW_USER_PASSWORD, (char*)pass, -1, 0) == NULL) {
-		syslog(LOG_ERR,
-		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-		       pctx->username);
-		ret = ERR_AUTH_FAIL;
-		goto cleanup;
-	}
-
-	if (pctx->our_ip[0] != 0) {
-		struct in_addr in;
-		struct in6_addr in6;
-
-		if (inet_pton(AF_INET, pctx->our_ip, &in) != 0) {
-			in.s_addr = ntohl(in.s_addr);
-			if (rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_IP_ADDRESS, (char*)&in, sizeof(struct in_addr), 0) == NULL) {
-				syslog(LOG_ERR,
-				       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-				       pctx->username);
-				ret = ERR_AUTH_FAIL;
-				goto cleanup;
-			}
-		} else if (inet_pton(AF_INET6, pctx->our_ip, &in6) != 0) {
-			if (rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_IPV6_ADDRESS, (char*)&in6, sizeof(struct in6_addr), 0) == NULL) {
-				syslog(LOG_ERR,
-				       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-				       pctx->username);
-				ret = ERR_AUTH_FAIL;
-				goto cleanup;
-			}
-		}
-	}
-
-	if (pctx->vctx->nas_identifier[0] != 0) {
-		if (rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_IDENTIFIER, pctx->vctx->nas_identifier, -1, 0) == NULL) {
-			syslog(LOG_ERR,
-			       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-			       pctx->username);
-			ret = ERR_AUTH_FAIL;
-			goto cleanup;
-		}
-	}
-
-	if (rc_avpair_add(pctx->vctx->rh, &send, PW_CALLING_STATION_ID, pctx->remote_ip, -1, 0) == NULL) {
-		syslog(LOG_ERR,
-		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-		       pctx->username);
-		ret = ERR_AUTH_FAIL;
-		goto cleanup;
-	}
-
-	if (pctx->user_agent[0] != 0) {
-		if (rc_avpair_add(pctx->vctx->rh, &send, PW_CONNECT_INFO, pctx->user_agent, -1, 0) == NULL) {
-			syslog(LOG_ERR,
-			       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-			       pctx->username);
-			ret = ERR_AUTH_FAIL;
-			goto cleanup;
-		}
-	}
-
-	service = PW_AUTHENTICATE_ONLY;
-	if (rc_avpair_add(pctx->vctx->rh, &send, PW_SERVICE_TYPE, &service, -1, 0) == NULL) {
-		syslog(LOG_ERR,
-		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-		       pctx->username);
-		ret = ERR_AUTH_FAIL;
-		goto cleanup;
-	}
-
-	service = PW_ASYNC;
-	if (rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_PORT_TYPE, &service, -1, 0) == NULL) {
-		syslog(LOG_ERR,
-		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-		       pctx->username);
-		ret = ERR_AUTH_FAIL;
-		goto cleanup;
-	}
-
-	if (pctx->state != NULL) {
-		if (rc_avpair_add(pctx->vctx->rh, &send, PW_STATE, pctx->state, -1, 0) == NULL) {
-			syslog(LOG_ERR,
-			       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-			       pctx->username);
-			ret = ERR_AUTH_FAIL;
-			goto cleanup;
-		}
-		talloc_free(pctx->state);
-		pctx->state = NULL;
-	}
-
-	pctx->pass_msg[0] = 0;
-	ret = rc_aaa(pctx->vctx->rh, 0, send, &recvd, pctx->pass_msg, 0, PW_ACCESS_REQUEST);
 
 	if (ret == OK_RC) {
 		uint32_t ipv4;
@@ -451,8 +353,7 @@ static int radius_auth_pass(void *ctx, const char *pass, unsigned pass_len)
 			vp = vp->next;
 		}
 
-		ret = 0;
-		goto cleanup;
+		return 0;
 	} else if (ret == CHALLENGE_RC) {
 
 		vp = recvd;
@@ -476,7 +377,7 @@ static int radius_auth_pass(void *ctx, const char *pass, unsigned pass_len)
 			syslog(LOG_ERR, "radius-auth: Access-Challenge with invalid State or Reply-Message, or max number of password requests exceeded");
 			ret = ERR_AUTH_FAIL;
 		}
-		goto cleanup;
+		return ret;
 	} else {
  fail:
 		if (pctx->pass_msg[0] == 0)
@@ -484,16 +385,205 @@ static int radius_auth_pass(void *ctx, const char *pass, unsigned pass_len)
 
 		if (pctx->retries++ < MAX_PASSWORD_TRIES-1 && pctx->passwd_counter == 0) {
 			ret = ERR_AUTH_CONTINUE;
-			goto cleanup;
+			return ret;
 		}
 
 		syslog(LOG_NOTICE,
 		       "radius-auth: error authenticating user '%s' (code %d)",
 		       pctx->username, ret);
 		ret = ERR_AUTH_FAIL;
+		return ret;
+	}
+}
+
+static void radius_auth_reply(sec_mod_st *sec, void *priv, unsigned code,
+			      const uint8_t *attrs, unsigned attrs_len)
+{
+	struct radius_ctx_st *pctx = priv;
+	VALUE_PAIR *recvd = NULL, *vp;
+	size_t len;
+	int ret;
+
+	switch (code) {
+	case RADIUS_CODE_ACCESS_ACCEPT:
+		ret = OK_RC;
+		break;
+	case RADIUS_CODE_ACCESS_CHALLENGE:
+		ret = CHALLENGE_RC;
+		break;
+	case RADIUS_CODE_ACCESS_REJECT:
+		ret = REJECT_RC;
+		break;
+	case RADIUS_CODE_TIMEOUT:
+		ret = TIMEOUT_RC;
+		break;
+	default:
+		ret = BADRESP_RC;
+		break;
+	}
+
+	if (ret != TIMEOUT_RC && ret != BADRESP_RC && attrs_len > 0)
+		recvd = rc_avpair_gen(pctx->vctx->rh, NULL, (unsigned char *)attrs, attrs_len, 0);
+
+	/* the Reply-Messages are concatenated as in rc_aaa() */
+	pctx->pass_msg[0] = 0;
+	for (vp = recvd; vp != NULL; vp = vp->next) {
+		if (vp->attribute == PW_REPLY_MESSAGE && vp->type == PW_TYPE_STRING) {
+			len = strlen(pctx->pass_msg);
+			strlcpy(pctx->pass_msg + len, vp->strvalue, sizeof(pctx->pass_msg) - len);
+		}
+	}
+
+	ret = radius_auth_result(pctx, ret, recvd);
+
+	if (recvd != NULL)
+		rc_avpair_free(recvd);
+	talloc_free(pctx->req);
+	pctx->req = NULL;
+
+	sec_auth_resume(sec, pctx->entry, ret);
+}
+
+/* Sends the Access-Request with the asynchronous client; the reply is
+ * processed by radius_auth_reply() */
+static int radius_auth_send(struct radius_ctx_st *pctx, VALUE_PAIR *send)
+{
+	talloc_free(pctx->req);
+	pctx->req = radius_req_new(pctx, pctx->vctx->client, RADIUS_CODE_ACCESS_REQUEST,
+				   radius_auth_reply, pctx);
+	if (pctx->req == NULL)
+		return ERR_AUTH_FAIL;
+
+	if (radius_req_add_avpairs(pctx->req, send) < 0 ||
+	    radius_req_send(pctx->req) < 0) {
+		syslog(LOG_ERR, "radius-auth: could not send request for user '%s'",
+		       pctx->username);
+		talloc_free(pctx->req);
+		pctx->req = NULL;
+		return ERR_AUTH_FAIL;
+	}
+
+	return ERR_WAIT_FOR_AUTH;
+}
+
+/* Returns 0 if the user is successfully authenticated, and sets the appropriate group name.
+ */
+static int radius_auth_pass(void *ctx, const char *pass, unsigned pass_len)
+{
+	struct radius_ctx_st *pctx = ctx;
+	VALUE_PAIR *send = NULL, *recvd = NULL;
+	uint32_t service;
+	int ret;
+
+	/* send Access-Request */
+	syslog(LOG_DEBUG, "radius-auth: communicating username (%s) and password", pctx->username);
+	if (rc_avpair_add(pctx->vctx->rh, &send, PW_USER_NAME, pctx->username, -1, 0) == NULL) {
+		syslog(LOG_ERR,
+		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+		       pctx->username);
+		return ERR_AUTH_FAIL;
+	}
+
+	if (rc_avpair_add(pctx->vctx->rh, &send, PW_USER_PASSWORD, (char*)pass, -1, 0) == NULL) {
+		syslog(LOG_ERR,
+		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+		       pctx->username);
+		ret = ERR_AUTH_FAIL;
+		goto cleanup;
+	}
+
+	if (pctx->our_ip[0] != 0) {
+		struct in_addr in;
+		struct in6_addr in6;
+
+		if (inet_pton(AF_INET, pctx->our_ip, &in) != 0) {
+			in.s_addr = ntohl(in.s_addr);
+			if (rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_IP_ADDRESS, (char*)&in, sizeof(struct in_addr), 0) == NULL) {
+				syslog(LOG_ERR,
+				       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+				       pctx->username);
+				ret = ERR_AUTH_FAIL;
+				goto cleanup;
+			}
+		} else if (inet_pton(AF_INET6, pctx->our_ip, &in6) != 0) {
+			if (rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_IPV6_ADDRESS, (char*)&in6, sizeof(struct in6_addr), 0) == NULL) {
+				syslog(LOG_ERR,
+				       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+				       pctx->username);
+				ret = ERR_AUTH_FAIL;
+				goto cleanup;
+			}
+		}
+	}
+
+	if (pctx->vctx->nas_identifier[0] != 0) {
+		if (rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_IDENTIFIER, pctx->vctx->nas_identifier, -1, 0) == NULL) {
+			syslog(LOG_ERR,
+			       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+			       pctx->username);
+			ret = ERR_AUTH_FAIL;
+			goto cleanup;
+		}
+	}
+
+	if (rc_avpair_add(pctx->vctx->rh, &send, PW_CALLING_STATION_ID, pctx->remote_ip, -1, 0) == NULL) {
+		syslog(LOG_ERR,
+		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+		       pctx->username);
+		ret = ERR_AUTH_FAIL;
 		goto cleanup;
 	}
 
+	if (pctx->user_agent[0] != 0) {
+		if (rc_avpair_add(pctx->vctx->rh, &send, PW_CONNECT_INFO, pctx->user_agent, -1, 0) == NULL) {
+			syslog(LOG_ERR,
+			       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+			       pctx->username);
+			ret = ERR_AUTH_FAIL;
+			goto cleanup;
+		}
+	}
+
+	service = PW_AUTHENTICATE_ONLY;
+	if (rc_avpair_add(pctx->vctx->rh, &send, PW_SERVICE_TYPE, &service, -1, 0) == NULL) {
+		syslog(LOG_ERR,
+		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+		       pctx->username);
+		ret = ERR_AUTH_FAIL;
+		goto cleanup;
+	}
+
+	service = PW_ASYNC;
+	if (rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_PORT_TYPE, &service, -1, 0) == NULL) {
+		syslog(LOG_ERR,
+		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+		       pctx->username);
+		ret = ERR_AUTH_FAIL;
+		goto cleanup;
+	}
+
+	if (pctx->state != NULL) {
+		if (rc_avpair_add(pctx->vctx->rh, &send, PW_STATE, pctx->state, -1, 0) == NULL) {
+			syslog(LOG_ERR,
+			       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+			       pctx->username);
+			ret = ERR_AUTH_FAIL;
+			goto cleanup;
+		}
+		talloc_free(pctx->state);
+		pctx->state = NULL;
+	}
+
+	if (pctx->vctx->client != NULL) {
+		ret = radius_auth_send(pctx, send);
+		goto cleanup;
+	}
+
+	pctx->pass_msg[0] = 0;
+	ret = rc_aaa(pctx->vctx->rh, 0, send, &recvd, pctx->pass_msg, 0, PW_ACCESS_REQUEST);
+
+	ret = radius_auth_result(pctx, ret, recvd);
+
  cleanup:
 	if (send != NULL)
 		rc_avpair_free(send);
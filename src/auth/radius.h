@@ -30,10 +30,14 @@
 #  else
 #   include <radcli/radcli.h>
 #  endif
+#  include <radius-client.h>
 
 struct radius_vhost_ctx {
 	rc_handle *rh;
 	char nas_identifier[64];
+	/* set when the asynchronous client is enabled */
+	struct radius_client_st *client;
+	struct acct_queue_st *queue; /* accounting only */
 };
 
 struct radius_ctx_st {
@@ -68,6 +72,8 @@ struct radius_ctx_st {
 	unsigned id;
 
 	struct radius_vhost_ctx *vctx;
+	void *entry; /* the pool given to auth_init() */
+	struct radius_req_st *req; /* the request in progress */
 	char *state;
 	unsigned passwd_counter;
 	size_t prev_prompt_hash;
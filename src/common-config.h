@@ -30,7 +30,7 @@ int _add_multi_line_val(void *pool, char ***varname, size_t *num,
 		        const char *val);
 int cfg_parse_ports(void *pool, FwPortSt ***fw_ports, size_t *n_fw_ports, const char *str);
 
-#define MAX_SUBOPTIONS 5
+#define MAX_SUBOPTIONS 8
 
 typedef struct subcfg_val_st {
 	char *name;
@@ -47,6 +47,10 @@ typedef struct gssapi_cfg_st {
 typedef struct radius_cfg_st {
 	char *config;
 	char *nas_identifier;
+	unsigned async;
+	char *weights;
+	char *spool; /* accounting only */
+	unsigned queue_size; /* accounting only */
 } radius_cfg_st;
 
 typedef struct plain_cfg_st {
@@ -56,6 +60,7 @@ typedef struct plain_cfg_st {
 
 typedef struct pam_cfg_st {
 	int gid_min;
+	unsigned threads; /* run the transactions in a pool of threads */
 } pam_cfg_st;
 
 #define CHECK_TRUE(str) ((str != NULL && (strcasecmp(str, "true") == 0 || strcasecmp(str, "yes") == 0))?1:0)
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <keyed-hash.h>
+
+static keyed_hash_key_st process_key;
+static bool process_key_set = false;
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+	} while (0)
+
+static inline uint64_t load_le64(const uint8_t *p)
+{
+	return ((uint64_t)p[0]) | ((uint64_t)p[1] << 8) |
+	    ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+	    ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+	    ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+/* SipHash with c compression and d finalization rounds */
+static inline uint64_t siphash_cd(const keyed_hash_key_st *key,
+				  const void *data, size_t len,
+				  unsigned c, unsigned d)
+{
+	const uint8_t *in = data;
+	const uint8_t *end = in + (len - (len % 8));
+	uint64_t v0 = 0x736f6d6570736575ULL ^ key->k0;
+	uint64_t v1 = 0x646f72616e646f6dULL ^ key->k1;
+	uint64_t v2 = 0x6c7967656e657261ULL ^ key->k0;
+	uint64_t v3 = 0x7465646279746573ULL ^ key->k1;
+	uint64_t b = ((uint64_t)len) << 56;
+	uint64_t m;
+	unsigned i;
+
+	for (; in != end; in += 8) {
+		m = load_le64(in);
+		v3 ^= m;
+		for (i = 0; i < c; i++)
+			SIPROUND;
+		v0 ^= m;
+	}
+
+	switch (len & 7) {
+	case 7:
+		b |= ((uint64_t)in[6]) << 48;
+		/* fall through */
+	case 6:
+		b |= ((uint64_t)in[5]) << 40;
+		/* fall through */
+	case 5:
+		b |= ((uint64_t)in[4]) << 32;
+		/* fall through */
+	case 4:
+		b |= ((uint64_t)in[3]) << 24;
+		/* fall through */
+	case 3:
+		b |= ((uint64_t)in[2]) << 16;
+		/* fall through */
+	case 2:
+		b |= ((uint64_t)in[1]) << 8;
+		/* fall through */
+	case 1:
+		b |= ((uint64_t)in[0]);
+		break;
+	case 0:
+		break;
+	}
+
+	v3 ^= b;
+	for (i = 0; i < c; i++)
+		SIPROUND;
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	for (i = 0; i < d; i++)
+		SIPROUND;
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+uint64_t siphash13(const keyed_hash_key_st *key, const void *data, size_t len)
+{
+	return siphash_cd(key, data, len, 1, 3);
+}
+
+bool keyed_hash_init_key(keyed_hash_key_st *key)
+{
+	return gnutls_rnd(GNUTLS_RND_RANDOM, key, sizeof(*key)) == 0;
+}
+
+bool keyed_hash_init(void)
+{
+	if (keyed_hash_init_key(&process_key) == 0)
+		return false;
+
+	process_key_set = true;
+	return true;
+}
+
+size_t keyed_hash(const void *data, size_t len)
+{
+	/* should not happen, but never fall back to a well known key */
+	if (__builtin_expect(!process_key_set, 0))
+		keyed_hash_init();
+
+	return siphash13(&process_key, data, len);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef KEYED_HASH_H
+#define KEYED_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Hash tables whose keys are controlled by the peer (IP addresses,
+ * session IDs) must use keyed_hash() rather than hash_any(), so that
+ * colliding keys cannot be precomputed. */
+
+typedef struct keyed_hash_key_st {
+	uint64_t k0;
+	uint64_t k1;
+} keyed_hash_key_st;
+
+/* Generates a random key. Returns false on failure. */
+bool keyed_hash_init_key(keyed_hash_key_st *key);
+
+/* Sets the per-process key. It is called once on startup, before any
+ * table is populated; forked processes share the key of their parent. */
+bool keyed_hash_init(void);
+
+/* SipHash-1-3 */
+uint64_t siphash13(const keyed_hash_key_st *key, const void *data, size_t len);
+
+/* Hashes with the per-process key. */
+size_t keyed_hash(const void *data, size_t len);
+
+#endif
@@ -0,0 +1,573 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <talloc.h>
+
+#include <vpn.h>
+#include <vhost.h>
+#include <config-blob.h>
+
+#ifdef HAVE_MEMFD_CREATE
+
+#define BLOB_ALIGN 16
+
+/* set on the recorded slots whose pointer is to a string */
+#define RELOC_STR ((uint64_t)1 << 63)
+
+typedef struct blob_writer_st {
+	void *pool;
+	uint8_t *data; /* the header and the structures */
+	size_t len;
+	size_t size;
+	char *strs;
+	size_t strs_len;
+	size_t strs_size;
+	uint64_t *relocs;
+	size_t relocs_len;
+	size_t relocs_size;
+	unsigned failed;
+} blob_writer_st;
+
+/* Returns the offset of @len zeroed bytes, or zero on error; the offsets
+ * are only valid as long as nothing else is added. */
+static size_t w_alloc(blob_writer_st *w, size_t len)
+{
+	size_t off, size;
+	uint8_t *p;
+
+	if (w->failed)
+		return 0;
+
+	off = (w->len + BLOB_ALIGN - 1) & ~((size_t)BLOB_ALIGN - 1);
+	if (off + len > w->size) {
+		size = w->size ? w->size * 2 : 4096;
+		while (size < off + len)
+			size *= 2;
+
+		p = talloc_realloc_size(w->pool, w->data, size);
+		if (p == NULL) {
+			w->failed = 1;
+			return 0;
+		}
+		w->data = p;
+		w->size = size;
+	}
+
+	memset(w->data + w->len, 0, off + len - w->len);
+	w->len = off + len;
+
+	return off;
+}
+
+/* Sets the pointer at @slot to the @target offset, and records it */
+static void w_ptr(blob_writer_st *w, size_t slot, uint64_t target, unsigned str)
+{
+	uintptr_t val = target;
+	uint64_t *p;
+
+	if (w->failed)
+		return;
+
+	if (w->relocs_len == w->relocs_size) {
+		w->relocs_size = w->relocs_size ? w->relocs_size * 2 : 256;
+		p = talloc_realloc(w->pool, w->relocs, uint64_t, w->relocs_size);
+		if (p == NULL) {
+			w->failed = 1;
+			return;
+		}
+		w->relocs = p;
+	}
+
+	memcpy(w->data + slot, &val, sizeof(val));
+	w->relocs[w->relocs_len++] = slot | (str ? RELOC_STR : 0);
+}
+
+/* Copies @str to the blob, and points the pointer at @slot to it */
+static void w_str(blob_writer_st *w, size_t slot, const char *str)
+{
+	size_t len, size;
+	char *p;
+
+	if (str == NULL || w->failed)
+		return;
+
+	len = strlen(str) + 1;
+	if (w->strs_len + len > w->strs_size) {
+		size = w->strs_size ? w->strs_size * 2 : 4096;
+		while (size < w->strs_len + len)
+			size *= 2;
+
+		p = talloc_realloc_size(w->pool, w->strs, size);
+		if (p == NULL) {
+			w->failed = 1;
+			return;
+		}
+		w->strs = p;
+		w->strs_size = size;
+	}
+
+	memcpy(w->strs + w->strs_len, str, len);
+	w_ptr(w, slot, w->strs_len, 1);
+	w->strs_len += len;
+}
+
+static void w_str_array(blob_writer_st *w, size_t slot, char **arr, size_t size)
+{
+	size_t off, i;
+
+	if (arr == NULL || size == 0)
+		return;
+
+	off = w_alloc(w, size * sizeof(char *));
+	if (off == 0)
+		return;
+
+	w_ptr(w, slot, off, 0);
+	for (i = 0; i < size; i++)
+		w_str(w, off + i * sizeof(char *), arr[i]);
+}
+
+#define SLOT(base, type, field) ((base) + offsetof(type, field))
+
+static void w_kkdcp(blob_writer_st *w, size_t slot, const kkdcp_st *kkdcp, unsigned size)
+{
+	size_t off, k;
+	unsigned i, j;
+
+	if (kkdcp == NULL || size == 0)
+		return;
+
+	off = w_alloc(w, size * sizeof(kkdcp_st));
+	if (off == 0)
+		return;
+
+	memcpy(w->data + off, kkdcp, size * sizeof(kkdcp_st));
+	w_ptr(w, slot, off, 0);
+
+	for (i = 0; i < size; i++) {
+		k = off + i * sizeof(kkdcp_st);
+		((kkdcp_st *)(w->data + k))->url = NULL;
+		w_str(w, SLOT(k, kkdcp_st, url), kkdcp[i].url);
+
+		for (j = 0; j < MAX_KRB_REALMS; j++) {
+			((kkdcp_st *)(w->data + k))->realms[j].realm = NULL;
+			w_str(w, SLOT(k, kkdcp_st, realms) + j * sizeof(kkdcp_realm_st) +
+			      offsetof(kkdcp_realm_st, realm), kkdcp[i].realms[j].realm);
+		}
+	}
+}
+
+/* Every pointer of struct cfg_st is either serialized here or cleared */
+static size_t w_cfg(blob_writer_st *w, const struct cfg_st *config)
+{
+	struct cfg_st *c;
+	size_t off;
+
+	off = w_alloc(w, sizeof(*config));
+	if (off == 0)
+		return 0;
+
+	c = (struct cfg_st *)(w->data + off);
+	memcpy(c, config, sizeof(*config));
+
+	c->kkdcp = NULL;
+	c->cert_user_oid = c->cert_group_oid = c->priorities = NULL;
+	c->banner = c->pre_login_banner = c->ocsp_response = c->default_domain = NULL;
+	c->group_list = c->friendly_group_list = NULL;
+	c->default_select_group = NULL;
+	c->custom_header = c->split_dns = c->included_http_headers = NULL;
+	c->crl = c->route_add_cmd = c->route_del_cmd = NULL;
+	c->connect_script = c->host_update_script = c->disconnect_script = NULL;
+	c->event_sink = c->cgroup = c->proxy_url = NULL;
+#ifdef ANYCONNECT_CLIENT_COMPAT
+	c->xml_config_file = c->xml_config_hash = NULL;
+#endif
+	c->per_group_dir = c->per_user_dir = NULL;
+	c->default_group_conf = c->default_user_conf = NULL;
+	c->known_iroutes = NULL;
+	c->network.ipv4_netmask = c->network.ipv4_network = NULL;
+	c->network.ipv4 = c->network.ipv4_local = NULL;
+	c->network.ipv6_network = c->network.ipv6 = c->network.ipv6_local = NULL;
+	c->network.routes = c->network.no_routes = NULL;
+	c->network.dns = c->network.nbns = NULL;
+	c->usage_count = NULL;
+	c->camouflage_secret = c->camouflage_realm = NULL;
+
+	/* the ports are only used by main, and are protobuf messages */
+	c->fw_ports = NULL;
+	c->n_fw_ports = 0;
+
+	w_kkdcp(w, SLOT(off, struct cfg_st, kkdcp), config->kkdcp, config->kkdcp_size);
+
+#define STR(field) w_str(w, SLOT(off, struct cfg_st, field), config->field)
+#define STR_ARRAY(field, size) \
+	w_str_array(w, SLOT(off, struct cfg_st, field), config->field, config->size)
+	STR(cert_user_oid);
+	STR(cert_group_oid);
+	STR(priorities);
+	STR(banner);
+	STR(pre_login_banner);
+	STR(ocsp_response);
+	STR(default_domain);
+	STR_ARRAY(group_list, group_list_size);
+	STR_ARRAY(friendly_group_list, group_list_size);
+	STR(default_select_group);
+	STR_ARRAY(custom_header, custom_header_size);
+	STR_ARRAY(split_dns, split_dns_size);
+	STR_ARRAY(included_http_headers, included_http_headers_size);
+	STR(crl);
+	STR(route_add_cmd);
+	STR(route_del_cmd);
+	STR(connect_script);
+	STR(host_update_script);
+	STR(disconnect_script);
+	STR(event_sink);
+	STR(cgroup);
+	STR(proxy_url);
+#ifdef ANYCONNECT_CLIENT_COMPAT
+	STR(xml_config_file);
+	STR(xml_config_hash);
+#endif
+	STR(per_group_dir);
+	STR(per_user_dir);
+	STR(default_group_conf);
+	STR(default_user_conf);
+	STR_ARRAY(known_iroutes, known_iroutes_size);
+	STR(network.ipv4_netmask);
+	STR(network.ipv4_network);
+	STR(network.ipv4);
+	STR(network.ipv4_local);
+	STR(network.ipv6_network);
+	STR(network.ipv6);
+	STR(network.ipv6_local);
+	STR_ARRAY(network.routes, network.routes_size);
+	STR_ARRAY(network.no_routes, network.no_routes_size);
+	STR_ARRAY(network.dns, network.dns_size);
+	STR_ARRAY(network.nbns, network.nbns_size);
+	STR(camouflage_secret);
+	STR(camouflage_realm);
+#undef STR
+#undef STR_ARRAY
+
+	return off;
+}
+
+/* Every pointer of vhost_cfg_st and perm_cfg_st is either serialized
+ * here or cleared; the loader sets the list, pool and attic. */
+static size_t w_vhost(blob_writer_st *w, const vhost_cfg_st *vhost)
+{
+	const struct perm_cfg_st *perm = &vhost->perm_config;
+	struct perm_cfg_st *p;
+	vhost_cfg_st *v;
+	size_t off, config, auth;
+	unsigned i;
+
+	off = w_alloc(w, sizeof(*vhost));
+	if (off == 0)
+		return 0;
+
+	v = (vhost_cfg_st *)(w->data + off);
+	memcpy(v, vhost, sizeof(*vhost));
+
+	memset(&v->list, 0, sizeof(v->list));
+	v->name = NULL;
+	memset(&v->creds, 0, sizeof(v->creds));
+	v->pool = NULL;
+	memset(&v->pins, 0, sizeof(v->pins));
+	v->config_module = NULL;
+	v->key = NULL;
+	v->key_size = 0;
+	v->acct = NULL;
+	v->auth = v->eauth = NULL;
+	v->auth_size = v->eauth_size = 0;
+#ifdef HAVE_GSSAPI
+	v->urlfw = NULL;
+	v->urlfw_size = 0;
+#endif
+
+	p = &v->perm_config;
+	p->config = NULL;
+	for (i = 0; i < MAX_AUTH_METHODS; i++) {
+		p->auth[i].name = p->auth[i].additional = NULL;
+		p->auth[i].amod = NULL;
+		p->auth[i].auth_ctx = p->auth[i].dl_ctx = NULL;
+	}
+	p->acct.name = NULL;
+	p->acct.additional = NULL;
+	p->acct.acct_ctx = NULL;
+	p->acct.amod = NULL;
+	p->chroot_dir = p->occtl_socket_file = p->socket_file_prefix = NULL;
+	p->ban_db_file = p->lease_journal_file = NULL;
+	p->key_pin = p->srk_pin = p->pin_file = p->srk_pin_file = NULL;
+	p->cert = p->key = NULL;
+#ifdef ANYCONNECT_CLIENT_COMPAT
+	p->cert_hash = NULL;
+#endif
+	p->ca = p->dh_params_file = NULL;
+	p->listen_host = p->udp_listen_host = p->listen_netns_name = NULL;
+	memset(&p->attic, 0, sizeof(p->attic));
+
+	w_str(w, SLOT(off, vhost_cfg_st, name), vhost->name);
+
+	config = w_cfg(w, perm->config);
+	if (config == 0)
+		return 0;
+	w_ptr(w, SLOT(off, vhost_cfg_st, perm_config.config), config, 0);
+
+#define STR(field) w_str(w, SLOT(off, vhost_cfg_st, perm_config.field), perm->field)
+#define STR_ARRAY(field, size) \
+	w_str_array(w, SLOT(off, vhost_cfg_st, perm_config.field), perm->field, perm->size)
+	for (i = 0; i < MAX_AUTH_METHODS; i++) {
+		auth = SLOT(off, vhost_cfg_st, perm_config.auth) + i * sizeof(auth_struct_st);
+		w_str(w, SLOT(auth, auth_struct_st, name), perm->auth[i].name);
+		w_str(w, SLOT(auth, auth_struct_st, additional), perm->auth[i].additional);
+	}
+	STR(acct.name);
+	STR(acct.additional);
+	STR(chroot_dir);
+	STR(occtl_socket_file);
+	STR(socket_file_prefix);
+	STR(ban_db_file);
+	STR(lease_journal_file);
+	STR(key_pin);
+	STR(srk_pin);
+	STR(pin_file);
+	STR(srk_pin_file);
+	STR_ARRAY(cert, cert_size);
+	STR_ARRAY(key, key_size);
+#ifdef ANYCONNECT_CLIENT_COMPAT
+	STR(cert_hash);
+#endif
+	STR(ca);
+	STR(dh_params_file);
+	STR(listen_host);
+	STR(udp_listen_host);
+	STR(listen_netns_name);
+#undef STR
+#undef STR_ARRAY
+
+	return off;
+}
+
+int config_blob_create(struct list_head *head)
+{
+	blob_writer_st w;
+	config_blob_hdr_st *hdr;
+	vhost_cfg_st *vhost;
+	size_t hdr_off, vhosts_off, off, strs_off, reloc_off, size, i;
+	unsigned vhosts = 0;
+	uintptr_t val;
+	uint8_t *blob = NULL;
+	ssize_t ret;
+	int fd = -1;
+
+	memset(&w, 0, sizeof(w));
+	w.pool = talloc_new(NULL);
+	if (w.pool == NULL)
+		return -1;
+
+	list_for_each(head, vhost, list)
+		vhosts++;
+
+	/* the header at offset zero, so that no structure has a zero offset */
+	hdr_off = w_alloc(&w, sizeof(config_blob_hdr_st));
+	if (w.failed)
+		goto fail;
+	assert(hdr_off == 0);
+
+	vhosts_off = w_alloc(&w, vhosts * sizeof(uint64_t));
+
+	i = 0;
+	list_for_each(head, vhost, list) {
+		off = w_vhost(&w, vhost);
+		if (off == 0)
+			goto fail;
+		((uint64_t *)(w.data + vhosts_off))[i++] = off;
+	}
+
+	if (w.failed)
+		goto fail;
+
+	strs_off = (w.len + 7) & ~(size_t)7;
+	reloc_off = (strs_off + w.strs_len + 7) & ~(size_t)7;
+	size = reloc_off + w.relocs_len * sizeof(uint64_t);
+
+	/* the pointers to strings become offsets from the start too */
+	for (i = 0; i < w.relocs_len; i++) {
+		if (w.relocs[i] & RELOC_STR) {
+			w.relocs[i] &= ~RELOC_STR;
+			memcpy(&val, w.data + w.relocs[i], sizeof(val));
+			val += strs_off;
+			memcpy(w.data + w.relocs[i], &val, sizeof(val));
+		}
+	}
+
+	hdr = (config_blob_hdr_st *)w.data;
+	hdr->magic = CONFIG_BLOB_MAGIC;
+	hdr->version = CONFIG_BLOB_VERSION;
+	snprintf(hdr->package_version, sizeof(hdr->package_version), "%s", PACKAGE_VERSION);
+	hdr->ptr_size = sizeof(void *);
+	hdr->vhost_size = sizeof(vhost_cfg_st);
+	hdr->cfg_size = sizeof(struct cfg_st);
+	hdr->vhosts = vhosts;
+	hdr->vhost_off = vhosts_off;
+	hdr->reloc_off = reloc_off;
+	hdr->relocs = w.relocs_len;
+	hdr->size = size;
+
+	blob = talloc_zero_size(w.pool, size);
+	if (blob == NULL)
+		goto fail;
+
+	memcpy(blob, w.data, w.len);
+	if (w.strs_len > 0)
+		memcpy(blob + strs_off, w.strs, w.strs_len);
+	if (w.relocs_len > 0)
+		memcpy(blob + reloc_off, w.relocs, w.relocs_len * sizeof(uint64_t));
+
+	fd = memfd_create("ocserv-config", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1)
+		goto fail;
+
+	for (off = 0; off < size; off += ret) {
+		ret = write(fd, blob + off, size - off);
+		if (ret == -1 && errno == EINTR) {
+			ret = 0;
+			continue;
+		}
+		if (ret <= 0)
+			goto fail;
+	}
+
+	/* the workers only ever get a private mapping of it */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+		  F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+		goto fail;
+
+	talloc_free(w.pool);
+	return fd;
+
+ fail:
+	if (fd != -1)
+		close(fd);
+	talloc_free(w.pool);
+	return -1;
+}
+
+static int blob_off_ok(const config_blob_hdr_st *hdr, uint64_t off, size_t len)
+{
+	return off >= sizeof(*hdr) && off <= hdr->size && len <= hdr->size - off;
+}
+
+int config_blob_load(void *pool, int fd, struct list_head *head)
+{
+	config_blob_hdr_st hdr;
+	vhost_cfg_st *vhost;
+	const uint64_t *vhosts, *relocs;
+	struct stat st;
+	uintptr_t val;
+	uint8_t *base;
+	uint64_t i;
+
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(hdr))
+		return ERR_READ_CONFIG;
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return ERR_READ_CONFIG;
+
+	if (hdr.magic != CONFIG_BLOB_MAGIC || hdr.version != CONFIG_BLOB_VERSION ||
+	    strncmp(hdr.package_version, PACKAGE_VERSION, sizeof(hdr.package_version)) != 0 ||
+	    hdr.ptr_size != sizeof(void *) || hdr.vhost_size != sizeof(vhost_cfg_st) ||
+	    hdr.cfg_size != sizeof(struct cfg_st) || hdr.size != (uint64_t)st.st_size ||
+	    hdr.vhosts == 0 ||
+	    !blob_off_ok(&hdr, hdr.vhost_off, hdr.vhosts * sizeof(uint64_t)) ||
+	    hdr.relocs > hdr.size / sizeof(uint64_t) ||
+	    !blob_off_ok(&hdr, hdr.reloc_off, hdr.relocs * sizeof(uint64_t)))
+		return ERR_READ_CONFIG;
+
+	/* a private mapping; the pages stay shared with main and the other
+	 * workers unless they are relocated or written */
+	base = mmap(NULL, hdr.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED)
+		return ERR_MEM;
+
+	relocs = (const uint64_t *)(base + hdr.reloc_off);
+	for (i = 0; i < hdr.relocs; i++) {
+		if (!blob_off_ok(&hdr, relocs[i], sizeof(val)))
+			goto fail;
+
+		memcpy(&val, base + relocs[i], sizeof(val));
+		if (val >= hdr.size)
+			goto fail;
+		val += (uintptr_t)base;
+		memcpy(base + relocs[i], &val, sizeof(val));
+	}
+
+	vhosts = (const uint64_t *)(base + hdr.vhost_off);
+	for (i = 0; i < hdr.vhosts; i++) {
+		if (!blob_off_ok(&hdr, vhosts[i], sizeof(vhost_cfg_st)))
+			goto fail;
+
+		vhost = talloc_memdup(pool, base + vhosts[i], sizeof(vhost_cfg_st));
+		if (vhost == NULL)
+			goto fail;
+		vhost->pool = vhost;
+		list_head_init(&vhost->perm_config.attic);
+
+		vhost->perm_config.config->usage_count = talloc_zero(vhost, int);
+		if (vhost->perm_config.config->usage_count == NULL)
+			goto fail;
+
+		list_add_tail(head, &vhost->list);
+	}
+
+	return 0;
+
+ fail:
+	/* the vhosts already added point to the mapping; @head was empty */
+	while ((vhost = list_top(head, vhost_cfg_st, list)) != NULL) {
+		list_del(&vhost->list);
+		talloc_free(vhost);
+	}
+	munmap(base, hdr.size);
+	return ERR_READ_CONFIG;
+}
+
+#else
+
+int config_blob_create(struct list_head *head)
+{
+	return -1;
+}
+
+int config_blob_load(void *pool, int fd, struct list_head *head)
+{
+	return ERR_READ_CONFIG;
+}
+
+#endif
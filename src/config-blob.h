@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_CONFIG_BLOB_H
+# define OC_CONFIG_BLOB_H
+
+# include <stdint.h>
+# include <ccan/list/list.h>
+
+/* The parsed configuration of the virtual hosts, as main serializes it
+ * once per configuration generation for the workers. The blob starts
+ * with that header, followed by the structures (the vhost_cfg_st and
+ * cfg_st images, the string arrays and the kkdcp entries), the strings,
+ * and the relocation table. The pointers in the structures hold offsets
+ * from the start of the blob, and the relocation table lists where they
+ * are, so that the blob can be mapped anywhere.
+ */
+#define CONFIG_BLOB_MAGIC 0x4f434346 /* OCCF */
+#define CONFIG_BLOB_VERSION 1
+
+typedef struct config_blob_hdr_st {
+	uint32_t magic;
+	uint32_t version;
+	char package_version[16]; /* the blob is only read by the same build */
+	uint32_t ptr_size;
+	uint32_t vhost_size; /* sizeof(vhost_cfg_st) of the writer */
+	uint32_t cfg_size; /* sizeof(struct cfg_st) of the writer */
+	uint32_t vhosts; /* number of virtual hosts */
+	uint64_t vhost_off; /* the array of their offsets, in list order */
+	uint64_t reloc_off;
+	uint64_t relocs;
+	uint64_t size;
+} config_blob_hdr_st;
+
+/* Serializes the virtual hosts in @head to a sealed memory file. Returns
+ * the file descriptor, which is close-on-exec, or -1 on error. */
+int config_blob_create(struct list_head *head);
+
+/* Maps the blob in @fd and adds its virtual hosts to the empty @head.
+ * These are allocated from @pool, and their strings point to the mapping,
+ * so they are not to be freed or re-allocated. The TLS credentials, the
+ * pins and the auth and accounting module pointers are not part of the
+ * blob. Returns zero or a negative error code. */
+int config_blob_load(void *pool, int fd, struct list_head *head);
+
+#endif
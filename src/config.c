@@ -57,6 +57,7 @@
 
 #include <getopt.h>
 #include <snapshot.h>
+#include <config-blob.h>
 
 #define OLD_DEFAULT_CFG_FILE "/etc/ocserv.conf"
 #define DEFAULT_CFG_FILE "/etc/ocserv/ocserv.conf"
@@ -523,6 +524,8 @@ static void apply_default_conf(vhost_cfg_st *vhost, unsigned reload)
 	if (!reload) { /* perm config defaults */
 		tls_vhost_init(vhost);
 		vhost->perm_config.stats_reset_time = 24*60*60*7; /* weekly */
+		vhost->perm_config.lease_journal_expiry = 24*60*60; /* daily */
+		vhost->perm_config.tls_ticket_key_rotation = 24*60*60;
 	}
 
 	vhost->perm_config.config->mobile_idle_timeout = (unsigned)-1;
@@ -811,6 +814,15 @@ static int cfg_ini_handler(void *_ctx, const char *section, const char *name, co
 		} else if (strcmp(name, "occtl-socket-file") == 0) {
 			if (!PWARN_ON_VHOST_STRDUP(vhost->name, "occtl-socket-file", occtl_socket_file))
 				PREAD_STRING(pool, vhost->perm_config.occtl_socket_file);
+		} else if (strcmp(name, "ban-db-file") == 0) {
+			if (!PWARN_ON_VHOST_STRDUP(vhost->name, "ban-db-file", ban_db_file))
+				PREAD_STRING(pool, vhost->perm_config.ban_db_file);
+		} else if (strcmp(name, "lease-journal-file") == 0) {
+			if (!PWARN_ON_VHOST_STRDUP(vhost->name, "lease-journal-file", lease_journal_file))
+				PREAD_STRING(pool, vhost->perm_config.lease_journal_file);
+		} else if (strcmp(name, "lease-journal-expiry") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "lease-journal-expiry", lease_journal_expiry))
+				READ_NUMERIC(vhost->perm_config.lease_journal_expiry);
 		} else if (strcmp(name, "chroot-dir") == 0) {
 			if (!PWARN_ON_VHOST_STRDUP(vhost->name, "chroot-dir", chroot_dir))
 				PREAD_STRING(pool, vhost->perm_config.chroot_dir);
@@ -827,6 +839,32 @@ static int cfg_ini_handler(void *_ctx, const char *section, const char *name, co
 		} else if (strcmp(name, "sec-mod-scale") == 0) {
 			if (!PWARN_ON_VHOST(vhost->name, "sec-mod-scale", sec_mod_scale))
 				READ_NUMERIC(vhost->perm_config.sec_mod_scale);
+		} else if (strcmp(name, "stateless-cookies") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "stateless-cookies", stateless_cookies))
+				READ_TF(vhost->perm_config.stateless_cookies);
+		} else if (strcmp(name, "tls-session-tickets") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "tls-session-tickets", tls_session_tickets))
+				READ_TF(vhost->perm_config.tls_session_tickets);
+		} else if (strcmp(name, "tls-session-ticket-key-rotation") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "tls-session-ticket-key-rotation", tls_ticket_key_rotation))
+				READ_NUMERIC(vhost->perm_config.tls_ticket_key_rotation);
+		} else if (strcmp(name, "tun-pool-size") == 0) {
+#ifdef __linux__
+			if (!PWARN_ON_VHOST(vhost->name, "tun-pool-size", tun_pool_size))
+				READ_NUMERIC(vhost->perm_config.tun_pool_size);
+#else
+			fprintf(stderr, WARNSTR"the option 'tun-pool-size' is only supported on Linux\n");
+#endif
+		} else if (strcmp(name, "tun-multi-queue") == 0) {
+#ifdef __linux__
+			if (!PWARN_ON_VHOST(vhost->name, "tun-multi-queue", tun_multi_queue))
+				READ_TF(vhost->perm_config.tun_multi_queue);
+#else
+			fprintf(stderr, WARNSTR"the option 'tun-multi-queue' is only supported on Linux\n");
+#endif
+		} else if (strcmp(name, "sec-mod-key-threads") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "sec-mod-key-threads", sec_mod_key_threads))
+				READ_NUMERIC(vhost->perm_config.sec_mod_key_threads);
 		} else if (strcmp(name, "log-level") == 0) {
 			if (vhost->perm_config.debug == 0) {
 				READ_NUMERIC(vhost->perm_config.debug);
@@ -898,6 +936,9 @@ static int cfg_ini_handler(void *_ctx, const char *section, const char *name, co
 	} else if (strcmp(name, "disconnect-script") == 0) {
 		if (!WARN_ON_VHOST(vhost->name, "disconnect-script", disconnect_script))
 			READ_STRING(config->disconnect_script);
+	} else if (strcmp(name, "event-sink") == 0) {
+		if (!WARN_ON_VHOST(vhost->name, "event-sink", event_sink))
+			READ_STRING(config->event_sink);
 	} else if (strcmp(name, "session-control") == 0) {
 		fprintf(stderr, WARNSTR"the option 'session-control' is deprecated\n");
 	} else if (strcmp(name, "banner") == 0) {
@@ -970,6 +1011,13 @@ static int cfg_ini_handler(void *_ctx, const char *section, const char *name, co
 			fprintf(stderr, ERRSTR"cannot parse restrict-user-to-ports\n");
 			return 0;
 		}
+	} else if (strcmp(name, "firewall-nftables") == 0) {
+#ifdef __linux__
+		if (!WARN_ON_VHOST(vhost->name, "firewall-nftables", firewall_nftables))
+			READ_TF(config->firewall_nftables);
+#else
+		fprintf(stderr, WARNSTR"the option 'firewall-nftables' is only supported on Linux\n");
+#endif
 	} else if (strcmp(name, "tls-priorities") == 0) {
 		READ_STRING(config->priorities);
 	} else if (strcmp(name, "mtu") == 0) {
@@ -1113,6 +1161,13 @@ static int cfg_ini_handler(void *_ctx, const char *section, const char *name, co
 	} else if (strcmp(name, "route-del-cmd") == 0) {
 		if (!WARN_ON_VHOST(vhost->name, "route-del-cmd", route_del_cmd))
 			READ_STRING(config->route_del_cmd);
+	} else if (strcmp(name, "route-netlink") == 0) {
+#ifdef __linux__
+		if (!WARN_ON_VHOST(vhost->name, "route-netlink", route_netlink))
+			READ_TF(config->route_netlink);
+#else
+		fprintf(stderr, WARNSTR"the option 'route-netlink' is only supported on Linux\n");
+#endif
 	} else if (strcmp(name, "config-per-user") == 0) {
 		READ_STRING(config->per_user_dir);
 	} else if (strcmp(name, "config-per-group") == 0) {
@@ -1145,7 +1200,8 @@ enum {
 	CFG_FLAG_WORKER = (1<<2)
 };
 
-static void replace_file_with_snapshot(char ** file_name)
+/* @talloced is zero for the names which point to the config blob */
+static void replace_file_with_snapshot(char ** file_name, unsigned talloced)
 {
 	char * snapshot_file_name;
 	if (*file_name == NULL) {
@@ -1160,7 +1216,8 @@ static void replace_file_with_snapshot(char ** file_name)
 		exit(EXIT_FAILURE);
 	}
 
-	talloc_free(*file_name);
+	if (talloced)
+		talloc_free(*file_name);
 	*file_name = snapshot_file_name;
 }
 
@@ -1205,10 +1262,10 @@ static void parse_cfg_file(void *pool, const char *file, struct list_head *head,
 		// Walk the config, replacing filename with the snapshot equivalent
 		list_for_each(head, vhost, list) {
 			size_t index;
-			replace_file_with_snapshot(&vhost->perm_config.dh_params_file);
-			replace_file_with_snapshot(&vhost->perm_config.config->ocsp_response);
+			replace_file_with_snapshot(&vhost->perm_config.dh_params_file, 1);
+			replace_file_with_snapshot(&vhost->perm_config.config->ocsp_response, 1);
 			for (index = 0; index < vhost->perm_config.cert_size; index ++) {
-				replace_file_with_snapshot(&vhost->perm_config.cert[index]);
+				replace_file_with_snapshot(&vhost->perm_config.cert[index], 1);
 			}
 		}
 	} else {
@@ -1683,6 +1740,36 @@ int cmd_parser (void *pool, int argc, char **argv, struct list_head *head, bool
 
 }
 
+/* Used by the worker instead of cmd_parser() when main serialized its
+ * configuration; only what is not part of the blob is set up here. */
+int load_cfg_blob(void *pool, int fd, struct list_head *head)
+{
+	vhost_cfg_st *vhost;
+	int ret;
+
+	ret = config_blob_load(pool, fd, head);
+	if (ret < 0)
+		return ret;
+
+	list_for_each(head, vhost, list) {
+#if defined(PROC_FS_SUPPORTED)
+		size_t index;
+
+		replace_file_with_snapshot(&vhost->perm_config.dh_params_file, 0);
+		replace_file_with_snapshot(&vhost->perm_config.config->ocsp_response, 0);
+		for (index = 0; index < vhost->perm_config.cert_size; index ++) {
+			replace_file_with_snapshot(&vhost->perm_config.cert[index], 0);
+		}
+#endif
+		tls_vhost_init(vhost);
+		tls_load_files(NULL, vhost);
+		tls_load_prio(NULL, vhost);
+		tls_reload_crl(NULL, vhost, 1);
+	}
+
+	return 0;
+}
+
 static void archive_cfg(struct list_head *head)
 {
 	attic_entry_st *e;
@@ -120,6 +120,8 @@ typedef enum {
 #define ERR_PEER_TERMINATED -11
 #define ERR_CTL -12
 #define ERR_NO_CMD_FD -13
+#define ERR_WAIT_FOR_PING -14
+#define ERR_WAIT_FOR_AUTH -15
 
 #define ERR_WORKER_TERMINATED ERR_PEER_TERMINATED
 
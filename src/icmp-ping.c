@@ -79,14 +79,15 @@
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
 #include <netinet/icmp6.h>
-#include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
 #include <gnutls/crypto.h>
 #include <icmp-ping.h>
-#include <poll.h>
+#include <common.h>
+#include <cloexec.h>
+#include <keyed-hash.h>
 
 #ifndef ICMP_DEST_UNREACH
 # ifdef ICMP_UNREACH
@@ -138,218 +139,403 @@ static int in_cksum(unsigned short *buf, int sz)
 	return ans;
 }
 
-inline static int retry(int e)
+/* Probes are sent from one raw socket per address family, shared by
+ * all the outstanding checks and watched from the main event loop.
+ * A probe is outstanding, and present in the probes table, until an
+ * echo reply or an unreachable message for its address arrives, or
+ * its batch times out.
+ */
+
+#define PING_TIMEOUT 3
+
+struct ping_probe_st {
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	uint16_t id;
+	unsigned pending;
+	unsigned in_use;
+	struct ping_batch_st *batch;
+};
+
+struct ping_batch_st {
+	/* must be first so that this structure can behave as ev_timer */
+	struct ev_timer timer;
+
+	main_server_st *s;
+	ping_batch_func done;
+	void *priv;
+
+	struct ping_probe_st probes[PING_MAX_BATCH];
+	unsigned nprobes;
+	unsigned pending;
+};
+
+struct ping_sock_st {
+	/* must be first so that this structure can behave as ev_io */
+	struct ev_io io;
+
+	int fd;
+	main_server_st *s;
+};
+
+struct icmp_ping_st {
+	struct ping_sock_st sock4;
+	struct ping_sock_st sock6;
+
+	/* outstanding probes by ICMP id */
+	struct htable probes;
+};
+
+static size_t rehash_probe(const void *_p, void *unused)
 {
-	if (e == EAGAIN || e == EWOULDBLOCK || e == EINTR)
-		return 1;
-	else
-		return 0;
+	const struct ping_probe_st *p = _p;
+	return keyed_hash(&p->id, sizeof(p->id));
 }
 
-#define PING_TIMEOUT 3
+static void log_probe(main_server_st *s, struct ping_probe_st *probe)
+{
+	char buf[64];
 
-static
-ssize_t recvfrom_timeout(int sockfd, void *buf, size_t len, int flags,
-			 struct sockaddr *src_addr, socklen_t * addrlen)
+	mslog(s, NULL, LOG_INFO,
+	      "pinged %s and is %s",
+	      human_addr((void *)&probe->addr, probe->addr_len,
+			 buf, sizeof(buf)),
+	      probe->in_use ? "in use" : "not in use");
+}
+
+static void ping_batch_finish(struct ping_batch_st *b)
 {
-	int ret;
-    struct pollfd pfd;
+	struct icmp_ping_st *p = b->s->ping;
+	unsigned i;
 
-    pfd.fd = sockfd;
-    pfd.events = POLLIN;
-    pfd.revents = 0;
+	ev_timer_stop(main_loop, &b->timer);
 
-    ret = poll(&pfd, 1, 250);
-	if (ret == -1)
-		return -1;
-	else if (ret > 0)
-		return recvfrom(sockfd, buf, len, 0, src_addr, addrlen);
-	else
-		return -1;
+	for (i = 0; i < b->nprobes; i++) {
+		if (b->probes[i].pending) {
+			htable_del(&p->probes, rehash_probe(&b->probes[i], NULL), &b->probes[i]);
+			b->probes[i].pending = 0;
+		}
+		log_probe(b->s, &b->probes[i]);
+	}
+	b->pending = 0;
 
+	/* may free the batch */
+	b->done(b->s, b, b->priv);
+}
 
+static void ping_resolve(struct icmp_ping_st *p, int family, uint16_t id,
+			 const void *addr, unsigned in_use)
+{
+	struct ping_probe_st *probe, key;
+	struct htable_iter iter;
+	size_t h;
+
+	key.id = id;
+	h = rehash_probe(&key, NULL);
+
+	probe = htable_firstval(&p->probes, &iter, h);
+	while (probe != NULL) {
+		if (probe->id == id && probe->addr.ss_family == family &&
+		    memcmp(SA_IN_P_GENERIC(&probe->addr, probe->addr_len), addr,
+			   SA_IN_SIZE(probe->addr_len)) == 0) {
+			htable_delval(&p->probes, &iter);
+			probe->pending = 0;
+			probe->in_use = in_use;
+
+			if (--probe->batch->pending == 0)
+				ping_batch_finish(probe->batch);
+			return;
+		}
+		probe = htable_nextval(&p->probes, &iter, h);
+	}
 }
 
-int icmp_ping4(main_server_st * s, struct sockaddr_in *addr1)
+/* Parses an ICMP message received on the IPv4 raw socket, which includes
+ * the IP header. */
+static void ping4_recv(struct icmp_ping_st *p, uint8_t *pkt, size_t len,
+		       struct sockaddr_in *from)
 {
-	struct icmp *pkt;
-	int pingsock, c, e;
-	char packet1[DEFDATALEN + MAXIPLEN + MAXICMPLEN];
-	char buf1[64];
-	time_t now;
-	uint16_t id1;
-	unsigned gotreply = 0, unreachable = 0;
-
-	if (GETCONFIG(s)->ping_leases == 0)
-		return 0;
+	struct icmp *icmp, *orig;
+	unsigned hlen, ohlen;
+	uint8_t *inner;
+
+	if (len < 20)
+		return;
+	hlen = (pkt[0] & 0x0f) << 2;
+	if (len < hlen + ICMP_MINLEN)
+		return;
+	icmp = (struct icmp *)(pkt + hlen);
+
+	if (icmp->icmp_type == ICMP_ECHOREPLY) {
+		ping_resolve(p, AF_INET, icmp->icmp_id, &from->sin_addr, 1);
+	} else if (icmp->icmp_type == ICMP_DEST_UNREACH) {
+		/* the unreachable is sent by a router; the probed address is
+		 * the destination of the quoted echo request */
+		inner = pkt + hlen + ICMP_MINLEN;
+		len -= hlen + ICMP_MINLEN;
+		if (len < 20)
+			return;
+		ohlen = (inner[0] & 0x0f) << 2;
+		if (len < ohlen + ICMP_MINLEN)
+			return;
+		orig = (struct icmp *)(inner + ohlen);
+		if (orig->icmp_type != ICMP_ECHO)
+			return;
+
+		ping_resolve(p, AF_INET, orig->icmp_id, inner + 16, 0);
+	}
+}
 
-	if ((e=gnutls_rnd(GNUTLS_RND_NONCE, &id1, sizeof(id1))) < 0) {
-		mslog(s, NULL, LOG_ERR,
-		      "error in the random generator: %s", gnutls_strerror(e));
-		return 0;
+/* Parses an ICMPv6 message; the IPv6 header is not included. */
+static void ping6_recv(struct icmp_ping_st *p, uint8_t *pkt, size_t len,
+		       struct sockaddr_in6 *from)
+{
+	struct icmp6_hdr *icmp, *orig;
+	uint8_t *inner;
+
+	if (len < sizeof(struct icmp6_hdr))
+		return;
+	icmp = (struct icmp6_hdr *)pkt;
+
+	if (icmp->icmp6_type == ICMP6_ECHO_REPLY) {
+		ping_resolve(p, AF_INET6, icmp->icmp6_id, &from->sin6_addr, 1);
+	} else if (icmp->icmp6_type == ICMP6_DST_UNREACH) {
+		/* the quoted IPv6 header is followed by our echo request */
+		inner = pkt + sizeof(struct icmp6_hdr);
+		len -= sizeof(struct icmp6_hdr);
+		if (len < 40 + sizeof(struct icmp6_hdr))
+			return;
+		orig = (struct icmp6_hdr *)(inner + 40);
+		if (orig->icmp6_type != ICMP6_ECHO_REQUEST)
+			return;
+
+		ping_resolve(p, AF_INET6, orig->icmp6_id, inner + 24, 0);
 	}
+}
+
+static void ping_sock_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct ping_sock_st *ps = (struct ping_sock_st *)w;
+	main_server_st *s = ps->s;
+	uint8_t packet[DEFDATALEN + MAXIPLEN + MAXICMPLEN];
+	struct sockaddr_storage from;
+	socklen_t from_len;
+	ssize_t ret;
+
+	/* the batches completed here may free themselves, but the socket
+	 * and the probes table are only released at deinitialization */
+	do {
+		from_len = sizeof(from);
+		ret = recvfrom(ps->fd, packet, sizeof(packet), 0,
+			       (struct sockaddr *)&from, &from_len);
+		if (ret < 0)
+			break;
+
+		if (from.ss_family == AF_INET && from_len == sizeof(struct sockaddr_in))
+			ping4_recv(s->ping, packet, ret, (struct sockaddr_in *)&from);
+		else if (from.ss_family == AF_INET6 && from_len == sizeof(struct sockaddr_in6))
+			ping6_recv(s->ping, packet, ret, (struct sockaddr_in6 *)&from);
+	} while (1);
+}
 
-	pingsock = socket(AF_INET, SOCK_RAW, 1);
-	if (pingsock == -1) {
+static int ping_sock_open(main_server_st *s, struct ping_sock_st *ps, int family)
+{
+	int fd, e;
+#if defined(SOL_RAW) && defined(IPV6_CHECKSUM)
+	int sockopt;
+#endif
+#ifdef ICMP6_FILTER
+	struct icmp6_filter filter;
+#endif
+
+	if (ps->fd >= 0)
+		return ps->fd;
+
+	if (family == AF_INET)
+		fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+	else
+		fd = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
+	if (fd == -1) {
 		e = errno;
 		mslog(s, NULL, LOG_ERR,
 		      "could not open raw socket for ping: %s", strerror(e));
-		return 0;
+		return -1;
 	}
 
-	pkt = (struct icmp *) packet1;
-	memset(pkt, 0, sizeof(packet1));
-	pkt->icmp_type = ICMP_ECHO;
-	pkt->icmp_id = id1;
-	pkt->icmp_cksum =
-	    in_cksum((unsigned short *) pkt, sizeof(packet1));
-
-	while (sendto(pingsock, packet1, DEFDATALEN + ICMP_MINLEN, 0,
-		      (struct sockaddr *) addr1,
-		      sizeof(*addr1) == -1) && retry(errno));
-	/* listen for replies */
-
-	now = time(NULL);
-	while (time(NULL) - now < PING_TIMEOUT
-	       && (unreachable + gotreply) < 2) {
-		struct sockaddr_in from;
-		socklen_t fromlen = sizeof(from);
-
-		c = recvfrom_timeout(pingsock, packet1, sizeof(packet1), 0,
-				     (struct sockaddr *) &from, &fromlen);
-
-		if (c < 0) {
-			continue;
-		} else if (c >= 76 && fromlen == sizeof(struct sockaddr_in)) {	/* icmp6_hdr */
-			if (memcmp
-			    (SA_IN_P(&from), SA_IN_P(addr1),
-			     SA_IN_SIZE(sizeof(*addr1))) == 0) {
-
-#ifdef HAVE_STRUCT_IPHDR_IHL
-				struct iphdr *iphdr =
-				    (struct iphdr *) packet1;
-				pkt = (struct icmp *) (packet1 + (iphdr->ihl << 2));	/* skip ip hdr */
-#else
-				pkt = (struct icmp *) (packet1 + ((packet1[0] & 0x0f) << 2));	/* skip ip hdr */
+	if (family == AF_INET6) {
+#if defined(SOL_RAW) && defined(IPV6_CHECKSUM)
+		sockopt = offsetof(struct icmp6_hdr, icmp6_cksum);
+		setsockopt(fd, SOL_RAW, IPV6_CHECKSUM,
+			   &sockopt, sizeof(sockopt));
+#endif
+#ifdef ICMP6_FILTER
+		/* only wake up for the messages we wait for */
+		ICMP6_FILTER_SETBLOCKALL(&filter);
+		ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+		ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH, &filter);
+		setsockopt(fd, IPPROTO_ICMPV6, ICMP6_FILTER,
+			   &filter, sizeof(filter));
 #endif
-				if (pkt->icmp_id == id1) {
-					if (pkt->icmp_type == ICMP_ECHOREPLY)
-						gotreply++;
-					else if (pkt->icmp_type == ICMP_DEST_UNREACH)
-						unreachable++;
-                                }
-			}
-		}
 	}
 
-	close(pingsock);
+	set_non_block(fd);
+	set_cloexec_flag(fd, 1);
 
-	if (gotreply > 0) {
-		mslog(s, NULL, LOG_INFO,
-		      "pinged %s and is in use",
-		      human_addr((void *) addr1,
-				 sizeof(struct sockaddr_in), buf1,
-				 sizeof(buf1)));
-		return gotreply;
-	} else {
-		mslog(s, NULL, LOG_INFO,
-		      "pinged %s and is not in use",
-		      human_addr((void *) addr1,
-				 sizeof(struct sockaddr_in), buf1,
-				 sizeof(buf1)));
-		return 0;
+	ps->fd = fd;
+	ps->s = s;
+	ev_io_init(&ps->io, ping_sock_cb, fd, EV_READ);
+	ev_io_start(main_loop, &ps->io);
+
+	return fd;
+}
+
+static void ping_sock_close(struct ping_sock_st *ps)
+{
+	if (ps->fd >= 0) {
+		if (main_loop)
+			ev_io_stop(main_loop, &ps->io);
+		close(ps->fd);
+		ps->fd = -1;
 	}
 }
 
-int icmp_ping6(main_server_st * s,
-	       struct sockaddr_in6 *addr1)
+static void ping_batch_timeout_cb(struct ev_loop *loop, ev_timer *w, int revents)
 {
-	struct icmp6_hdr *pkt;
-	char buf1[64];
-	int pingsock, c, e;
-#if defined(SOL_RAW) && defined(IPV6_CHECKSUM)
-	int sockopt;
-#endif
-	char packet1[DEFDATALEN + MAXIPLEN + MAXICMPLEN];
-	uint16_t id1;
-	unsigned gotreply = 0, unreachable = 0;
-	time_t now;
+	ping_batch_finish((struct ping_batch_st *)w);
+}
 
-	if (GETCONFIG(s)->ping_leases == 0)
-		return 0;
+static int ping_batch_destructor(struct ping_batch_st *b)
+{
+	struct icmp_ping_st *p = b->s->ping;
+	unsigned i;
 
-	if ((e=gnutls_rnd(GNUTLS_RND_NONCE, &id1, sizeof(id1))) < 0) {
+	if (main_loop)
+		ev_timer_stop(main_loop, &b->timer);
+
+	for (i = 0; i < b->nprobes; i++) {
+		if (b->probes[i].pending)
+			htable_del(&p->probes, rehash_probe(&b->probes[i], NULL), &b->probes[i]);
+	}
+
+	return 0;
+}
+
+struct ping_batch_st *ping_batch_new(main_server_st *s, void *pool,
+				     ping_batch_func done, void *priv)
+{
+	struct ping_batch_st *b;
+
+	if (s->ping == NULL) {
+		s->ping = talloc_zero(s, struct icmp_ping_st);
+		if (s->ping == NULL)
+			return NULL;
+		s->ping->sock4.fd = -1;
+		s->ping->sock6.fd = -1;
+		htable_init(&s->ping->probes, rehash_probe, NULL);
+	}
+
+	b = talloc_zero(pool, struct ping_batch_st);
+	if (b == NULL)
+		return NULL;
+
+	b->s = s;
+	b->done = done;
+	b->priv = priv;
+	ev_init(&b->timer, ping_batch_timeout_cb);
+	talloc_set_destructor(b, ping_batch_destructor);
+
+	return b;
+}
+
+int ping_batch_add(struct ping_batch_st *b, const struct sockaddr_storage *addr,
+		   socklen_t addr_len)
+{
+	main_server_st *s = b->s;
+	struct ping_probe_st *probe;
+	char packet[DEFDATALEN + MAXIPLEN + MAXICMPLEN];
+	struct icmp *pkt4;
+	struct icmp6_hdr *pkt6;
+	size_t len;
+	int fd, e;
+
+	if (b->nprobes >= PING_MAX_BATCH)
+		return -1;
+
+	probe = &b->probes[b->nprobes];
+	memset(probe, 0, sizeof(*probe));
+	memcpy(&probe->addr, addr, addr_len);
+	probe->addr_len = addr_len;
+	probe->batch = b;
+
+	/* an address that cannot be probed is considered not in use */
+	if ((e=gnutls_rnd(GNUTLS_RND_NONCE, &probe->id, sizeof(probe->id))) < 0) {
 		mslog(s, NULL, LOG_ERR,
 		      "error in the random generator: %s", gnutls_strerror(e));
-		return 0;
+		return b->nprobes++;
 	}
 
-	pingsock = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
-	if (pingsock == -1) {
+	memset(packet, 0, sizeof(packet));
+	if (addr->ss_family == AF_INET) {
+		fd = ping_sock_open(s, &s->ping->sock4, AF_INET);
+
+		pkt4 = (struct icmp *) packet;
+		pkt4->icmp_type = ICMP_ECHO;
+		pkt4->icmp_id = probe->id;
+		len = DEFDATALEN + ICMP_MINLEN;
+		pkt4->icmp_cksum = in_cksum((unsigned short *) pkt4, len);
+	} else {
+		fd = ping_sock_open(s, &s->ping->sock6, AF_INET6);
+
+		/* the checksum is calculated by the kernel */
+		pkt6 = (struct icmp6_hdr *) packet;
+		pkt6->icmp6_type = ICMP6_ECHO_REQUEST;
+		pkt6->icmp6_id = probe->id;
+		len = DEFDATALEN + sizeof(struct icmp6_hdr);
+	}
+
+	if (fd < 0)
+		return b->nprobes++;
+
+	if (sendto(fd, packet, len, 0, (struct sockaddr *)addr, addr_len) == -1) {
 		e = errno;
 		mslog(s, NULL, LOG_ERR,
-		      "could not open raw socket for ping: %s", strerror(e));
-		return 0;
+		      "could not send ping: %s", strerror(e));
+		return b->nprobes++;
 	}
 
-	pkt = (struct icmp6_hdr *) packet1;
-	memset(pkt, 0, sizeof(packet1));
-	pkt->icmp6_type = ICMP6_ECHO_REQUEST;
-	pkt->icmp6_id = id1;
-
-#if defined(SOL_RAW) && defined(IPV6_CHECKSUM)
-	sockopt = offsetof(struct icmp6_hdr, icmp6_cksum);
-	setsockopt(pingsock, SOL_RAW, IPV6_CHECKSUM,
-		   &sockopt, sizeof(sockopt));
-#endif
-	while (sendto(pingsock, packet1,
-		      DEFDATALEN + sizeof(struct icmp6_hdr), 0,
-		      (struct sockaddr *) addr1,
-		      sizeof(*addr1) == -1) && retry(errno));
-
-	/* listen for replies */
-	now = time(NULL);
-	while (time(NULL) - now < PING_TIMEOUT
-	       && (unreachable + gotreply) < 2) {
-		struct sockaddr_in6 from;
-		socklen_t fromlen = sizeof(from);
-		c = recvfrom_timeout(pingsock, packet1,
-				     sizeof(packet1), 0,
-				     (struct sockaddr *)
-				     &from, &fromlen);
-		if (c < 0) {
-			continue;
-		} else if (c >= 8 && fromlen == sizeof(struct sockaddr_in6)) {	/* icmp6_hdr */
-			if (memcmp
-			    (SA_IN6_P(&from), SA_IN6_P(addr1),
-			     SA_IN_SIZE(sizeof(*addr1))) == 0) {
-
-				pkt = (struct icmp6_hdr *) packet1;
-				if (pkt->icmp6_id == id1) {
-					if (pkt->icmp6_type == ICMP6_ECHO_REPLY)
-						gotreply++;
-					else if (pkt->icmp6_type == ICMP6_DST_UNREACH)
-						unreachable++;
-				}
-			}
-		}
+	probe->pending = 1;
+	if (htable_add(&s->ping->probes, rehash_probe(probe, NULL), probe) == 0) {
+		probe->pending = 0;
+		return b->nprobes++;
 	}
+	b->pending++;
 
-	close(pingsock);
+	return b->nprobes++;
+}
 
-	if (gotreply > 0) {
-		mslog(s, NULL, LOG_INFO,
-		      "pinged %s and is in use",
-		      human_addr((void *) addr1,
-				 sizeof(struct sockaddr_in6), buf1,
-				 sizeof(buf1)));
-		return gotreply;
-	} else {
-		mslog(s, NULL, LOG_INFO,
-		      "pinged %s and is not in use",
-		      human_addr((void *) addr1,
-				 sizeof(struct sockaddr_in6), buf1,
-				 sizeof(buf1)));
+void ping_batch_start(struct ping_batch_st *b)
+{
+	/* completion is always reported from the event loop, even when
+	 * no probe could be sent */
+	ev_timer_set(&b->timer, b->pending ? PING_TIMEOUT : 0., 0.);
+	ev_timer_start(main_loop, &b->timer);
+}
+
+unsigned ping_batch_in_use(struct ping_batch_st *b, unsigned idx)
+{
+	if (idx >= b->nprobes)
 		return 0;
-	}
+	return b->probes[idx].in_use;
+}
+
+void icmp_ping_deinit(main_server_st *s)
+{
+	if (s->ping == NULL)
+		return;
+
+	ping_sock_close(&s->ping->sock4);
+	ping_sock_close(&s->ping->sock6);
+	htable_clear(&s->ping->probes);
+	talloc_free(s->ping);
+	s->ping = NULL;
 }
@@ -23,9 +23,25 @@
 
 #include <main.h>
 
-/* returns the number of positive replies received or
- * 0 if no host with this IP exists. */
-int icmp_ping4(main_server_st* s, struct sockaddr_in* addr1);
-int icmp_ping6(main_server_st* s, struct sockaddr_in6* addr1);
+/* Checks whether addresses are in use (see ping-leases). The addresses
+ * of a batch are probed in parallel, and @done is called from the event
+ * loop once all of them have replied or the timeout passed. Freeing the
+ * batch, which may also be done from @done, cancels outstanding probes.
+ */
+#define PING_MAX_BATCH 8
+
+struct ping_batch_st;
+typedef void (*ping_batch_func)(main_server_st *s, struct ping_batch_st *batch, void *priv);
+
+struct ping_batch_st *ping_batch_new(main_server_st *s, void *pool,
+				     ping_batch_func done, void *priv);
+/* returns the index of the probe, or -1 if the batch is full */
+int ping_batch_add(struct ping_batch_st *batch, const struct sockaddr_storage *addr,
+		   socklen_t addr_len);
+void ping_batch_start(struct ping_batch_st *batch);
+/* returns non-zero if a host replied to the probe */
+unsigned ping_batch_in_use(struct ping_batch_st *batch, unsigned idx);
+
+void icmp_ping_deinit(main_server_st *s);
 
 #endif
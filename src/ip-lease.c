@@ -25,6 +25,7 @@
 #include <ip-util.h>
 #include <gnutls/crypto.h>
 #include <icmp-ping.h>
+#include <lease-journal.h>
 #include <arpa/inet.h>
 
 static void ip_from_seed(uint8_t *seed, unsigned seed_size,
@@ -48,6 +49,8 @@ static void ip_from_seed(uint8_t *seed, unsigned seed_size,
 
 }
 
+static void ip_pools_deinit(struct ip_lease_db_st* db);
+
 void ip_lease_deinit(struct ip_lease_db_st* db)
 {
 struct ip_lease_st * cache;
@@ -62,6 +65,7 @@ struct htable_iter iter;
 		cache = htable_next(&db->ht, &iter);
 	}
 	htable_clear(&db->ht);
+	ip_pools_deinit(db);
 }
 
 static size_t rehash(const void* _e, void* unused)
@@ -74,6 +78,7 @@ const struct ip_lease_st * e = _e;
 void ip_lease_init(struct ip_lease_db_st* db)
 {
 	htable_init(&db->ht, rehash, NULL);
+	list_head_init(&db->pools);
 }
 
 static bool ip_lease_cmp(const void* _c1, void* _c2)
@@ -101,6 +106,285 @@ struct ip_lease_st t;
 	return 0;
 }
 
+/* Per-network allocation bitmaps.
+ *
+ * Addresses are first selected from the client's seed and then randomly,
+ * which keeps the assigned IP stable across sessions. When a network is
+ * almost fully in use random selection rarely succeeds, so each network
+ * also keeps a bitmap of its leases (a projection of the hash table) from
+ * which a free address is found directly. A second level bitmap marks the
+ * words of the first which are full, so a search skips 4096 addresses
+ * per word read.
+ *
+ * Networks larger than 2^IP_POOL_MAX_BITS leases are tracked only in their
+ * lower part; random selection on the remainder practically never fails.
+ */
+#define IP_POOL_MAX_BITS 24
+
+struct ip_pool_st {
+	struct list_node list;
+	int family;
+	uint8_t network[16];
+	unsigned prefix; /* of the network */
+	unsigned subnet_prefix; /* of each lease; 32 in IPv4 */
+	unsigned bits; /* the size of a lease index */
+	size_t size; /* 2^bits */
+	size_t used; /* the set bits in map */
+	uint64_t *map; /* a set bit is a lease in use or reserved */
+	uint64_t *full; /* a set bit is a word of map with all bits set */
+	size_t words;
+	size_t cursor; /* the word a search starts from */
+};
+
+#define IP_POOL_BIT(pos) (0x80 >> ((pos) % 8))
+
+static size_t ip_pool_index(const struct ip_pool_st *pool, const uint8_t *ip)
+{
+	size_t idx = 0;
+	unsigned i, pos;
+
+	for (i = 0; i < pool->bits; i++) {
+		pos = pool->subnet_prefix - pool->bits + i;
+		idx = (idx << 1) | ((ip[pos/8] & IP_POOL_BIT(pos)) ? 1 : 0);
+	}
+
+	return idx;
+}
+
+static void ip_pool_addr(const struct ip_pool_st *pool, size_t idx, uint8_t *ip)
+{
+	unsigned i, pos;
+
+	memcpy(ip, pool->network, pool->family == AF_INET ? 4 : 16);
+
+	for (i = 0; i < pool->bits; i++) {
+		pos = pool->subnet_prefix - 1 - i;
+		if (idx & ((size_t)1 << i))
+			ip[pos/8] |= IP_POOL_BIT(pos);
+	}
+}
+
+/* whether the lease address is in the tracked part of the pool */
+static bool ip_pool_contains(const struct ip_pool_st *pool, const uint8_t *ip)
+{
+	unsigned pos;
+
+	for (pos = 0; pos < pool->subnet_prefix - pool->bits; pos++) {
+		if (pos < pool->prefix) {
+			if ((ip[pos/8] ^ pool->network[pos/8]) & IP_POOL_BIT(pos))
+				return 0;
+		} else if (ip[pos/8] & IP_POOL_BIT(pos)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static bool ip_pool_test(const struct ip_pool_st *pool, size_t idx)
+{
+	return (pool->map[idx / 64] >> (idx % 64)) & 1;
+}
+
+static void ip_pool_set(struct ip_pool_st *pool, size_t idx)
+{
+	size_t w = idx / 64;
+
+	if (ip_pool_test(pool, idx))
+		return;
+
+	pool->map[w] |= (uint64_t)1 << (idx % 64);
+	pool->used++;
+	if (pool->map[w] == UINT64_MAX)
+		pool->full[w / 64] |= (uint64_t)1 << (w % 64);
+}
+
+static void ip_pool_clear(struct ip_pool_st *pool, size_t idx)
+{
+	size_t w = idx / 64;
+
+	if (!ip_pool_test(pool, idx))
+		return;
+
+	pool->map[w] &= ~((uint64_t)1 << (idx % 64));
+	pool->used--;
+	pool->full[w / 64] &= ~((uint64_t)1 << (w % 64));
+}
+
+/* the network, broadcast and local (tun) addresses are never leased */
+static bool ip_pool_reserved(const struct ip_pool_st *pool, size_t idx)
+{
+	if (pool->family == AF_INET) {
+		if (idx == 0 || idx == 1)
+			return 1;
+		if (pool->bits == 32 - pool->prefix && idx == pool->size - 1)
+			return 1;
+	} else {
+		if (pool->subnet_prefix == 128 && idx == 1)
+			return 1;
+	}
+	return 0;
+}
+
+/* Finds a free lease index, searching from the cursor onwards and
+ * wrapping around. Returns -1 if all are in use. */
+static int ip_pool_find(struct ip_pool_st *pool, size_t *idx)
+{
+	size_t nsum = (pool->words + 63) / 64;
+	size_t start = pool->cursor / 64;
+	size_t k, sw, w;
+	uint64_t avail;
+
+	for (k = 0; k <= nsum; k++) {
+		sw = (start + k) % nsum;
+		avail = ~pool->full[sw];
+		if (k == 0)
+			avail &= UINT64_MAX << (pool->cursor % 64);
+		if (avail == 0)
+			continue;
+
+		w = sw * 64 + __builtin_ctzll(avail);
+		*idx = w * 64 + __builtin_ctzll(~pool->map[w]);
+		pool->cursor = w;
+		return 0;
+	}
+
+	return -1;
+}
+
+static bool ip_pool_matches(const struct ip_pool_st *pool,
+			    const struct ip_lease_st *lease)
+{
+	if (lease->sig.ss_family != pool->family)
+		return 0;
+
+	if (pool->family == AF_INET6 && lease->prefix != pool->subnet_prefix)
+		return 0;
+
+	return ip_pool_contains(pool, SA_IN_P_TYPE(&lease->sig, pool->family));
+}
+
+/* Reflects the addition or the removal of a lease to the pools covering it */
+static void ip_pools_update(struct ip_lease_db_st *db, struct ip_lease_st *lease, bool add)
+{
+	struct ip_pool_st *pool;
+	size_t idx;
+
+	list_for_each(&db->pools, pool, list) {
+		if (!ip_pool_matches(pool, lease))
+			continue;
+
+		idx = ip_pool_index(pool, SA_IN_P_TYPE(&lease->sig, pool->family));
+		if (add)
+			ip_pool_set(pool, idx);
+		else if (!ip_pool_reserved(pool, idx))
+			ip_pool_clear(pool, idx);
+	}
+}
+
+/* Returns the pool of the network, creating it if needed. It returns NULL
+ * if the network cannot be tracked. Pools are kept until ip_lease_deinit(). */
+static struct ip_pool_st *ip_pool_get(main_server_st *s, int family,
+				      const uint8_t *network, unsigned prefix,
+				      unsigned subnet_prefix)
+{
+	struct ip_lease_db_st *db = &s->ip_leases;
+	struct ip_pool_st *pool;
+	struct ip_lease_st *lease;
+	struct htable_iter iter;
+	unsigned alen = family == AF_INET ? 4 : 16;
+	size_t i;
+
+	if (subnet_prefix <= prefix || subnet_prefix > alen * 8)
+		return NULL;
+
+	list_for_each(&db->pools, pool, list) {
+		if (pool->family == family && pool->prefix == prefix &&
+		    pool->subnet_prefix == subnet_prefix &&
+		    memcmp(pool->network, network, alen) == 0)
+			return pool;
+	}
+
+	pool = talloc_zero(s, struct ip_pool_st);
+	if (pool == NULL)
+		return NULL;
+
+	pool->family = family;
+	memcpy(pool->network, network, alen);
+	pool->prefix = prefix;
+	pool->subnet_prefix = subnet_prefix;
+	pool->bits = subnet_prefix - prefix;
+	if (pool->bits > IP_POOL_MAX_BITS)
+		pool->bits = IP_POOL_MAX_BITS;
+	pool->size = (size_t)1 << pool->bits;
+
+	/* at least a word in each level; the bits past the end are in use */
+	pool->words = (pool->size + 63) / 64;
+	pool->map = talloc_zero_array(pool, uint64_t, pool->words);
+	pool->full = talloc_zero_array(pool, uint64_t, (pool->words + 63) / 64);
+	if (pool->map == NULL || pool->full == NULL) {
+		talloc_free(pool);
+		return NULL;
+	}
+
+	if (pool->size % 64 != 0) {
+		pool->map[pool->words - 1] = UINT64_MAX << (pool->size % 64);
+	}
+	for (i = pool->words; i < ((pool->words + 63) / 64) * 64; i++)
+		pool->full[i / 64] |= (uint64_t)1 << (i % 64);
+
+	for (i = 0; i < pool->size && i < 2; i++) {
+		if (ip_pool_reserved(pool, i))
+			ip_pool_set(pool, i);
+	}
+	if (ip_pool_reserved(pool, pool->size - 1))
+		ip_pool_set(pool, pool->size - 1);
+
+	list_add(&db->pools, &pool->list);
+
+	/* account the existing leases */
+	lease = htable_first(&db->ht, &iter);
+	while (lease != NULL) {
+		if (ip_pool_matches(pool, lease))
+			ip_pool_set(pool, ip_pool_index(pool, SA_IN_P_TYPE(&lease->sig, pool->family)));
+		lease = htable_next(&db->ht, &iter);
+	}
+
+	return pool;
+}
+
+/* whether random selection is unlikely to find a free address */
+static bool ip_pool_dense(const struct ip_pool_st *pool)
+{
+	return pool != NULL && pool->used * 4 > pool->size * 3;
+}
+
+static void ip_pools_deinit(struct ip_lease_db_st* db)
+{
+	struct ip_pool_st *pool, *tmp;
+
+	list_for_each_safe(&db->pools, pool, tmp, list) {
+		list_del(&pool->list);
+		talloc_free(pool);
+	}
+}
+
+static unsigned ipv4_mask_to_prefix(const uint8_t *mask)
+{
+	uint32_t m = ((uint32_t)mask[0] << 24) | ((uint32_t)mask[1] << 16) |
+		     ((uint32_t)mask[2] << 8) | mask[3];
+	unsigned prefix = 0;
+
+	while (prefix < 32 && (m & (UINT32_C(1) << (31 - prefix))))
+		prefix++;
+
+	/* not contiguous */
+	if (prefix < 32 && (m << prefix) != 0)
+		return 0;
+
+	return prefix;
+}
+
 void steal_ip_leases(struct proc_st* proc, struct proc_st *thief)
 {
 	/* here we reset the old tun device, and assign the old addresses
@@ -176,6 +460,99 @@ static int is_ipv4_ok(main_server_st *s, struct sockaddr_storage *ip, struct soc
 #define MAX_IP_TRIES 16
 #define FIXED_IPS 5
 
+/* Selects the next free address of the pool. Addresses which are leased
+ * from overlapping networks are skipped, up to MAX_IP_TRIES of them. The
+ * selected address is marked as used in the pool when the lease is added
+ * to the table. */
+static
+int get_ipv4_lease_from_pool(main_server_st* s, struct proc_st* proc,
+			     struct ip_pool_st *pool, struct sockaddr_storage *network)
+{
+	size_t tried[MAX_IP_TRIES];
+	unsigned ntried, i;
+	struct sockaddr_in *rip = (void*)&proc->ipv4->rip;
+	int ret = -1;
+
+	for (ntried = 0; ntried < MAX_IP_TRIES; ntried++) {
+		if (ip_pool_find(pool, &tried[ntried]) < 0)
+			break;
+		/* so that the next search skips it */
+		ip_pool_set(pool, tried[ntried]);
+
+		memset(rip, 0, sizeof(*rip));
+		rip->sin_family = AF_INET;
+		ip_pool_addr(pool, tried[ntried], SA_IN_U8_P(rip));
+		proc->ipv4->rip_len = sizeof(struct sockaddr_in);
+
+		/* also rejects addresses leased from overlapping networks
+		 * that are not tracked by this pool */
+		if (ip_lease_exists(s, &proc->ipv4->rip, sizeof(struct sockaddr_in)) == 0) {
+			ntried++;
+			ret = 0;
+			break;
+		}
+	}
+
+	for (i = 0; i < ntried; i++)
+		ip_pool_clear(pool, tried[i]);
+
+	if (ret < 0)
+		return ret;
+
+	memcpy(&proc->ipv4->sig, &proc->ipv4->rip, sizeof(struct sockaddr_in));
+
+	/* LIP = network address + 1 */
+	memcpy(&proc->ipv4->lip, network, sizeof(struct sockaddr_in));
+	proc->ipv4->lip_len = sizeof(struct sockaddr_in);
+	SA_IN_U8_P(&proc->ipv4->lip)[3] |= 1;
+
+	return 0;
+}
+
+static
+int get_ipv6_lease_from_pool(main_server_st* s, struct proc_st* proc,
+			     struct ip_pool_st *pool, struct sockaddr_storage *subnet_mask)
+{
+	size_t tried[MAX_IP_TRIES];
+	unsigned ntried, i, j;
+	struct sockaddr_in6 *sig = (void*)&proc->ipv6->sig;
+	struct sockaddr_storage rnd;
+	int ret = -1;
+
+	for (ntried = 0; ntried < MAX_IP_TRIES; ntried++) {
+		if (ip_pool_find(pool, &tried[ntried]) < 0)
+			break;
+		ip_pool_set(pool, tried[ntried]);
+
+		memset(sig, 0, sizeof(*sig));
+		sig->sin6_family = AF_INET6;
+		ip_pool_addr(pool, tried[ntried], SA_IN6_U8_P(sig));
+
+		if (ip_lease_exists(s, &proc->ipv6->sig, sizeof(struct sockaddr_in6)) != 0)
+			continue;
+
+		/* as in random selection, the host part within the subnet is random */
+		memset(&rnd, 0, sizeof(rnd));
+		if (pool->subnet_prefix != 128 &&
+		    gnutls_rnd(GNUTLS_RND_NONCE, SA_IN6_U8_P(&rnd), sizeof(struct in6_addr)) < 0)
+			break;
+
+		proc->ipv6->rip_len = sizeof(struct sockaddr_in6);
+		memcpy(&proc->ipv6->rip, sig, sizeof(struct sockaddr_in6));
+		for (j=0;j<sizeof(struct in6_addr);j++)
+			SA_IN6_U8_P(&proc->ipv6->rip)[j] |= SA_IN6_U8_P(&rnd)[j] & ~(SA_IN6_U8_P(subnet_mask)[j]);
+
+		ntried++;
+		ret = 0;
+		break;
+	}
+
+	for (i = 0; i < ntried; i++)
+		ip_pool_clear(pool, tried[i]);
+
+	return ret;
+}
+
 static
 int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
 {
@@ -186,6 +563,8 @@ int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
 	int ret;
 	const char *c_network, *c_netmask;
 	char buf[64];
+	struct ip_pool_st *pool = NULL;
+	unsigned prefix;
 
 	/* Our IP accounting */
 	if (proc->config->ipv4_net && proc->config->ipv4_netmask) {
@@ -278,8 +657,43 @@ int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
 	((struct sockaddr_in*)&rnd)->sin_family = AF_INET;
 	((struct sockaddr_in*)&rnd)->sin_port = 0;
 
+	prefix = ipv4_mask_to_prefix(SA_IN_U8_P(&mask));
+	if (prefix > 0)
+		pool = ip_pool_get(s, AF_INET, SA_IN_U8_P(&network), prefix, 32);
+
+	/* prefer the address the user had before, if it is still valid */
+	if (lease_journal_get(s, proc->username, AF_INET, SA_IN_U8_P(&rnd)) == 0) {
+		for (i=0;i<sizeof(struct in_addr);i++) {
+			if ((SA_IN_U8_P(&rnd)[i] & SA_IN_U8_P(&mask)[i]) != SA_IN_U8_P(&network)[i])
+				break;
+		}
+
+		if (i == sizeof(struct in_addr) && is_ipv4_ok(s, &rnd, &network, &mask) != 0) {
+			memcpy(&proc->ipv4->rip, &rnd, sizeof(struct sockaddr_in));
+			proc->ipv4->rip_len = sizeof(struct sockaddr_in);
+			memcpy(&proc->ipv4->sig, &rnd, sizeof(struct sockaddr_in));
+
+			/* LIP = network address + 1 */
+			memcpy(&proc->ipv4->lip, &network, sizeof(struct sockaddr_in));
+			proc->ipv4->lip_len = sizeof(struct sockaddr_in);
+			SA_IN_U8_P(&proc->ipv4->lip)[3] |= 1;
+
+			if (ip_cmp(&proc->ipv4->lip, &proc->ipv4->rip) != 0) {
+				mslog(s, proc, LOG_DEBUG, "selected previous IP: %s",
+				      human_addr((void*)&proc->ipv4->rip, proc->ipv4->rip_len, buf, sizeof(buf)));
+				return 0;
+			}
+		}
+	}
+
 	do {
-		if (max_loops == 0) {
+		if (max_loops == 0 ||
+		    (max_loops < MAX_IP_TRIES-FIXED_IPS && ip_pool_dense(pool))) {
+			if (pool != NULL) {
+				ret = get_ipv4_lease_from_pool(s, proc, pool, &network);
+				if (ret == 0)
+					break;
+			}
 			mslog(s, proc, LOG_ERR, "could not figure out a valid IPv4 IP");
 			ret = ERR_NO_IP;
 			goto fail;
@@ -333,9 +747,7 @@ int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
 
 		mslog(s, proc, LOG_DEBUG, "selected IP: %s",
 		      human_addr((void*)&proc->ipv4->rip, proc->ipv4->rip_len, buf, sizeof(buf)));
-
-		if (icmp_ping4(s, (void*)&proc->ipv4->rip) == 0)
-			break;
+		break;
 	} while (1);
 
 	return 0;
@@ -357,6 +769,7 @@ int get_ipv6_lease(main_server_st* s, struct proc_st* proc)
 	unsigned prefix, subnet_prefix ;
 	int ret;
 	char buf[64];
+	struct ip_pool_st *pool;
 
 	if (proc->config->ipv6_net && proc->config->ipv6_subnet_prefix) {
 		c_network = proc->config->ipv6_net;
@@ -443,8 +856,42 @@ int get_ipv6_lease(main_server_st* s, struct proc_st* proc)
 	((struct sockaddr_in6*)&tmp)->sin6_family = AF_INET6;
 	((struct sockaddr_in6*)&tmp)->sin6_port = 0;
 
+	pool = ip_pool_get(s, AF_INET6, SA_IN6_U8_P(&network), prefix, subnet_prefix);
+
+	/* prefer the address the user had before, if it is still valid */
+	memset(&rnd, 0, sizeof(rnd));
+	((struct sockaddr_in6*)&rnd)->sin6_family = AF_INET6;
+	if (lease_journal_get(s, proc->username, AF_INET6, SA_IN6_U8_P(&rnd)) == 0) {
+		for (i=0;i<sizeof(struct in6_addr);i++) {
+			if ((SA_IN6_U8_P(&rnd)[i] & SA_IN6_U8_P(&mask)[i]) != SA_IN6_U8_P(&network)[i])
+				break;
+		}
+
+		if (i == sizeof(struct in6_addr)) {
+			((struct sockaddr_in6*)&proc->ipv6->sig)->sin6_family = AF_INET6;
+			((struct sockaddr_in6*)&proc->ipv6->sig)->sin6_port = 0;
+			for (i=0;i<sizeof(struct in6_addr);i++)
+				SA_IN6_U8_P(&proc->ipv6->sig)[i] = SA_IN6_U8_P(&rnd)[i] & SA_IN6_U8_P(&subnet_mask)[i];
+
+			if (is_ipv6_ok(s, &rnd, &proc->ipv6->lip, &proc->ipv6->sig) != 0) {
+				proc->ipv6->rip_len = sizeof(struct sockaddr_in6);
+				memcpy(&proc->ipv6->rip, &rnd, proc->ipv6->rip_len);
+
+				mslog(s, proc, LOG_DEBUG, "selected previous IP: %s",
+				      human_addr((void*)&proc->ipv6->rip, proc->ipv6->rip_len, buf, sizeof(buf)));
+				goto finish;
+			}
+		}
+	}
+
 	do {
-		if (max_loops == 0) {
+		if (max_loops == 0 ||
+		    (max_loops < MAX_IP_TRIES-FIXED_IPS && ip_pool_dense(pool))) {
+			if (pool != NULL) {
+				ret = get_ipv6_lease_from_pool(s, proc, pool, &subnet_mask);
+				if (ret == 0)
+					break;
+			}
 			mslog(s, NULL, LOG_ERR, "could not figure out a valid IPv6 IP");
 			ret = ERR_NO_IP;
 			goto fail;
@@ -498,9 +945,7 @@ int get_ipv6_lease(main_server_st* s, struct proc_st* proc)
 
 		mslog(s, proc, LOG_DEBUG, "selected IP: %s",
 		      human_addr((void*)&proc->ipv6->rip, proc->ipv6->rip_len, buf, sizeof(buf)));
-
-		if (proc->ipv6->prefix != 128 || icmp_ping6(s, (void*)&proc->ipv6->rip) == 0)
-			break;
+		break;
 	} while (1);
 
  finish:
@@ -519,28 +964,256 @@ static
 int unref_ip_lease(struct ip_lease_st *lease)
 {
 	if (lease->db) {
-		htable_del(&lease->db->ht, rehash(lease, NULL), lease);
+		if (htable_del(&lease->db->ht, rehash(lease, NULL), lease))
+			ip_pools_update(lease->db, lease, 0);
 	}
 
 	return 0;
 }
 
+int add_ip_lease(main_server_st *s, struct ip_lease_st *lease)
+{
+	if (htable_add(&s->ip_leases.ht, rehash(lease, NULL), lease) == 0)
+		return -1;
+
+	ip_pools_update(&s->ip_leases, lease, 1);
+	talloc_set_destructor(lease, unref_ip_lease);
+	return 0;
+}
+
+/* With ping-leases the selected addresses are checked for hosts which
+ * already use them, without blocking the main loop. Each round reserves
+ * the next few candidates in the lease table, in the order they are
+ * selected so that the sticky address is preferred, and probes them in
+ * parallel. The first candidate that gets no reply is leased, and the
+ * connection continues at resume_accept_user().
+ */
+#define LEASE_PROBES_PER_ROUND 4
+
+struct lease_candidates_st {
+	struct ip_lease_st *lease[MAX_IP_TRIES];
+	int probe[MAX_IP_TRIES];
+	unsigned n; /* candidates reserved so far */
+	unsigned first; /* the first candidate of the current round */
+	unsigned done;
+	struct ip_lease_st *selected;
+};
+
+struct lease_probe_st {
+	struct proc_st *proc;
+	struct ping_batch_st *batch;
+	struct lease_candidates_st ipv4;
+	struct lease_candidates_st ipv6;
+};
+
+/* Reserves the candidates of a round; returns the number of
+ * probes sent or a negative error code. */
+static
+int lease_probe_reserve(main_server_st *s, struct lease_probe_st *lp, unsigned ipv6)
+{
+	struct proc_st *proc = lp->proc;
+	struct lease_candidates_st *c = ipv6 ? &lp->ipv6 : &lp->ipv4;
+	struct ip_lease_st **plp = ipv6 ? &proc->ipv6 : &proc->ipv4;
+	struct ip_lease_st *lease;
+	unsigned i;
+	int ret;
+
+	c->first = c->n;
+	for (i = 0; i < LEASE_PROBES_PER_ROUND && c->n < MAX_IP_TRIES; i++) {
+		if (ipv6)
+			ret = get_ipv6_lease(s, proc);
+		else
+			ret = get_ipv4_lease(s, proc);
+		if (ret < 0) {
+			/* check the candidates we already have */
+			if (c->n > c->first)
+				break;
+			return ret;
+		}
+
+		/* explicit addresses and networks that are not configured
+		 * are not checked */
+		if (*plp == NULL || (*plp)->db == NULL) {
+			c->done = 1;
+			return 0;
+		}
+
+		lease = talloc_steal(lp, *plp);
+		*plp = NULL;
+
+		if (add_ip_lease(s, lease) < 0) {
+			mslog(s, proc, LOG_ERR, "could not add IP lease to hash table");
+			talloc_free(lease);
+			return -1;
+		}
+
+		/* as in the pool, IPv6 hosts are only probed when a single
+		 * address is leased */
+		if (ipv6 && lease->prefix != 128) {
+			c->selected = lease;
+			c->done = 1;
+			return 0;
+		}
+
+		c->lease[c->n] = lease;
+		c->probe[c->n] = ping_batch_add(lp->batch, &lease->rip, lease->rip_len);
+		c->n++;
+	}
+
+	return c->n - c->first;
+}
+
+static void lease_probe_done(main_server_st *s, struct ping_batch_st *batch, void *priv);
+
+static
+int lease_probe_round(main_server_st *s, struct lease_probe_st *lp)
+{
+	int ret, probes = 0;
+
+	talloc_free(lp->batch);
+	lp->batch = ping_batch_new(s, lp, lease_probe_done, lp);
+	if (lp->batch == NULL)
+		return ERR_MEM;
+
+	if (!lp->ipv4.done) {
+		ret = lease_probe_reserve(s, lp, 0);
+		if (ret < 0)
+			return ret;
+		probes += ret;
+	}
+
+	if (!lp->ipv6.done) {
+		ret = lease_probe_reserve(s, lp, 1);
+		if (ret < 0)
+			return ret;
+		probes += ret;
+	}
+
+	if (probes > 0)
+		ping_batch_start(lp->batch);
+
+	return probes;
+}
+
+static
+int lease_probe_select(main_server_st *s, struct lease_probe_st *lp, unsigned ipv6)
+{
+	struct lease_candidates_st *c = ipv6 ? &lp->ipv6 : &lp->ipv4;
+	unsigned i;
+
+	if (c->done)
+		return 0;
+
+	for (i = c->first; i < c->n; i++) {
+		if (ping_batch_in_use(lp->batch, c->probe[i]) == 0) {
+			c->selected = c->lease[i];
+			c->done = 1;
+			return 0;
+		}
+	}
+
+	if (c->n >= MAX_IP_TRIES) {
+		mslog(s, lp->proc, LOG_ERR, "could not figure out a valid %s IP; all candidates are in use",
+		      ipv6 ? "IPv6" : "IPv4");
+		return ERR_NO_IP;
+	}
+
+	return 0;
+}
+
+/* Moves the selected leases to the proc and releases the rest */
+static
+void lease_probe_finish(struct lease_probe_st *lp)
+{
+	struct proc_st *proc = lp->proc;
+
+	if (lp->ipv4.selected)
+		proc->ipv4 = talloc_steal(proc, lp->ipv4.selected);
+	if (lp->ipv6.selected)
+		proc->ipv6 = talloc_steal(proc, lp->ipv6.selected);
+	proc->leases_probed = 1;
+
+	talloc_free(lp);
+}
+
+static void lease_probe_done(main_server_st *s, struct ping_batch_st *batch, void *priv)
+{
+	struct lease_probe_st *lp = priv;
+	struct proc_st *proc = lp->proc;
+	int ret;
+
+	ret = lease_probe_select(s, lp, 0);
+	if (ret == 0)
+		ret = lease_probe_select(s, lp, 1);
+
+	/* some candidates were in use; try the next ones */
+	if (ret == 0 && (!lp->ipv4.done || !lp->ipv6.done)) {
+		ret = lease_probe_round(s, lp);
+		if (ret > 0)
+			return;
+	}
+
+	if (ret < 0)
+		talloc_free(lp);
+	else
+		lease_probe_finish(lp);
+
+	resume_accept_user(s, proc, ret < 0 ? ret : 0);
+}
+
+static
+int lease_probe_start(main_server_st *s, struct proc_st *proc)
+{
+	struct lease_probe_st *lp;
+	int ret;
+
+	lp = talloc_zero(proc, struct lease_probe_st);
+	if (lp == NULL)
+		return ERR_MEM;
+
+	lp->proc = proc;
+	lp->ipv4.done = (proc->ipv4 != NULL);
+	lp->ipv6.done = (proc->ipv6 != NULL);
+
+	ret = lease_probe_round(s, lp);
+	if (ret < 0) {
+		talloc_free(lp);
+		return ret;
+	}
+
+	if (ret == 0) {
+		/* nothing to check */
+		lease_probe_finish(lp);
+		return 0;
+	}
+
+	return ERR_WAIT_FOR_PING;
+}
+
+/* Returns zero when the leases are assigned, or ERR_WAIT_FOR_PING if
+ * they are being checked and resume_accept_user() will be called. */
 int get_ip_leases(main_server_st *s, struct proc_st *proc)
 {
 int ret;
 char buf[128];
 
+	if (GETCONFIG(s)->ping_leases && !proc->leases_probed &&
+	    (proc->ipv4 == NULL || proc->ipv6 == NULL)) {
+		ret = lease_probe_start(s, proc);
+		if (ret != 0)
+			return ret;
+	}
+
 	if (proc->ipv4 == NULL) {
 		ret = get_ipv4_lease(s, proc);
 		if (ret < 0)
 			return ret;
 
 		if (proc->ipv4 && proc->ipv4->db) {
-			if (htable_add(&s->ip_leases.ht, rehash(proc->ipv4, NULL), proc->ipv4) == 0) {
+			if (add_ip_lease(s, proc->ipv4) < 0) {
 				mslog(s, proc, LOG_ERR, "could not add IPv4 lease to hash table");
 				return -1;
 			}
-			talloc_set_destructor(proc->ipv4, unref_ip_lease);
 		}
 	}
 
@@ -550,11 +1223,10 @@ char buf[128];
 			return ret;
 
 		if (proc->ipv6 && proc->ipv6->db) {
-			if (htable_add(&s->ip_leases.ht, rehash(proc->ipv6, NULL), proc->ipv6) == 0) {
+			if (add_ip_lease(s, proc->ipv6) < 0) {
 				mslog(s, proc, LOG_ERR, "could not add IPv6 lease to hash table");
 				return -1;
 			}
-			talloc_set_destructor(proc->ipv6, unref_ip_lease);
 		}
 	}
 
@@ -572,6 +1244,8 @@ char buf[128];
 			human_addr((void*)&proc->ipv6->rip, proc->ipv6->rip_len, buf, sizeof(buf)),
 			proc->ipv6->prefix);
 
+	lease_journal_put(s, proc);
+
 	return 0;
 }
 
@@ -51,5 +51,7 @@ void steal_ip_leases(struct proc_st* proc, struct proc_st *thief);
 int get_ip_leases(struct main_server_st* s, struct proc_st* proc);
 void remove_ip_leases(struct main_server_st* s, struct proc_st* proc);
 void remove_ip_lease(main_server_st* s, struct ip_lease_st * lease);
+/* Adds a lease with 'db' set to the lease table */
+int add_ip_lease(main_server_st *s, struct ip_lease_st *lease);
 
 #endif
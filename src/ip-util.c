@@ -19,6 +19,7 @@
 #include <config.h>
 #include "ip-util.h"
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <talloc.h>
 #include <assert.h>
@@ -201,6 +202,62 @@ char *ipv4_route_to_cidr(void *pool, const char *route)
 	return talloc_asprintf(pool, "%.*s/%d", len, route, prefix);
 }
 
+/* Parses a route in the xxx.xxx.xxx.xxx/xxx.xxx.xxx.xxx, xxx.xxx.xxx.xxx/prefix
+ * or IPv6 address/prefix formats. A route without a prefix is a host route.
+ */
+int ip_route_parse(const char *route, struct sockaddr_storage *addr, unsigned *prefix)
+{
+	char str[MAX_IP_STR];
+	const char *p;
+	unsigned max;
+	size_t len;
+	char *end;
+	long val;
+	int ret;
+
+	memset(addr, 0, sizeof(*addr));
+
+	p = strchr(route, '/');
+	len = (p != NULL) ? (size_t)(p - route) : strlen(route);
+	if (len >= sizeof(str))
+		return -1;
+	memcpy(str, route, len);
+	str[len] = 0;
+
+	if (strchr(str, ':') != NULL) {
+		addr->ss_family = AF_INET6;
+		ret = inet_pton(AF_INET6, str, SA_IN6_P(addr));
+		max = 128;
+	} else {
+		addr->ss_family = AF_INET;
+		ret = inet_pton(AF_INET, str, SA_IN_P(addr));
+		max = 32;
+	}
+	if (ret != 1)
+		return -1;
+
+	if (p == NULL) {
+		*prefix = max;
+		return 0;
+	}
+	p++;
+
+	if (addr->ss_family == AF_INET && strchr(p, '.') != NULL) {
+		ret = ipv4_mask_to_int(p);
+		if (ret < 0)
+			return -1;
+		*prefix = ret;
+		return 0;
+	}
+
+	val = strtol(p, &end, 10);
+	if (end == p || *end != 0 || val < 0 || val > (long)max)
+		return -1;
+	*prefix = val;
+
+	return 0;
+}
+
 char *human_addr2(const struct sockaddr *sa, socklen_t salen,
 		       void *_buf, size_t buflen, unsigned full)
 {
@@ -46,6 +46,7 @@ inline static int valid_ipv6_prefix(unsigned prefix)
 }
 
 char *ipv4_route_to_cidr(void *pool, const char *route);
+int ip_route_parse(const char *route, struct sockaddr_storage *addr, unsigned *prefix);
 
 /* Helper casts */
 #define SA_IN_P(p) (&((struct sockaddr_in *)(p))->sin_addr)
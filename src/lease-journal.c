@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <main.h>
+#include <ip-util.h>
+#include <ip-lease.h>
+#include <lease-journal.h>
+
+static void journal_entry_key(const void *entry, const void **key, size_t *key_size)
+{
+	const lease_journal_entry_st *e = entry;
+
+	*key = e->username;
+	*key_size = strnlen(e->username, sizeof(e->username));
+}
+
+static const mmap_table_type_st journal_type = {
+	.name = "lease journal",
+	.magic = LEASE_JOURNAL_MAGIC,
+	.version = LEASE_JOURNAL_VERSION,
+	.entry_size = sizeof(lease_journal_entry_st),
+	.state_offset = offsetof(lease_journal_entry_st, state),
+	.min_slots = LEASE_JOURNAL_MIN_SLOTS,
+	.entry_key = journal_entry_key,
+};
+
+static lease_journal_entry_st *journal_find(struct mmap_table_st *j, const char *username)
+{
+	return mmap_table_find(j, username, strlen(username), NULL);
+}
+
+void lease_journal_init(main_server_st *s)
+{
+	const char *file = GETPCONFIG(s)->lease_journal_file;
+
+	if (file == NULL)
+		return;
+
+	/* without it addresses are assigned as without the journal */
+	s->lease_journal = mmap_table_open(s, s, &journal_type, file);
+}
+
+void lease_journal_deinit(main_server_st *s)
+{
+	if (s->lease_journal == NULL)
+		return;
+
+	mmap_table_close(s->lease_journal);
+	s->lease_journal = NULL;
+}
+
+int lease_journal_get(main_server_st *s, const char *username, int family, uint8_t *ip)
+{
+	struct mmap_table_st *j = s->lease_journal;
+	lease_journal_entry_st *e;
+
+	if (j == NULL || username[0] == 0)
+		return -1;
+
+	e = journal_find(j, username);
+	if (e == NULL || e->expires < (uint64_t)time(NULL))
+		return -1;
+
+	if (family == AF_INET && (e->flags & LEASE_JOURNAL_IPV4)) {
+		memcpy(ip, e->ipv4, sizeof(e->ipv4));
+		return 0;
+	} else if (family == AF_INET6 && (e->flags & LEASE_JOURNAL_IPV6)) {
+		memcpy(ip, e->ipv6, sizeof(e->ipv6));
+		return 0;
+	}
+
+	return -1;
+}
+
+void lease_journal_put(main_server_st *s, struct proc_st *proc)
+{
+	struct mmap_table_st *j = s->lease_journal;
+	lease_journal_entry_st t, *e;
+
+	if (j == NULL || proc->username[0] == 0)
+		return;
+
+	/* explicit addresses are not recorded */
+	memset(&t, 0, sizeof(t));
+	if (proc->ipv4 && proc->ipv4->db) {
+		memcpy(t.ipv4, SA_IN_U8_P(&proc->ipv4->rip), sizeof(t.ipv4));
+		t.flags |= LEASE_JOURNAL_IPV4;
+	}
+	if (proc->ipv6 && proc->ipv6->db) {
+		memcpy(t.ipv6, SA_IN6_U8_P(&proc->ipv6->rip), sizeof(t.ipv6));
+		t.flags |= LEASE_JOURNAL_IPV6;
+	}
+	if (t.flags == 0)
+		return;
+
+	memcpy(t.username, proc->username, sizeof(t.username));
+	t.expires = time(NULL) + GETPCONFIG(s)->lease_journal_expiry;
+
+	e = journal_find(j, t.username);
+	if (e != NULL) {
+		memcpy(e->ipv4, t.ipv4, sizeof(e->ipv4));
+		memcpy(e->ipv6, t.ipv6, sizeof(e->ipv6));
+		e->flags = t.flags;
+		e->expires = t.expires;
+		return;
+	}
+
+	mmap_table_add(s, j, &t);
+}
+
+void lease_journal_cleanup(main_server_st *s)
+{
+	struct mmap_table_st *j = s->lease_journal;
+	lease_journal_entry_st *e;
+	uint64_t now = time(NULL);
+	unsigned iter = 0;
+
+	if (j == NULL)
+		return;
+
+	while ((e = mmap_table_next(j, &iter)) != NULL) {
+		if (e->expires < now)
+			mmap_table_del(j, e);
+	}
+
+	/* drop the deleted slots, shrinking when mostly empty */
+	if (j->hdr->deleted > j->hdr->slots / 4) {
+		unsigned slots = j->hdr->slots;
+
+		while (slots > LEASE_JOURNAL_MIN_SLOTS && (size_t)j->hdr->used * 8 < slots)
+			slots /= 2;
+		mmap_table_rebuild(s, j, slots);
+	}
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_LEASE_JOURNAL_H
+# define OC_LEASE_JOURNAL_H
+
+# include "main.h"
+# include <mmap-table.h>
+
+/* The lease journal records the addresses last leased to each user, so
+ * that they are offered to the user again, including after a restart.
+ * It is a table keyed by the username in a mapping of the
+ * 'lease-journal-file' (see mmap-table.h).
+ */
+#define LEASE_JOURNAL_MAGIC 0x4f434c4a /* OCLJ */
+#define LEASE_JOURNAL_VERSION 1
+#define LEASE_JOURNAL_MIN_SLOTS 256
+
+#define LEASE_JOURNAL_IPV4 1
+#define LEASE_JOURNAL_IPV6 (1<<1)
+
+typedef struct lease_journal_entry_st {
+	char username[MAX_USERNAME_SIZE];
+	uint8_t ipv4[4];
+	uint8_t ipv6[16];
+	uint32_t flags; /* LEASE_JOURNAL_IPV4 and/or LEASE_JOURNAL_IPV6 */
+	uint32_t state; /* MMAP_SLOT_ */
+	uint64_t expires;
+} lease_journal_entry_st;
+
+void lease_journal_init(main_server_st *s);
+void lease_journal_deinit(main_server_st *s);
+
+/* Copies the address last leased to the user for the given family to
+ * @ip; returns -1 if there is none or it has expired. */
+int lease_journal_get(main_server_st *s, const char *username, int family, uint8_t *ip);
+
+/* Records the leases of the proc; they expire 'lease-journal-expiry'
+ * seconds from now. */
+void lease_journal_put(main_server_st *s, struct proc_st *proc);
+
+void lease_journal_cleanup(main_server_st *s);
+
+#endif
@@ -170,7 +170,8 @@ int handle_auth_cookie_req(sec_mod_instance_st * sec_mod_instance, struct proc_s
 	int ret;
 	struct proc_st *old_proc;
 
-	if (req->cookie.data == NULL || req->cookie.len != sizeof(proc->sid))
+	if (req->cookie.data == NULL || req->cookie.len < sizeof(proc->sid) ||
+	    req->cookie.len > MAX_COOKIE_SIZE)
 		return -1;
 
 	/* generate a new DTLS session ID for each connection, to allow
@@ -214,6 +215,10 @@ int handle_auth_cookie_req(sec_mod_instance_st * sec_mod_instance, struct proc_s
 		/* steal its leases */
 		steal_ip_leases(old_proc, proc);
 
+		/* its instance must not invalidate the session on close */
+		if (old_proc->sec_mod_instance_index != proc->sec_mod_instance_index)
+			old_proc->session_moved = 1;
+
 		if (old_proc->pid > 0) {
 			kill_proc(old_proc);
 		}
@@ -223,7 +228,7 @@ int handle_auth_cookie_req(sec_mod_instance_st * sec_mod_instance, struct proc_s
 	}
 
 	/* update the SID */
-	memcpy(proc->sid, req->cookie.data, req->cookie.len);
+	memcpy(proc->sid, req->cookie.data, sizeof(proc->sid));
 	/* this also hints to call session_close() */
 	proc->active_sid = 1;
 
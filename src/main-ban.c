@@ -41,42 +41,63 @@
 #include <main.h>
 #include <main-ban.h>
 #include <arpa/inet.h>
-#include <ccan/hash/hash.h>
-#include <ccan/htable/htable.h>
+#include <stddef.h>
 #include <ifaddrs.h>
 #include <sys/socket.h>
 
 static bool if_address_test_local(main_server_st * s, struct sockaddr_storage *addr);
 
-static size_t rehash(const void *_e, void *unused)
+static void ban_entry_key(const void *entry, const void **key, size_t *key_size)
 {
-	ban_entry_st *e = (void*)_e;
-	return hash_any(e->ip.ip, e->ip.size, 0);
+	const ban_entry_st *e = entry;
+
+	*key = e->ip.ip;
+	*key_size = e->ip.size;
 }
 
-/* The first argument is the entry from the hash, and
- * the second is the entry from check_if_banned().
- */
-static bool ban_entry_cmp(const void *_c1, void *_c2)
+static const mmap_table_type_st ban_type = {
+	.name = "ban DB",
+	.magic = BAN_DB_MAGIC,
+	.version = BAN_DB_VERSION,
+	.entry_size = sizeof(ban_entry_st),
+	.state_offset = offsetof(ban_entry_st, state),
+	.min_slots = BAN_DB_MIN_SLOTS,
+	.entry_key = ban_entry_key,
+};
+
+static ban_entry_st *ban_db_find(struct mmap_table_st *db, const inaddr_st *ip)
 {
-	const struct ban_entry_st *c1 = _c1;
-	struct ban_entry_st *c2 = _c2;
-
-	if (c1->ip.size == c2->ip.size && memcmp(c1->ip.ip, c2->ip.ip, c1->ip.size) == 0)
-		return 1;
-	return 0;
+	return mmap_table_find(db, ip->ip, ip->size, NULL);
 }
 
+static ban_entry_st *ban_db_add(main_server_st *s, struct mmap_table_st *db,
+				const inaddr_st *ip, time_t now)
+{
+	ban_entry_st t;
+
+	memset(&t, 0, sizeof(t));
+	memcpy(&t.ip, ip, sizeof(t.ip));
+	t.last_reset = now;
+
+	return mmap_table_add(s, db, &t);
+}
 
 void *main_ban_db_init(main_server_st *s)
 {
-	struct htable *db = talloc(s, struct htable);
+	struct mmap_table_st *db = NULL;
+	const char *file = GETPCONFIG(s)->ban_db_file;
+
+	if (file != NULL)
+		db = mmap_table_open(s, s, &ban_type, file);
+
+	/* continue with an in-memory DB */
+	if (db == NULL)
+		db = mmap_table_open(s, s, &ban_type, NULL);
 	if (db == NULL) {
 		fprintf(stderr, "error initializing ban DB\n");
 		exit(EXIT_FAILURE);
 	}
 
-	htable_init(db, rehash, NULL);
 	s->ban_db = db;
 
 	return db;
@@ -84,33 +105,45 @@ void *main_ban_db_init(main_server_st *s)
 
 void main_ban_db_deinit(main_server_st *s)
 {
-	struct htable *db = s->ban_db;
-
-	if (db != NULL) {
-		htable_clear(db);
-		talloc_free(db);
+	if (s->ban_db != NULL) {
+		mmap_table_close(s->ban_db);
+		s->ban_db = NULL;
 	}
 }
 
+ban_entry_st *main_ban_db_next(main_server_st *s, unsigned *iter)
+{
+	if (s->ban_db == NULL)
+		return NULL;
+
+	return mmap_table_next(s->ban_db, iter);
+}
+
+ban_entry_st *main_ban_db_first(main_server_st *s, unsigned *iter)
+{
+	*iter = 0;
+	return main_ban_db_next(s, iter);
+}
+
 #define IS_BANNED(main, entry) (entry->score >= GETCONFIG(main)->max_ban_score)
 
 unsigned main_ban_db_elems(main_server_st *s)
 {
-	struct htable *db = s->ban_db;
+	struct mmap_table_st *db = s->ban_db;
 	ban_entry_st *t;
-	struct htable_iter iter;
+	unsigned iter;
 	time_t now = time(NULL);
 	unsigned banned = 0;
 
 	if (db == NULL || GETCONFIG(s)->max_ban_score == 0)
 		return 0;
 
-	t = htable_first(db, &iter);
+	t = main_ban_db_first(s, &iter);
 	while (t != NULL) {
 		if (t->expires > now && IS_BANNED(s, t)) {
 			banned++;
 		}
-		t = htable_next(db, &iter);
+		t = main_ban_db_next(s, &iter);
 	}
 	return banned;
 }
@@ -126,7 +159,7 @@ static void massage_ipv6_address(ban_entry_st *t)
 static
 int add_ip_to_ban_list(main_server_st *s, const unsigned char *ip, unsigned ip_size, unsigned score)
 {
-	struct htable *db = s->ban_db;
+	struct mmap_table_st *db = s->ban_db;
 	struct ban_entry_st *e;
 	ban_entry_st t;
 	time_t now = time(NULL);
@@ -139,26 +172,20 @@ int add_ip_to_ban_list(main_server_st *s, const unsigned char *ip, unsigned ip_s
 	if (db == NULL || GETCONFIG(s)->max_ban_score == 0 || ip == NULL || (ip_size != 4 && ip_size != 16))
 		return 0;
 
+	memset(&t, 0, sizeof(t));
 	memcpy(t.ip.ip, ip, ip_size);
 	t.ip.size = ip_size;
 
 	/* In IPv6 treat a /64 as a single address */
 	massage_ipv6_address(&t);
 
-	e = htable_get(db, rehash(&t, NULL), ban_entry_cmp, &t);
+	e = ban_db_find(db, &t.ip);
 	if (e == NULL) { /* new entry */
-		e = talloc_zero(db, ban_entry_st);
+		e = ban_db_add(s, db, &t.ip, now);
 		if (e == NULL) {
-			return 0;
-		}
-
-		memcpy(&e->ip, &t.ip, sizeof(e->ip));
-		e->last_reset = now;
-
-		if (htable_add(db, rehash(e, NULL), e) == 0) {
 			mslog(s, NULL, LOG_INFO,
 			       "could not add ban entry to hash table");
-			goto fail;
+			return 0;
 		}
 	} else {
 		if (now > e->last_reset + GETCONFIG(s)->ban_reset_time) {
@@ -201,15 +228,12 @@ int add_ip_to_ban_list(main_server_st *s, const unsigned char *ip, unsigned ip_s
 		ret = 0;
 	}
 
-	return ret;
- fail:
-	talloc_free(e);
 	return ret;
 }
 
 int add_str_ip_to_ban_list(main_server_st *s, const char *ip, unsigned score)
 {
-	struct htable *db = s->ban_db;
+	struct mmap_table_st *db = s->ban_db;
 	ban_entry_st t;
 	int ret = 0;
 
@@ -232,10 +256,44 @@ int add_str_ip_to_ban_list(main_server_st *s, const char *ip, unsigned score)
 	return add_ip_to_ban_list(s, t.ip.ip, t.ip.size, score);
 }
 
+/* Merges an entry exported from another server (or an earlier run) into
+ * the DB. The higher score and later times win. Returns -1 on error. */
+int main_ban_db_import(main_server_st *s, const uint8_t *ip, unsigned ip_size,
+		       unsigned score, time_t expires, time_t last_reset)
+{
+	struct mmap_table_st *db = s->ban_db;
+	ban_entry_st t, *e;
+
+	if (db == NULL || ip == NULL || (ip_size != 4 && ip_size != 16))
+		return -1;
+
+	memset(&t, 0, sizeof(t));
+	memcpy(t.ip.ip, ip, ip_size);
+	t.ip.size = ip_size;
+
+	massage_ipv6_address(&t);
+
+	e = ban_db_find(db, &t.ip);
+	if (e == NULL) {
+		e = ban_db_add(s, db, &t.ip, last_reset);
+		if (e == NULL)
+			return -1;
+	}
+
+	if (score > e->score)
+		e->score = score;
+	if (expires > e->expires)
+		e->expires = expires;
+	if (last_reset > e->last_reset)
+		e->last_reset = last_reset;
+
+	return 0;
+}
+
 /* returns non-zero if there is an IP removed */
 int remove_ip_from_ban_list(main_server_st *s, const uint8_t *ip, unsigned size)
 {
-	struct htable *db = s->ban_db;
+	struct mmap_table_st *db = s->ban_db;
 	struct ban_entry_st *e;
 	ban_entry_st t;
 	char txt_ip[MAX_IP_STR];
@@ -249,14 +307,15 @@ int remove_ip_from_ban_list(main_server_st *s, const uint8_t *ip, unsigned size)
 				      "unbanning IP '%s'", txt_ip);
 		}
 
+		memset(&t, 0, sizeof(t));
 		t.ip.size = size;
 		memcpy(&t.ip.ip, ip, size);
 
 		/* In IPv6 treat a /64 as a single address */
 		massage_ipv6_address(&t);
 
-		e = htable_get(db, rehash(&t, NULL), ban_entry_cmp, &t);
-		if (e != NULL) { /* new entry */
+		e = ban_db_find(db, &t.ip);
+		if (e != NULL) {
 			e->score = 0;
 			e->expires = 0;
 			return 1;
@@ -268,7 +327,7 @@ int remove_ip_from_ban_list(main_server_st *s, const uint8_t *ip, unsigned size)
 
 unsigned check_if_banned(main_server_st *s, struct sockaddr_storage *addr, socklen_t addr_size)
 {
-	struct htable *db = s->ban_db;
+	struct mmap_table_st *db = s->ban_db;
 	time_t now;
 	ban_entry_st t, *e;
 	unsigned in_size;
@@ -290,6 +349,7 @@ unsigned check_if_banned(main_server_st *s, struct sockaddr_storage *addr, sockl
 		return 0;
 	}
 
+	memset(&t, 0, sizeof(t));
 	memcpy(t.ip.ip, SA_IN_P_GENERIC(addr, addr_size), SA_IN_SIZE(addr_size));
 	t.ip.size = SA_IN_SIZE(addr_size);
 
@@ -300,7 +360,7 @@ unsigned check_if_banned(main_server_st *s, struct sockaddr_storage *addr, sockl
 	add_ip_to_ban_list(s, t.ip.ip, t.ip.size, GETCONFIG(s)->ban_points_connect);
 
 	now = time(NULL);
-	e = htable_get(db, rehash(&t, NULL), ban_entry_cmp, &t);
+	e = ban_db_find(db, &t.ip);
 	if (e != NULL) {
 		if (now > e->expires)
 			return 0;
@@ -315,23 +375,29 @@ unsigned check_if_banned(main_server_st *s, struct sockaddr_storage *addr, sockl
 
 void cleanup_banned_entries(main_server_st *s)
 {
-	struct htable *db = s->ban_db;
+	struct mmap_table_st *db = s->ban_db;
 	ban_entry_st *t;
-	struct htable_iter iter;
+	unsigned iter, slots;
 	time_t now = time(NULL);
 
 	if (db == NULL)
 		return;
 
-	t = htable_first(db, &iter);
+	t = main_ban_db_first(s, &iter);
 	while (t != NULL) {
 		if (now >= t->expires && now > t->last_reset + GETCONFIG(s)->ban_reset_time) {
-			htable_delval(db, &iter);
-			talloc_free(t);
+			mmap_table_del(db, t);
 		}
-		t = htable_next(db, &iter);
-
+		t = main_ban_db_next(s, &iter);
 	}
+
+	/* drop the deleted slots, and shrink the table if it got sparse */
+	slots = BAN_DB_MIN_SLOTS;
+	while ((size_t)db->hdr->used * 2 > slots)
+		slots *= 2;
+
+	if (db->hdr->deleted * 4 > db->hdr->slots || slots * 4 <= db->hdr->slots)
+		mmap_table_rebuild(s, db, slots);
 }
 
 int if_address_init(main_server_st *s)
@@ -22,6 +22,7 @@
 # define OC_MAIN_BAN_H
 
 # include "main.h"
+# include <mmap-table.h>
 
 typedef struct inaddr_st {
 	uint8_t ip[16];
@@ -34,8 +35,18 @@ typedef struct ban_entry_st {
 
 	time_t last_reset; /* the time its score counting started */
 	time_t expires; /* the time after the client is allowed to login */
+
+	uint32_t state; /* MMAP_SLOT_ */
 } ban_entry_st;
 
+/* The ban table lives in a shared mapping (see mmap-table.h). When
+ * 'ban-db-file' is set the mapping is backed by that file, and on restart
+ * the table is used as is, without re-inserting any entries.
+ */
+#define BAN_DB_MAGIC 0x4f434244 /* OCBD */
+#define BAN_DB_VERSION 2
+#define BAN_DB_MIN_SLOTS 256
+
 void cleanup_banned_entries(main_server_st *s);
 unsigned check_if_banned(main_server_st *s, struct sockaddr_storage *addr, socklen_t addr_size);
 int add_str_ip_to_ban_list(main_server_st *s, const char *ip, unsigned score);
@@ -44,6 +55,11 @@ unsigned main_ban_db_elems(main_server_st *s);
 void main_ban_db_deinit(main_server_st *s);
 void *main_ban_db_init(main_server_st *s);
 
+ban_entry_st *main_ban_db_first(main_server_st *s, unsigned *iter);
+ban_entry_st *main_ban_db_next(main_server_st *s, unsigned *iter);
+int main_ban_db_import(main_server_st *s, const uint8_t *ip, unsigned ip_size,
+		       unsigned score, time_t expires, time_t last_reset);
+
 int if_address_init(main_server_st *s);
 void if_address_cleanup(main_server_st * s);
 
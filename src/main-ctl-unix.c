@@ -35,6 +35,7 @@
 #include <system.h>
 #include <main-ctl.h>
 #include <main-ban.h>
+#include <sec-mod-auth.h>
 #include <ccan/container_of/container_of.h>
 
 #include <ctl.pb-c.h>
@@ -61,6 +62,8 @@ static void method_stop(method_ctx *ctx, int cfd, uint8_t * msg,
 			unsigned msg_size);
 static void method_reload(method_ctx *ctx, int cfd, uint8_t * msg,
 			  unsigned msg_size);
+static void method_upgrade(method_ctx *ctx, int cfd, uint8_t * msg,
+			   unsigned msg_size);
 static void method_user_info(method_ctx *ctx, int cfd, uint8_t * msg,
 			     unsigned msg_size);
 static void method_id_info(method_ctx *ctx, int cfd, uint8_t * msg,
@@ -69,6 +72,10 @@ static void method_list_banned(method_ctx *ctx, int cfd, uint8_t * msg,
 			   unsigned msg_size);
 static void method_list_cookies(method_ctx *ctx, int cfd, uint8_t * msg,
 			   unsigned msg_size);
+static void method_export_banned(method_ctx *ctx, int cfd, uint8_t * msg,
+			   unsigned msg_size);
+static void method_import_banned(method_ctx *ctx, int cfd, uint8_t * msg,
+			   unsigned msg_size);
 
 typedef void (*method_func) (method_ctx *ctx, int cfd, uint8_t * msg,
 			     unsigned msg_size);
@@ -90,10 +97,13 @@ static const ctl_method_st methods[] = {
 	ENTRY_INDEF(CTL_CMD_TOP, method_top),
 	ENTRY(CTL_CMD_STATUS, method_status),
 	ENTRY(CTL_CMD_RELOAD, method_reload),
+	ENTRY(CTL_CMD_UPGRADE, method_upgrade),
 	ENTRY(CTL_CMD_STOP, method_stop),
 	ENTRY(CTL_CMD_LIST, method_list_users),
 	ENTRY(CTL_CMD_LIST_BANNED, method_list_banned),
 	ENTRY(CTL_CMD_LIST_COOKIES, method_list_cookies),
+	ENTRY(CTL_CMD_EXPORT_BANNED, method_export_banned),
+	ENTRY(CTL_CMD_IMPORT_BANNED, method_import_banned),
 	ENTRY(CTL_CMD_USER_INFO, method_user_info),
 	ENTRY(CTL_CMD_ID_INFO, method_id_info),
 	ENTRY(CTL_CMD_UNBAN_IP, method_unban_ip),
@@ -176,8 +186,13 @@ static void method_status(method_ctx *ctx, int cfd, uint8_t * msg,
 {
 	StatusRep rep = STATUS_REP__INIT;
 	int ret;
-	unsigned int i;
+	unsigned int i, j;
 	uint32_t * sec_mod_pids;
+	auth_latency_st latency[MAX_AUTH_LATENCY_MODULES];
+	AuthLatencyMsg latency_msg[MAX_AUTH_LATENCY_MODULES];
+	AuthLatencyMsg *platency_msg[MAX_AUTH_LATENCY_MODULES];
+	unsigned latency_size = 0;
+	uint64_t expiry_lag_total = 0;
 
 	sec_mod_pids = talloc_array(ctx->pool, uint32_t, ctx->s->sec_mod_instance_count);
 	if (sec_mod_pids) {
@@ -205,7 +220,45 @@ static void method_status(method_ctx *ctx, int cfd, uint8_t * msg,
 		rep.stored_tls_sessions += ctx->s->sec_mod_instances[i].tlsdb_entries;
 		rep.max_auth_time = MAX(rep.max_auth_time, ctx->s->sec_mod_instances[i].max_auth_time);
 		rep.avg_auth_time = ctx->s->sec_mod_instances[i].avg_auth_time;
+		rep.key_ops += ctx->s->sec_mod_instances[i].key_ops;
+		rep.key_op_queue_max = MAX(rep.key_op_queue_max, ctx->s->sec_mod_instances[i].key_op_queue_max);
+		rep.acct_sent += ctx->s->sec_mod_instances[i].acct_sent;
+		rep.acct_dropped += ctx->s->sec_mod_instances[i].acct_dropped;
+		rep.acct_backlog += ctx->s->sec_mod_instances[i].acct_backlog;
+		rep.sup_config_hits += ctx->s->sec_mod_instances[i].sup_config_hits;
+		rep.sup_config_misses += ctx->s->sec_mod_instances[i].sup_config_misses;
+		rep.expired_entries += ctx->s->sec_mod_instances[i].expired;
+		expiry_lag_total += ctx->s->sec_mod_instances[i].expiry_lag_total;
+		rep.max_expiry_lag = MAX(rep.max_expiry_lag, ctx->s->sec_mod_instances[i].expiry_lag_max);
+		for (j = 0; j < ctx->s->sec_mod_instances[i].auth_latency_size; j++) {
+			auth_latency_st *l = &ctx->s->sec_mod_instances[i].auth_latency[j];
+
+			auth_latency_add(latency, &latency_size, l->module,
+					 l->count, l->total_usecs, l->max_usecs);
+		}
+	}
+	for (j = 0; j < latency_size; j++) {
+		auth_latency_msg__init(&latency_msg[j]);
+		latency_msg[j].module = latency[j].module;
+		latency_msg[j].count = latency[j].count;
+		latency_msg[j].total_usecs = latency[j].total_usecs;
+		latency_msg[j].max_usecs = latency[j].max_usecs;
+		platency_msg[j] = &latency_msg[j];
 	}
+	rep.auth_latency = platency_msg;
+	rep.n_auth_latency = latency_size;
+	rep.has_key_ops = 1;
+	rep.has_key_op_queue_max = 1;
+	rep.has_acct_sent = 1;
+	rep.has_acct_dropped = 1;
+	rep.has_acct_backlog = 1;
+	rep.has_sup_config_hits = 1;
+	rep.has_sup_config_misses = 1;
+	if (rep.expired_entries != 0)
+		rep.avg_expiry_lag = expiry_lag_total / rep.expired_entries;
+	rep.has_expired_entries = 1;
+	rep.has_avg_expiry_lag = 1;
+	rep.has_max_expiry_lag = 1;
 	if (ctx->s->sec_mod_instance_count != 0) {
 		rep.avg_auth_time /= ctx->s->sec_mod_instance_count;
 	}
@@ -263,6 +316,27 @@ static void method_reload(method_ctx *ctx, int cfd, uint8_t * msg,
 	}
 }
 
+/* the reply is sent before the server is re-executed */
+static void method_upgrade(method_ctx *ctx, int cfd, uint8_t * msg,
+			   unsigned msg_size)
+{
+	BoolMsg rep = BOOL_MSG__INIT;
+	int ret;
+
+	mslog(ctx->s, NULL, LOG_DEBUG, "ctl: upgrade");
+
+	ev_feed_signal_event (main_loop, SIGUSR1);
+
+	rep.status = 1;
+
+	ret = send_msg(ctx->pool, cfd, CTL_CMD_UPGRADE_REP, &rep,
+		       (pack_size_func) bool_msg__get_packed_size,
+		       (pack_func) bool_msg__pack);
+	if (ret < 0) {
+		mslog(ctx->s, NULL, LOG_ERR, "error sending ctl reply");
+	}
+}
+
 static void method_stop(method_ctx *ctx, int cfd, uint8_t * msg,
 			unsigned msg_size)
 {
@@ -502,7 +576,8 @@ static void method_top(method_ctx *ctx, int cfd, uint8_t * msg,
 
 static int append_ban_info(method_ctx *ctx,
 			   BanListRep *list,
-			   struct ban_entry_st *e)
+			   struct ban_entry_st *e,
+			   unsigned export)
 {
 	BanInfoRep *rep;
 	main_server_st *s = ctx->s;
@@ -523,7 +598,12 @@ static int append_ban_info(method_ctx *ctx,
 	rep->ip.len = e->ip.size;
 	rep->score = e->score;
 
-	if (GETCONFIG(s)->max_ban_score > 0 && e->score >= GETCONFIG(s)->max_ban_score) {
+	if (export) {
+		rep->expires = e->expires;
+		rep->has_expires = 1;
+		rep->last_reset = e->last_reset;
+		rep->has_last_reset = 1;
+	} else if (GETCONFIG(s)->max_ban_score > 0 && e->score >= GETCONFIG(s)->max_ban_score) {
 		rep->expires = e->expires;
 		rep->has_expires = 1;
 	}
@@ -531,26 +611,22 @@ static int append_ban_info(method_ctx *ctx,
 	return 0;
 }
 
-static void method_list_banned(method_ctx *ctx, int cfd, uint8_t * msg,
-			      unsigned msg_size)
+static void list_banned(method_ctx *ctx, int cfd, unsigned export)
 {
 	BanListRep rep = BAN_LIST_REP__INIT;
 	struct ban_entry_st *e = NULL;
-	struct htable *db = ctx->s->ban_db;
 	int ret;
-	struct htable_iter iter;
-
-	mslog(ctx->s, NULL, LOG_DEBUG, "ctl: list-banned-ips");
+	unsigned iter;
 
-	e = htable_first(db, &iter);
+	e = main_ban_db_first(ctx->s, &iter);
 	while (e != NULL) {
-		ret = append_ban_info(ctx, &rep, e);
+		ret = append_ban_info(ctx, &rep, e, export);
 		if (ret < 0) {
 			mslog(ctx->s, NULL, LOG_ERR,
 			      "error appending ban info to reply");
 			return;
 		}
-		e = htable_next(db, &iter);
+		e = main_ban_db_next(ctx->s, &iter);
 	}
 
 	ret = send_msg(ctx->pool, cfd, CTL_CMD_LIST_BANNED_REP, &rep,
@@ -561,6 +637,61 @@ static void method_list_banned(method_ctx *ctx, int cfd, uint8_t * msg,
 	}
 }
 
+static void method_list_banned(method_ctx *ctx, int cfd, uint8_t * msg,
+			      unsigned msg_size)
+{
+	mslog(ctx->s, NULL, LOG_DEBUG, "ctl: list-banned-ips");
+
+	list_banned(ctx, cfd, 0);
+}
+
+static void method_export_banned(method_ctx *ctx, int cfd, uint8_t * msg,
+			      unsigned msg_size)
+{
+	mslog(ctx->s, NULL, LOG_DEBUG, "ctl: export-banned-ips");
+
+	list_banned(ctx, cfd, 1);
+}
+
+static void method_import_banned(method_ctx *ctx, int cfd, uint8_t * msg,
+			      unsigned msg_size)
+{
+	BanListRep *req;
+	BanImportRep rep = BAN_IMPORT_REP__INIT;
+	unsigned i;
+	int ret;
+
+	mslog(ctx->s, NULL, LOG_DEBUG, "ctl: import-banned-ips");
+
+	req = ban_list_rep__unpack(NULL, msg_size, msg);
+	if (req == NULL) {
+		mslog(ctx->s, NULL, LOG_ERR,
+		      "error parsing import banned IPs request");
+		return;
+	}
+
+	for (i = 0; i < req->n_info; i++) {
+		BanInfoRep *e = req->info[i];
+
+		if (main_ban_db_import(ctx->s, e->ip.data, e->ip.len, e->score,
+				       e->has_expires ? e->expires : 0,
+				       e->has_last_reset ? e->last_reset : 0) == 0)
+			rep.imported++;
+	}
+
+	mslog(ctx->s, NULL, LOG_INFO, "imported %u of %u ban entries",
+	      rep.imported, (unsigned)req->n_info);
+
+	ban_list_rep__free_unpacked(req, NULL);
+
+	ret = send_msg(ctx->pool, cfd, CTL_CMD_IMPORT_BANNED_REP, &rep,
+		       (pack_size_func) ban_import_rep__get_packed_size,
+		       (pack_func) ban_import_rep__pack);
+	if (ret < 0) {
+		mslog(ctx->s, NULL, LOG_ERR, "error sending import banned IPs reply");
+	}
+}
+
 static void method_list_cookies(method_ctx *ctx, int cfd, uint8_t * msg,
 			      unsigned msg_size)
 {
@@ -850,7 +981,7 @@ static void ctl_cmd_wacher_cb(EV_P_ ev_io *w, int revents)
 	int ret;
 	size_t length;
 	uint8_t cmd;
-	uint8_t buffer[256];
+	uint8_t *buffer;
 	method_ctx ctx;
 	struct ctl_watcher_st *wst = container_of(w, struct ctl_watcher_st, ctl_cmd_io);
 	unsigned i, indef = 0;
@@ -861,8 +992,13 @@ static void ctl_cmd_wacher_cb(EV_P_ ev_io *w, int revents)
 	if (ctx.pool == NULL)
 		goto fail;
 
+	/* large enough for a chunk of imported ban entries */
+	buffer = talloc_size(ctx.pool, MAX_MSG_SIZE);
+	if (buffer == NULL)
+		goto fail;
+
 	/* read request */
-	ret = recv_msg_data(wst->fd, &cmd, buffer, sizeof(buffer), NULL);
+	ret = recv_msg_data(wst->fd, &cmd, buffer, MAX_MSG_SIZE, NULL);
 	if (ret < 0) {
 		mslog(s, NULL, LOG_ERR, "error receiving ctl data");
 		goto fail;
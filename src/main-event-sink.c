@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cloexec.h>
+#include <common.h>
+#include <main.h>
+#include <main-event-sink.h>
+
+/* events which are not written past that size are dropped */
+#define MAX_EVENT_SINK_BUFFER (4*1024*1024)
+
+/* a connect event waiting for its reply */
+struct event_wait_st {
+	struct list_node list;
+	uint64_t seq;
+	struct proc_st *proc;
+};
+
+struct event_sink_st {
+	main_server_st *s;
+	int fd;
+	ev_io read_io;
+	ev_io write_io;
+
+	time_t last_open; /* the last connection attempt */
+	uint64_t seq;
+
+	str_st out; /* the events which were not written yet */
+	size_t out_pos;
+	char in[128]; /* an incomplete reply line */
+	unsigned in_len;
+
+	struct list_head waiting;
+};
+
+static void sink_close(struct event_sink_st *es)
+{
+	main_server_st *s = es->s;
+	struct event_wait_st *w;
+	struct list_head failed;
+	struct proc_st *proc;
+
+	if (es->fd >= 0) {
+		ev_io_stop(main_loop, &es->read_io);
+		ev_io_stop(main_loop, &es->write_io);
+		close(es->fd);
+		es->fd = -1;
+	}
+
+	str_reset(&es->out);
+	es->out_pos = 0;
+	es->in_len = 0;
+
+	/* the connect events without a reply fail; the callbacks may
+	 * remove other sessions, so the list is detached first */
+	list_head_init(&failed);
+	while ((w = list_top(&es->waiting, struct event_wait_st, list)) != NULL) {
+		list_del(&w->list);
+		list_add_tail(&failed, &w->list);
+	}
+
+	while ((w = list_top(&failed, struct event_wait_st, list)) != NULL) {
+		proc = w->proc;
+		list_del(&w->list);
+		talloc_free(w);
+		user_connect_event_done(s, proc, -1);
+	}
+}
+
+static int sink_open(main_server_st *s, struct event_sink_st *es)
+{
+	const char *path = GETCONFIG(s)->event_sink;
+	struct sockaddr_un sa;
+	time_t now;
+	int fd, e;
+
+	if (es->fd >= 0)
+		return 0;
+
+	/* don't retry more than once a second while the helper is down */
+	now = time(0);
+	if (es->last_open == now)
+		return -1;
+	es->last_open = now;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		mslog(s, NULL, LOG_ERR, "the event-sink path is too long: %s", path);
+		return -1;
+	}
+	strcpy(sa.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "could not create event-sink socket: %s", strerror(e));
+		return -1;
+	}
+	set_cloexec_flag(fd, 1);
+
+	if (connect(fd, (struct sockaddr *)&sa, SUN_LEN(&sa)) == -1) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "could not connect to event-sink %s: %s", path, strerror(e));
+		close(fd);
+		return -1;
+	}
+	set_non_block(fd);
+
+	es->fd = fd;
+	ev_io_set(&es->read_io, fd, EV_READ);
+	ev_io_set(&es->write_io, fd, EV_WRITE);
+	ev_io_start(main_loop, &es->read_io);
+
+	mslog(s, NULL, LOG_INFO, "connected to event-sink %s", path);
+	return 0;
+}
+
+static void handle_reply(struct event_sink_st *es, uint64_t seq, int status)
+{
+	struct event_wait_st *w;
+	struct proc_st *proc;
+
+	/* the replies normally come in order */
+	list_for_each(&es->waiting, w, list) {
+		if (w->seq == seq) {
+			proc = w->proc;
+			list_del(&w->list);
+			talloc_free(w);
+			user_connect_event_done(es->s, proc, status);
+			return;
+		}
+	}
+}
+
+static void sink_read_cb(struct ev_loop *loop, ev_io *io, int revents)
+{
+	struct event_sink_st *es = io->data;
+	main_server_st *s = es->s;
+	char *p, *nl, *end;
+	unsigned long long seq;
+	long status;
+	ssize_t ret;
+	int e;
+
+	ret = read(es->fd, es->in + es->in_len, sizeof(es->in) - es->in_len);
+	if (ret == -1) {
+		e = errno;
+		if (e == EAGAIN || e == EINTR)
+			return;
+		mslog(s, NULL, LOG_ERR, "error reading from event-sink: %s", strerror(e));
+		sink_close(es);
+		return;
+	} else if (ret == 0) {
+		mslog(s, NULL, LOG_INFO, "event-sink closed the connection");
+		sink_close(es);
+		return;
+	}
+	es->in_len += ret;
+
+	p = es->in;
+	while ((nl = memchr(p, '\n', es->in_len - (p - es->in))) != NULL) {
+		*nl = 0;
+
+		seq = strtoull(p, &end, 10);
+		if (end == p || *end != ' ')
+			goto fail;
+		status = strtol(end + 1, &end, 10);
+		if (*end != 0)
+			goto fail;
+
+		p = nl + 1;
+		handle_reply(es, seq, status);
+	}
+
+	es->in_len -= p - es->in;
+	if (es->in_len == sizeof(es->in))
+		goto fail;
+	memmove(es->in, p, es->in_len);
+	return;
+
+ fail:
+	mslog(s, NULL, LOG_ERR, "received invalid reply from event-sink");
+	sink_close(es);
+}
+
+static void sink_write_cb(struct ev_loop *loop, ev_io *io, int revents)
+{
+	struct event_sink_st *es = io->data;
+	ssize_t ret;
+	int e;
+
+	while (es->out_pos < es->out.length) {
+		ret = send(es->fd, es->out.data + es->out_pos,
+			   es->out.length - es->out_pos, MSG_NOSIGNAL);
+		if (ret == -1) {
+			e = errno;
+			if (e == EINTR)
+				continue;
+			if (e == EAGAIN)
+				return;
+			mslog(es->s, NULL, LOG_ERR, "error writing to event-sink: %s", strerror(e));
+			sink_close(es);
+			return;
+		}
+		es->out_pos += ret;
+	}
+
+	str_reset(&es->out);
+	es->out_pos = 0;
+	ev_io_stop(main_loop, &es->write_io);
+}
+
+int event_sink_append_var(str_st *str, const char *name, const char *value)
+{
+	size_t n;
+	int ret;
+
+	ret = str_append_str(str, name);
+	if (ret >= 0)
+		ret = str_append_data(str, "=", 1);
+
+	while (ret >= 0 && *value != 0) {
+		n = strcspn(value, "\n\\");
+		ret = str_append_data(str, value, n);
+		value += n;
+		if (ret < 0 || *value == 0)
+			break;
+
+		ret = str_append_str(str, (*value == '\n')?"\\n":"\\\\");
+		value++;
+	}
+
+	if (ret >= 0)
+		ret = str_append_data(str, "\n", 1);
+
+	return ret;
+}
+
+int event_sink_send(main_server_st *s, struct proc_st *proc, str_st *vars)
+{
+	struct event_sink_st *es = s->event_sink;
+	struct event_wait_st *w = NULL;
+	size_t pos;
+	int ret;
+
+	if (es == NULL) {
+		es = talloc_zero(s, struct event_sink_st);
+		if (es == NULL)
+			return ERR_MEM;
+		es->s = s;
+		es->fd = -1;
+		str_init(&es->out, es);
+		list_head_init(&es->waiting);
+		ev_init(&es->read_io, sink_read_cb);
+		ev_init(&es->write_io, sink_write_cb);
+		es->read_io.data = es;
+		es->write_io.data = es;
+		s->event_sink = es;
+	}
+
+	if (sink_open(s, es) < 0)
+		return -1;
+
+	if (es->out.length - es->out_pos + vars->length > MAX_EVENT_SINK_BUFFER) {
+		mslog(s, proc, LOG_ERR, "event-sink is not reading; dropping event");
+		return -1;
+	}
+
+	if (proc) {
+		w = talloc(es, struct event_wait_st);
+		if (w == NULL)
+			return ERR_MEM;
+		w->proc = proc;
+		w->seq = es->seq + 1;
+	}
+
+	pos = es->out.length;
+	ret = str_append_printf(&es->out, "EVENT %"PRIu64"\n", es->seq + 1);
+	if (ret >= 0)
+		ret = str_append_data(&es->out, vars->data, vars->length);
+	if (ret >= 0)
+		ret = str_append_data(&es->out, "\n", 1);
+	if (ret < 0) {
+		es->out.length = pos;
+		talloc_free(w);
+		return ERR_MEM;
+	}
+
+	es->seq++;
+	if (w)
+		list_add_tail(&es->waiting, &w->list);
+
+	/* the events of this loop iteration are written together */
+	ev_io_start(main_loop, &es->write_io);
+
+	return 0;
+}
+
+unsigned event_sink_cancel(main_server_st *s, struct proc_st *proc)
+{
+	struct event_wait_st *w;
+
+	if (s->event_sink == NULL)
+		return 0;
+
+	list_for_each(&s->event_sink->waiting, w, list) {
+		if (w->proc == proc) {
+			list_del(&w->list);
+			talloc_free(w);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void event_sink_deinit(main_server_st *s)
+{
+	struct event_sink_st *es = s->event_sink;
+
+	if (es == NULL)
+		return;
+
+	if (es->fd >= 0) {
+		if (main_loop) {
+			ev_io_stop(main_loop, &es->read_io);
+			ev_io_stop(main_loop, &es->write_io);
+		}
+		close(es->fd);
+	}
+
+	talloc_free(es);
+	s->event_sink = NULL;
+}
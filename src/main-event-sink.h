@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_MAIN_EVENT_SINK_H
+# define OC_MAIN_EVENT_SINK_H
+
+#include <main.h>
+#include <str.h>
+
+/* Sends the session events to a long-running helper listening on the
+ * unix socket set with event-sink, rather than running a script per
+ * event. Each event is written as:
+ *
+ *   EVENT <seq>
+ *   NAME=value
+ *   ...
+ *   <empty line>
+ *
+ * with the variables of the scripts; a newline or backslash in a value
+ * is escaped as \n or \\. The helper replies to each event with a line
+ * "<seq> <status>", and a connection is accepted only if the status of
+ * its connect event is zero. Events are written as the socket allows,
+ * so that several are passed in a single write, and the socket is
+ * re-opened on the next event once the helper went away. Events are
+ * not queued while it is away; see event_sink_send().
+ */
+
+/* Appends a NAME=value line of an event to @str */
+int event_sink_append_var(str_st *str, const char *name, const char *value);
+
+/* Queues the event in @vars. When @proc is set the result is passed to
+ * user_connect_event_done() once the helper acknowledged the event, or
+ * the connection to it was lost. Returns zero or a negative error code
+ * if the event could not be sent: the helper cannot be connected to, a
+ * connection was attempted less than a second ago, or too many events
+ * are not written yet. */
+int event_sink_send(main_server_st *s, struct proc_st *proc, str_st *vars);
+
+/* Stops waiting for the acknowledgement of the connect event of @proc.
+ * Returns non-zero if there was such an event, i.e., the helper may
+ * have accepted the connection. */
+unsigned event_sink_cancel(main_server_st *s, struct proc_st *proc);
+
+void event_sink_deinit(main_server_st *s);
+
+#endif
@@ -47,6 +47,7 @@
 #include <proc-search.h>
 #include <ipc.pb-c.h>
 #include <script-list.h>
+#include <main-event-sink.h>
 #include <inttypes.h>
 #include <ev.h>
 
@@ -58,6 +59,8 @@
 #include <tun.h>
 #include <main.h>
 #include <main-ban.h>
+#include <lease-journal.h>
+#include <tun-mq.h>
 #include <ccan/list/list.h>
 
 struct proc_st *new_proc(main_server_st * s, pid_t pid, int cmd_fd,
@@ -98,13 +101,18 @@ struct proc_st *new_proc(main_server_st * s, pid_t pid, int cmd_fd,
  */
 void remove_proc(main_server_st * s, struct proc_st *proc, unsigned flags)
 {
-	pid_t pid;
+	pid_t pid, worker_pid;
+	unsigned event_sent;
+
+	/* the worker is not reaped yet while it is watched */
+	worker_pid = ev_is_active(&proc->ev_child) ? proc->pid : -1;
 
 	ev_io_stop(main_loop, &proc->io);
 	ev_child_stop(main_loop, &proc->ev_child);
 
 	list_del(&proc->list);
 	s->stats.active_clients--;
+	s->sec_mod_instances[proc->sec_mod_instance_index].workers--;
 
 	if ((flags&RPROC_KILL) && proc->pid != -1 && proc->pid != 0)
 		kill(proc->pid, SIGTERM);
@@ -121,7 +129,10 @@ void remove_proc(main_server_st * s, struct proc_st *proc, unsigned flags)
 		discon_reason_to_str(proc->discon_reason), proc->bytes_in, proc->bytes_out);
 
 	pid = remove_from_script_list(s, proc);
-	if (proc->status == PS_AUTH_COMPLETED || pid > 0) {
+	/* the helper will receive the disconnect event after the connect
+	 * one it did not reply to yet */
+	event_sent = event_sink_cancel(s, proc);
+	if (proc->status == PS_AUTH_COMPLETED || pid > 0 || event_sent) {
 		if (pid > 0) {
 			int wstatus;
 			/* we were called during the connect script being run.
@@ -146,10 +157,17 @@ void remove_proc(main_server_st * s, struct proc_st *proc, unsigned flags)
 
 	remove_iroutes(s, proc);
 
-	if (proc->ipv4 || proc->ipv6)
+	if (proc->ipv4 || proc->ipv6) {
+		/* the addresses are kept for the user from now on */
+		if (proc->status == PS_AUTH_COMPLETED)
+			lease_journal_put(s, proc);
 		remove_ip_leases(s, proc);
+	}
 
-	close_tun(s, proc);
+	if (proc->tun_lease.mq_slot != 0)
+		tun_mq_close(s, proc, worker_pid);
+	else
+		close_tun(s, proc);
 	proc_table_del(s, proc);
 	if (proc->config_usage_count && *proc->config_usage_count > 0) {
 		(*proc->config_usage_count)--;
@@ -40,6 +40,7 @@
 #include "str.h"
 #include "setproctitle.h"
 #include <sec-mod.h>
+#include <sec-mod-auth.h>
 #include <ip-lease.h>
 #include <route-add.h>
 #include <ipc.pb-c.h>
@@ -178,6 +179,7 @@ int handle_sec_mod_commands(sec_mod_instance_st * sec_mod_instance)
 		break;
 	case CMD_SECM_STATS:{
 			SecmStatsMsg *smsg = NULL;
+			unsigned i;
 
 			smsg = secm_stats_msg__unpack(&pa, raw_len, raw);
 			if (smsg == NULL) {
@@ -190,6 +192,25 @@ int handle_sec_mod_commands(sec_mod_instance_st * sec_mod_instance)
 			sec_mod_instance->tlsdb_entries = smsg->secmod_tlsdb_entries;
 			sec_mod_instance->max_auth_time = smsg->secmod_max_auth_time;
 			sec_mod_instance->avg_auth_time = smsg->secmod_avg_auth_time;
+			sec_mod_instance->key_ops += smsg->secmod_key_ops;
+			sec_mod_instance->key_op_queue_max = MAX(sec_mod_instance->key_op_queue_max,
+								 smsg->secmod_key_op_queue_max);
+			sec_mod_instance->acct_sent += smsg->secmod_acct_sent;
+			sec_mod_instance->acct_dropped += smsg->secmod_acct_dropped;
+			sec_mod_instance->acct_backlog = smsg->secmod_acct_backlog;
+			sec_mod_instance->sup_config_hits += smsg->secmod_sup_config_hits;
+			sec_mod_instance->sup_config_misses += smsg->secmod_sup_config_misses;
+			sec_mod_instance->expired += smsg->secmod_expired;
+			sec_mod_instance->expiry_lag_total += smsg->secmod_expiry_lag_total;
+			sec_mod_instance->expiry_lag_max = MAX(sec_mod_instance->expiry_lag_max,
+							       smsg->secmod_expiry_lag_max);
+			for (i = 0; i < smsg->n_secmod_auth_latency; i++) {
+				AuthLatencyMsg *l = smsg->secmod_auth_latency[i];
+
+				auth_latency_add(sec_mod_instance->auth_latency,
+						 &sec_mod_instance->auth_latency_size,
+						 l->module, l->count, l->total_usecs, l->max_usecs);
+			}
 			update_auth_failures(s, smsg->secmod_auth_failures);
 
 		}
@@ -463,11 +484,17 @@ int session_open(sec_mod_instance_st * sec_mod_instance, struct proc_st *proc, c
 	char str_ipv6[MAX_IP_STR];
 	char str_ip[MAX_IP_STR];
 
-	if (cookie == NULL || cookie_size != SID_SIZE)
+	if (cookie == NULL || cookie_size < SID_SIZE || cookie_size > MAX_COOKIE_SIZE)
 		return -1;
 
 	ireq.sid.data = (void*)cookie;
-	ireq.sid.len = cookie_size;
+	ireq.sid.len = SID_SIZE;
+
+	if (cookie_size > SID_SIZE) {
+		ireq.has_cookie = 1;
+		ireq.cookie.data = (void*)cookie;
+		ireq.cookie.len = cookie_size;
+	}
 
 	if (proc->ipv4 &&
 	    human_addr2((struct sockaddr *)&proc->ipv4->rip, proc->ipv4->rip_len,
@@ -568,11 +595,50 @@ static void reset_stats(main_server_st *s, time_t now)
 	unsigned int i;
 	unsigned long max_auth_time = 0;
 	unsigned long avg_auth_time = 0;
+	unsigned long key_ops = 0;
+	unsigned long key_op_queue_max = 0;
+	unsigned long acct_sent = 0;
+	unsigned long acct_dropped = 0;
+	unsigned long acct_backlog = 0;
+	unsigned long sup_config_hits = 0;
+	unsigned long sup_config_misses = 0;
+	unsigned long expired = 0;
+	unsigned long expiry_lag_total = 0;
+	unsigned long expiry_lag_max = 0;
+	auth_latency_st latency[MAX_AUTH_LATENCY_MODULES];
+	unsigned latency_size = 0, j;
+
 	for (i = 0; i < s->sec_mod_instance_count; i ++) {
 		max_auth_time = MAX(max_auth_time, s->sec_mod_instances[i].max_auth_time);
 		s->sec_mod_instances[i].max_auth_time = 0;
 		avg_auth_time += s->sec_mod_instances[i].avg_auth_time;
 		s->sec_mod_instances[i].avg_auth_time = 0;
+		key_ops += s->sec_mod_instances[i].key_ops;
+		s->sec_mod_instances[i].key_ops = 0;
+		key_op_queue_max = MAX(key_op_queue_max, s->sec_mod_instances[i].key_op_queue_max);
+		s->sec_mod_instances[i].key_op_queue_max = 0;
+		acct_sent += s->sec_mod_instances[i].acct_sent;
+		s->sec_mod_instances[i].acct_sent = 0;
+		acct_dropped += s->sec_mod_instances[i].acct_dropped;
+		s->sec_mod_instances[i].acct_dropped = 0;
+		acct_backlog += s->sec_mod_instances[i].acct_backlog;
+		sup_config_hits += s->sec_mod_instances[i].sup_config_hits;
+		s->sec_mod_instances[i].sup_config_hits = 0;
+		sup_config_misses += s->sec_mod_instances[i].sup_config_misses;
+		s->sec_mod_instances[i].sup_config_misses = 0;
+		expired += s->sec_mod_instances[i].expired;
+		s->sec_mod_instances[i].expired = 0;
+		expiry_lag_total += s->sec_mod_instances[i].expiry_lag_total;
+		s->sec_mod_instances[i].expiry_lag_total = 0;
+		expiry_lag_max = MAX(expiry_lag_max, s->sec_mod_instances[i].expiry_lag_max);
+		s->sec_mod_instances[i].expiry_lag_max = 0;
+		for (j = 0; j < s->sec_mod_instances[i].auth_latency_size; j++) {
+			auth_latency_st *l = &s->sec_mod_instances[i].auth_latency[j];
+
+			auth_latency_add(latency, &latency_size, l->module,
+					 l->count, l->total_usecs, l->max_usecs);
+		}
+		s->sec_mod_instances[i].auth_latency_size = 0;
 	}
 	if (s->sec_mod_instance_count != 0)
 		avg_auth_time /= s->sec_mod_instance_count;
@@ -589,6 +655,22 @@ static void reset_stats(main_server_st *s, time_t now)
 	mslog(s, NULL, LOG_INFO, "Authentication failures: %lu", (unsigned long)s->stats.auth_failures);
 	mslog(s, NULL, LOG_INFO, "Maximum authentication time: %lu sec", max_auth_time);
 	mslog(s, NULL, LOG_INFO, "Average authentication time: %lu sec", avg_auth_time);
+	mslog(s, NULL, LOG_INFO, "Private key operations: %lu, maximum pending: %lu", key_ops, key_op_queue_max);
+	if (acct_sent != 0 || acct_dropped != 0 || acct_backlog != 0)
+		mslog(s, NULL, LOG_INFO, "Accounting records sent: %lu, dropped: %lu, queued: %lu",
+		      acct_sent, acct_dropped, acct_backlog);
+	if (sup_config_hits != 0 || sup_config_misses != 0)
+		mslog(s, NULL, LOG_INFO, "Supplemental config cache hits: %lu, misses: %lu",
+		      sup_config_hits, sup_config_misses);
+	if (expired != 0)
+		mslog(s, NULL, LOG_INFO, "Expired sec-mod entries: %lu, average lag: %lu sec, maximum: %lu sec",
+		      expired, expiry_lag_total / expired, expiry_lag_max);
+	for (j = 0; j < latency_size; j++) {
+		mslog(s, NULL, LOG_INFO, "Password checks by '%s': %lu, average: %lu ms, maximum: %lu ms",
+		      latency[j].module, (unsigned long)latency[j].count,
+		      (unsigned long)(latency[j].total_usecs / latency[j].count / 1000),
+		      (unsigned long)(latency[j].max_usecs / 1000));
+	}
 	mslog(s, NULL, LOG_INFO, "Data in: %lu, out: %lu kbytes", (unsigned long)s->stats.kbytes_in, (unsigned long)s->stats.kbytes_out);
 	mslog(s, NULL, LOG_INFO, "End of statistics block; resetting non-total stats");
 
@@ -680,6 +762,11 @@ int session_close(sec_mod_instance_st * sec_mod_instance, struct proc_st *proc)
 	if (proc->invalidated)
 		ireq.server_disconnected = 1;
 
+	if (proc->session_moved) {
+		ireq.has_moved = 1;
+		ireq.moved = 1;
+	}
+
 	mslog(s, proc, LOG_DEBUG, "sending msg %s to sec-mod", cmd_request_to_str(CMD_SECM_SESSION_CLOSE));
 
 	ret = send_msg(proc, sec_mod_instance->sec_mod_fd_sync, CMD_SECM_SESSION_CLOSE,
@@ -807,7 +894,7 @@ void run_sec_mod(sec_mod_instance_st * sec_mod_instance, unsigned int instance_i
 		set_cloexec_flag (fd[0], 1);
 		set_cloexec_flag (sfd[0], 1);
 		clear_unneeded_mem(s->vconfig);
-		sec_mod_server(s->main_pool, s->config_pool, s->vconfig, p, fd[0], sfd[0], sizeof(s->hmac_key), s->hmac_key, instance_index);
+		sec_mod_server(s->main_pool, s->config_pool, s->vconfig, p, fd[0], sfd[0], sizeof(s->hmac_key), s->hmac_key, instance_index, s->cookie_revocations);
 		exit(EXIT_SUCCESS);
 	} else if (pid > 0) {	/* parent */
 		close(fd[0]);
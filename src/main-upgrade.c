@@ -0,0 +1,758 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <gnutls/gnutls.h>
+#include <cloexec.h>
+#include <main.h>
+#include <main-ban.h>
+#include <ip-lease.h>
+#include <proc-search.h>
+#include <lease-journal.h>
+#include <snapshot.h>
+#include <stateless-cookie.h>
+#include <main-upgrade.h>
+
+/* The sec-mod instances and the workers are children of main, and
+ * remain so after main re-executes itself, as the PID does not change.
+ * The new main process reuses their descriptors, as well as those of
+ * the listening sockets, and rebuilds the tables which refer to them.
+ *
+ * The sec-mod instances keep their state (the sessions, the cookies
+ * and the TLS session cache) and continue running the previous code
+ * until the server is restarted. The file-backed ban DB and lease
+ * journal are reopened by the new process; otherwise the bans are
+ * included in the state. The memory file of the cookie revocations,
+ * which the instances share, is passed as a descriptor.
+ */
+
+extern char **worker_argv;
+extern sigset_t sig_default_set;
+extern struct snapshot_t *config_snapshot;
+
+/* the binary which is currently installed at the path of ours */
+static int get_exe_path(char *path, size_t path_size)
+{
+#if defined(PROC_FS_SUPPORTED)
+	static const char deleted[] = " (deleted)";
+	ssize_t len;
+
+	len = readlink("/proc/self/exe", path, path_size - 1);
+	if (len == -1)
+		return -1;
+	path[len] = 0;
+
+	/* our binary was replaced */
+	if ((size_t)len > sizeof(deleted) - 1 &&
+	    strcmp(path + len - (sizeof(deleted) - 1), deleted) == 0)
+		path[len - (sizeof(deleted) - 1)] = 0;
+#else
+	if (worker_argv[0][0] != '/' ||
+	    strlcpy(path, worker_argv[0], path_size) >= path_size)
+		return -1;
+#endif
+	return 0;
+}
+
+static UpgradeLeaseMsg *pack_lease(void *pool, struct ip_lease_st *lease)
+{
+	UpgradeLeaseMsg *m;
+
+	m = talloc(pool, UpgradeLeaseMsg);
+	if (m == NULL)
+		return NULL;
+	upgrade_lease_msg__init(m);
+
+	m->rip.data = (void *)&lease->rip;
+	m->rip.len = lease->rip_len;
+	m->lip.data = (void *)&lease->lip;
+	m->lip.len = lease->lip_len;
+	m->sig.data = (void *)&lease->sig;
+	m->sig.len = lease->rip_len;
+	m->prefix = lease->prefix;
+	m->pooled = lease->db != NULL;
+
+	return m;
+}
+
+static UpgradeProcMsg *pack_proc(void *pool, struct proc_st *proc)
+{
+	UpgradeProcMsg *m;
+
+	m = talloc(pool, UpgradeProcMsg);
+	if (m == NULL)
+		return NULL;
+	upgrade_proc_msg__init(m);
+
+	m->pid = proc->pid;
+	m->fd = proc->fd;
+	m->sec_mod_instance = proc->sec_mod_instance_index;
+	m->conn_time = proc->conn_time;
+
+	m->remote_addr.data = (void *)&proc->remote_addr;
+	m->remote_addr.len = proc->remote_addr_len;
+	if (proc->dtls_remote_addr_len > 0) {
+		m->has_dtls_remote_addr = 1;
+		m->dtls_remote_addr.data = (void *)&proc->dtls_remote_addr;
+		m->dtls_remote_addr.len = proc->dtls_remote_addr_len;
+	}
+	if (proc->our_addr_len > 0) {
+		m->has_our_addr = 1;
+		m->our_addr.data = (void *)&proc->our_addr;
+		m->our_addr.len = proc->our_addr_len;
+	}
+
+	m->sid.data = proc->sid;
+	m->sid.len = sizeof(proc->sid);
+	m->active_sid = proc->active_sid != 0;
+	m->invalidated = proc->invalidated != 0;
+	m->session_moved = proc->session_moved != 0;
+	m->host_updated = proc->host_updated != 0;
+	m->pid_killed = proc->pid_killed != 0;
+	if (proc->dtls_session_id_size > 0) {
+		m->has_dtls_session_id = 1;
+		m->dtls_session_id.data = proc->dtls_session_id;
+		m->dtls_session_id.len = proc->dtls_session_id_size;
+	}
+
+	m->username = proc->username;
+	m->groupname = proc->groupname;
+	m->hostname = proc->hostname;
+	m->user_agent = proc->user_agent;
+	m->device_type = proc->device_type;
+	m->device_platform = proc->device_platform;
+	m->tls_ciphersuite = proc->tls_ciphersuite;
+	m->dtls_ciphersuite = proc->dtls_ciphersuite;
+	m->cstp_compr = proc->cstp_compr;
+	m->dtls_compr = proc->dtls_compr;
+	m->mtu = proc->mtu;
+	m->ipv4_seed.data = proc->ipv4_seed;
+	m->ipv4_seed.len = sizeof(proc->ipv4_seed);
+
+	if (proc->tun_lease.name[0] != 0)
+		m->tun_name = proc->tun_lease.name;
+
+	if (proc->ipv4) {
+		m->ipv4 = pack_lease(pool, proc->ipv4);
+		if (m->ipv4 == NULL)
+			return NULL;
+	}
+	if (proc->ipv6) {
+		m->ipv6 = pack_lease(pool, proc->ipv6);
+		if (m->ipv6 == NULL)
+			return NULL;
+	}
+	m->applied_iroutes = proc->applied_iroutes != 0;
+
+	if (proc->config) {
+		m->has_config = 1;
+		m->config.len = group_cfg_st__get_packed_size(proc->config);
+		m->config.data = talloc_size(pool, m->config.len);
+		if (m->config.data == NULL)
+			return NULL;
+		group_cfg_st__pack(proc->config, m->config.data);
+	}
+	if (proc->vhost)
+		m->vhost = proc->vhost->name;
+
+	m->bytes_in = proc->bytes_in;
+	m->bytes_out = proc->bytes_out;
+	m->discon_reason = proc->discon_reason;
+	m->udp_fd_receive_time = proc->udp_fd_receive_time;
+
+	return m;
+}
+
+static int pack_state(main_server_st *s, void *pool, UpgradeMsg *msg)
+{
+	struct listener_st *ltmp = NULL;
+	struct proc_st *ctmp = NULL;
+	ban_entry_st *e;
+	UpgradeListenerMsg *l;
+	UpgradeSecModMsg *sm;
+	UpgradeBanMsg *b;
+	unsigned i, iter;
+
+	msg->hmac_key.data = (void *)s->hmac_key;
+	msg->hmac_key.len = sizeof(s->hmac_key);
+	if (s->ticket_key.size > 0) {
+		msg->has_tls_ticket_key = 1;
+		msg->tls_ticket_key.data = s->ticket_key.data;
+		msg->tls_ticket_key.len = s->ticket_key.size;
+		msg->has_tls_ticket_key_time = 1;
+		msg->tls_ticket_key_time = s->ticket_key_time;
+	}
+	if (s->prev_ticket_key.size > 0) {
+		msg->has_tls_previous_ticket_key = 1;
+		msg->tls_previous_ticket_key.data = s->prev_ticket_key.data;
+		msg->tls_previous_ticket_key.len = s->prev_ticket_key.size;
+	}
+	if (s->cookie_revocations_fd != -1) {
+		msg->has_cookie_revocations_fd = 1;
+		msg->cookie_revocations_fd = s->cookie_revocations_fd;
+	}
+	msg->secmod_socket_name = (char *)secmod_socket_file_name(GETPCONFIG(s));
+	msg->start_time = s->stats.start_time;
+	msg->total_auth_failures = s->stats.total_auth_failures;
+	msg->total_sessions_closed = s->stats.total_sessions_closed;
+
+	msg->listeners = talloc_array(pool, UpgradeListenerMsg *, s->listen_list.total);
+	if (msg->listeners == NULL)
+		return -1;
+	list_for_each(&s->listen_list.head, ltmp, list) {
+		if (ltmp->fd == -1 || msg->n_listeners >= s->listen_list.total)
+			continue;
+
+		l = talloc(pool, UpgradeListenerMsg);
+		if (l == NULL)
+			return -1;
+		upgrade_listener_msg__init(l);
+		l->fd = ltmp->fd;
+		l->sock_type = ltmp->sock_type;
+		l->family = ltmp->family;
+		l->protocol = ltmp->protocol;
+		l->addr.data = (void *)&ltmp->addr;
+		l->addr.len = ltmp->addr_len;
+		msg->listeners[msg->n_listeners++] = l;
+	}
+
+	msg->sec_mods = talloc_array(pool, UpgradeSecModMsg *, s->sec_mod_instance_count);
+	if (msg->sec_mods == NULL)
+		return -1;
+	for (i = 0; i < s->sec_mod_instance_count; i++) {
+		sm = talloc(pool, UpgradeSecModMsg);
+		if (sm == NULL)
+			return -1;
+		upgrade_sec_mod_msg__init(sm);
+		sm->pid = s->sec_mod_instances[i].sec_mod_pid;
+		sm->fd = s->sec_mod_instances[i].sec_mod_fd;
+		sm->fd_sync = s->sec_mod_instances[i].sec_mod_fd_sync;
+		sm->socket_file = s->sec_mod_instances[i].socket_file;
+		sm->full_socket_file = s->sec_mod_instances[i].full_socket_file;
+		msg->sec_mods[msg->n_sec_mods++] = sm;
+	}
+
+	msg->procs = talloc_array(pool, UpgradeProcMsg *, s->stats.active_clients);
+	if (msg->procs == NULL && s->stats.active_clients > 0)
+		return -1;
+	list_for_each(&s->proc_list.head, ctmp, list) {
+		if (msg->n_procs >= s->stats.active_clients)
+			break;
+
+		msg->procs[msg->n_procs] = pack_proc(pool, ctmp);
+		if (msg->procs[msg->n_procs] == NULL)
+			return -1;
+		msg->n_procs++;
+	}
+
+	if (s->ban_db->fd != -1)
+		return 0;
+
+	for (e = main_ban_db_first(s, &iter); e != NULL; e = main_ban_db_next(s, &iter))
+		msg->n_bans++;
+
+	msg->bans = talloc_array(pool, UpgradeBanMsg *, msg->n_bans);
+	if (msg->bans == NULL && msg->n_bans > 0)
+		return -1;
+	i = 0;
+	for (e = main_ban_db_first(s, &iter); e != NULL && i < msg->n_bans; e = main_ban_db_next(s, &iter)) {
+		b = talloc(pool, UpgradeBanMsg);
+		if (b == NULL)
+			return -1;
+		upgrade_ban_msg__init(b);
+		b->ip.data = e->ip.ip;
+		b->ip.len = e->ip.size;
+		b->score = e->score;
+		b->expires = e->expires;
+		b->last_reset = e->last_reset;
+		msg->bans[i++] = b;
+	}
+	msg->n_bans = i;
+
+	return 0;
+}
+
+/* Sets whether the descriptors are closed on exec; the ones handed
+ * over are kept, and those of the occtl socket and of the configuration
+ * snapshot are closed. */
+static void set_upgrade_cloexec(main_server_st *s, int keep)
+{
+	struct listener_st *ltmp = NULL;
+	struct proc_st *ctmp = NULL;
+	struct htable_iter iter;
+	const char *file_name;
+	unsigned i;
+	int fd, ret;
+
+	list_for_each(&s->listen_list.head, ltmp, list) {
+		if (ltmp->fd != -1)
+			set_cloexec_flag(ltmp->fd, !keep);
+	}
+
+	for (i = 0; i < s->sec_mod_instance_count; i++) {
+		set_cloexec_flag(s->sec_mod_instances[i].sec_mod_fd, !keep);
+		set_cloexec_flag(s->sec_mod_instances[i].sec_mod_fd_sync, !keep);
+	}
+
+	list_for_each(&s->proc_list.head, ctmp, list) {
+		set_cloexec_flag(ctmp->fd, !keep);
+	}
+
+	if (s->cookie_revocations_fd != -1)
+		set_cloexec_flag(s->cookie_revocations_fd, !keep);
+
+	if (s->ctl_fd >= 0)
+		set_cloexec_flag(s->ctl_fd, keep);
+
+	/* these are inherited by the workers */
+	for (ret = snapshot_first(config_snapshot, &iter, &fd, &file_name); ret == 0;
+	     ret = snapshot_next(config_snapshot, &iter, &fd, &file_name))
+		set_cloexec_flag(fd, keep);
+}
+
+void main_upgrade(main_server_st *s)
+{
+	UpgradeMsg msg = UPGRADE_MSG__INIT;
+	struct proc_st *ctmp = NULL, *cpos;
+	char path[_POSIX_PATH_MAX];
+	char fd_str[16];
+	sigset_t old_set;
+	uint8_t *buf;
+	size_t size;
+	void *pool;
+	FILE *fp = NULL;
+	int fd = -1, e;
+
+	/* the queues must stay attached in order */
+	if (s->tun_mq != NULL) {
+		mslog(s, NULL, LOG_ERR, "cannot upgrade: the sessions of tun-multi-queue cannot be handed over");
+		return;
+	}
+
+	if (get_exe_path(path, sizeof(path)) < 0 || access(path, X_OK) != 0) {
+		mslog(s, NULL, LOG_ERR, "cannot upgrade: the server binary could not be found");
+		return;
+	}
+
+	/* the sessions which are not yet established are not handed
+	 * over; their clients will reconnect */
+	list_for_each_safe(&s->proc_list.head, ctmp, cpos, list) {
+		if (ctmp->status != PS_AUTH_COMPLETED || ctmp->pid <= 0)
+			remove_proc(s, ctmp, RPROC_KILL);
+	}
+
+	pool = talloc_new(s);
+	if (pool == NULL) {
+		mslog(s, NULL, LOG_ERR, "cannot upgrade: memory error");
+		return;
+	}
+
+	if (pack_state(s, pool, &msg) < 0) {
+		mslog(s, NULL, LOG_ERR, "cannot upgrade: memory error");
+		goto fail;
+	}
+
+	size = upgrade_msg__get_packed_size(&msg);
+	buf = talloc_size(pool, size);
+	if (buf == NULL) {
+		mslog(s, NULL, LOG_ERR, "cannot upgrade: memory error");
+		goto fail;
+	}
+	upgrade_msg__pack(&msg, buf);
+
+	/* it contains our keys; kept in memory when possible, or in an
+	 * unlinked file */
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("ocserv-upgrade", MFD_CLOEXEC);
+#endif
+	if (fd == -1) {
+		fp = tmpfile();
+		if (fp != NULL)
+			fd = fileno(fp);
+	}
+	if (fd == -1) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "cannot upgrade: cannot create the state file: %s", strerror(e));
+		safe_memset(buf, 0, size);
+		goto fail;
+	}
+
+	if (force_write(fd, buf, size) != (ssize_t)size || lseek(fd, 0, SEEK_SET) != 0) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "cannot upgrade: cannot write the state file: %s", strerror(e));
+		safe_memset(buf, 0, size);
+		goto fail_close;
+	}
+	safe_memset(buf, 0, size);
+	snprintf(fd_str, sizeof(fd_str), "%d", fd);
+
+	mslog(s, NULL, LOG_INFO, "upgrading to %s with %u sessions", path, (unsigned)msg.n_procs);
+
+	set_upgrade_cloexec(s, 1);
+	/* marked as closed orderly; reopened by the new process */
+	if (s->ban_db->fd != -1)
+		main_ban_db_deinit(s);
+	lease_journal_deinit(s);
+
+	setenv(OCSERV_ENV_UPGRADE_FD, fd_str, 1);
+	sigprocmask(SIG_SETMASK, &sig_default_set, &old_set);
+	set_cloexec_flag(fd, 0);
+
+	execv(path, worker_argv);
+
+	e = errno;
+	set_cloexec_flag(fd, 1);
+	sigprocmask(SIG_SETMASK, &old_set, NULL);
+	unsetenv(OCSERV_ENV_UPGRADE_FD);
+	mslog(s, NULL, LOG_ERR, "cannot upgrade: exec %s failed: %s", path, strerror(e));
+
+	set_upgrade_cloexec(s, 0);
+	if (s->ban_db == NULL)
+		main_ban_db_init(s);
+	if (s->lease_journal == NULL)
+		lease_journal_init(s);
+ fail_close:
+	if (fp != NULL)
+		fclose(fp);
+	else
+		close(fd);
+ fail:
+	talloc_free(pool);
+}
+
+UpgradeMsg *main_upgrade_load(void *pool)
+{
+	const char *str = getenv(OCSERV_ENV_UPGRADE_FD);
+	UpgradeMsg *msg;
+	struct stat st;
+	uint8_t *buf;
+	int fd;
+	PROTOBUF_ALLOCATOR(pa, pool);
+
+	if (str == NULL)
+		return NULL;
+
+	fd = atoi(str);
+	unsetenv(OCSERV_ENV_UPGRADE_FD);
+
+	if (fd < 0 || fstat(fd, &st) == -1 || st.st_size <= 0) {
+		fprintf(stderr, "cannot read the upgrade state\n");
+		exit(EXIT_FAILURE);
+	}
+
+	buf = talloc_size(pool, st.st_size);
+	if (buf == NULL) {
+		fprintf(stderr, "memory error\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (force_read(fd, buf, st.st_size) != st.st_size) {
+		fprintf(stderr, "cannot read the upgrade state\n");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	msg = upgrade_msg__unpack(&pa, st.st_size, buf);
+	safe_memset(buf, 0, st.st_size);
+	talloc_free(buf);
+
+	if (msg == NULL || msg->n_sec_mods == 0 ||
+	    msg->hmac_key.len != HMAC_DIGEST_SIZE) {
+		fprintf(stderr, "invalid upgrade state\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* before the configuration is loaded, as the keys use it */
+	restore_secmod_socket_file_name(msg->secmod_socket_name);
+
+	return msg;
+}
+
+int main_upgrade_restore_listeners(main_server_st *s, UpgradeMsg *msg)
+{
+	struct perm_cfg_st *config = GETPCONFIG(s);
+	struct sockaddr_storage addr;
+	UpgradeListenerMsg *l;
+	unsigned i, port;
+
+	list_head_init(&s->listen_list.head);
+	s->listen_list.total = 0;
+
+	for (i = 0; i < msg->n_listeners; i++) {
+		l = msg->listeners[i];
+		if (l->addr.len > sizeof(addr))
+			continue;
+
+		memset(&addr, 0, sizeof(addr));
+		memcpy(&addr, l->addr.data, l->addr.len);
+		set_cloexec_flag(l->fd, 1);
+		add_listener(s, &s->listen_list, l->fd, l->family, l->sock_type,
+			     l->protocol, (struct sockaddr *)&addr, l->addr.len);
+
+		/* as with the sockets of systemd */
+		if (l->family == AF_INET)
+			port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+		else if (l->family == AF_INET6)
+			port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+		else
+			continue;
+
+		if (l->sock_type == SOCK_TYPE_TCP && config->port == 0)
+			config->port = port;
+		else if (l->sock_type == SOCK_TYPE_UDP && config->udp_port == 0)
+			config->udp_port = port;
+	}
+
+	if (s->listen_list.total == 0)
+		return -1;
+
+	return 0;
+}
+
+void main_upgrade_restore_sec_mod(main_server_st *s, UpgradeMsg *msg)
+{
+	sec_mod_instance_st *sm;
+	unsigned i;
+
+	for (i = 0; i < msg->n_sec_mods && i < s->sec_mod_instance_count; i++) {
+		sm = &s->sec_mod_instances[i];
+
+		sm->server = s;
+		sm->sec_mod_pid = msg->sec_mods[i]->pid;
+		sm->sec_mod_fd = msg->sec_mods[i]->fd;
+		sm->sec_mod_fd_sync = msg->sec_mods[i]->fd_sync;
+		strlcpy(sm->socket_file, msg->sec_mods[i]->socket_file, sizeof(sm->socket_file));
+		strlcpy(sm->full_socket_file, msg->sec_mods[i]->full_socket_file, sizeof(sm->full_socket_file));
+		set_cloexec_flag(sm->sec_mod_fd, 1);
+		set_cloexec_flag(sm->sec_mod_fd_sync, 1);
+	}
+
+	/* the set the running instances share */
+	if (msg->has_cookie_revocations_fd) {
+		s->cookie_revocations = cookie_revocations_open(msg->cookie_revocations_fd);
+		if (s->cookie_revocations != NULL) {
+			s->cookie_revocations_fd = msg->cookie_revocations_fd;
+			set_cloexec_flag(s->cookie_revocations_fd, 1);
+		} else {
+			mslog(s, NULL, LOG_ERR, "could not map the cookie revocations");
+			close(msg->cookie_revocations_fd);
+		}
+	}
+
+	s->stats.start_time = msg->start_time;
+	s->stats.total_auth_failures = msg->total_auth_failures;
+	s->stats.total_sessions_closed = msg->total_sessions_closed;
+
+	if (msg->has_tls_ticket_key && msg->tls_ticket_key.len > 0) {
+		s->ticket_key.data = gnutls_malloc(msg->tls_ticket_key.len);
+		if (s->ticket_key.data != NULL) {
+			memcpy(s->ticket_key.data, msg->tls_ticket_key.data, msg->tls_ticket_key.len);
+			s->ticket_key.size = msg->tls_ticket_key.len;
+			s->ticket_key_time = msg->tls_ticket_key_time;
+		}
+		safe_memset(msg->tls_ticket_key.data, 0, msg->tls_ticket_key.len);
+	}
+
+	if (msg->has_tls_previous_ticket_key && msg->tls_previous_ticket_key.len > 0) {
+		s->prev_ticket_key.data = gnutls_malloc(msg->tls_previous_ticket_key.len);
+		if (s->prev_ticket_key.data != NULL) {
+			memcpy(s->prev_ticket_key.data, msg->tls_previous_ticket_key.data,
+			       msg->tls_previous_ticket_key.len);
+			s->prev_ticket_key.size = msg->tls_previous_ticket_key.len;
+		}
+		safe_memset(msg->tls_previous_ticket_key.data, 0, msg->tls_previous_ticket_key.len);
+	}
+}
+
+void main_upgrade_restore_bans(main_server_st *s, UpgradeMsg *msg)
+{
+	unsigned i, imported = 0;
+
+	for (i = 0; i < msg->n_bans; i++) {
+		if (main_ban_db_import(s, msg->bans[i]->ip.data, msg->bans[i]->ip.len,
+				       msg->bans[i]->score, msg->bans[i]->expires,
+				       msg->bans[i]->last_reset) == 0)
+			imported++;
+	}
+
+	if (msg->n_bans > 0)
+		mslog(s, NULL, LOG_INFO, "restored %u of %u ban entries", imported, (unsigned)msg->n_bans);
+}
+
+static struct ip_lease_st *restore_lease(main_server_st *s, struct proc_st *proc,
+					 UpgradeLeaseMsg *m)
+{
+	struct ip_lease_st *lease;
+
+	if (m->rip.len > sizeof(lease->rip) || m->lip.len > sizeof(lease->lip) ||
+	    m->sig.len > sizeof(lease->sig))
+		return NULL;
+
+	lease = talloc_zero(proc, struct ip_lease_st);
+	if (lease == NULL)
+		return NULL;
+
+	memcpy(&lease->rip, m->rip.data, m->rip.len);
+	lease->rip_len = m->rip.len;
+	memcpy(&lease->lip, m->lip.data, m->lip.len);
+	lease->lip_len = m->lip.len;
+	memcpy(&lease->sig, m->sig.data, m->sig.len);
+	lease->prefix = m->prefix;
+
+	if (m->pooled) {
+		lease->db = &s->ip_leases;
+		if (add_ip_lease(s, lease) < 0) {
+			talloc_free(lease);
+			return NULL;
+		}
+	}
+
+	return lease;
+}
+
+static GroupCfgSt *unpack_config(struct proc_st *proc, ProtobufCBinaryData *config)
+{
+	PROTOBUF_ALLOCATOR(pa, proc);
+
+	return group_cfg_st__unpack(&pa, config->len, config->data);
+}
+
+static int restore_proc(main_server_st *s, UpgradeProcMsg *m)
+{
+	struct proc_st *proc;
+	struct sockaddr_storage addr;
+
+	if (m->sec_mod_instance >= s->sec_mod_instance_count ||
+	    m->sid.len != SID_SIZE || m->ipv4_seed.len != sizeof(proc->ipv4_seed) ||
+	    m->remote_addr.len > sizeof(proc->remote_addr) ||
+	    (m->has_dtls_remote_addr && m->dtls_remote_addr.len > sizeof(addr)) ||
+	    (m->has_our_addr && m->our_addr.len > sizeof(proc->our_addr)) ||
+	    (m->has_dtls_session_id && m->dtls_session_id.len > sizeof(proc->dtls_session_id)))
+		return -1;
+
+	proc = talloc_zero(s, struct proc_st);
+	if (proc == NULL)
+		return -1;
+
+	proc->pid = m->pid;
+	proc->fd = m->fd;
+	set_cloexec_flag(proc->fd, 1);
+	proc->tun_lease.fd = -1;
+	proc->sec_mod_instance_index = m->sec_mod_instance;
+	proc->conn_time = m->conn_time;
+	proc->status = PS_AUTH_COMPLETED;
+
+	memcpy(&proc->remote_addr, m->remote_addr.data, m->remote_addr.len);
+	proc->remote_addr_len = m->remote_addr.len;
+	if (m->has_our_addr) {
+		memcpy(&proc->our_addr, m->our_addr.data, m->our_addr.len);
+		proc->our_addr_len = m->our_addr.len;
+	}
+
+	memcpy(proc->sid, m->sid.data, sizeof(proc->sid));
+	proc->active_sid = m->active_sid;
+	proc->invalidated = m->invalidated;
+	proc->session_moved = m->session_moved;
+	proc->host_updated = m->host_updated;
+	proc->pid_killed = m->pid_killed;
+	if (m->has_dtls_session_id) {
+		memcpy(proc->dtls_session_id, m->dtls_session_id.data, m->dtls_session_id.len);
+		proc->dtls_session_id_size = m->dtls_session_id.len;
+	}
+
+	strlcpy(proc->username, m->username, sizeof(proc->username));
+	strlcpy(proc->groupname, m->groupname, sizeof(proc->groupname));
+	strlcpy(proc->hostname, m->hostname, sizeof(proc->hostname));
+	strlcpy(proc->user_agent, m->user_agent, sizeof(proc->user_agent));
+	strlcpy(proc->device_type, m->device_type, sizeof(proc->device_type));
+	strlcpy(proc->device_platform, m->device_platform, sizeof(proc->device_platform));
+	strlcpy(proc->tls_ciphersuite, m->tls_ciphersuite, sizeof(proc->tls_ciphersuite));
+	strlcpy(proc->dtls_ciphersuite, m->dtls_ciphersuite, sizeof(proc->dtls_ciphersuite));
+	strlcpy(proc->cstp_compr, m->cstp_compr, sizeof(proc->cstp_compr));
+	strlcpy(proc->dtls_compr, m->dtls_compr, sizeof(proc->dtls_compr));
+	proc->mtu = m->mtu;
+	memcpy(proc->ipv4_seed, m->ipv4_seed.data, sizeof(proc->ipv4_seed));
+	if (m->tun_name)
+		strlcpy(proc->tun_lease.name, m->tun_name, sizeof(proc->tun_lease.name));
+	proc->applied_iroutes = m->applied_iroutes;
+
+	/* the configuration is no longer shared with the vhost's */
+	if (m->has_config) {
+		proc->config = unpack_config(proc, &m->config);
+		if (proc->config == NULL) {
+			talloc_free(proc);
+			return -1;
+		}
+	}
+	proc->vhost = find_vhost(s->vconfig, m->vhost);
+
+	proc->bytes_in = m->bytes_in;
+	proc->bytes_out = m->bytes_out;
+	proc->discon_reason = m->discon_reason;
+	proc->udp_fd_receive_time = m->udp_fd_receive_time;
+
+	if ((m->ipv4 && (proc->ipv4 = restore_lease(s, proc, m->ipv4)) == NULL) ||
+	    (m->ipv6 && (proc->ipv6 = restore_lease(s, proc, m->ipv6)) == NULL)) {
+		talloc_free(proc);
+		return -1;
+	}
+
+	list_add(&s->proc_list.head, &proc->list);
+	s->stats.active_clients++;
+	s->sec_mod_instances[proc->sec_mod_instance_index].workers++;
+
+	if (proc->active_sid && proc_table_add(s, proc) < 0) {
+		mslog(s, proc, LOG_ERR, "failed to add proc hashes");
+		remove_proc(s, proc, RPROC_KILL);
+		return 0;
+	}
+
+	if (m->has_dtls_remote_addr) {
+		memcpy(&addr, m->dtls_remote_addr.data, m->dtls_remote_addr.len);
+		proc_table_update_dtls_ip(s, proc, &addr, m->dtls_remote_addr.len);
+	}
+
+	return 0;
+}
+
+void main_upgrade_restore_procs(main_server_st *s, UpgradeMsg *msg)
+{
+	unsigned i;
+
+	for (i = 0; i < msg->n_procs; i++) {
+		if (restore_proc(s, msg->procs[i]) < 0) {
+			mslog(s, NULL, LOG_ERR, "could not restore the session of worker %u",
+			      (unsigned)msg->procs[i]->pid);
+			kill(msg->procs[i]->pid, SIGTERM);
+			close(msg->procs[i]->fd);
+		}
+	}
+
+	mslog(s, NULL, LOG_INFO, "upgraded; took over %u sessions", s->stats.active_clients);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_MAIN_UPGRADE_H
+# define OC_MAIN_UPGRADE_H
+
+# include <main.h>
+# include <ipc.pb-c.h>
+
+/* On an upgrade main re-executes the server binary, which takes over
+ * the listening sockets, the sec-mod instances and the sessions of the
+ * running workers. The state is passed in a memory file (or an unlinked
+ * file where memfd_create() is not available), whose descriptor is set
+ * in this variable.
+ */
+#define OCSERV_ENV_UPGRADE_FD "OCSERV_UPGRADE_FD"
+
+/* Re-executes the server binary with the state of main. It returns
+ * only on failure, and the server continues as before. */
+void main_upgrade(main_server_st *s);
+
+/* Returns the state handed over by the previous main process, or
+ * NULL if the server was not started by main_upgrade(). */
+UpgradeMsg *main_upgrade_load(void *pool);
+
+int main_upgrade_restore_listeners(main_server_st *s, UpgradeMsg *msg);
+void main_upgrade_restore_sec_mod(main_server_st *s, UpgradeMsg *msg);
+void main_upgrade_restore_bans(main_server_st *s, UpgradeMsg *msg);
+
+/* Re-adopts the workers; their command watchers are left to the caller */
+void main_upgrade_restore_procs(main_server_st *s, UpgradeMsg *msg);
+
+#endif
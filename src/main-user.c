@@ -45,6 +45,8 @@
 #include <main-ctl.h>
 #include <ip-lease.h>
 #include <script-list.h>
+#include <main-event-sink.h>
+#include <nft-fw.h>
 #include <ccan/list/list.h>
 
 #define OCSERV_FW_SCRIPT "/usr/bin/ocserv-fw"
@@ -54,7 +56,7 @@
 		ret = str_append_str(str, val); \
 		if (ret < 0) { \
 			mslog(s, proc, LOG_ERR, "could not append value to environment\n"); \
-			exit(EXIT_FAILURE); \
+			goto fail; \
 		} \
 	} while (0)
 
@@ -66,7 +68,18 @@ typedef enum script_type_t {
 
 static const char * const type_name[] = {"up", "host-update", "down"};
 
-static void export_fw_info(main_server_st *s, struct proc_st* proc)
+typedef int (*set_var_func)(void *priv, const char *name, const char *value);
+
+#define FW_NEEDED(proc) \
+	((proc)->config->restrict_user_to_routes || (proc)->config->n_fw_ports > 0)
+
+/* the firewall rules of the user are set by OCSERV_FW_SCRIPT, unless
+ * firewall-nftables is set */
+#define FW_SCRIPT_NEEDED(s, proc) \
+	(!GETCONFIG(s)->firewall_nftables && FW_NEEDED(proc))
+
+static int export_fw_info(main_server_st *s, struct proc_st* proc,
+			  set_var_func set, void *priv)
 {
 	str_st str4;
 	str_st str6;
@@ -95,19 +108,19 @@ static void export_fw_info(main_server_st *s, struct proc_st* proc)
 		}
 	}
 
-	if (str4.length > 0 && setenv("OCSERV_ROUTES4", (char*)str4.data, 1) == -1) {
+	if (str4.length > 0 && set(priv, "OCSERV_ROUTES4", (char*)str4.data) < 0) {
 		mslog(s, proc, LOG_ERR, "could not export routes\n");
-		exit(EXIT_FAILURE);
+		goto fail;
 	}
 
-	if (str6.length > 0 && setenv("OCSERV_ROUTES6", (char*)str6.data, 1) == -1) {
+	if (str6.length > 0 && set(priv, "OCSERV_ROUTES6", (char*)str6.data) < 0) {
 		mslog(s, proc, LOG_ERR, "could not export routes\n");
-		exit(EXIT_FAILURE);
+		goto fail;
 	}
 
-	if (str_common.length > 0 && setenv("OCSERV_ROUTES", (char*)str_common.data, 1) == -1) {
+	if (str_common.length > 0 && set(priv, "OCSERV_ROUTES", (char*)str_common.data) < 0) {
 		mslog(s, proc, LOG_ERR, "could not export routes\n");
-		exit(EXIT_FAILURE);
+		goto fail;
 	}
 
 	/* export the No-routes */
@@ -130,25 +143,25 @@ static void export_fw_info(main_server_st *s, struct proc_st* proc)
 		}
 	}
 
-	if (str4.length > 0 && setenv("OCSERV_NO_ROUTES4", (char*)str4.data, 1) == -1) {
+	if (str4.length > 0 && set(priv, "OCSERV_NO_ROUTES4", (char*)str4.data) < 0) {
 		mslog(s, proc, LOG_ERR, "could not export no-routes\n");
-		exit(EXIT_FAILURE);
+		goto fail;
 	}
 
-	if (str6.length > 0 && setenv("OCSERV_NO_ROUTES6", (char*)str6.data, 1) == -1) {
+	if (str6.length > 0 && set(priv, "OCSERV_NO_ROUTES6", (char*)str6.data) < 0) {
 		mslog(s, proc, LOG_ERR, "could not export no-routes\n");
-		exit(EXIT_FAILURE);
+		goto fail;
 	}
 
-	if (str_common.length > 0 && setenv("OCSERV_NO_ROUTES", (char*)str_common.data, 1) == -1) {
+	if (str_common.length > 0 && set(priv, "OCSERV_NO_ROUTES", (char*)str_common.data) < 0) {
 		mslog(s, proc, LOG_ERR, "could not export no-routes\n");
-		exit(EXIT_FAILURE);
+		goto fail;
 	}
 
 	if (proc->config->restrict_user_to_routes) {
-		if (setenv("OCSERV_RESTRICT_TO_ROUTES", "1", 1) == -1) {
+		if (set(priv, "OCSERV_RESTRICT_TO_ROUTES", "1") < 0) {
 			mslog(s, proc, LOG_ERR, "could not export OCSERV_RESTRICT_TO_ROUTES\n");
-			exit(EXIT_FAILURE);
+			goto fail;
 		}
 	}
 	/* export the DNS servers */
@@ -172,19 +185,19 @@ static void export_fw_info(main_server_st *s, struct proc_st* proc)
 		}
 	}
 
-	if (str4.length > 0 && setenv("OCSERV_DNS4", (char*)str4.data, 1) == -1) {
+	if (str4.length > 0 && set(priv, "OCSERV_DNS4", (char*)str4.data) < 0) {
 		mslog(s, proc, LOG_ERR, "could not export DNS servers\n");
-		exit(EXIT_FAILURE);
+		goto fail;
 	}
 
-	if (str6.length > 0 && setenv("OCSERV_DNS6", (char*)str6.data, 1) == -1) {
+	if (str6.length > 0 && set(priv, "OCSERV_DNS6", (char*)str6.data) < 0) {
 		mslog(s, proc, LOG_ERR, "could not export DNS servers\n");
-		exit(EXIT_FAILURE);
+		goto fail;
 	}
 
-	if (str_common.length > 0 && setenv("OCSERV_DNS", (char*)str_common.data, 1) == -1) {
+	if (str_common.length > 0 && set(priv, "OCSERV_DNS", (char*)str_common.data) < 0) {
 		mslog(s, proc, LOG_ERR, "could not export DNS servers\n");
-		exit(EXIT_FAILURE);
+		goto fail;
 	}
 
 	str_clear(&str4);
@@ -225,149 +238,167 @@ static void export_fw_info(main_server_st *s, struct proc_st* proc)
 
 			if (ret < 0) {
 				mslog(s, proc, LOG_ERR, "could not append value to environment\n");
-				exit(EXIT_FAILURE);
+				goto fail;
 			}
 		}
 	}
 
 	if (str_common.length > 0) {
 		if (negate) {
-			if (setenv("OCSERV_DENY_PORTS", (char*)str_common.data, 1) == -1) {
+			if (set(priv, "OCSERV_DENY_PORTS", (char*)str_common.data) < 0) {
 				mslog(s, proc, LOG_ERR, "could not export DENY_PORTS\n");
-				exit(EXIT_FAILURE);
+				goto fail;
 			}
 		} else {
-			if (setenv("OCSERV_ALLOW_PORTS", (char*)str_common.data, 1) == -1) {
+			if (set(priv, "OCSERV_ALLOW_PORTS", (char*)str_common.data) < 0) {
 				mslog(s, proc, LOG_ERR, "could not export ALLOW_PORTS\n");
-				exit(EXIT_FAILURE);
+				goto fail;
 			}
 		}
 	}
 
 	str_clear(&str_common);
+	return 0;
+
+ fail:
+	str_clear(&str4);
+	str_clear(&str6);
+	str_clear(&str_common);
+	return -1;
 }
 
-static
-int call_script(main_server_st *s, struct proc_st* proc, script_type_t type)
+#define SET_VAR(name, val) \
+	do { \
+		if (set(priv, name, val) < 0) { \
+			mslog(s, proc, LOG_ERR, "could not export %s", name); \
+			return -1; \
+		} \
+	} while (0)
+
+/* Exports the information of the session passed to the scripts, as
+ * environment variables or in the events of the event sink */
+static int export_session_info(main_server_st *s, struct proc_st* proc, script_type_t type,
+			       set_var_func set, void *priv)
 {
-pid_t pid;
-int ret;
-const char* script, *next_script = NULL;
+	char real[64] = "";
+	char local[64] = "";
+	char remote[64] = "";
+	int ret;
 
-	if (type == SCRIPT_CONNECT)
-		script = GETCONFIG(s)->connect_script;
-	else if (type == SCRIPT_HOST_UPDATE)
-		script = GETCONFIG(s)->host_update_script;
-	else
-		script = GETCONFIG(s)->disconnect_script;
+	snprintf(real, sizeof(real), "%u", (unsigned)proc->pid);
+	SET_VAR("ID", real);
 
-	if (type != SCRIPT_HOST_UPDATE) {
-		if (proc->config->restrict_user_to_routes || proc->config->n_fw_ports > 0) {
-			next_script = script;
-			script = OCSERV_FW_SCRIPT;
+	if (proc->remote_addr_len > 0) {
+		if ((ret=getnameinfo((void*)&proc->remote_addr, proc->remote_addr_len, real, sizeof(real), NULL, 0, NI_NUMERICHOST)) != 0) {
+			mslog(s, proc, LOG_DEBUG, "cannot determine peer address: %s; script failed", gai_strerror(ret));
+			return -1;
 		}
+		SET_VAR("IP_REAL", real);
 	}
 
-	if (script == NULL)
-		return 0;
-
-	pid = fork();
-	if (pid == 0) {
-		char real[64] = "";
-		char local[64] = "";
-		char remote[64] = "";
-
-		sigprocmask(SIG_SETMASK, &sig_default_set, NULL);
-
-		snprintf(real, sizeof(real), "%u", (unsigned)proc->pid);
-		setenv("ID", real, 1);
+	if (proc->our_addr_len > 0) {
+		if ((ret=getnameinfo((void*)&proc->our_addr, proc->our_addr_len, real, sizeof(real), NULL, 0, NI_NUMERICHOST)) != 0) {
+			mslog(s, proc, LOG_DEBUG, "cannot determine our address: %s", gai_strerror(ret));
+		} else {
+			SET_VAR("IP_REAL_LOCAL", real);
+		}
+	}
 
-		if (proc->remote_addr_len > 0) {
-			if ((ret=getnameinfo((void*)&proc->remote_addr, proc->remote_addr_len, real, sizeof(real), NULL, 0, NI_NUMERICHOST)) != 0) {
-				mslog(s, proc, LOG_DEBUG, "cannot determine peer address: %s; script failed", gai_strerror(ret));
-				exit(EXIT_FAILURE);
+	if (proc->ipv4 != NULL || proc->ipv6 != NULL) {
+		if (proc->ipv4 && proc->ipv4->lip_len > 0) {
+			if (getnameinfo((void*)&proc->ipv4->lip, proc->ipv4->lip_len, local, sizeof(local), NULL, 0, NI_NUMERICHOST) != 0) {
+				mslog(s, proc, LOG_DEBUG, "cannot determine local VPN address; script failed");
+				return -1;
 			}
-			setenv("IP_REAL", real, 1);
+			SET_VAR("IP_LOCAL", local);
 		}
 
-		if (proc->our_addr_len > 0) {
-			if ((ret=getnameinfo((void*)&proc->our_addr, proc->our_addr_len, real, sizeof(real), NULL, 0, NI_NUMERICHOST)) != 0) {
-				mslog(s, proc, LOG_DEBUG, "cannot determine our address: %s", gai_strerror(ret));
-			} else {
-				setenv("IP_REAL_LOCAL", real, 1);
+		if (proc->ipv6 && proc->ipv6->lip_len > 0) {
+			if (getnameinfo((void*)&proc->ipv6->lip, proc->ipv6->lip_len, local, sizeof(local), NULL, 0, NI_NUMERICHOST) != 0) {
+				mslog(s, proc, LOG_DEBUG, "cannot determine local VPN PtP address; script failed");
+				return -1;
 			}
+			if (local[0] == 0)
+				SET_VAR("IP_LOCAL", local);
+			SET_VAR("IPV6_LOCAL", local);
 		}
 
-		if (proc->ipv4 != NULL || proc->ipv6 != NULL) {
-			if (proc->ipv4 && proc->ipv4->lip_len > 0) {
-				if (getnameinfo((void*)&proc->ipv4->lip, proc->ipv4->lip_len, local, sizeof(local), NULL, 0, NI_NUMERICHOST) != 0) {
-					mslog(s, proc, LOG_DEBUG, "cannot determine local VPN address; script failed");
-					exit(EXIT_FAILURE);
-				}
-				setenv("IP_LOCAL", local, 1);
+		if (proc->ipv4 && proc->ipv4->rip_len > 0) {
+			if (getnameinfo((void*)&proc->ipv4->rip, proc->ipv4->rip_len, remote, sizeof(remote), NULL, 0, NI_NUMERICHOST) != 0) {
+				mslog(s, proc, LOG_DEBUG, "cannot determine local VPN address; script failed");
+				return -1;
 			}
-
-			if (proc->ipv6 && proc->ipv6->lip_len > 0) {
-				if (getnameinfo((void*)&proc->ipv6->lip, proc->ipv6->lip_len, local, sizeof(local), NULL, 0, NI_NUMERICHOST) != 0) {
-					mslog(s, proc, LOG_DEBUG, "cannot determine local VPN PtP address; script failed");
-					exit(EXIT_FAILURE);
-				}
-				if (local[0] == 0)
-					setenv("IP_LOCAL", local, 1);
-				setenv("IPV6_LOCAL", local, 1);
+			SET_VAR("IP_REMOTE", remote);
+		}
+		if (proc->ipv6 && proc->ipv6->rip_len > 0) {
+			if (getnameinfo((void*)&proc->ipv6->rip, proc->ipv6->rip_len, remote, sizeof(remote), NULL, 0, NI_NUMERICHOST) != 0) {
+				mslog(s, proc, LOG_DEBUG, "cannot determine local VPN PtP address; script failed");
+				return -1;
 			}
+			if (remote[0] == 0)
+				SET_VAR("IP_REMOTE", remote);
+			SET_VAR("IPV6_REMOTE", remote);
 
-			if (proc->ipv4 && proc->ipv4->rip_len > 0) {
-				if (getnameinfo((void*)&proc->ipv4->rip, proc->ipv4->rip_len, remote, sizeof(remote), NULL, 0, NI_NUMERICHOST) != 0) {
-					mslog(s, proc, LOG_DEBUG, "cannot determine local VPN address; script failed");
-					exit(EXIT_FAILURE);
-				}
-				setenv("IP_REMOTE", remote, 1);
-			}
-			if (proc->ipv6 && proc->ipv6->rip_len > 0) {
-				if (getnameinfo((void*)&proc->ipv6->rip, proc->ipv6->rip_len, remote, sizeof(remote), NULL, 0, NI_NUMERICHOST) != 0) {
-					mslog(s, proc, LOG_DEBUG, "cannot determine local VPN PtP address; script failed");
-					exit(EXIT_FAILURE);
-				}
-				if (remote[0] == 0)
-					setenv("IP_REMOTE", remote, 1);
-				setenv("IPV6_REMOTE", remote, 1);
-
-				snprintf(remote, sizeof(remote), "%u", proc->ipv6->prefix);
-				setenv("IPV6_PREFIX", remote, 1);
-			}
+			snprintf(remote, sizeof(remote), "%u", proc->ipv6->prefix);
+			SET_VAR("IPV6_PREFIX", remote);
 		}
+	}
 
-		if (proc->vhost)
-			setenv("VHOST", VHOSTNAME(proc->vhost), 1);
-		setenv("USERNAME", proc->username, 1);
-		setenv("GROUPNAME", proc->groupname, 1);
-		setenv("HOSTNAME", proc->hostname, 1);
-		setenv("REMOTE_HOSTNAME", proc->hostname, 1);
-		setenv("DEVICE", proc->tun_lease.name, 1);
-		setenv("USER_AGENT", proc->user_agent, 1);
-		setenv("DEVICE_TYPE", proc->device_type, 1);
-		setenv("DEVICE_PLATFORM", proc->device_platform, 1);
-
-		if (type == SCRIPT_CONNECT) {
-			setenv("REASON", "connect", 1);
-		} else if (type == SCRIPT_HOST_UPDATE) {
-			setenv("REASON", "host-update", 1);
-		} else if (type == SCRIPT_DISCONNECT) {
-			/* use remote as temp buffer */
-			snprintf(remote, sizeof(remote), "%lu", (unsigned long)proc->bytes_in);
-			setenv("STATS_BYTES_IN", remote, 1);
-			snprintf(remote, sizeof(remote), "%lu", (unsigned long)proc->bytes_out);
-			setenv("STATS_BYTES_OUT", remote, 1);
-			if (proc->conn_time > 0) {
-				snprintf(remote, sizeof(remote), "%lu", (unsigned long)(time(NULL)-proc->conn_time));
-				setenv("STATS_DURATION", remote, 1);
-			}
-			setenv("REASON", "disconnect", 1);
+	if (proc->vhost)
+		SET_VAR("VHOST", VHOSTNAME(proc->vhost));
+	SET_VAR("USERNAME", proc->username);
+	SET_VAR("GROUPNAME", proc->groupname);
+	SET_VAR("HOSTNAME", proc->hostname);
+	SET_VAR("REMOTE_HOSTNAME", proc->hostname);
+	SET_VAR("DEVICE", proc->tun_lease.name);
+	SET_VAR("USER_AGENT", proc->user_agent);
+	SET_VAR("DEVICE_TYPE", proc->device_type);
+	SET_VAR("DEVICE_PLATFORM", proc->device_platform);
+
+	if (type == SCRIPT_CONNECT) {
+		SET_VAR("REASON", "connect");
+	} else if (type == SCRIPT_HOST_UPDATE) {
+		SET_VAR("REASON", "host-update");
+	} else if (type == SCRIPT_DISCONNECT) {
+		/* use remote as temp buffer */
+		snprintf(remote, sizeof(remote), "%lu", (unsigned long)proc->bytes_in);
+		SET_VAR("STATS_BYTES_IN", remote);
+		snprintf(remote, sizeof(remote), "%lu", (unsigned long)proc->bytes_out);
+		SET_VAR("STATS_BYTES_OUT", remote);
+		if (proc->conn_time > 0) {
+			snprintf(remote, sizeof(remote), "%lu", (unsigned long)(time(NULL)-proc->conn_time));
+			SET_VAR("STATS_DURATION", remote);
 		}
+		SET_VAR("REASON", "disconnect");
+	}
+
+	/* export DNS and route info */
+	return export_fw_info(s, proc, set, priv);
+}
+
+static int set_env(void *priv, const char *name, const char *value)
+{
+	return setenv(name, value, 1);
+}
+
+static int append_var(void *priv, const char *name, const char *value)
+{
+	return event_sink_append_var(priv, name, value);
+}
 
-		/* export DNS and route info */
-		export_fw_info(s, proc);
+static
+int run_script(main_server_st *s, struct proc_st* proc, script_type_t type,
+	       const char *script, const char *next_script)
+{
+pid_t pid;
+int ret;
+
+	pid = fork();
+	if (pid == 0) {
+		sigprocmask(SIG_SETMASK, &sig_default_set, NULL);
+
+		if (export_session_info(s, proc, type, set_env, NULL) < 0)
+			exit(EXIT_FAILURE);
 
 		/* set stdout to be stderr to avoid confusing scripts - note we have stdout closed */
 		if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
@@ -404,6 +435,131 @@ const char* script, *next_script = NULL;
 	}
 }
 
+static
+int send_event(main_server_st *s, struct proc_st* proc, script_type_t type)
+{
+str_st str;
+int ret;
+
+	str_init(&str, proc);
+	ret = export_session_info(s, proc, type, append_var, &str);
+	if (ret >= 0)
+		ret = event_sink_send(s, (type == SCRIPT_CONNECT)?proc:NULL, &str);
+	str_clear(&str);
+
+	if (ret < 0)
+		mslog(s, proc, LOG_ERR, "could not send %s event", type_name[type]);
+
+	/* the rules of the user are removed even if the event was dropped */
+	if (type == SCRIPT_DISCONNECT && FW_SCRIPT_NEEDED(s, proc))
+		return run_script(s, proc, type, OCSERV_FW_SCRIPT, NULL);
+
+	if (ret < 0)
+		return ret;
+
+	/* the connection is completed in user_connect_event_done() */
+	if (type == SCRIPT_CONNECT)
+		return ERR_WAIT_FOR_SCRIPT;
+
+	return 0;
+}
+
+/* Applies or removes the firewall rules of the user when they are set
+ * via nf_tables, before the scripts are run */
+static
+int apply_nft_fw(main_server_st *s, struct proc_st* proc, script_type_t type)
+{
+int ret, e;
+
+	if (!FW_NEEDED(proc) || type == SCRIPT_HOST_UPDATE)
+		return 0;
+
+	/* the rules match the device of the user, which is shared
+	 * with tun-multi-queue */
+	if (proc->tun_lease.mq_slot != 0) {
+		if (type == SCRIPT_CONNECT)
+			mslog(s, proc, LOG_ERR, "the restrictions of the user cannot be applied on the shared device %s",
+			      proc->tun_lease.name);
+		return -1;
+	}
+
+	if (!GETCONFIG(s)->firewall_nftables)
+		return 0;
+
+	if (type == SCRIPT_CONNECT)
+		ret = nft_fw_add(proc, proc->tun_lease.name, proc->config);
+	else
+		ret = nft_fw_remove(proc, proc->tun_lease.name);
+
+	if (ret < 0) {
+		e = errno;
+		if (ret == -1)
+			mslog(s, proc, LOG_ERR, "could not %s nftables rules: %s",
+			      (type == SCRIPT_CONNECT)?"apply":"remove", strerror(e));
+		else
+			mslog(s, proc, LOG_ERR, "could not %s nftables rules",
+			      (type == SCRIPT_CONNECT)?"apply":"remove");
+		return -1;
+	}
+
+	return 0;
+}
+
+static
+int call_script(main_server_st *s, struct proc_st* proc, script_type_t type)
+{
+const char* script, *next_script = NULL;
+
+	/* a user whose restrictions cannot be applied is not connected */
+	if (apply_nft_fw(s, proc, type) < 0 && type == SCRIPT_CONNECT)
+		return -1;
+
+	if (GETCONFIG(s)->event_sink != NULL)
+		return send_event(s, proc, type);
+
+	if (type == SCRIPT_CONNECT)
+		script = GETCONFIG(s)->connect_script;
+	else if (type == SCRIPT_HOST_UPDATE)
+		script = GETCONFIG(s)->host_update_script;
+	else
+		script = GETCONFIG(s)->disconnect_script;
+
+	if (type != SCRIPT_HOST_UPDATE) {
+		if (FW_SCRIPT_NEEDED(s, proc)) {
+			next_script = script;
+			script = OCSERV_FW_SCRIPT;
+		}
+	}
+
+	if (script == NULL)
+		return 0;
+
+	return run_script(s, proc, type, script, next_script);
+}
+
+/* Called once the event sink replied to the connect event of @proc; on
+ * success the firewall script is run next, if needed, as in call_script().
+ */
+void user_connect_event_done(main_server_st *s, struct proc_st* proc, int status)
+{
+	int ret;
+
+	mslog(s, proc, LOG_DEBUG, "connect event status: %d", status);
+
+	if (status == 0 && FW_SCRIPT_NEEDED(s, proc)) {
+		ret = run_script(s, proc, SCRIPT_CONNECT, OCSERV_FW_SCRIPT, NULL);
+		if (ret == ERR_WAIT_FOR_SCRIPT)
+			return;
+		status = 1;
+	}
+
+	ret = handle_script_exit(s, proc, status);
+	if (ret < 0) {
+		/* takes care of free */
+		remove_proc(s, proc, RPROC_KILL);
+	}
+}
+
 static void
 add_utmp_entry(main_server_st *s, struct proc_st* proc)
 {
@@ -58,6 +58,7 @@
 #include <tun.h>
 #include <main.h>
 #include <main-ban.h>
+#include <tun-mq.h>
 #include <ccan/list/list.h>
 
 int set_tun_mtu(main_server_st * s, struct proc_st *proc, unsigned mtu)
@@ -69,6 +70,9 @@ int set_tun_mtu(main_server_st * s, struct proc_st *proc, unsigned mtu)
 	if (proc->tun_lease.name[0] == 0)
 		return -1;
 
+	if (proc->tun_lease.mq_slot != 0)
+		return tun_mq_set_mtu(s, proc, mtu);
+
 	name = proc->tun_lease.name;
 
 	mslog(s, proc, LOG_DEBUG, "setting %s MTU to %u", name, mtu);
@@ -161,7 +165,14 @@ static int accept_user(main_server_st * s, struct proc_st *proc, unsigned cmd)
 		return ret;
 	}
 
-	ret = open_tun(s, proc);
+	if (s->tun_mq != NULL)
+		ret = tun_mq_open(s, proc);
+	else
+		ret = open_tun(s, proc);
+	if (ret == ERR_WAIT_FOR_PING) {
+		/* we are called again from resume_accept_user() */
+		return ret;
+	}
 	if (ret < 0) {
 		return -1;
 	}
@@ -219,9 +230,10 @@ static int handle_cookie_auth_res(main_server_st *s, struct proc_st *proc,
 	}
 
  finished:
-	if (ret == ERR_WAIT_FOR_SCRIPT) {
-		/* we will wait for script termination to send our reply.
-		 * The notification of peer will be done in handle_script_exit().
+	if (ret == ERR_WAIT_FOR_SCRIPT || ret == ERR_WAIT_FOR_PING) {
+		/* we will wait for script termination, or for the IP lease
+		 * checks, to send our reply. The notification of peer will
+		 * be done in handle_script_exit().
 		 */
 		ret = 0;
 	} else {
@@ -234,6 +246,21 @@ static int handle_cookie_auth_res(main_server_st *s, struct proc_st *proc,
 	return ret;
 }
 
+/* Called when the IP lease checks started by accept_user() complete
+ * (see ping-leases); it repeats the steps of accept_user() using the
+ * checked leases.
+ */
+void resume_accept_user(main_server_st *s, struct proc_st *proc, int result)
+{
+	int ret;
+
+	ret = handle_cookie_auth_res(s, proc, AUTH_COOKIE_REQ, result);
+	if (ret < 0) {
+		/* takes care of free */
+		remove_proc(s, proc, RPROC_KILL);
+	}
+}
+
 int handle_worker_commands(main_server_st * s, struct proc_st *proc)
 {
 	uint8_t cmd;
@@ -431,7 +458,13 @@ int handle_worker_commands(main_server_st * s, struct proc_st *proc)
 			goto cleanup;
 		}
 
-		proc->sec_mod_instance_index = auth_cookie_req->cookie.data[0] % s->sec_mod_instance_count;
+		/* a stateless cookie is resumed by the instance of the worker;
+		 * otherwise by the instance which issued it */
+		if (!GETPCONFIG(s)->stateless_cookies && auth_cookie_req->cookie.len > 0) {
+			s->sec_mod_instances[proc->sec_mod_instance_index].workers--;
+			proc->sec_mod_instance_index = auth_cookie_req->cookie.data[0] % s->sec_mod_instance_count;
+			s->sec_mod_instances[proc->sec_mod_instance_index].workers++;
+		}
 
 		ret = handle_auth_cookie_req(&s->sec_mod_instances[proc->sec_mod_instance_index], proc, auth_cookie_req);
 
@@ -62,13 +62,21 @@
 #include <tun.h>
 #include <grp.h>
 #include <ip-lease.h>
+#include <icmp-ping.h>
+#include <lease-journal.h>
 #include <ccan/list/list.h>
 #include <hmac.h>
+#include <keyed-hash.h>
 #include <base64-helper.h>
 #include <snapshot.h>
 #include <isolate.h>
 #include <sockdiag.h>
 #include <namespace.h>
+#include <stateless-cookie.h>
+#include <main-upgrade.h>
+#include <config-blob.h>
+#include <main-event-sink.h>
+#include <tun-mq.h>
 
 #ifdef HAVE_GSSAPI
 # include <libtasn1.h>
@@ -102,6 +110,7 @@ sec_mod_watcher_st * sec_mod_watchers = NULL;
 ev_timer maintenance_watcher;
 ev_timer graceful_shutdown_watcher;
 ev_signal maintenance_sig_watcher;
+ev_signal upgrade_sig_watcher;
 ev_signal term_sig_watcher;
 ev_signal int_sig_watcher;
 ev_signal reload_sig_watcher;
@@ -111,7 +120,7 @@ ev_timer latency_watcher;
 
 static bool set_env_from_ws(main_server_st * ws);
 
-static void add_listener(void *pool, struct listen_list_st *list,
+void add_listener(void *pool, struct listen_list_st *list,
 	int fd, int family, int socktype, int protocol,
 	struct sockaddr* addr, socklen_t addr_len)
 {
@@ -471,9 +480,14 @@ void clear_lists(main_server_st *s)
 	}
 
 	ip_lease_deinit(&s->ip_leases);
+	icmp_ping_deinit(s);
+	event_sink_deinit(s);
+	tun_pool_deinit(s, 0);
+	tun_mq_deinit(s);
 	proc_table_deinit(s);
 	ctl_handler_deinit(s);
 	main_ban_db_deinit(s);
+	lease_journal_deinit(s);
 	if_address_cleanup(s);
 
 	/* clear libev state */
@@ -963,6 +977,18 @@ static void term_sig_watcher_cb(struct ev_loop *loop, ev_signal *w, int revents)
 	}
 }
 
+/* The workers map the parsed configuration from that blob, rather than
+ * parsing the configuration files again. Without it they parse them. */
+static void update_config_blob(main_server_st *s)
+{
+	if (s->config_blob_fd != -1)
+		close(s->config_blob_fd);
+
+	s->config_blob_fd = config_blob_create(s->vconfig);
+	if (s->config_blob_fd == -1)
+		mslog(s, NULL, LOG_INFO, "could not serialize the configuration; the workers will parse it");
+}
+
 static void reload_sig_watcher_cb(struct ev_loop *loop, ev_signal *w, int revents)
 {
 	main_server_st *s = ev_userdata(loop);
@@ -983,6 +1009,7 @@ static void reload_sig_watcher_cb(struct ev_loop *loop, ev_signal *w, int revent
 		}
 	}
 	reload_cfg_file(s->config_pool, s->vconfig, 0);
+	update_config_blob(s);
 }
 
 static void cmd_watcher_cb (EV_P_ ev_io *w, int revents)
@@ -1013,6 +1040,27 @@ static void resume_accept_cb (EV_P_ ev_timer *w, int revents)
 	}
 }
 
+/* Each cookie is valid for its IP address and when resuming it must
+ * reach the same sec-mod process that contains the corresponding
+ * session information under the SID. With stateless cookies any
+ * instance can resume a session, and the one with the fewest workers
+ * is used. */
+static unsigned select_sec_mod_instance(main_server_st *s, struct worker_st *ws)
+{
+	unsigned i, idx = 0;
+
+	if (GETPCONFIG(s)->stateless_cookies) {
+		for (i = 1; i < s->sec_mod_instance_count; i++) {
+			if (s->sec_mod_instances[i].workers < s->sec_mod_instances[idx].workers)
+				idx = i;
+		}
+		return idx;
+	}
+
+	return hash_any(SA_IN_P_GENERIC(&ws->remote_addr, ws->remote_addr_len),
+			SA_IN_SIZE(ws->remote_addr_len), 0) % s->sec_mod_instance_count;
+}
+
 static void listen_watcher_cb (EV_P_ ev_io *w, int revents)
 {
 	main_server_st *s = ev_userdata(loop);
@@ -1023,6 +1071,7 @@ static void listen_watcher_cb (EV_P_ ev_io *w, int revents)
 	int cmd_fd[2];
 	pid_t pid;
 	int i;
+	unsigned int sec_mod_instance_index;
 	hmac_component_st hmac_components[3];
 	char worker_path[_POSIX_PATH_MAX];
 
@@ -1067,6 +1116,8 @@ static void listen_watcher_cb (EV_P_ ev_io *w, int revents)
 			}
 		}
 
+		sec_mod_instance_index = select_sec_mod_instance(s, ws);
+
 		/* Create a command socket */
 		ret = socketpair(AF_UNIX, SOCK_STREAM, 0, cmd_fd);
 		if (ret < 0) {
@@ -1077,7 +1128,6 @@ static void listen_watcher_cb (EV_P_ ev_io *w, int revents)
 
 		pid = fork();
 		if (pid == 0) {	/* child */
-			unsigned int sec_mod_instance_index;
 			/* close any open descriptors, and erase
 			 * sensitive data before running the worker
 			 */
@@ -1095,13 +1145,6 @@ static void listen_watcher_cb (EV_P_ ev_io *w, int revents)
 
 			set_self_oom_score_adj(s);
 
-			/* Each cookie is valid for its IP address and when resuming it must
-			 * reach the same sec-mod process that contains the corresponding
-			 * session information under the SID. */
-			sec_mod_instance_index = hash_any(
-				SA_IN_P_GENERIC(&ws->remote_addr, ws->remote_addr_len),
-				SA_IN_SIZE(ws->remote_addr_len), 0) % s->sec_mod_instance_count;
-
 			/* write sec-mod's address */
 			memcpy(&ws->secmod_addr, &s->sec_mod_instances[sec_mod_instance_index].secmod_addr, s->sec_mod_instances[sec_mod_instance_index].secmod_addr_len);
 			ws->secmod_addr_len = s->sec_mod_instances[sec_mod_instance_index].secmod_addr_len;
@@ -1114,6 +1157,8 @@ static void listen_watcher_cb (EV_P_ ev_io *w, int revents)
 			ws->cmd_fd = cmd_fd[1];
 			ws->tun_fd = -1;
 			set_cloexec_flag(fd, false);
+			if (s->config_blob_fd != -1)
+				set_cloexec_flag(s->config_blob_fd, false);
 			ws->conn_fd = fd;
 			ws->conn_type = stype;
 			ws->session_start_time = time(NULL);
@@ -1178,6 +1223,9 @@ fork_failed:
 				goto fork_failed;
 			}
 
+			ctmp->sec_mod_instance_index = sec_mod_instance_index;
+			s->sec_mod_instances[sec_mod_instance_index].workers++;
+
 			ev_io_init(&ctmp->io, cmd_watcher_cb, cmd_fd[0], EV_READ);
 			ev_io_start(loop, &ctmp->io);
 
@@ -1246,7 +1294,9 @@ static void perform_maintenance(main_server_st *s)
 	/* Check if we need to expire any data */
 	mslog(s, NULL, LOG_DEBUG, "performing maintenance");
 	cleanup_banned_entries(s);
+	lease_journal_cleanup(s);
 	clear_old_configs(s->vconfig);
+	tls_rotate_ticket_key(s, 0);
 
 	kill_children_auth_timeout(s);
 
@@ -1289,6 +1339,19 @@ static void maintenance_sig_watcher_cb(struct ev_loop *loop, ev_signal *w, int r
 	perform_maintenance(s);
 }
 
+static void upgrade_sig_watcher_cb(struct ev_loop *loop, ev_signal *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+
+	if (ev_is_active(&graceful_shutdown_watcher)) {
+		mslog(s, NULL, LOG_INFO, "ignoring upgrade request during shutdown");
+		return;
+	}
+
+	mslog(s, NULL, LOG_INFO, "upgrade request received");
+	main_upgrade(s);
+}
+
 
 static void syserr_cb (const char *msg)
 {
@@ -1304,9 +1367,11 @@ int main(int argc, char** argv)
 {
 	int e;
 	struct listener_st *ltmp = NULL;
+	struct proc_st *ctmp = NULL;
 	int ret, flags;
 	char *p;
-	void *worker_pool;
+	void *worker_pool, *upgrade_pool;
+	UpgradeMsg *upgrade;
 	void *main_pool, *config_pool;
 	main_server_st *s;
 	char *str;
@@ -1356,10 +1421,24 @@ int main(int argc, char** argv)
 	s->stats.start_time = s->stats.last_reset = time(NULL);
 	s->top_fd = -1;
 	s->ctl_fd = -1;
+	s->config_blob_fd = -1;
+	s->cookie_revocations_fd = -1;
 	s->netns.default_fd = -1;
 	s->netns.listen_fd = -1;
 
-	if (!hmac_init_key(sizeof(s->hmac_key), (uint8_t*)(s->hmac_key))) {
+	upgrade_pool = talloc_named(main_pool, 0, "upgrade");
+	if (upgrade_pool == NULL) {
+		fprintf(stderr, "talloc init error\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* set when started by main_upgrade() */
+	upgrade = main_upgrade_load(upgrade_pool);
+	if (upgrade != NULL) {
+		/* the sec-mod instances verify the workers with it */
+		memcpy((uint8_t*)s->hmac_key, upgrade->hmac_key.data, sizeof(s->hmac_key));
+		safe_memset(upgrade->hmac_key.data, 0, upgrade->hmac_key.len);
+	} else if (!hmac_init_key(sizeof(s->hmac_key), (uint8_t*)(s->hmac_key))) {
 		fprintf(stderr, "unable to generate hmac key\n");
 		exit(EXIT_FAILURE);
 	}
@@ -1389,7 +1468,6 @@ int main(int argc, char** argv)
 	list_head_init(&s->script_list.head);
 	ip_lease_init(&s->ip_leases);
 	proc_table_init(s);
-	main_ban_db_init(s);
 	if (if_address_init(s) == 0)
 	{
 		fprintf(stderr, "failed to initialize local addresses\n");
@@ -1403,6 +1481,12 @@ int main(int argc, char** argv)
 	/* Initialize GnuTLS */
 	tls_global_init();
 
+	/* the key of the hash tables; inherited by sec-mod */
+	if (!keyed_hash_init()) {
+		fprintf(stderr, "cannot initialize hash key\n");
+		exit(EXIT_FAILURE);
+	}
+
 	/* load configuration */
 	s->vconfig = talloc_zero(config_pool, struct list_head);
 	if (s->vconfig == NULL) {
@@ -1429,7 +1513,10 @@ int main(int argc, char** argv)
 		exit(EXIT_FAILURE);
 	}
 	/* Listen to network ports */
-	ret = listen_ports(s, GETPCONFIG(s), &s->listen_list, &s->netns);
+	if (upgrade != NULL)
+		ret = main_upgrade_restore_listeners(s, upgrade);
+	else
+		ret = listen_ports(s, GETPCONFIG(s), &s->listen_list, &s->netns);
 	if (ret < 0) {
 		fprintf(stderr, "Cannot listen to specified ports\n");
 		exit(EXIT_FAILURE);
@@ -1447,27 +1534,40 @@ int main(int argc, char** argv)
 	deny_severity = LOG_DAEMON|LOG_WARNING;
 #endif
 
-	if (GETPCONFIG(s)->foreground == 0) {
-		if (daemon(GETPCONFIG(s)->no_chdir, 0) == -1) {
-			e = errno;
-			fprintf(stderr, "daemon failed: %s\n", strerror(e));
-			exit(EXIT_FAILURE);
+	/* after an upgrade this is already done, and the standard
+	 * descriptors may be in use by the ones handed over */
+	if (upgrade == NULL) {
+		if (GETPCONFIG(s)->foreground == 0) {
+			if (daemon(GETPCONFIG(s)->no_chdir, 0) == -1) {
+				e = errno;
+				fprintf(stderr, "daemon failed: %s\n", strerror(e));
+				exit(EXIT_FAILURE);
+			}
 		}
-	}
 
-	/* create our process group */
-	setpgid(0, 0);
+		/* create our process group */
+		setpgid(0, 0);
 
-	/* we don't need them */
-	close(STDIN_FILENO);
-	close(STDOUT_FILENO);
+		/* we don't need them */
+		close(STDIN_FILENO);
+		close(STDOUT_FILENO);
+	}
 
 	write_pid_file();
 
+	/* after daemon(), as the DB is owned by the process which opens it */
+	main_ban_db_init(s);
+	lease_journal_init(s);
+	if (upgrade != NULL)
+		main_upgrade_restore_bans(s, upgrade);
+
 	// Start the configured number of ocserv-sm processes
 	s->sec_mod_instance_count = GETPCONFIG(s)->sec_mod_scale;
 
-	if (s->sec_mod_instance_count == 0)	{
+	if (upgrade != NULL) {
+		/* the running instances are kept */
+		s->sec_mod_instance_count = upgrade->n_sec_mods;
+	} else if (s->sec_mod_instance_count == 0)	{
 		if (GETCONFIG(s)->max_clients != 0) {
 			// Compute ideal number of clients per sec-mod
 			unsigned int sec_mod_count_for_users = GETCONFIG(s)->max_clients / MINIMUM_USERS_PER_SEC_MOD + 1;
@@ -1482,12 +1582,31 @@ int main(int argc, char** argv)
 	s->sec_mod_instances = talloc_zero_array(s, sec_mod_instance_st, s->sec_mod_instance_count);
 	sec_mod_watchers = talloc_zero_array(s, sec_mod_watcher_st, s->sec_mod_instance_count);
 
-	mslog(s, NULL, LOG_INFO, "Starting %d instances of ocserv-sm", s->sec_mod_instance_count);
-	for (i = 0; i < s->sec_mod_instance_count; i ++) {
-		s->sec_mod_instances[i].server = s;
-		run_sec_mod(&s->sec_mod_instances[i], i);
+	if (upgrade != NULL) {
+		main_upgrade_restore_sec_mod(s, upgrade);
+	} else {
+		/* before the instances are forked, as they share it */
+		if (GETPCONFIG(s)->stateless_cookies) {
+			s->cookie_revocations = cookie_revocations_new(GETCONFIG(s)->max_clients != 0 ?
+								       GETCONFIG(s)->max_clients : COOKIE_REVOCATIONS_UNLIMITED,
+								       &s->cookie_revocations_fd);
+			if (s->cookie_revocations == NULL) {
+				mslog(s, NULL, LOG_ERR, "cannot allocate the cookie revocation set");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		mslog(s, NULL, LOG_INFO, "Starting %d instances of ocserv-sm", s->sec_mod_instance_count);
+		for (i = 0; i < s->sec_mod_instance_count; i ++) {
+			s->sec_mod_instances[i].server = s;
+			run_sec_mod(&s->sec_mod_instances[i], i);
+		}
 	}
 
+	/* after the instances are forked, as they do not need it; the
+	 * key handed over on upgrade is kept */
+	tls_rotate_ticket_key(s, upgrade == NULL);
+
 	ret = ctl_handler_init(s);
 	if (ret < 0) {
 		mslog(s, NULL, LOG_ERR, "Cannot create command handler");
@@ -1511,7 +1630,8 @@ int main(int argc, char** argv)
 			exit(EXIT_FAILURE);
 		}
 	}
-	ms_sleep(100); /* give some time for sec-mod to initialize */
+	if (upgrade == NULL)
+		ms_sleep(100); /* give some time for sec-mod to initialize */
 
 	for (i = 0; i < s->sec_mod_instance_count; i ++) {
 		s->sec_mod_instances[i].secmod_addr.sun_family = AF_UNIX;
@@ -1591,10 +1711,34 @@ int main(int argc, char** argv)
 		ev_child_start (main_loop, &sec_mod_watchers[i].child_watcher);
 	}
 
+	/* re-adopt the workers of the previous main process */
+	if (upgrade != NULL) {
+		main_upgrade_restore_procs(s, upgrade);
+
+		list_for_each(&s->proc_list.head, ctmp, list) {
+			ev_io_init(&ctmp->io, cmd_watcher_cb, ctmp->fd, EV_READ);
+			ev_io_start(main_loop, &ctmp->io);
+
+			ev_child_init(&ctmp->ev_child, worker_child_watcher_cb, ctmp->pid, 0);
+			ev_child_start(main_loop, &ctmp->ev_child);
+		}
+
+		/* reap the children which exited in the meantime */
+		ev_feed_signal_event(main_loop, SIGCHLD);
+	}
+	talloc_free(upgrade_pool);
+	upgrade = NULL;
+
 	ev_init(&maintenance_watcher, maintenance_watcher_cb);
 	ev_timer_set(&maintenance_watcher, MAIN_MAINTENANCE_TIME, MAIN_MAINTENANCE_TIME);
 	ev_timer_start(main_loop, &maintenance_watcher);
 
+	tun_mq_init(s);
+	/* the devices are created as the loop is idle */
+	tun_pool_init(s);
+
+	update_config_blob(s);
+
 	ev_init(&graceful_shutdown_watcher, graceful_shutdown_watcher_cb);
 
 #if defined(CAPTURE_LATENCY_SUPPORT)
@@ -1608,6 +1752,11 @@ int main(int argc, char** argv)
 	ev_signal_set (&maintenance_sig_watcher, SIGUSR2);
 	ev_signal_start (main_loop, &maintenance_sig_watcher);
 
+	/* re-execute the server binary, keeping the sessions, with SIGUSR1 */
+	ev_init (&upgrade_sig_watcher, upgrade_sig_watcher_cb);
+	ev_signal_set (&upgrade_sig_watcher, SIGUSR1);
+	ev_signal_start (main_loop, &upgrade_sig_watcher);
+
 	/* Main server loop */
 	ev_run (main_loop, 0);
 
@@ -1620,7 +1769,12 @@ int main(int argc, char** argv)
 	remove(GETPCONFIG(s)->occtl_socket_file);
 	remove_pid_file();
 
+	tun_pool_deinit(s, 1);
+	tun_mq_deinit(s);
+
 	snapshot_terminate(config_snapshot);
+	if (s->config_blob_fd != -1)
+		close(s->config_blob_fd);
 
 	if (GETPCONFIG(s)->listen_netns_name && close_namespaces(&s->netns) < 0) {
 		fprintf(stderr, "cannot close listen namespaces\n");
@@ -1653,6 +1807,7 @@ static bool set_env_from_ws(main_server_st *s)
 	int ret = 0;
 	SnapshotEntryMsg **entries = NULL;
 	SnapshotEntryMsg entry_template = SNAPSHOT_ENTRY_MSG__INIT;
+	ProtobufCBinaryData *secmod_addrs = NULL;
 	size_t entry_count;
 	size_t index = 0;
 	struct htable_iter iter;
@@ -1672,6 +1827,38 @@ static bool set_env_from_ws(main_server_st *s)
 	msg.sec_auth_init_hmac.data = (uint8_t *)ws->sec_auth_init_hmac;
 	msg.sec_auth_init_hmac.len = sizeof(ws->sec_auth_init_hmac);
 
+	/* a worker continues an authentication on the instance which
+	 * started it */
+	if (GETPCONFIG(s)->stateless_cookies) {
+		secmod_addrs = talloc_zero_array(s, ProtobufCBinaryData, s->sec_mod_instance_count);
+		if (!secmod_addrs)
+			goto cleanup;
+
+		for (index = 0; index < s->sec_mod_instance_count; index++) {
+			secmod_addrs[index].data = (uint8_t *)&s->sec_mod_instances[index].secmod_addr;
+			secmod_addrs[index].len = s->sec_mod_instances[index].secmod_addr_len;
+		}
+		msg.n_secmod_addrs = s->sec_mod_instance_count;
+		msg.secmod_addrs = secmod_addrs;
+	}
+
+	if (s->config_blob_fd != -1) {
+		msg.has_config_blob_fd = 1;
+		msg.config_blob_fd = s->config_blob_fd;
+	}
+
+	if (s->ticket_key.size > 0) {
+		msg.has_tls_ticket_key = 1;
+		msg.tls_ticket_key.data = s->ticket_key.data;
+		msg.tls_ticket_key.len = s->ticket_key.size;
+	}
+
+	if (s->prev_ticket_key.size > 0) {
+		msg.has_tls_previous_ticket_key = 1;
+		msg.tls_previous_ticket_key.data = s->prev_ticket_key.data;
+		msg.tls_previous_ticket_key.len = s->prev_ticket_key.size;
+	}
+
 	entry_count = snapshot_entry_count(config_snapshot);
 
 	entries = talloc_zero_array(s, SnapshotEntryMsg *, entry_count);
@@ -1742,6 +1929,9 @@ cleanup:
 	if (entries)
 		talloc_free(entries);
 
+	if (secmod_addrs)
+		talloc_free(secmod_addrs);
+
 	if (msg_buffer)
 		talloc_free(msg_buffer);
 
@@ -55,6 +55,7 @@ extern ev_timer maintainance_watcher;
 #define MAIN_MAINTENANCE_TIME (900)
 
 int cmd_parser (void *pool, int argc, char **argv, struct list_head *head, bool worker);
+int load_cfg_blob(void *pool, int fd, struct list_head *head);
 
 #if defined(CAPTURE_LATENCY_SUPPORT)
 #define LATENCY_AGGREGATION_TIME (60)
@@ -62,6 +63,10 @@ int cmd_parser (void *pool, int argc, char **argv, struct list_head *head, bool
 
 #define MINIMUM_USERS_PER_SEC_MOD 500
 
+/* the revocations the cookie revocation set is sized for, when there
+ * is no client limit */
+#define COOKIE_REVOCATIONS_UNLIMITED 8192
+
 struct listener_st {
 	ev_io io;
 	struct list_node list;
@@ -80,6 +85,10 @@ struct listen_list_st {
 	unsigned int total;
 };
 
+void add_listener(void *pool, struct listen_list_st *list,
+	int fd, int family, int socktype, int protocol,
+	struct sockaddr* addr, socklen_t addr_len);
+
 struct script_wait_st {
 	/* must be first so that this structure can behave as ev_child */
 	struct ev_child ev_child;
@@ -111,6 +120,7 @@ typedef struct proc_st {
 	struct ip_lease_st *ipv4;
 	struct ip_lease_st *ipv6;
 	unsigned leases_in_use; /* someone else got our IP leases */
+	unsigned leases_probed; /* the IP leases were checked with ping */
 
 	struct sockaddr_storage remote_addr; /* peer address (CSTP) */
 	socklen_t remote_addr_len;
@@ -129,6 +139,10 @@ typedef struct proc_st {
 	 * to reconnect. */
 	unsigned invalidated;
 
+	/* non zero if the session was resumed by a worker of another
+	 * sec-mod instance (with stateless cookies) */
+	unsigned session_moved;
+
 	/* whether the host-update script has already been called */
 	unsigned host_updated;
 
@@ -187,6 +201,7 @@ inline static void kill_proc(proc_st *proc)
 
 struct ip_lease_db_st {
 	struct htable ht;
+	struct list_head pools; /* struct ip_pool_st, see ip-lease.c */
 };
 
 struct proc_list_st {
@@ -257,8 +272,21 @@ typedef struct sec_mod_instance_st {
 	 * Holds the number of entries in secmod list of users */
 	unsigned secmod_client_entries;
 	unsigned tlsdb_entries;
+	unsigned workers; /* the workers connected to this instance */
 	uint32_t avg_auth_time; /* in seconds */
 	uint32_t max_auth_time; /* in seconds */
+	uint64_t key_ops; /* private key operations in the current stats period */
+	uint32_t key_op_queue_max; /* max pending key operations in the current stats period */
+	uint64_t acct_sent; /* accounting records acknowledged in the current stats period */
+	uint64_t acct_dropped; /* accounting records dropped in the current stats period */
+	uint32_t acct_backlog; /* accounting records queued */
+	uint64_t sup_config_hits; /* cached supplemental configs used in the current stats period */
+	uint64_t sup_config_misses; /* supplemental configs parsed in the current stats period */
+	uint64_t expired; /* client entries and TLS sessions expired in the current stats period */
+	uint64_t expiry_lag_total; /* their delays past expiration, in seconds */
+	uint32_t expiry_lag_max; /* in seconds */
+	auth_latency_st auth_latency[MAX_AUTH_LATENCY_MODULES]; /* in the current stats period */
+	unsigned auth_latency_size;
 
 } sec_mod_instance_st;
 
@@ -273,7 +301,20 @@ typedef struct main_server_st {
 
 	struct ip_lease_db_st ip_leases;
 
-	struct htable *ban_db;
+	struct mmap_table_st *ban_db;
+	/* shared with sec-mod; set with stateless cookies */
+	struct cookie_revocations_st *cookie_revocations;
+	int cookie_revocations_fd; /* its memory file, or -1 */
+	struct mmap_table_st *lease_journal;
+
+	/* outstanding lease checks (see icmp-ping.c) */
+	struct icmp_ping_st *ping;
+	/* the connection to the event-sink helper */
+	struct event_sink_st *event_sink;
+	/* the pre-created tun devices (see tun.c) */
+	struct tun_pool_st *tun_pool;
+	/* the shared multi-queue devices (see tun-mq.c) */
+	struct tun_mq_st *tun_mq;
 
 	struct listen_list_st listen_list;
 	struct proc_list_st proc_list;
@@ -293,12 +334,20 @@ typedef struct main_server_st {
 
 	int top_fd;
 	int ctl_fd;
+	int config_blob_fd; /* the configuration for the workers, or -1 */
 
 	void *main_pool; /* talloc main pool */
 	void *config_pool; /* talloc config pool */
 
 	const uint8_t hmac_key[HMAC_DIGEST_SIZE];
 
+	/* the master key of the TLS session tickets, which is given to
+	 * the workers; see tls_rotate_ticket_key() */
+	gnutls_datum_t ticket_key;
+	time_t ticket_key_time;
+	/* the key before the last rotation, or empty */
+	gnutls_datum_t prev_ticket_key;
+
 	/* used as temporary buffer (currently by forward_udp_to_owner) */
 	uint8_t msg_buffer[MAX_MSG_SIZE];
 
@@ -315,11 +364,13 @@ typedef struct main_server_st {
 void clear_lists(main_server_st *s);
 
 int handle_worker_commands(main_server_st *s, struct proc_st* cur);
+void resume_accept_user(main_server_st *s, struct proc_st *proc, int result);
 int handle_sec_mod_commands(sec_mod_instance_st * sec_mod_instances);
 
 int user_connected(main_server_st *s, struct proc_st* cur);
 void user_hostname_update(main_server_st *s, struct proc_st* cur);
 void user_disconnected(main_server_st *s, struct proc_st* cur);
+void user_connect_event_done(main_server_st *s, struct proc_st* cur, int status);
 
 int send_udp_fd(main_server_st* s, struct proc_st * proc, int fd);
 
@@ -354,6 +405,9 @@ void mslog_hex(const main_server_st * s, const struct proc_st* proc,
 int open_tun(main_server_st* s, struct proc_st* proc);
 void close_tun(main_server_st* s, struct proc_st* proc);
 void reset_tun(struct proc_st* proc);
+void tun_pool_init(main_server_st* s);
+/* the devices of the pool which are not in use are removed with @destroy */
+void tun_pool_deinit(main_server_st* s, unsigned destroy);
 int set_tun_mtu(main_server_st* s, struct proc_st * proc, unsigned mtu);
 
 int send_cookie_auth_reply(main_server_st* s, struct proc_st* proc,
@@ -0,0 +1,423 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <main.h>
+#include <mmap-table.h>
+
+#define SLOT(t, i) ((t)->slots + (size_t)(i) * (t)->type->entry_size)
+#define STATE(t, e) ((uint32_t *)((uint8_t *)(e) + (t)->type->state_offset))
+
+static size_t map_size(const mmap_table_type_st *type, unsigned slots)
+{
+	return sizeof(mmap_table_hdr_st) + (size_t)slots * type->entry_size;
+}
+
+/* Allocates an empty table of the given number of slots. If a file is
+ * given the table is created in that file, otherwise an anonymous mapping
+ * is used. The table is written to 'out'; on error -1 is returned.
+ */
+static int table_alloc(main_server_st *s, struct mmap_table_st *out,
+		       const char *file, unsigned slots)
+{
+	const mmap_table_type_st *type = out->type;
+	size_t size = map_size(type, slots);
+	void *p;
+	int fd = -1, e;
+
+	if (file != NULL) {
+		fd = open(file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (fd == -1) {
+			e = errno;
+			mslog(s, NULL, LOG_ERR, "cannot create %s file %s: %s",
+			      type->name, file, strerror(e));
+			return -1;
+		}
+
+		if (ftruncate(fd, size) == -1) {
+			e = errno;
+			mslog(s, NULL, LOG_ERR, "cannot resize %s file %s: %s",
+			      type->name, file, strerror(e));
+			close(fd);
+			return -1;
+		}
+
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	} else {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+
+	if (p == MAP_FAILED) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "cannot map %s: %s", type->name, strerror(e));
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	/* both ftruncate() and anonymous mappings give zeroed memory, i.e.,
+	 * all slots are in MMAP_SLOT_EMPTY state */
+	out->hdr = p;
+	out->slots = (uint8_t *)p + sizeof(mmap_table_hdr_st);
+	out->map_size = size;
+	out->fd = fd;
+
+	out->hdr->magic = type->magic;
+	out->hdr->version = type->version;
+	out->hdr->entry_size = type->entry_size;
+	out->hdr->slots = slots;
+
+	/* every table gets its own key, which is kept in the file */
+	if (!keyed_hash_init_key(&out->hdr->key)) {
+		mslog(s, NULL, LOG_ERR, "cannot generate %s key", type->name);
+		munmap(p, size);
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void table_unmap(struct mmap_table_st *t)
+{
+	if (t->hdr != NULL)
+		munmap(t->hdr, t->map_size);
+	if (t->fd != -1)
+		close(t->fd);
+	t->hdr = NULL;
+	t->slots = NULL;
+	t->fd = -1;
+}
+
+void *mmap_table_find(struct mmap_table_st *t, const void *key, size_t key_size,
+		      void **free_slot)
+{
+	uint32_t mask = t->hdr->slots - 1;
+	uint32_t i = siphash13(&t->hdr->key, key, key_size) & mask;
+	const void *ekey;
+	size_t ekey_size;
+	unsigned n, state;
+	void *e;
+
+	if (free_slot)
+		*free_slot = NULL;
+
+	for (n = 0; n <= mask; n++, i = (i + 1) & mask) {
+		e = SLOT(t, i);
+		state = __atomic_load_n(STATE(t, e), __ATOMIC_ACQUIRE);
+
+		if (state == MMAP_SLOT_EMPTY) {
+			if (free_slot && *free_slot == NULL)
+				*free_slot = e;
+			return NULL;
+		}
+
+		if (state == MMAP_SLOT_USED) {
+			t->type->entry_key(e, &ekey, &ekey_size);
+			if (ekey_size == key_size && memcmp(ekey, key, key_size) == 0)
+				return e;
+		} else if (free_slot && *free_slot == NULL) {
+			*free_slot = e;
+		}
+	}
+
+	return NULL;
+}
+
+/* Stores a copy of 'src' in a free slot. The slot is only marked as used
+ * after the entry is written, so that a crash at any point leaves a
+ * table which can be loaded. */
+static void *table_put(struct mmap_table_st *t, const void *src)
+{
+	size_t off = t->type->state_offset, after = off + sizeof(uint32_t);
+	const void *key;
+	size_t key_size;
+	void *e, *slot;
+
+	t->type->entry_key(src, &key, &key_size);
+	e = mmap_table_find(t, key, key_size, &slot);
+	if (e != NULL)
+		return e;
+	if (slot == NULL)
+		return NULL;
+
+	if (*STATE(t, slot) == MMAP_SLOT_DELETED)
+		t->hdr->deleted--;
+
+	memcpy(slot, src, off);
+	memcpy((uint8_t *)slot + after, (const uint8_t *)src + after,
+	       t->type->entry_size - after);
+	__atomic_store_n(STATE(t, slot), MMAP_SLOT_USED, __ATOMIC_RELEASE);
+
+	t->hdr->used++;
+	return slot;
+}
+
+/* When file-backed, the new table is written to a temporary file which
+ * atomically replaces the old one, so the file is always a complete
+ * table. It is not synced, as that would stall main; the writeback is
+ * left to the kernel, and a file left incomplete by a power loss is
+ * recovered, or set aside, when loaded. */
+int mmap_table_rebuild(main_server_st *s, struct mmap_table_st *t, unsigned slots)
+{
+	struct mmap_table_st n;
+	char *tmp = NULL;
+	unsigned i;
+	void *entry;
+	int ret = -1;
+
+	if (t->file != NULL) {
+		tmp = talloc_asprintf(t, "%s.tmp", t->file);
+		if (tmp == NULL)
+			return -1;
+	}
+
+	memset(&n, 0, sizeof(n));
+	n.type = t->type;
+	if (table_alloc(s, &n, tmp, slots) < 0)
+		goto cleanup;
+
+	for (i = 0; i < t->hdr->slots; i++) {
+		entry = SLOT(t, i);
+		if (*STATE(t, entry) != MMAP_SLOT_USED)
+			continue;
+		if (table_put(&n, entry) == NULL)
+			goto fail;
+	}
+
+	if (tmp != NULL) {
+		if (msync(n.hdr, n.map_size, MS_ASYNC) == -1 ||
+		    rename(tmp, t->file) == -1) {
+			int e = errno;
+			mslog(s, NULL, LOG_ERR, "cannot replace %s file %s: %s",
+			      t->type->name, t->file, strerror(e));
+			goto fail;
+		}
+	}
+
+	table_unmap(t);
+	t->hdr = n.hdr;
+	t->slots = n.slots;
+	t->map_size = n.map_size;
+	t->fd = n.fd;
+
+	ret = 0;
+	goto cleanup;
+ fail:
+	table_unmap(&n);
+	if (tmp != NULL)
+		unlink(tmp);
+ cleanup:
+	talloc_free(tmp);
+	return ret;
+}
+
+void *mmap_table_add(main_server_st *s, struct mmap_table_st *t, const void *src)
+{
+	size_t fill = (size_t)t->hdr->used + t->hdr->deleted + 1;
+
+	/* keep the load factor (including deleted slots) under 3/4 */
+	if (fill * 4 > (size_t)t->hdr->slots * 3) {
+		unsigned slots = t->hdr->slots;
+
+		if (((size_t)t->hdr->used + 1) * 2 > slots)
+			slots *= 2;
+
+		if (mmap_table_rebuild(s, t, slots) < 0 && fill >= t->hdr->slots) {
+			mslog(s, NULL, LOG_INFO, "%s is full", t->type->name);
+			return NULL;
+		}
+	}
+
+	return table_put(t, src);
+}
+
+void mmap_table_del(struct mmap_table_st *t, void *entry)
+{
+	__atomic_store_n(STATE(t, entry), MMAP_SLOT_DELETED, __ATOMIC_RELEASE);
+	t->hdr->used--;
+	t->hdr->deleted++;
+}
+
+void *mmap_table_next(struct mmap_table_st *t, unsigned *iter)
+{
+	void *e;
+
+	while (*iter < t->hdr->slots) {
+		e = SLOT(t, (*iter)++);
+		if (*STATE(t, e) == MMAP_SLOT_USED)
+			return e;
+	}
+
+	return NULL;
+}
+
+/* Opens an existing table file. Returns -1 if there is no file, or -2
+ * if there is no usable table in it. */
+static int table_load(main_server_st *s, struct mmap_table_st *t)
+{
+	const mmap_table_type_st *type = t->type;
+	mmap_table_hdr_st hdr;
+	struct stat st;
+	unsigned i, used = 0, deleted = 0;
+	uint32_t *state;
+	void *p;
+	int fd, e;
+
+	fd = open(t->file, O_RDWR | O_CLOEXEC);
+	if (fd == -1) {
+		e = errno;
+		if (e == ENOENT)
+			return -1;
+		mslog(s, NULL, LOG_ERR, "cannot open %s file %s: %s",
+		      type->name, t->file, strerror(e));
+		return -2;
+	}
+
+	if (fstat(fd, &st) == -1 ||
+	    pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		goto invalid;
+
+	if (hdr.magic != type->magic || hdr.version != type->version ||
+	    hdr.entry_size != type->entry_size ||
+	    hdr.slots < type->min_slots || (hdr.slots & (hdr.slots - 1)) != 0 ||
+	    (size_t)st.st_size < map_size(type, hdr.slots))
+		goto invalid;
+
+	p = mmap(NULL, map_size(type, hdr.slots), PROT_READ | PROT_WRITE,
+		 MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "cannot map %s file %s: %s",
+		      type->name, t->file, strerror(e));
+		close(fd);
+		return -2;
+	}
+
+	t->hdr = p;
+	t->slots = (uint8_t *)p + sizeof(mmap_table_hdr_st);
+	t->map_size = map_size(type, hdr.slots);
+	t->fd = fd;
+
+	/* the counters may be stale if we were not shut down orderly */
+	if (t->hdr->clean == 0) {
+		for (i = 0; i < t->hdr->slots; i++) {
+			state = STATE(t, SLOT(t, i));
+			if (*state == MMAP_SLOT_USED)
+				used++;
+			else if (*state != MMAP_SLOT_EMPTY) {
+				*state = MMAP_SLOT_DELETED;
+				deleted++;
+			}
+		}
+		t->hdr->used = used;
+		t->hdr->deleted = deleted;
+		mslog(s, NULL, LOG_INFO, "%s %s was not closed orderly; recovered %u entries",
+		      type->name, t->file, used);
+	}
+	t->hdr->clean = 0;
+
+	return 0;
+ invalid:
+	mslog(s, NULL, LOG_ERR, "invalid %s file %s", type->name, t->file);
+	close(fd);
+	return -2;
+}
+
+/* Renames a file which could not be loaded, rather than truncating it */
+static int table_set_aside(main_server_st *s, struct mmap_table_st *t)
+{
+	char *bad;
+	int ret = 0, e;
+
+	bad = talloc_asprintf(t, "%s.bad", t->file);
+	if (bad == NULL)
+		return -1;
+
+	if (rename(t->file, bad) == -1) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "cannot rename %s file %s to %s: %s",
+		      t->type->name, t->file, bad, strerror(e));
+		ret = -1;
+	} else {
+		mslog(s, NULL, LOG_ERR, "renamed %s file %s to %s; starting with an empty one",
+		      t->type->name, t->file, bad);
+	}
+
+	talloc_free(bad);
+	return ret;
+}
+
+struct mmap_table_st *mmap_table_open(main_server_st *s, void *pool,
+				      const mmap_table_type_st *type,
+				      const char *file)
+{
+	struct mmap_table_st *t;
+	int ret;
+
+	t = talloc_zero(pool, struct mmap_table_st);
+	if (t == NULL)
+		return NULL;
+
+	t->type = type;
+	t->fd = -1;
+	t->owner = getpid();
+
+	if (file != NULL) {
+		t->file = talloc_strdup(t, file);
+		if (t->file == NULL)
+			goto fail;
+
+		ret = table_load(s, t);
+		if (ret == 0)
+			return t;
+		if (ret == -2 && table_set_aside(s, t) < 0)
+			goto fail;
+	}
+
+	if (table_alloc(s, t, t->file, type->min_slots) < 0)
+		goto fail;
+
+	return t;
+ fail:
+	talloc_free(t);
+	return NULL;
+}
+
+void mmap_table_close(struct mmap_table_st *t)
+{
+	/* only the process which opened the file marks it as clean;
+	 * forked children just drop their mapping */
+	if (t->fd != -1 && t->owner == getpid()) {
+		t->hdr->clean = 1;
+		msync(t->hdr, t->map_size, MS_SYNC);
+	}
+	table_unmap(t);
+	talloc_free(t);
+}
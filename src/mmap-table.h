@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_MMAP_TABLE_H
+# define OC_MMAP_TABLE_H
+
+# include "main.h"
+# include <keyed-hash.h>
+
+/* An open addressing hash table (linear probing) in a shared mapping,
+ * which is backed by a file when one is given. The file is the table
+ * itself: on restart it is used as is, without re-inserting any entries,
+ * and it is replaced atomically when the table is resized. The ban DB
+ * and the lease journal are such tables.
+ */
+
+/* state of a slot */
+#define MMAP_SLOT_EMPTY 0
+#define MMAP_SLOT_USED 1
+#define MMAP_SLOT_DELETED 2
+
+typedef struct mmap_table_hdr_st {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_size; /* the entry size of the writer */
+	uint32_t slots; /* a power of two */
+	uint32_t used; /* slots in MMAP_SLOT_USED state */
+	uint32_t deleted; /* slots in MMAP_SLOT_DELETED state */
+	uint32_t clean; /* non-zero if the file was closed orderly */
+	uint32_t reserved0;
+	keyed_hash_key_st key; /* the key the slots are hashed with */
+	uint32_t reserved[4];
+} mmap_table_hdr_st;
+
+/* The layout of the entries of a table. Each entry has a uint32_t
+ * state (MMAP_SLOT_) at @state_offset, and a key which is hashed and
+ * compared as bytes. */
+typedef struct mmap_table_type_st {
+	const char *name; /* e.g., "ban DB", for the logs */
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_size;
+	size_t state_offset;
+	unsigned min_slots; /* a power of two */
+
+	/* sets @key and @key_size to the key of the entry */
+	void (*entry_key)(const void *entry, const void **key, size_t *key_size);
+} mmap_table_type_st;
+
+struct mmap_table_st {
+	const mmap_table_type_st *type;
+	mmap_table_hdr_st *hdr;
+	uint8_t *slots;
+	size_t map_size;
+
+	int fd; /* -1 when the table is not file-backed */
+	char *file;
+	pid_t owner; /* the process which may mark the file as clean */
+};
+
+/* Opens the table in @file, or creates it with the minimum number of
+ * slots if there is none; a file which cannot be loaded is renamed to
+ * @file.bad first. When @file is NULL the table is in anonymous memory.
+ * Returns NULL on error. */
+struct mmap_table_st *mmap_table_open(main_server_st *s, void *pool,
+				      const mmap_table_type_st *type,
+				      const char *file);
+
+/* Unmaps the table; the file is marked as clean if the calling process
+ * opened it */
+void mmap_table_close(struct mmap_table_st *t);
+
+/* Looks up the entry with the given key. If @free_slot is non-null it is
+ * set to the first slot that a new entry with that key can be stored
+ * in. */
+void *mmap_table_find(struct mmap_table_st *t, const void *key, size_t key_size,
+		      void **free_slot);
+
+/* Stores a copy of @src, whose state is ignored, growing the table when
+ * needed. Returns the existing entry with the key of @src if there is
+ * one, or NULL if the table is full. */
+void *mmap_table_add(main_server_st *s, struct mmap_table_st *t, const void *src);
+
+void mmap_table_del(struct mmap_table_st *t, void *entry);
+
+/* Returns the used entry at or after *@iter, or NULL, and advances
+ * *@iter past it; start with zero. */
+void *mmap_table_next(struct mmap_table_st *t, unsigned *iter);
+
+/* Re-creates the table with the given number of slots, dropping the
+ * deleted ones. */
+int mmap_table_rebuild(main_server_st *s, struct mmap_table_st *t, unsigned slots);
+
+#endif
@@ -0,0 +1,564 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <talloc.h>
+
+#ifdef __linux__
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+#include <defs.h>
+#include <vpn.h>
+#include <ip-util.h>
+#include <rtnl.h>
+#include <nft-fw.h>
+
+#define NFT_FW_TABLE "ocserv"
+#define NFT_FW_CHAIN "forward"
+#define NFT_FW_MAP "dispatch"
+#define NFT_FW_ROUTES_SUFFIX "-routes"
+
+/* the nft data type of interface names, for the listing of the map */
+#define NFT_TYPE_IFNAME 41
+
+#define NFT_FW_MAP_ID 1
+
+static void nft_msg(rtnl_batch_st *b, int type, int flags)
+{
+	struct nfgenmsg nfg;
+
+	memset(&nfg, 0, sizeof(nfg));
+	nfg.nfgen_family = NFPROTO_INET;
+	nfg.version = NFNETLINK_V0;
+
+	rtnl_batch_msg(b, (NFNL_SUBSYS_NFTABLES << 8) | type,
+		       NLM_F_REQUEST | flags, &nfg, sizeof(nfg));
+}
+
+static void batch_delimiter(rtnl_batch_st *b, int type)
+{
+	struct nfgenmsg nfg;
+
+	memset(&nfg, 0, sizeof(nfg));
+	nfg.nfgen_family = AF_UNSPEC;
+	nfg.version = NFNETLINK_V0;
+	nfg.res_id = htons(NFNL_SUBSYS_NFTABLES);
+
+	rtnl_batch_msg(b, type, NLM_F_REQUEST, &nfg, sizeof(nfg));
+}
+
+static void attr_be32(rtnl_batch_st *b, int type, uint32_t val)
+{
+	rtnl_batch_attr_u32(b, type, htonl(val));
+}
+
+static void attr_data(rtnl_batch_st *b, int type, const void *data, size_t len)
+{
+	size_t nest;
+
+	nest = rtnl_batch_nest_start(b, type);
+	rtnl_batch_attr(b, NFTA_DATA_VALUE, data, len);
+	rtnl_batch_nest_end(b, nest);
+}
+
+static void attr_verdict(rtnl_batch_st *b, int type, int code, const char *chain)
+{
+	size_t nest, verdict;
+
+	nest = rtnl_batch_nest_start(b, type);
+	verdict = rtnl_batch_nest_start(b, NFTA_DATA_VERDICT);
+	attr_be32(b, NFTA_VERDICT_CODE, code);
+	if (chain)
+		rtnl_batch_attr_str(b, NFTA_VERDICT_CHAIN, chain);
+	rtnl_batch_nest_end(b, verdict);
+	rtnl_batch_nest_end(b, nest);
+}
+
+static void attr_ifname(rtnl_batch_st *b, int type, const char *device)
+{
+	char name[IFNAMSIZ];
+
+	memset(name, 0, sizeof(name));
+	memcpy(name, device, strnlen(device, sizeof(name) - 1));
+	attr_data(b, type, name, sizeof(name));
+}
+
+/* Expressions */
+
+struct nft_expr {
+	size_t elem;
+	size_t data;
+};
+
+static void expr_start(rtnl_batch_st *b, struct nft_expr *e, const char *name)
+{
+	e->elem = rtnl_batch_nest_start(b, NFTA_LIST_ELEM);
+	rtnl_batch_attr_str(b, NFTA_EXPR_NAME, name);
+	e->data = rtnl_batch_nest_start(b, NFTA_EXPR_DATA);
+}
+
+static void expr_end(rtnl_batch_st *b, struct nft_expr *e)
+{
+	rtnl_batch_nest_end(b, e->data);
+	rtnl_batch_nest_end(b, e->elem);
+}
+
+static void expr_meta(rtnl_batch_st *b, int key)
+{
+	struct nft_expr e;
+
+	expr_start(b, &e, "meta");
+	attr_be32(b, NFTA_META_KEY, key);
+	attr_be32(b, NFTA_META_DREG, NFT_REG_1);
+	expr_end(b, &e);
+}
+
+static void expr_payload(rtnl_batch_st *b, int base, unsigned offset, unsigned len)
+{
+	struct nft_expr e;
+
+	expr_start(b, &e, "payload");
+	attr_be32(b, NFTA_PAYLOAD_DREG, NFT_REG_1);
+	attr_be32(b, NFTA_PAYLOAD_BASE, base);
+	attr_be32(b, NFTA_PAYLOAD_OFFSET, offset);
+	attr_be32(b, NFTA_PAYLOAD_LEN, len);
+	expr_end(b, &e);
+}
+
+static void expr_bitwise(rtnl_batch_st *b, const void *mask, unsigned len)
+{
+	static const uint8_t zero[16];
+	struct nft_expr e;
+
+	expr_start(b, &e, "bitwise");
+	attr_be32(b, NFTA_BITWISE_SREG, NFT_REG_1);
+	attr_be32(b, NFTA_BITWISE_DREG, NFT_REG_1);
+	attr_be32(b, NFTA_BITWISE_LEN, len);
+	attr_data(b, NFTA_BITWISE_MASK, mask, len);
+	attr_data(b, NFTA_BITWISE_XOR, zero, len);
+	expr_end(b, &e);
+}
+
+static void expr_cmp(rtnl_batch_st *b, const void *data, unsigned len)
+{
+	struct nft_expr e;
+
+	expr_start(b, &e, "cmp");
+	attr_be32(b, NFTA_CMP_SREG, NFT_REG_1);
+	attr_be32(b, NFTA_CMP_OP, NFT_CMP_EQ);
+	attr_data(b, NFTA_CMP_DATA, data, len);
+	expr_end(b, &e);
+}
+
+static void expr_lookup_verdict(rtnl_batch_st *b, const char *set, unsigned set_id)
+{
+	struct nft_expr e;
+
+	expr_start(b, &e, "lookup");
+	rtnl_batch_attr_str(b, NFTA_LOOKUP_SET, set);
+	attr_be32(b, NFTA_LOOKUP_SET_ID, set_id);
+	attr_be32(b, NFTA_LOOKUP_SREG, NFT_REG_1);
+	attr_be32(b, NFTA_LOOKUP_DREG, NFT_REG_VERDICT);
+	expr_end(b, &e);
+}
+
+static void expr_verdict(rtnl_batch_st *b, int code, const char *chain)
+{
+	struct nft_expr e;
+
+	expr_start(b, &e, "immediate");
+	attr_be32(b, NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT);
+	attr_verdict(b, NFTA_IMMEDIATE_DATA, code, chain);
+	expr_end(b, &e);
+}
+
+/* as iptables' REJECT */
+static void expr_reject(rtnl_batch_st *b)
+{
+	uint8_t code = NFT_REJECT_ICMPX_PORT_UNREACH;
+	struct nft_expr e;
+
+	expr_start(b, &e, "reject");
+	attr_be32(b, NFTA_REJECT_TYPE, NFT_REJECT_ICMPX_UNREACH);
+	rtnl_batch_attr(b, NFTA_REJECT_ICMP_CODE, &code, sizeof(code));
+	expr_end(b, &e);
+}
+
+/* Matches */
+
+static void match_u8(rtnl_batch_st *b, int meta, uint8_t val)
+{
+	expr_meta(b, meta);
+	expr_cmp(b, &val, sizeof(val));
+}
+
+static void match_daddr(rtnl_batch_st *b, const struct sockaddr_storage *addr, unsigned prefix)
+{
+	uint8_t mask[16], data[16];
+	const uint8_t *p;
+	unsigned len, offset, i;
+
+	if (addr->ss_family == AF_INET) {
+		match_u8(b, NFT_META_NFPROTO, NFPROTO_IPV4);
+		p = (uint8_t *)SA_IN_P(addr);
+		offset = offsetof(struct iphdr, daddr);
+		len = 4;
+	} else {
+		match_u8(b, NFT_META_NFPROTO, NFPROTO_IPV6);
+		p = (uint8_t *)SA_IN6_P(addr);
+		offset = offsetof(struct ip6_hdr, ip6_dst);
+		len = 16;
+	}
+
+	if (prefix == 0)
+		return;
+
+	expr_payload(b, NFT_PAYLOAD_NETWORK_HEADER, offset, len);
+
+	memset(mask, 0, sizeof(mask));
+	for (i = 0; i < prefix / 8; i++)
+		mask[i] = 0xff;
+	if (prefix % 8)
+		mask[i] = 0xff << (8 - prefix % 8);
+
+	for (i = 0; i < len; i++)
+		data[i] = p[i] & mask[i];
+
+	if (prefix < len * 8)
+		expr_bitwise(b, mask, len);
+	expr_cmp(b, data, len);
+}
+
+static void match_dport(rtnl_batch_st *b, uint8_t proto, unsigned port)
+{
+	uint16_t val = htons(port);
+
+	match_u8(b, NFT_META_L4PROTO, proto);
+	expr_payload(b, NFT_PAYLOAD_TRANSPORT_HEADER, 2, sizeof(val));
+	expr_cmp(b, &val, sizeof(val));
+}
+
+/* Requests */
+
+static size_t rule_start(rtnl_batch_st *b, const char *chain)
+{
+	nft_msg(b, NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND);
+	rtnl_batch_attr_str(b, NFTA_RULE_TABLE, NFT_FW_TABLE);
+	rtnl_batch_attr_str(b, NFTA_RULE_CHAIN, chain);
+
+	return rtnl_batch_nest_start(b, NFTA_RULE_EXPRESSIONS);
+}
+
+static void rule_end(rtnl_batch_st *b, size_t exprs)
+{
+	rtnl_batch_nest_end(b, exprs);
+}
+
+static void new_chain(rtnl_batch_st *b, const char *chain)
+{
+	nft_msg(b, NFT_MSG_NEWCHAIN, NLM_F_CREATE);
+	rtnl_batch_attr_str(b, NFTA_CHAIN_TABLE, NFT_FW_TABLE);
+	rtnl_batch_attr_str(b, NFTA_CHAIN_NAME, chain);
+}
+
+static void flush_chain(rtnl_batch_st *b, const char *chain)
+{
+	nft_msg(b, NFT_MSG_DELRULE, 0);
+	rtnl_batch_attr_str(b, NFTA_RULE_TABLE, NFT_FW_TABLE);
+	rtnl_batch_attr_str(b, NFTA_RULE_CHAIN, chain);
+}
+
+static void map_elem(rtnl_batch_st *b, int type, const char *device)
+{
+	size_t list, elem;
+
+	nft_msg(b, type, (type == NFT_MSG_NEWSETELEM) ? NLM_F_CREATE : 0);
+	rtnl_batch_attr_str(b, NFTA_SET_ELEM_LIST_TABLE, NFT_FW_TABLE);
+	rtnl_batch_attr_str(b, NFTA_SET_ELEM_LIST_SET, NFT_FW_MAP);
+
+	list = rtnl_batch_nest_start(b, NFTA_SET_ELEM_LIST_ELEMENTS);
+	elem = rtnl_batch_nest_start(b, NFTA_LIST_ELEM);
+	attr_ifname(b, NFTA_SET_ELEM_KEY, device);
+	if (type == NFT_MSG_NEWSETELEM)
+		attr_verdict(b, NFTA_SET_ELEM_DATA, NFT_GOTO, device);
+	rtnl_batch_nest_end(b, elem);
+	rtnl_batch_nest_end(b, list);
+}
+
+/* Creates the table, its forward chain and the dispatch map if they
+ * don't exist; they are shared by all the devices. The rule of the
+ * forward chain is replaced, so that the batch does not depend on what
+ * is there already. */
+static void fw_init(rtnl_batch_st *b)
+{
+	size_t nest;
+
+	batch_delimiter(b, NFNL_MSG_BATCH_BEGIN);
+
+	nft_msg(b, NFT_MSG_NEWTABLE, NLM_F_CREATE);
+	rtnl_batch_attr_str(b, NFTA_TABLE_NAME, NFT_FW_TABLE);
+
+	new_chain(b, NFT_FW_CHAIN);
+	rtnl_batch_attr_str(b, NFTA_CHAIN_TYPE, "filter");
+	attr_be32(b, NFTA_CHAIN_POLICY, NF_ACCEPT);
+	nest = rtnl_batch_nest_start(b, NFTA_CHAIN_HOOK);
+	attr_be32(b, NFTA_HOOK_HOOKNUM, NF_INET_FORWARD);
+	attr_be32(b, NFTA_HOOK_PRIORITY, 0);
+	rtnl_batch_nest_end(b, nest);
+
+	nft_msg(b, NFT_MSG_NEWSET, NLM_F_CREATE);
+	rtnl_batch_attr_str(b, NFTA_SET_TABLE, NFT_FW_TABLE);
+	rtnl_batch_attr_str(b, NFTA_SET_NAME, NFT_FW_MAP);
+	attr_be32(b, NFTA_SET_FLAGS, NFT_SET_MAP);
+	attr_be32(b, NFTA_SET_KEY_TYPE, NFT_TYPE_IFNAME);
+	attr_be32(b, NFTA_SET_KEY_LEN, IFNAMSIZ);
+	attr_be32(b, NFTA_SET_DATA_TYPE, NFT_DATA_VERDICT);
+	attr_be32(b, NFTA_SET_ID, NFT_FW_MAP_ID);
+
+	/* iifname vmap @dispatch */
+	flush_chain(b, NFT_FW_CHAIN);
+	nest = rule_start(b, NFT_FW_CHAIN);
+	expr_meta(b, NFT_META_IIFNAME);
+	expr_lookup_verdict(b, NFT_FW_MAP, NFT_FW_MAP_ID);
+	rule_end(b, nest);
+}
+
+static int fw_commit(rtnl_batch_st *b)
+{
+	unsigned i;
+	int ret;
+
+	rtnl_batch_ack(b);
+	batch_delimiter(b, NFNL_MSG_BATCH_END);
+
+	ret = rtnl_batch_commit_atomic(b, NETLINK_NETFILTER);
+	if (ret <= 0)
+		return ret;
+
+	for (i = 0; i < b->count; i++) {
+		if (b->errors[i] != 0) {
+			errno = b->errors[i];
+			break;
+		}
+	}
+
+	return -1;
+}
+
+static uint8_t fw_proto(unsigned proto)
+{
+	switch (proto) {
+	case PROTO_UDP:
+		return IPPROTO_UDP;
+	case PROTO_TCP:
+		return IPPROTO_TCP;
+	case PROTO_SCTP:
+		return IPPROTO_SCTP;
+	case PROTO_ESP:
+		return IPPROTO_ESP;
+	case PROTO_ICMP:
+		return IPPROTO_ICMP;
+	case PROTO_ICMPv6:
+		return IPPROTO_ICMPV6;
+	default:
+		return 0;
+	}
+}
+
+/* Adds a rule per route, in the order of the script: the excluded routes
+ * are rejected before the included ones are accepted. */
+static int add_routes(rtnl_batch_st *b, const char *chain,
+		      char **routes, size_t n_routes, unsigned accept)
+{
+	struct sockaddr_storage addr;
+	unsigned prefix, i;
+	size_t nest;
+
+	for (i = 0; i < n_routes; i++) {
+		if (ip_route_parse(routes[i], &addr, &prefix) < 0)
+			return ERR_PARSING;
+
+		nest = rule_start(b, chain);
+		match_daddr(b, &addr, prefix);
+		if (accept)
+			expr_verdict(b, NF_ACCEPT, NULL);
+		else
+			expr_reject(b);
+		rule_end(b, nest);
+	}
+
+	return 0;
+}
+
+int nft_fw_add(void *pool, const char *device, const GroupCfgSt *config)
+{
+	struct sockaddr_storage addr;
+	rtnl_batch_st b;
+	char *routes_chain;
+	unsigned prefix, i, negate = 0;
+	uint8_t proto;
+	size_t nest;
+	int ret;
+
+	routes_chain = talloc_asprintf(pool, "%s"NFT_FW_ROUTES_SUFFIX, device);
+	if (routes_chain == NULL)
+		return ERR_MEM;
+
+	rtnl_batch_init(&b, pool);
+	fw_init(&b);
+
+	/* clear any leftover rules for this device */
+	new_chain(&b, device);
+	new_chain(&b, routes_chain);
+	flush_chain(&b, device);
+	flush_chain(&b, routes_chain);
+
+	/* allow DNS lookups */
+	for (i = 0; i < config->n_dns; i++) {
+		if (ip_route_parse(config->dns[i], &addr, &prefix) < 0) {
+			ret = ERR_PARSING;
+			goto cleanup;
+		}
+
+		nest = rule_start(&b, device);
+		match_daddr(&b, &addr, prefix);
+		match_dport(&b, IPPROTO_UDP, 53);
+		expr_verdict(&b, NF_ACCEPT, NULL);
+		rule_end(&b, nest);
+
+		nest = rule_start(&b, device);
+		match_daddr(&b, &addr, prefix);
+		match_dport(&b, IPPROTO_TCP, 53);
+		expr_verdict(&b, NF_ACCEPT, NULL);
+		rule_end(&b, nest);
+	}
+
+	/* block ports, or allow only these */
+	for (i = 0; i < config->n_fw_ports; i++) {
+		if (config->fw_ports[i]->negate)
+			negate = 1;
+	}
+
+	for (i = 0; i < config->n_fw_ports; i++) {
+		proto = fw_proto(config->fw_ports[i]->proto);
+		if (proto == 0) {
+			ret = ERR_PARSING;
+			goto cleanup;
+		}
+
+		nest = rule_start(&b, device);
+		if (proto == IPPROTO_UDP || proto == IPPROTO_TCP || proto == IPPROTO_SCTP)
+			match_dport(&b, proto, config->fw_ports[i]->port);
+		else
+			match_u8(&b, NFT_META_L4PROTO, proto);
+
+		if (negate)
+			expr_reject(&b);
+		else
+			expr_verdict(&b, NFT_GOTO, routes_chain);
+		rule_end(&b, nest);
+	}
+
+	nest = rule_start(&b, device);
+	if (config->n_fw_ports > 0 && !negate)
+		expr_reject(&b);
+	else
+		expr_verdict(&b, NFT_GOTO, routes_chain);
+	rule_end(&b, nest);
+
+	/* block or allow routes */
+	if (config->restrict_user_to_routes) {
+		ret = add_routes(&b, routes_chain, config->no_routes, config->n_no_routes, 0);
+		if (ret < 0)
+			goto cleanup;
+
+		ret = add_routes(&b, routes_chain, config->routes, config->n_routes, 1);
+		if (ret < 0)
+			goto cleanup;
+	}
+
+	/* without routes the user has the default route */
+	nest = rule_start(&b, routes_chain);
+	if (config->restrict_user_to_routes && config->n_routes > 0)
+		expr_reject(&b);
+	else
+		expr_verdict(&b, NF_ACCEPT, NULL);
+	rule_end(&b, nest);
+
+	/* send the traffic of the device to its chain */
+	map_elem(&b, NFT_MSG_NEWSETELEM, device);
+
+	ret = fw_commit(&b);
+
+ cleanup:
+	rtnl_batch_deinit(&b);
+	talloc_free(routes_chain);
+	return ret;
+}
+
+int nft_fw_remove(void *pool, const char *device)
+{
+	rtnl_batch_st b;
+	char *routes_chain;
+	int ret;
+
+	routes_chain = talloc_asprintf(pool, "%s"NFT_FW_ROUTES_SUFFIX, device);
+	if (routes_chain == NULL)
+		return ERR_MEM;
+
+	rtnl_batch_init(&b, pool);
+	fw_init(&b);
+
+	/* the objects are created if missing, so that their removal
+	 * doesn't fail the transaction */
+	new_chain(&b, device);
+	new_chain(&b, routes_chain);
+	map_elem(&b, NFT_MSG_NEWSETELEM, device);
+
+	map_elem(&b, NFT_MSG_DELSETELEM, device);
+	flush_chain(&b, device);
+	flush_chain(&b, routes_chain);
+
+	nft_msg(&b, NFT_MSG_DELCHAIN, 0);
+	rtnl_batch_attr_str(&b, NFTA_CHAIN_TABLE, NFT_FW_TABLE);
+	rtnl_batch_attr_str(&b, NFTA_CHAIN_NAME, device);
+
+	nft_msg(&b, NFT_MSG_DELCHAIN, 0);
+	rtnl_batch_attr_str(&b, NFTA_CHAIN_TABLE, NFT_FW_TABLE);
+	rtnl_batch_attr_str(&b, NFTA_CHAIN_NAME, routes_chain);
+
+	ret = fw_commit(&b);
+
+	rtnl_batch_deinit(&b);
+	talloc_free(routes_chain);
+	return ret;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_NFT_FW_H
+# define OC_NFT_FW_H
+
+#include <config.h>
+#include <ipc.pb-c.h>
+
+/* The per-user restrictions of firewall-nftables. They are kept in the
+ * "inet ocserv" table, where the forward chain dispatches the traffic of
+ * each device through the "dispatch" verdict map to the chain named after
+ * the device, which holds the DNS and port rules, and then to its
+ * "<device>-routes" chain. Each of these functions applies its changes
+ * in a single nf_tables transaction, and returns zero, a negative error
+ * code, or -1 with errno set to the error of the kernel.
+ *
+ * The rules only restrict: unlike ocserv-fw, which inserts ACCEPT rules
+ * (including one for the return traffic) in the FORWARD chain, an accept
+ * verdict in this table does not override a drop in another table or in
+ * iptables, so the host's firewall must forward the traffic of the users.
+ */
+
+#ifdef __linux__
+
+int nft_fw_add(void *pool, const char *device, const GroupCfgSt *config);
+int nft_fw_remove(void *pool, const char *device);
+
+#else
+
+#define nft_fw_add(pool, device, config) (-1)
+#define nft_fw_remove(pool, device) (-1)
+
+#endif
+
+#endif
@@ -53,8 +53,14 @@ static const commands_st commands[] = {
 	      "Disconnect the specified ID", 1, 1),
 	ENTRY("unban ip", "[IP]", handle_unban_ip_cmd,
 	      "Unban the specified IP", 1, 1),
+	ENTRY("export ip bans", "[FILE]", handle_export_banned_cmd,
+	      "Writes the ban database to the specified file (or stdout)", 1, 1),
+	ENTRY("import ip bans", "[FILE]", handle_import_banned_cmd,
+	      "Merges the bans in the specified file (or stdin) to the ban database", 1, 1),
 	ENTRY("reload", NULL, handle_reload_cmd,
 	      "Reloads the server configuration", 1, 1),
+	ENTRY("upgrade", NULL, handle_upgrade_cmd,
+	      "Restarts the server binary, keeping the sessions", 1, 1),
 	ENTRY("show status", NULL, handle_status_cmd,
 	      "Prints the status and statistics of the server", 1, 1),
 	ENTRY("show users", NULL, handle_list_users_cmd,
@@ -97,8 +97,11 @@ int handle_show_user_cmd(CONN_TYPE * conn, const char *arg, cmd_params_st *param
 int handle_show_id_cmd(CONN_TYPE * conn, const char *arg, cmd_params_st *params);
 int handle_disconnect_user_cmd(CONN_TYPE * conn, const char *arg, cmd_params_st *params);
 int handle_unban_ip_cmd(CONN_TYPE * conn, const char *arg, cmd_params_st *params);
+int handle_export_banned_cmd(CONN_TYPE * conn, const char *arg, cmd_params_st *params);
+int handle_import_banned_cmd(CONN_TYPE * conn, const char *arg, cmd_params_st *params);
 int handle_disconnect_id_cmd(CONN_TYPE * conn, const char *arg, cmd_params_st *params);
 int handle_reload_cmd(CONN_TYPE * conn, const char *arg, cmd_params_st *params);
+int handle_upgrade_cmd(CONN_TYPE * conn, const char *arg, cmd_params_st *params);
 int handle_stop_cmd(CONN_TYPE * conn, const char *arg, cmd_params_st *params);
 int handle_events_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *params);
 
@@ -78,6 +78,9 @@ static uint8_t msg_map[] = {
         [CTL_CMD_DISCONNECT_NAME] = CTL_CMD_DISCONNECT_NAME_REP,
         [CTL_CMD_DISCONNECT_ID] = CTL_CMD_DISCONNECT_ID_REP,
         [CTL_CMD_UNBAN_IP] = CTL_CMD_UNBAN_IP_REP,
+        [CTL_CMD_EXPORT_BANNED] = CTL_CMD_LIST_BANNED_REP,
+        [CTL_CMD_IMPORT_BANNED] = CTL_CMD_IMPORT_BANNED_REP,
+        [CTL_CMD_UPGRADE] = CTL_CMD_UPGRADE_REP,
 };
 
 struct cmd_reply_st {
@@ -202,6 +205,8 @@ int handle_status_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *para
 	StatusRep *rep;
 	char str_since[64];
 	char buf[MAX_TMPSTR_SIZE];
+	char name[64];
+	unsigned i;
 	time_t t;
 	struct tm *tm, _tm;
 	PROTOBUF_ALLOCATOR(pa, ctx);
@@ -292,6 +297,37 @@ int handle_status_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *para
 		print_single_value_int(stdout, params, "Timed out (idle) sessions", rep->session_idle_timeouts, 1);
 		print_single_value_int(stdout, params, "Closed due to error sessions", rep->session_errors, 1);
 		print_single_value_int(stdout, params, "Authentication failures", rep->auth_failures, 1);
+		if (rep->has_key_ops) {
+			print_single_value_int(stdout, params, "Private key operations", rep->key_ops, 1);
+			print_single_value_int(stdout, params, "Max pending key operations", rep->key_op_queue_max, 1);
+		}
+		if (rep->acct_sent != 0 || rep->acct_dropped != 0 || rep->acct_backlog != 0) {
+			print_single_value_int(stdout, params, "Accounting records sent", rep->acct_sent, 1);
+			print_single_value_int(stdout, params, "Accounting records dropped", rep->acct_dropped, 1);
+			print_single_value_int(stdout, params, "Accounting records queued", rep->acct_backlog, 1);
+		}
+		if (rep->sup_config_hits != 0 || rep->sup_config_misses != 0) {
+			print_single_value_int(stdout, params, "Sup-config cache hits", rep->sup_config_hits, 1);
+			print_single_value_int(stdout, params, "Sup-config cache misses", rep->sup_config_misses, 1);
+			print_single_value_int(stdout, params, "Sup-config cache hit rate (%)",
+					       rep->sup_config_hits * 100 / (rep->sup_config_hits + rep->sup_config_misses), 1);
+		}
+		if (rep->expired_entries != 0) {
+			print_single_value_int(stdout, params, "Expired sec-mod entries", rep->expired_entries, 1);
+			print_single_value_int(stdout, params, "Average expiry lag (sec)", rep->avg_expiry_lag, 1);
+			print_single_value_int(stdout, params, "Max expiry lag (sec)", rep->max_expiry_lag, 1);
+		}
+		for (i = 0; i < rep->n_auth_latency; i++) {
+			AuthLatencyMsg *l = rep->auth_latency[i];
+
+			snprintf(name, sizeof(name), "Password checks by %s", l->module);
+			print_single_value_int(stdout, params, name, l->count, 1);
+			snprintf(name, sizeof(name), "Average %s latency (ms)", l->module);
+			print_single_value_int(stdout, params, name,
+					       l->count ? l->total_usecs / l->count / 1000 : 0, 1);
+			snprintf(name, sizeof(name), "Max %s latency (ms)", l->module);
+			print_single_value_int(stdout, params, name, l->max_usecs / 1000, 1);
+		}
 
 		print_time_ival7(buf, rep->avg_auth_time, 0);
 		print_single_value(stdout, params, "Average auth time", buf, 1);
@@ -385,6 +421,46 @@ int handle_reload_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *para
 	return ret;
 }
 
+int handle_upgrade_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *params)
+{
+	int ret;
+	struct cmd_reply_st raw;
+	BoolMsg *rep;
+	unsigned status;
+	PROTOBUF_ALLOCATOR(pa, ctx);
+
+	init_reply(&raw);
+
+	ret = send_cmd(ctx, CTL_CMD_UPGRADE, NULL, NULL, NULL, &raw);
+	if (ret < 0) {
+		goto error_status;
+	}
+
+	rep = bool_msg__unpack(&pa, raw.data_size, raw.data);
+	if (rep == NULL)
+		goto error_status;
+
+	status = rep->status;
+	bool_msg__free_unpacked(rep, &pa);
+
+	if (status != 0)
+		printf("Server scheduled to upgrade\n");
+	else
+		goto error_status;
+
+	ret = 0;
+	goto cleanup;
+
+ error_status:
+	printf("Error scheduling upgrade\n");
+	ret = 1;
+
+ cleanup:
+	free_reply(&raw);
+
+	return ret;
+}
+
 int handle_stop_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *params)
 {
 	int ret;
@@ -1077,6 +1153,225 @@ int handle_list_banned_points_cmd(struct unix_ctx *ctx, const char *arg, cmd_par
 	return handle_list_banned_cmd(ctx, arg, params, 1);
 }
 
+/* Writes all the entries of the ban DB, one per line, in a format
+ * which can be read by 'import ip bans':
+ * IP SCORE EXPIRES LAST_RESET
+ */
+int handle_export_banned_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *params)
+{
+	int ret;
+	struct cmd_reply_st raw;
+	BanListRep *rep = NULL;
+	unsigned i;
+	FILE *out = stdout;
+	PROTOBUF_ALLOCATOR(pa, ctx);
+	char txt_ip[MAX_IP_STR];
+	const char *tmp_str;
+
+	init_reply(&raw);
+
+	/* the file is optional */
+	if (arg != NULL && arg[0] == '?' && arg[1] == 0) {
+		check_cmd_help(rl_line_buffer);
+		return 1;
+	}
+
+	ret = send_cmd(ctx, CTL_CMD_EXPORT_BANNED, NULL, NULL, NULL, &raw);
+	if (ret < 0) {
+		goto error;
+	}
+
+	rep = ban_list_rep__unpack(&pa, raw.data_size, raw.data);
+	if (rep == NULL)
+		goto error;
+
+	if (arg != NULL && arg[0] != 0) {
+		out = fopen(arg, "w");
+		if (out == NULL) {
+			ret = errno;
+			fprintf(stderr, "cannot open %s: %s\n", arg, strerror(ret));
+			out = stdout;
+			ret = 1;
+			goto cleanup;
+		}
+	}
+
+	fprintf(out, "# IP score expires last-reset\n");
+	for (i=0;i<rep->n_info;i++) {
+		if (rep->info[i]->ip.len == 16)
+			tmp_str = inet_ntop(AF_INET6, rep->info[i]->ip.data, txt_ip, sizeof(txt_ip));
+		else if (rep->info[i]->ip.len == 4)
+			tmp_str = inet_ntop(AF_INET, rep->info[i]->ip.data, txt_ip, sizeof(txt_ip));
+		else
+			tmp_str = NULL;
+		if (tmp_str == NULL)
+			continue;
+
+		fprintf(out, "%s %u %lu %lu\n", txt_ip,
+			(unsigned)rep->info[i]->score,
+			(unsigned long)rep->info[i]->expires,
+			(unsigned long)rep->info[i]->last_reset);
+	}
+
+	if (out != stdout) {
+		if (fclose(out) != 0) {
+			ret = errno;
+			fprintf(stderr, "error writing %s: %s\n", arg, strerror(ret));
+			out = stdout;
+			ret = 1;
+			goto cleanup;
+		}
+		out = stdout;
+		printf("exported %u entries\n", (unsigned)rep->n_info);
+	}
+
+	ret = 0;
+	goto cleanup;
+
+ error:
+	ret = 1;
+	fprintf(stderr, ERR_SERVER_UNREACHABLE);
+
+ cleanup:
+	if (rep != NULL)
+		ban_list_rep__free_unpacked(rep, &pa);
+
+	free_reply(&raw);
+
+	return ret;
+}
+
+/* the number of entries sent in a single import message */
+#define IMPORT_CHUNK_SIZE 128
+
+static int send_import_chunk(struct unix_ctx *ctx, BanListRep *req, unsigned *imported)
+{
+	int ret;
+	struct cmd_reply_st raw;
+	BanImportRep *rep;
+	PROTOBUF_ALLOCATOR(pa, ctx);
+
+	init_reply(&raw);
+
+	/* the server handles a single command per connection */
+	if (ctx->is_open == 0 && conn_prehandle(ctx) == -1)
+		return -1;
+
+	ret = send_cmd(ctx, CTL_CMD_IMPORT_BANNED, req,
+		(pack_size_func)ban_list_rep__get_packed_size,
+		(pack_func)ban_list_rep__pack, &raw);
+	conn_posthandle(ctx);
+	if (ret < 0)
+		goto cleanup;
+
+	rep = ban_import_rep__unpack(&pa, raw.data_size, raw.data);
+	if (rep == NULL) {
+		ret = -1;
+		goto cleanup;
+	}
+
+	*imported += rep->imported;
+	ban_import_rep__free_unpacked(rep, &pa);
+
+	ret = 0;
+ cleanup:
+	free_reply(&raw);
+	return ret;
+}
+
+/* Reads entries in the format written by 'export ip bans' and merges
+ * them into the server's ban DB.
+ */
+int handle_import_banned_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *params)
+{
+	int ret;
+	FILE *in = stdin;
+	char line[256];
+	char str_ip[MAX_IP_STR];
+	unsigned score, total = 0, imported = 0, lineno = 0;
+	unsigned long expires, last_reset;
+	BanListRep req = BAN_LIST_REP__INIT;
+	BanInfoRep infos[IMPORT_CHUNK_SIZE];
+	BanInfoRep *pinfos[IMPORT_CHUNK_SIZE];
+	uint8_t ips[IMPORT_CHUNK_SIZE][16];
+
+	/* the file is optional */
+	if (arg != NULL && arg[0] == '?' && arg[1] == 0) {
+		check_cmd_help(rl_line_buffer);
+		return 1;
+	}
+
+	if (arg != NULL && arg[0] != 0) {
+		in = fopen(arg, "r");
+		if (in == NULL) {
+			ret = errno;
+			fprintf(stderr, "cannot open %s: %s\n", arg, strerror(ret));
+			return 1;
+		}
+	}
+
+	req.info = pinfos;
+
+	while (fgets(line, sizeof(line), in) != NULL) {
+		BanInfoRep *e;
+		int af;
+
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n' || line[0] == 0)
+			continue;
+
+		if (sscanf(line, "%45s %u %lu %lu", str_ip, &score, &expires, &last_reset) != 4) {
+			fprintf(stderr, "%s:%u: cannot parse line\n", arg?arg:"stdin", lineno);
+			continue;
+		}
+
+		e = &infos[req.n_info];
+		ban_info_rep__init(e);
+
+		af = strchr(str_ip, ':') != NULL ? AF_INET6 : AF_INET;
+		if (inet_pton(af, str_ip, ips[req.n_info]) != 1) {
+			fprintf(stderr, "%s:%u: cannot parse IP: %s\n", arg?arg:"stdin", lineno, str_ip);
+			continue;
+		}
+
+		e->ip.data = ips[req.n_info];
+		e->ip.len = af == AF_INET6 ? 16 : 4;
+		e->score = score;
+		e->expires = expires;
+		e->has_expires = 1;
+		e->last_reset = last_reset;
+		e->has_last_reset = 1;
+
+		pinfos[req.n_info++] = e;
+		total++;
+
+		if (req.n_info == IMPORT_CHUNK_SIZE) {
+			if (send_import_chunk(ctx, &req, &imported) < 0)
+				goto error;
+			req.n_info = 0;
+		}
+	}
+
+	if (req.n_info > 0) {
+		if (send_import_chunk(ctx, &req, &imported) < 0)
+			goto error;
+	}
+
+	printf("imported %u of %u entries\n", imported, total);
+	ret = imported == total ? 0 : 1;
+	goto cleanup;
+
+ error:
+	ret = 1;
+	fprintf(stderr, ERR_SERVER_UNREACHABLE);
+
+ cleanup:
+	if (in != stdin)
+		fclose(in);
+
+	return ret;
+}
+
 
 static char *int2str(char tmpbuf[MAX_TMPSTR_SIZE], int i)
 {
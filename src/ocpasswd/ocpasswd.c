@@ -28,6 +28,8 @@
 #include <gnutls/crypto.h>	/* for random */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <getopt.h>
 #ifdef HAVE_CRYPT_H
   /* libcrypt in Fedora28 does not provide prototype
@@ -43,27 +45,13 @@ static const char alphabet[] =
 
 #define SALT_SIZE 16
 static void
-crypt_int(const char *fpasswd, const char *username, const char *groupname,
-	  const char *passwd)
+generate_salt(char salt[SALT_SIZE+16])
 {
 	uint8_t _salt[SALT_SIZE];
-	char salt[SALT_SIZE+16];
-	char *p, *cr_passwd;
-	char *tmp_passwd;
+	char *p;
 	unsigned i;
-	unsigned fpasswd_len = strlen(fpasswd);
-	unsigned tmp_passwd_len;
-	unsigned username_len = strlen(username);
-	struct stat st;
-	FILE *fd, *fd2;
-	char *line = NULL;
-	size_t line_size;
-	ssize_t len, l;
 	int ret;
 
-	setlocale(LC_CTYPE, "C");
-	setlocale(LC_COLLATE, "C");
-
 	ret = gnutls_rnd(GNUTLS_RND_NONCE, _salt, sizeof(_salt));
 	if (ret < 0) {
 		fprintf(stderr, "Error generating nonce: %s\n",
@@ -85,7 +73,29 @@ crypt_int(const char *fpasswd, const char *username, const char *groupname,
 	*p = '$';
 	p++;
 	*p = 0;
-	p++;
+}
+
+static void
+crypt_int(const char *fpasswd, const char *username, const char *groupname,
+	  const char *passwd)
+{
+	char salt[SALT_SIZE+16];
+	char *p, *cr_passwd;
+	char *tmp_passwd;
+	unsigned fpasswd_len = strlen(fpasswd);
+	unsigned tmp_passwd_len;
+	unsigned username_len = strlen(username);
+	struct stat st;
+	FILE *fd, *fd2;
+	char *line = NULL;
+	size_t line_size;
+	ssize_t len, l;
+	int ret;
+
+	setlocale(LC_CTYPE, "C");
+	setlocale(LC_COLLATE, "C");
+
+	generate_salt(salt);
 
 	cr_passwd = crypt(passwd, salt);
 	if (cr_passwd == NULL) { /* try MD5 */
@@ -356,12 +366,606 @@ unlock_user(const char *fpasswd, const char *username)
 	free(tmp_passwd);
 }
 
+/* Batch mode. The operations are read one per line, as:
+ *
+ *   set <username> <groupname> <password>
+ *   delete <username>
+ *   lock <username>
+ *   unlock <username>
+ *
+ * where the password is the rest of the line. They are applied in order
+ * to a copy of the password file in memory, which is written once and
+ * renamed over the original; either all of them take effect or none.
+ * The passwords are hashed before the file is locked, in threads when
+ * crypt_r() is available.
+ */
+#if defined(HAVE_PTHREAD) && defined(HAVE_CRYPT_R)
+# define HASH_THREADS
+# include <pthread.h>
+#endif
+
+#define OP_SET 1
+#define OP_DELETE 2
+#define OP_LOCK 3
+#define OP_UNLOCK 4
+
+#define MAX_HASH_THREADS 64
+
+struct batch_op_st {
+	unsigned type;
+	char *line; /* the fields below point into it */
+	size_t line_size;
+	char *username;
+	char *groupname;
+	char *passwd;
+	char salt[SALT_SIZE+16];
+	char *cr_passwd;
+};
+
+struct batch_st {
+	struct batch_op_st *ops;
+	unsigned nops;
+	unsigned max_ops;
+	unsigned sets;
+
+	/* the next operation to hash */
+	unsigned next;
+#ifdef HASH_THREADS
+	pthread_mutex_t lock;
+#endif
+};
+
+/* The password file; the lines of a user are linked from its slot */
+struct passwd_db_st {
+	char **lines; /* without the newline */
+	unsigned char *removed;
+	unsigned *next; /* the next line of the same user, index + 1 */
+	unsigned nlines;
+	unsigned max_lines;
+
+	unsigned *slots; /* a line of the user, index + 1 */
+	unsigned mask;
+};
+
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size);
+
+	if (p == NULL) {
+		fprintf(stderr, "memory error\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	void *p = realloc(ptr, size);
+
+	if (p == NULL) {
+		fprintf(stderr, "memory error\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static void wipe(void *data, size_t size)
+{
+	volatile char *p = data;
+
+	while (size--)
+		*p++ = 0;
+}
+
+/* Returns the next field separated by spaces or tabs, and moves @sp past
+ * the separator that follows it. */
+static char *next_field(char **sp)
+{
+	char *p = *sp, *f;
+
+	if (p == NULL)
+		return NULL;
+
+	p += strspn(p, " \t");
+	if (*p == 0) {
+		*sp = NULL;
+		return NULL;
+	}
+
+	f = p;
+	p += strcspn(p, " \t");
+	if (*p != 0) {
+		*p = 0;
+		*sp = p + 1;
+	} else {
+		*sp = NULL;
+	}
+
+	return f;
+}
+
+/* Returns 0 if the line holds an operation, 1 if it is empty or a
+ * comment, or -1 after printing an error. */
+static int parse_op(const char *file, unsigned lineno, struct batch_op_st *op)
+{
+	char *sp = op->line, *cmd;
+	size_t len = strlen(op->line);
+
+	if (len > 0 && op->line[len-1] == '\n')
+		op->line[--len] = 0;
+	if (len > 0 && op->line[len-1] == '\r')
+		op->line[--len] = 0;
+
+	cmd = next_field(&sp);
+	if (cmd == NULL || cmd[0] == '#')
+		return 1;
+
+	if (strcmp(cmd, "set") == 0) {
+		op->type = OP_SET;
+	} else if (strcmp(cmd, "delete") == 0) {
+		op->type = OP_DELETE;
+	} else if (strcmp(cmd, "lock") == 0) {
+		op->type = OP_LOCK;
+	} else if (strcmp(cmd, "unlock") == 0) {
+		op->type = OP_UNLOCK;
+	} else {
+		fprintf(stderr, "%s:%u: unknown operation '%s'\n", file, lineno, cmd);
+		return -1;
+	}
+
+	op->username = next_field(&sp);
+	if (op->username == NULL || strchr(op->username, ':') != NULL) {
+		fprintf(stderr, "%s:%u: invalid or missing username\n", file, lineno);
+		return -1;
+	}
+
+	if (op->type == OP_SET) {
+		op->groupname = next_field(&sp);
+		if (op->groupname == NULL || strchr(op->groupname, ':') != NULL) {
+			fprintf(stderr, "%s:%u: invalid or missing group name\n", file, lineno);
+			return -1;
+		}
+
+		op->passwd = sp;
+		if (op->passwd == NULL || op->passwd[0] == 0) {
+			fprintf(stderr, "%s:%u: Please specify a password\n", file, lineno);
+			return -1;
+		}
+	} else if (next_field(&sp) != NULL) {
+		fprintf(stderr, "%s:%u: unexpected text after the username\n", file, lineno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void read_batch(const char *file, struct batch_st *batch)
+{
+	struct batch_op_st *op;
+	FILE *fd;
+	unsigned lineno = 0;
+	int ret, failed = 0;
+
+	if (strcmp(file, "-") == 0) {
+		fd = stdin;
+		file = "<stdin>";
+	} else {
+		fd = fopen(file, "r");
+		if (fd == NULL) {
+			fprintf(stderr, "Cannot open '%s' for reading.\n", file);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (;;) {
+		if (batch->nops == batch->max_ops) {
+			batch->max_ops = batch->max_ops ? batch->max_ops * 2 : 64;
+			batch->ops = xrealloc(batch->ops, batch->max_ops * sizeof(batch->ops[0]));
+		}
+
+		op = &batch->ops[batch->nops];
+		memset(op, 0, sizeof(*op));
+		if (getline(&op->line, &op->line_size, fd) <= 0) {
+			free(op->line);
+			break;
+		}
+		lineno++;
+
+		ret = parse_op(file, lineno, op);
+		if (ret < 0)
+			failed = 1;
+		if (ret != 0) {
+			wipe(op->line, op->line_size);
+			free(op->line);
+			continue;
+		}
+
+		if (op->type == OP_SET)
+			batch->sets++;
+		batch->nops++;
+	}
+
+	if (ferror(fd)) {
+		fprintf(stderr, "Error reading '%s'.\n", file);
+		failed = 1;
+	}
+	if (fd != stdin)
+		fclose(fd);
+
+	if (failed)
+		exit(EXIT_FAILURE);
+}
+
+static char *hash_passwd(const char *passwd, char *salt, void *data)
+{
+	char *cr_passwd;
+
+#ifdef HASH_THREADS
+	cr_passwd = crypt_r(passwd, salt, data);
+	if (cr_passwd == NULL || cr_passwd[0] == '*') { /* try MD5 */
+		salt[1] = '1';
+		cr_passwd = crypt_r(passwd, salt, data);
+	}
+#else
+	(void)data;
+	cr_passwd = crypt(passwd, salt);
+	if (cr_passwd == NULL || cr_passwd[0] == '*') { /* try MD5 */
+		salt[1] = '1';
+		cr_passwd = crypt(passwd, salt);
+	}
+#endif
+	if (cr_passwd == NULL || cr_passwd[0] == '*')
+		return NULL;
+
+	return strdup(cr_passwd);
+}
+
+/* Hashes the pending passwords of the batch; called from every thread */
+static void hash_ops(struct batch_st *batch, void *data)
+{
+	struct batch_op_st *op;
+	unsigned i;
+
+	for (;;) {
+#ifdef HASH_THREADS
+		pthread_mutex_lock(&batch->lock);
+#endif
+		while (batch->next < batch->nops &&
+		       batch->ops[batch->next].type != OP_SET)
+			batch->next++;
+		i = batch->next;
+		if (i < batch->nops)
+			batch->next++;
+#ifdef HASH_THREADS
+		pthread_mutex_unlock(&batch->lock);
+#endif
+		if (i >= batch->nops)
+			break;
+
+		op = &batch->ops[i];
+		op->cr_passwd = hash_passwd(op->passwd, op->salt, data);
+	}
+}
+
+#ifdef HASH_THREADS
+static void *hash_thread(void *arg)
+{
+	struct batch_st *batch = arg;
+	struct crypt_data *data;
+
+	/* large; it must be zeroed before the first use */
+	data = calloc(1, sizeof(*data));
+	if (data != NULL) {
+		hash_ops(batch, data);
+		wipe(data, sizeof(*data));
+		free(data);
+	}
+	return NULL;
+}
+#endif
+
+static void hash_batch(struct batch_st *batch)
+{
+	unsigned i;
+#ifdef HASH_THREADS
+	pthread_t threads[MAX_HASH_THREADS];
+	unsigned started = 0, nthreads;
+	long cpus;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = cpus > 0 ? cpus : 1;
+	if (nthreads > MAX_HASH_THREADS)
+		nthreads = MAX_HASH_THREADS;
+	if (nthreads > batch->sets)
+		nthreads = batch->sets;
+
+	pthread_mutex_init(&batch->lock, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[started], NULL, hash_thread, batch) != 0)
+			break;
+		started++;
+	}
+
+	/* with no thread the remaining passwords are hashed here */
+	hash_thread(batch);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&batch->lock);
+#else
+	hash_ops(batch, NULL);
+#endif
+
+	for (i = 0; i < batch->nops; i++) {
+		if (batch->ops[i].type == OP_SET && batch->ops[i].cr_passwd == NULL) {
+			fprintf(stderr, "Error in crypt().\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static unsigned username_len(const char *line)
+{
+	return strchr(line, ':') - line;
+}
+
+/* Returns the slot of the lines of @username, or the empty slot where
+ * they would be linked. */
+static unsigned find_slot(struct passwd_db_st *db, const char *username, unsigned len)
+{
+	const char *line;
+	uint32_t h = 2166136261u;
+	unsigned i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++)
+		h = (h ^ (uint8_t)username[i]) * 16777619u;
+
+	i = h & db->mask;
+	while (db->slots[i] != 0) {
+		line = db->lines[db->slots[i] - 1];
+		if (username_len(line) == len && strncmp(line, username, len) == 0)
+			break;
+		i = (i + 1) & db->mask;
+	}
+
+	return i;
+}
+
+static void add_line(struct passwd_db_st *db, char *line)
+{
+	unsigned n = db->nlines, i;
+
+	if (n == db->max_lines) {
+		fprintf(stderr, "memory error\n");
+		exit(EXIT_FAILURE);
+	}
+
+	db->lines[n] = line;
+	db->removed[n] = 0;
+
+	i = find_slot(db, line, username_len(line));
+	db->next[n] = db->slots[i];
+	db->slots[i] = n + 1;
+	db->nlines++;
+}
+
+/* Reads the password file; lines without a username are dropped, as
+ * when a single user is modified. The table is sized for @extra lines
+ * to be added. A missing file is empty. */
+static int load_db(const char *fpasswd, struct passwd_db_st *db, unsigned extra)
+{
+	FILE *fd;
+	char *line = NULL, **lines = NULL;
+	size_t line_size = 0;
+	unsigned nlines = 0, max = 0, size, i;
+	ssize_t len;
+
+	fd = fopen(fpasswd, "r");
+	if (fd == NULL && errno != ENOENT) {
+		fprintf(stderr, "Cannot open '%s' for reading.\n", fpasswd);
+		return -1;
+	}
+
+	if (fd != NULL) {
+		while ((len = getline(&line, &line_size, fd)) > 0) {
+			if (line[len-1] == '\n')
+				line[--len] = 0;
+			if (strchr(line, ':') == NULL)
+				continue;
+
+			if (nlines == max) {
+				max = max ? max * 2 : 1024;
+				lines = xrealloc(lines, max * sizeof(lines[0]));
+			}
+			lines[nlines] = xmalloc(len + 1);
+			memcpy(lines[nlines], line, len + 1);
+			nlines++;
+		}
+		if (ferror(fd)) {
+			fprintf(stderr, "Error reading '%s'.\n", fpasswd);
+			return -1;
+		}
+		free(line);
+		fclose(fd);
+	}
+
+	memset(db, 0, sizeof(*db));
+	db->max_lines = nlines + extra;
+	db->lines = xmalloc((db->max_lines + 1) * sizeof(db->lines[0]));
+	db->removed = xmalloc(db->max_lines + 1);
+	db->next = xmalloc((db->max_lines + 1) * sizeof(db->next[0]));
+
+	/* at most half full */
+	for (size = 16; size < 2 * db->max_lines; size <<= 1)
+		;
+	db->slots = xmalloc(size * sizeof(db->slots[0]));
+	memset(db->slots, 0, size * sizeof(db->slots[0]));
+	db->mask = size - 1;
+
+	for (i = 0; i < nlines; i++)
+		add_line(db, lines[i]);
+	free(lines);
+	return 0;
+}
+
+static void replace_line(struct passwd_db_st *db, unsigned n, char *line)
+{
+	free(db->lines[n]);
+	db->lines[n] = line;
+}
+
+static void apply_op(struct passwd_db_st *db, struct batch_op_st *op)
+{
+	unsigned len = strlen(op->username);
+	unsigned n, found = 0;
+	size_t size;
+	char *line, *p;
+
+	n = db->slots[find_slot(db, op->username, len)];
+	for (; n != 0; n = db->next[n - 1]) {
+		if (db->removed[n - 1])
+			continue;
+		line = db->lines[n - 1];
+
+		switch (op->type) {
+		case OP_SET:
+			size = len + strlen(op->groupname) + strlen(op->cr_passwd) + 3;
+			p = xmalloc(size);
+			snprintf(p, size, "%s:%s:%s", op->username, op->groupname, op->cr_passwd);
+			replace_line(db, n - 1, p);
+			found = 1;
+			break;
+		case OP_DELETE:
+			db->removed[n - 1] = 1;
+			break;
+		case OP_LOCK:
+		case OP_UNLOCK:
+			p = strchr(line + len + 1, ':');
+			if (p == NULL) {
+				db->removed[n - 1] = 1;
+				break;
+			}
+			p++;
+
+			if (op->type == OP_LOCK && *p != '!') {
+				size = strlen(line) + 2;
+				line = xmalloc(size);
+				snprintf(line, size, "%.*s!%s",
+					 (int)(p - db->lines[n - 1]), db->lines[n - 1], p);
+				replace_line(db, n - 1, line);
+			} else if (op->type == OP_UNLOCK && *p == '!') {
+				memmove(p, p + 1, strlen(p));
+			}
+			break;
+		}
+	}
+
+	if (op->type == OP_SET && found == 0) {
+		size = len + strlen(op->groupname) + strlen(op->cr_passwd) + 3;
+		p = xmalloc(size);
+		snprintf(p, size, "%s:%s:%s", op->username, op->groupname, op->cr_passwd);
+		add_line(db, p);
+	}
+}
+
+static void
+batch_run(const char *fpasswd, const char *file)
+{
+	struct batch_st batch;
+	struct passwd_db_st db;
+	char *tmp_passwd;
+	unsigned tmp_passwd_len = strlen(fpasswd) + 5;
+	unsigned i;
+	FILE *fd;
+	int fd2, ret;
+
+	setlocale(LC_CTYPE, "C");
+	setlocale(LC_COLLATE, "C");
+
+	memset(&batch, 0, sizeof(batch));
+	read_batch(file, &batch);
+
+	for (i = 0; i < batch.nops; i++) {
+		if (batch.ops[i].type == OP_SET)
+			generate_salt(batch.ops[i].salt);
+	}
+
+	hash_batch(&batch);
+
+	tmp_passwd = xmalloc(tmp_passwd_len);
+	snprintf(tmp_passwd, tmp_passwd_len, "%s.tmp", fpasswd);
+
+	/* the file is locked while it is read and written */
+	fd2 = open(tmp_passwd, O_WRONLY|O_CREAT|O_EXCL, 0600);
+	if (fd2 == -1) {
+		if (errno == EEXIST)
+			fprintf(stderr, "file '%s' is locked.\n", fpasswd);
+		else
+			fprintf(stderr, "Cannot open '%s' for writing.\n", tmp_passwd);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = fdopen(fd2, "w");
+	if (fd == NULL) {
+		fprintf(stderr, "Cannot open '%s' for writing.\n", tmp_passwd);
+		goto fail;
+	}
+
+	if (load_db(fpasswd, &db, batch.sets) < 0) {
+		fclose(fd);
+		goto fail;
+	}
+
+	for (i = 0; i < batch.nops; i++)
+		apply_op(&db, &batch.ops[i]);
+
+	for (i = 0; i < db.nlines; i++) {
+		if (!db.removed[i])
+			fprintf(fd, "%s\n", db.lines[i]); /* lgtm[cpp/cleartext-storage-file] */
+	}
+
+	if (fflush(fd) != 0 || fsync(fileno(fd)) != 0 || ferror(fd)) {
+		fprintf(stderr, "Cannot write to '%s'.\n", tmp_passwd);
+		fclose(fd);
+		goto fail;
+	}
+	fclose(fd);
+
+	ret = rename(tmp_passwd, fpasswd);
+	if (ret == -1) {
+		fprintf(stderr, "Cannot write to '%s'.\n", fpasswd);
+		goto fail;
+	}
+	free(tmp_passwd);
+
+	for (i = 0; i < db.nlines; i++)
+		free(db.lines[i]);
+	free(db.lines);
+	free(db.removed);
+	free(db.next);
+	free(db.slots);
+
+	for (i = 0; i < batch.nops; i++) {
+		wipe(batch.ops[i].line, batch.ops[i].line_size);
+		free(batch.ops[i].line);
+		free(batch.ops[i].cr_passwd);
+	}
+	free(batch.ops);
+	return;
+
+ fail:
+	unlink(tmp_passwd);
+	exit(EXIT_FAILURE);
+}
+
 static const struct option long_options[] = {
 	{"passwd", 1, 0, 'c'},
 	{"groupname", 1, 0, 'g'},
 	{"delete", 0, 0, 'd'},
 	{"lock", 0, 0, 'l'},
 	{"unlock", 0, 0, 'u'},
+	{"batch", 1, 0, 'b'},
 	{"help", 0, 0, 'h'},
 	{"version", 0, 0, 'v'},
 	{NULL, 0, 0, 0}
@@ -378,6 +982,7 @@ void usage(void)
 	fprintf(stderr, "   -d, --delete               Delete user\n");
 	fprintf(stderr, "   -l, --lock                 Lock user\n");
 	fprintf(stderr, "   -u, --unlock               Unlock user\n");
+	fprintf(stderr, "   -b, --batch=file           Apply the operations listed in file (- for stdin)\n");
 	fprintf(stderr, "   -v, --version              output version information and exit\n");
 	fprintf(stderr, "   -h, --help                 display extended usage information and exit\n");
 	fprintf(stderr, "\n");
@@ -402,12 +1007,13 @@ void version(void)
 #define FLAG_DELETE 1
 #define FLAG_LOCK (1<<1)
 #define FLAG_UNLOCK (1<<2)
+#define FLAG_BATCH (1<<3)
 
 int main(int argc, char **argv)
 {
 	int ret, c;
 	const char *username = NULL;
-	char *groupname = NULL, *fpasswd = NULL;
+	char *groupname = NULL, *fpasswd = NULL, *fbatch = NULL;
 	char* passwd = NULL;
 	unsigned free_passwd = 0;
 	size_t l, i;
@@ -421,7 +1027,7 @@ int main(int argc, char **argv)
 	umask(066);
 
 	while (1) {
-		c = getopt_long(argc, argv, "c:g:dluvh", long_options, NULL);
+		c = getopt_long(argc, argv, "c:g:dlub:vh", long_options, NULL);
 		if (c == -1)
 			break;
 
@@ -461,6 +1067,14 @@ int main(int argc, char **argv)
 			}
 			flags |= FLAG_LOCK;
 			break;
+		case 'b':
+			if (flags) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			flags |= FLAG_BATCH;
+			fbatch = strdup(optarg);
+			break;
 		case 'h':
 			usage();
 			exit(EXIT_SUCCESS);
@@ -470,7 +1084,12 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (optind < argc && argc-optind == 1) {
+	if (flags & FLAG_BATCH) {
+		if (optind != argc || groupname) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	} else if (optind < argc && argc-optind == 1) {
 		username = argv[optind++];
 	} else {
 		usage();
@@ -482,7 +1101,10 @@ int main(int argc, char **argv)
 	if (!fpasswd)
 		fpasswd = strdup(DEFAULT_OCPASSWD);
 
-	if (flags & FLAG_LOCK) {
+	if (flags & FLAG_BATCH) {
+		batch_run(fpasswd, fbatch);
+		free(fbatch);
+	} else if (flags & FLAG_LOCK) {
 		lock_user(fpasswd, username);
 	} else if (flags & FLAG_UNLOCK) {
 		unlock_user(fpasswd, username);
@@ -22,6 +22,7 @@
 #include <proc-search.h>
 #include <main.h>
 #include <common.h>
+#include <keyed-hash.h>
 
 struct find_ip_st {
 	struct sockaddr_storage *sockaddr;
@@ -43,32 +44,32 @@ static size_t rehash_ip(const void* _p, void* unused)
 {
 	const struct proc_st * proc = _p;
 
-	return hash_any(
+	return keyed_hash(
 		SA_IN_P_GENERIC(&proc->remote_addr, proc->remote_addr_len),
-		SA_IN_SIZE(proc->remote_addr_len), 0);
+		SA_IN_SIZE(proc->remote_addr_len));
 }
 
 static size_t rehash_dtls_ip(const void* _p, void* unused)
 {
 	const struct proc_st * proc = _p;
 
-	return hash_any(
+	return keyed_hash(
 		SA_IN_P_GENERIC(&proc->dtls_remote_addr, proc->dtls_remote_addr_len),
-		SA_IN_SIZE(proc->dtls_remote_addr_len), 0);
+		SA_IN_SIZE(proc->dtls_remote_addr_len));
 }
 
 static size_t rehash_dtls_id(const void* _p, void* unused)
 {
 	const struct proc_st * proc = _p;
 
-	return hash_any(proc->dtls_session_id, proc->dtls_session_id_size, 0);
+	return keyed_hash(proc->dtls_session_id, proc->dtls_session_id_size);
 }
 
 static size_t rehash_sid(const void* _p, void* unused)
 {
 	const struct proc_st * proc = _p;
 
-	return hash_any(proc->sid, sizeof(proc->sid), 0);
+	return keyed_hash(proc->sid, sizeof(proc->sid));
 }
 
 void proc_table_init(main_server_st *s)
@@ -251,8 +252,8 @@ struct proc_st *proc_search_single_ip(struct main_server_st *s,
 	fip.sockaddr = sockaddr;
 	fip.sockaddr_size = sockaddr_size;
 
-	h = hash_any(SA_IN_P_GENERIC(sockaddr, sockaddr_size),
-			SA_IN_SIZE(sockaddr_size), 0);
+	h = keyed_hash(SA_IN_P_GENERIC(sockaddr, sockaddr_size),
+			SA_IN_SIZE(sockaddr_size));
 
 	fip.found_ips = 0;
 	proc = htable_get(s->proc_table.db_dtls_ip, h, local_ip_cmp, &fip);
@@ -292,7 +293,7 @@ struct proc_st *proc_search_dtls_id(struct main_server_st *s,
 	fdtls_id.dtls_id = id;
 	fdtls_id.dtls_id_size = id_size;
 
-	return htable_get(s->proc_table.db_dtls_id, hash_any(id, id_size, 0), dtls_id_cmp, &fdtls_id);
+	return htable_get(s->proc_table.db_dtls_id, keyed_hash(id, id_size), dtls_id_cmp, &fdtls_id);
 }
 
 static bool sid_cmp(const void* _c1, void* _c2)
@@ -315,5 +316,5 @@ struct proc_st *proc_search_sid(struct main_server_st *s,
 	struct find_sid_st fsid;
 	fsid.sid = sid;
 
-	return htable_get(s->proc_table.db_sid, hash_any(sid, SID_SIZE, 0), sid_cmp, &fsid);
+	return htable_get(s->proc_table.db_sid, keyed_hash(sid, SID_SIZE), sid_cmp, &fsid);
 }
@@ -0,0 +1,817 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <syslog.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <talloc.h>
+#include <ccan/list/list.h>
+
+#include <sec-mod.h>
+#include <radius-client.h>
+#include <cloexec.h>
+
+#ifdef HAVE_RADIUS
+
+typedef struct radius_server_st {
+	char *name;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char *secret;
+	unsigned weight;
+
+	/* health */
+	time_t dead_until;
+	unsigned failures; /* consecutive */
+	uint64_t requests;
+	uint64_t timeouts;
+} radius_server_st;
+
+struct radius_client_st {
+	radius_server_st servers[RADIUS_MAX_SERVERS];
+	unsigned nservers;
+
+	unsigned timeout; /* seconds per transmission */
+	unsigned retries; /* retransmissions per server */
+	unsigned deadtime;
+};
+
+/* The shared socket of an address family */
+typedef struct radius_sock_st {
+	sec_mod_watch_st w; /* must be first */
+	int family;
+	struct radius_req_st *pending[256]; /* by identifier */
+	unsigned npending;
+	unsigned next_id;
+	struct list_head waiting; /* requests waiting for an identifier */
+} radius_sock_st;
+
+struct radius_req_st {
+	struct radius_client_st *client;
+	unsigned code;
+	radius_reply_func func;
+	void *priv;
+
+	uint8_t attrs[RADIUS_MAX_PACKET - RADIUS_HDR_SIZE];
+	unsigned attrs_len;
+	uint8_t password[RADIUS_MAX_PASSWORD];
+	unsigned password_len;
+	unsigned has_password;
+
+	/* the transmission in progress */
+	radius_sock_st *sock;
+	int id; /* -1 when it has no identifier */
+	unsigned waiting; /* in sock->waiting */
+	struct list_node list;
+	int server;
+	uint32_t tried; /* the servers tried; a bitmask */
+	unsigned tries; /* transmissions to the current server */
+	time_t deadline;
+	uint8_t auth[16]; /* the request authenticator */
+	uint8_t packet[RADIUS_MAX_PACKET];
+	unsigned packet_len;
+};
+
+static radius_sock_st *radius_socks[2];
+
+static unsigned random_u32(void)
+{
+	unsigned r = 0;
+
+	if (gnutls_rnd(GNUTLS_RND_NONCE, &r, sizeof(r)) < 0)
+		r = (unsigned)random();
+	return r;
+}
+
+/* Chooses among the servers not tried yet. The live ones are chosen at
+ * random in proportion to their weight; if all are dead, the one whose
+ * dead time ends first is retried. */
+static int select_server(struct radius_client_st *c, uint32_t tried, time_t now)
+{
+	unsigned i, total = 0, r;
+	int best = -1;
+
+	for (i = 0; i < c->nservers; i++) {
+		if (!(tried & (1U << i)) && c->servers[i].dead_until <= now)
+			total += c->servers[i].weight;
+	}
+
+	if (total > 0) {
+		r = random_u32() % total;
+		for (i = 0; i < c->nservers; i++) {
+			if ((tried & (1U << i)) || c->servers[i].dead_until > now)
+				continue;
+			if (r < c->servers[i].weight)
+				return i;
+			r -= c->servers[i].weight;
+		}
+	}
+
+	for (i = 0; i < c->nservers; i++) {
+		if (tried & (1U << i))
+			continue;
+		if (best == -1 || c->servers[i].dead_until < c->servers[best].dead_until)
+			best = i;
+	}
+
+	return best;
+}
+
+static int md5_concat(const void *d1, size_t l1, const void *d2, size_t l2,
+		      uint8_t out[16])
+{
+	gnutls_hash_hd_t h;
+	int ret;
+
+	ret = gnutls_hash_init(&h, GNUTLS_DIG_MD5);
+	if (ret < 0)
+		return ret;
+
+	gnutls_hash(h, d1, l1);
+	gnutls_hash(h, d2, l2);
+	gnutls_hash_deinit(h, out);
+	return 0;
+}
+
+/* The User-Password hiding of RFC2865 section 5.2 */
+static int hide_password(const struct radius_req_st *req, const char *secret,
+			 uint8_t *out, unsigned *out_len)
+{
+	unsigned len, i, j;
+	uint8_t b[16];
+	const uint8_t *prev = req->auth;
+
+	len = (req->password_len + 15) & ~15U;
+	if (len == 0)
+		len = 16;
+
+	memset(out, 0, len);
+	memcpy(out, req->password, req->password_len);
+
+	for (i = 0; i < len; i += 16) {
+		if (md5_concat(secret, strlen(secret), prev, 16, b) < 0)
+			return -1;
+		for (j = 0; j < 16; j++)
+			out[i + j] ^= b[j];
+		prev = &out[i];
+	}
+
+	safe_memset(b, 0, sizeof(b));
+	*out_len = len;
+	return 0;
+}
+
+/* Encodes the request for its current server and identifier */
+static int build_packet(struct radius_req_st *req)
+{
+	radius_server_st *srv = &req->client->servers[req->server];
+	uint8_t *p = req->packet;
+	uint8_t mac[16];
+	unsigned len = RADIUS_HDR_SIZE, ma_offset = 0, plen;
+
+	p[0] = req->code;
+	p[1] = req->id;
+
+	if (req->code == RADIUS_CODE_ACCESS_REQUEST) {
+		if (gnutls_rnd(GNUTLS_RND_NONCE, req->auth, sizeof(req->auth)) < 0)
+			return -1;
+		memcpy(&p[4], req->auth, 16);
+
+		/* always protected by a Message-Authenticator */
+		ma_offset = len;
+		p[len] = RADIUS_ATTR_MESSAGE_AUTHENTICATOR;
+		p[len + 1] = 18;
+		memset(&p[len + 2], 0, 16);
+		len += 18;
+	} else {
+		memset(&p[4], 0, 16);
+	}
+
+	if (len + req->attrs_len > RADIUS_MAX_PACKET)
+		return -1;
+	memcpy(&p[len], req->attrs, req->attrs_len);
+	len += req->attrs_len;
+
+	if (req->has_password) {
+		if (len + 2 + RADIUS_MAX_PASSWORD > RADIUS_MAX_PACKET)
+			return -1;
+		if (hide_password(req, srv->secret, &p[len + 2], &plen) < 0)
+			return -1;
+		p[len] = RADIUS_ATTR_USER_PASSWORD;
+		p[len + 1] = plen + 2;
+		len += plen + 2;
+	}
+
+	p[2] = len >> 8;
+	p[3] = len & 0xff;
+
+	if (req->code != RADIUS_CODE_ACCESS_REQUEST) {
+		/* RFC2866 request authenticator */
+		if (md5_concat(p, len, srv->secret, strlen(srv->secret), req->auth) < 0)
+			return -1;
+		memcpy(&p[4], req->auth, 16);
+	} else {
+		if (gnutls_hmac_fast(GNUTLS_MAC_MD5, srv->secret, strlen(srv->secret),
+				     p, len, mac) < 0)
+			return -1;
+		memcpy(&p[ma_offset + 2], mac, 16);
+	}
+
+	req->packet_len = len;
+	return 0;
+}
+
+static void transmit(sec_mod_st *sec, struct radius_req_st *req, time_t now)
+{
+	radius_server_st *srv = &req->client->servers[req->server];
+	ssize_t ret;
+
+	req->tries++;
+	req->deadline = now + req->client->timeout;
+
+	ret = sendto(req->sock->w.fd, req->packet, req->packet_len, 0,
+		     (struct sockaddr *)&srv->addr, srv->addr_len);
+	if (ret < 0) {
+		/* treated as a lost packet */
+		seclog(sec, LOG_DEBUG, "radius: error sending to %s: %s",
+		       srv->name, strerror(errno));
+	}
+}
+
+static void release_id(struct radius_req_st *req)
+{
+	radius_sock_st *sock = req->sock;
+
+	if (req->id != -1) {
+		sock->pending[req->id] = NULL;
+		sock->npending--;
+		req->id = -1;
+	}
+}
+
+/* Starts the transmission of a request to a server not tried yet;
+ * returns -1 if there is none. */
+static int start_server(sec_mod_st *sec, struct radius_req_st *req, time_t now)
+{
+	int server;
+
+	for (;;) {
+		server = select_server(req->client, req->tried, now);
+		if (server < 0)
+			return -1;
+
+		req->server = server;
+		req->tried |= (1U << server);
+		req->tries = 0;
+
+		if (req->client->servers[server].addr.ss_family != req->sock->family)
+			continue;
+
+		if (build_packet(req) < 0) {
+			seclog(sec, LOG_ERR, "radius: error encoding request for %s",
+			       req->client->servers[server].name);
+			continue;
+		}
+
+		req->client->servers[server].requests++;
+		transmit(sec, req, now);
+		return 0;
+	}
+}
+
+static int assign_id(radius_sock_st *sock, struct radius_req_st *req)
+{
+	unsigned i, id;
+
+	if (sock->npending >= 256)
+		return -1;
+
+	for (i = 0; i < 256; i++) {
+		id = (sock->next_id + i) & 0xff;
+		if (sock->pending[id] == NULL)
+			break;
+	}
+
+	sock->pending[id] = req;
+	sock->npending++;
+	sock->next_id = id + 1;
+	req->id = id;
+	return 0;
+}
+
+static void finish(sec_mod_st *sec, struct radius_req_st *req, unsigned code,
+		   const uint8_t *attrs, unsigned attrs_len);
+
+/* Gives the released identifiers to the waiting requests */
+static void start_waiting(sec_mod_st *sec, radius_sock_st *sock)
+{
+	struct radius_req_st *req;
+	time_t now = time(NULL);
+
+	while (sock->npending < 256 &&
+	       (req = list_top(&sock->waiting, struct radius_req_st, list)) != NULL) {
+		list_del(&req->list);
+		req->waiting = 0;
+
+		assign_id(sock, req);
+		if (start_server(sec, req, now) < 0)
+			finish(sec, req, RADIUS_CODE_TIMEOUT, NULL, 0);
+	}
+}
+
+static void finish(sec_mod_st *sec, struct radius_req_st *req, unsigned code,
+		   const uint8_t *attrs, unsigned attrs_len)
+{
+	radius_sock_st *sock = req->sock;
+
+	release_id(req);
+	req->sock = NULL;
+
+	/* may release req */
+	req->func(sec, req->priv, code, attrs, attrs_len);
+
+	if (sec != NULL)
+		start_waiting(sec, sock);
+}
+
+static int sockaddr_match(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return 0;
+
+	if (a->ss_family == AF_INET) {
+		const struct sockaddr_in *a4 = (void *)a, *b4 = (void *)b;
+		return a4->sin_port == b4->sin_port &&
+		       memcmp(&a4->sin_addr, &b4->sin_addr, sizeof(a4->sin_addr)) == 0;
+	} else {
+		const struct sockaddr_in6 *a6 = (void *)a, *b6 = (void *)b;
+		return a6->sin6_port == b6->sin6_port &&
+		       memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+	}
+}
+
+/* Checks the response authenticator and, if present, the
+ * Message-Authenticator of a reply */
+static int verify_reply(struct radius_req_st *req, radius_server_st *srv,
+			uint8_t *p, unsigned len)
+{
+	uint8_t digest[16], ma[16], mac[16];
+	gnutls_hash_hd_t h;
+	unsigned i;
+
+	/* MD5(code + id + length + request authenticator + attributes + secret) */
+	if (gnutls_hash_init(&h, GNUTLS_DIG_MD5) < 0)
+		return -1;
+	gnutls_hash(h, p, 4);
+	gnutls_hash(h, req->auth, 16);
+	gnutls_hash(h, &p[RADIUS_HDR_SIZE], len - RADIUS_HDR_SIZE);
+	gnutls_hash(h, srv->secret, strlen(srv->secret));
+	gnutls_hash_deinit(h, digest);
+
+	if (memcmp(digest, &p[4], 16) != 0)
+		return -1;
+
+	for (i = RADIUS_HDR_SIZE; i + 2 <= len; i += p[i + 1]) {
+		if (p[i + 1] < 2 || i + p[i + 1] > len)
+			return -1;
+		if (p[i] != RADIUS_ATTR_MESSAGE_AUTHENTICATOR)
+			continue;
+		if (p[i + 1] != 18)
+			return -1;
+
+		memcpy(ma, &p[i + 2], 16);
+		memset(&p[i + 2], 0, 16);
+		memcpy(&p[4], req->auth, 16);
+		if (gnutls_hmac_fast(GNUTLS_MAC_MD5, srv->secret, strlen(srv->secret),
+				     p, len, mac) < 0 || memcmp(mac, ma, 16) != 0)
+			return -1;
+		break;
+	}
+
+	return 0;
+}
+
+static void radius_sock_read(sec_mod_st *sec, sec_mod_watch_st *w)
+{
+	radius_sock_st *sock = (radius_sock_st *)w;
+	struct radius_req_st *req;
+	radius_server_st *srv;
+	struct sockaddr_storage from;
+	socklen_t from_len;
+	uint8_t p[RADIUS_MAX_PACKET];
+	unsigned len, n;
+	ssize_t ret;
+
+	/* drain the socket, with a bound to let other work proceed */
+	for (n = 0; n < 64; n++) {
+		from_len = sizeof(from);
+		ret = recvfrom(w->fd, p, sizeof(p), 0, (struct sockaddr *)&from, &from_len);
+		if (ret < 0)
+			break;
+
+		if (ret < RADIUS_HDR_SIZE)
+			continue;
+
+		len = (p[2] << 8) | p[3];
+		if (len < RADIUS_HDR_SIZE || len > ret)
+			continue;
+
+		req = sock->pending[p[1]];
+		if (req == NULL || req->server < 0) {
+			seclog(sec, LOG_DEBUG, "radius: ignoring reply with unknown identifier %u",
+			       (unsigned)p[1]);
+			continue;
+		}
+
+		srv = &req->client->servers[req->server];
+		if (!sockaddr_match(&from, &srv->addr)) {
+			seclog(sec, LOG_DEBUG, "radius: ignoring reply from unexpected address");
+			continue;
+		}
+
+		if (verify_reply(req, srv, p, len) < 0) {
+			seclog(sec, LOG_INFO, "radius: ignoring reply from %s with invalid authenticator",
+			       srv->name);
+			continue;
+		}
+
+		if (srv->dead_until != 0) {
+			seclog(sec, LOG_INFO, "radius: server %s is responding", srv->name);
+		}
+		srv->dead_until = 0;
+		srv->failures = 0;
+
+		finish(sec, req, p[0], &p[RADIUS_HDR_SIZE], len - RADIUS_HDR_SIZE);
+	}
+}
+
+static int radius_sock_expire(sec_mod_st *sec, sec_mod_watch_st *w, time_t now)
+{
+	radius_sock_st *sock = (radius_sock_st *)w;
+	struct radius_req_st *req;
+	radius_server_st *srv;
+	int secs = -1;
+	unsigned i;
+
+	for (i = 0; i < 256 && sock->npending > 0; i++) {
+		req = sock->pending[i];
+		if (req == NULL)
+			continue;
+
+		if (req->deadline <= now) {
+			srv = &req->client->servers[req->server];
+
+			if (req->tries <= req->client->retries) {
+				transmit(sec, req, now);
+			} else {
+				srv->timeouts++;
+				srv->failures++;
+				if (req->client->deadtime > 0) {
+					if (srv->dead_until <= now)
+						seclog(sec, LOG_NOTICE, "radius: server %s is not responding; marking it dead for %u secs",
+						       srv->name, req->client->deadtime);
+					srv->dead_until = now + req->client->deadtime;
+				}
+
+				if (start_server(sec, req, now) < 0) {
+					seclog(sec, LOG_NOTICE, "radius: no server replied to request");
+					finish(sec, req, RADIUS_CODE_TIMEOUT, NULL, 0);
+					continue;
+				}
+			}
+		}
+
+		if (secs == -1 || req->deadline - now < secs)
+			secs = req->deadline - now;
+	}
+
+	/* identifiers of cancelled requests */
+	if (!list_empty(&sock->waiting)) {
+		start_waiting(sec, sock);
+		if (sock->npending > 0 && (secs == -1 || secs > 1))
+			secs = 1;
+	}
+
+	return secs;
+}
+
+static radius_sock_st *get_sock(sec_mod_st *sec, int family)
+{
+	radius_sock_st **s = &radius_socks[family == AF_INET6];
+	radius_sock_st *sock;
+	int fd;
+
+	if (*s != NULL)
+		return *s;
+
+	sock = talloc_zero(NULL, radius_sock_st);
+	if (sock == NULL)
+		return NULL;
+
+	fd = socket(family, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		seclog(sec, LOG_ERR, "radius: could not create socket: %s", strerror(errno));
+		talloc_free(sock);
+		return NULL;
+	}
+	set_cloexec_flag(fd, 1);
+	set_non_block(fd);
+
+	sock->family = family;
+	list_head_init(&sock->waiting);
+	sock->w.fd = fd;
+	sock->w.read = radius_sock_read;
+	sock->w.expire = radius_sock_expire;
+
+	if (sec_mod_watch_add(&sock->w) < 0) {
+		close(fd);
+		talloc_free(sock);
+		return NULL;
+	}
+
+	*s = sock;
+	return sock;
+}
+
+static int req_destructor(struct radius_req_st *req)
+{
+	if (req->waiting)
+		list_del(&req->list);
+	if (req->sock)
+		release_id(req);
+
+	safe_memset(req->password, 0, sizeof(req->password));
+	return 0;
+}
+
+struct radius_req_st *radius_req_new(void *pool, struct radius_client_st *client,
+				     unsigned code, radius_reply_func func, void *priv)
+{
+	struct radius_req_st *req;
+
+	req = talloc_zero(pool, struct radius_req_st);
+	if (req == NULL)
+		return NULL;
+
+	req->client = client;
+	req->code = code;
+	req->func = func;
+	req->priv = priv;
+	req->id = -1;
+	req->server = -1;
+	talloc_set_destructor(req, req_destructor);
+
+	return req;
+}
+
+int radius_req_add(struct radius_req_st *req, unsigned type, const void *data, unsigned len)
+{
+	uint8_t *p;
+
+	if (type == 0 || type > 255 || len > 253 ||
+	    req->attrs_len + len + 2 > sizeof(req->attrs))
+		return -1;
+
+	p = &req->attrs[req->attrs_len];
+	p[0] = type;
+	p[1] = len + 2;
+	memcpy(&p[2], data, len);
+	req->attrs_len += len + 2;
+
+	return 0;
+}
+
+int radius_req_add_raw(struct radius_req_st *req, const uint8_t *attrs, unsigned len)
+{
+	if (req->attrs_len + len > sizeof(req->attrs))
+		return -1;
+
+	memcpy(&req->attrs[req->attrs_len], attrs, len);
+	req->attrs_len += len;
+	return 0;
+}
+
+int radius_avpairs_encode(VALUE_PAIR *vp, uint8_t *out, unsigned out_size)
+{
+	unsigned len = 0, size;
+	const void *data;
+	uint32_t v;
+
+	for (; vp != NULL; vp = vp->next) {
+		if (vp->attribute == PW_USER_PASSWORD)
+			continue;
+
+		if (vp->type == PW_TYPE_STRING) {
+			data = vp->strvalue;
+			size = vp->lvalue;
+		} else if (vp->type == PW_TYPE_INTEGER || vp->type == PW_TYPE_IPADDR) {
+			v = htonl(vp->lvalue);
+			data = &v;
+			size = sizeof(v);
+		} else if (vp->type == PW_TYPE_IPV6ADDR) {
+			data = vp->strvalue;
+			size = 16;
+		} else {
+			size = UINT_MAX;
+		}
+
+		if (vp->attribute == 0 || vp->attribute > 255 || size > 253 ||
+		    len + size + 2 > out_size) {
+			syslog(LOG_ERR, "radius: cannot encode attribute %u of type %u",
+			       (unsigned)vp->attribute, (unsigned)vp->type);
+			return -1;
+		}
+
+		out[len] = vp->attribute;
+		out[len + 1] = size + 2;
+		memcpy(&out[len + 2], data, size);
+		len += size + 2;
+	}
+
+	return len;
+}
+
+int radius_req_add_avpairs(struct radius_req_st *req, VALUE_PAIR *vp)
+{
+	int ret;
+
+	ret = radius_avpairs_encode(vp, &req->attrs[req->attrs_len],
+				    sizeof(req->attrs) - req->attrs_len);
+	if (ret < 0)
+		return -1;
+	req->attrs_len += ret;
+
+	for (; vp != NULL; vp = vp->next) {
+		if (vp->attribute == PW_USER_PASSWORD)
+			return radius_req_set_password(req, vp->strvalue, vp->lvalue);
+	}
+
+	return 0;
+}
+
+int radius_req_set_password(struct radius_req_st *req, const void *pass, unsigned len)
+{
+	if (len > RADIUS_MAX_PASSWORD)
+		return -1;
+
+	memcpy(req->password, pass, len);
+	req->password_len = len;
+	req->has_password = 1;
+	return 0;
+}
+
+int radius_req_send(struct radius_req_st *req)
+{
+	sec_mod_st *sec = sec_mod_watch_sec();
+	radius_sock_st *sock;
+
+	/* only called from the sec-mod loop, which owns the sockets */
+	if (sec == NULL || req->client->nservers == 0)
+		return -1;
+
+	/* all servers of a client are of the same family, see radius_client_new() */
+	sock = get_sock(sec, req->client->servers[0].addr.ss_family);
+	if (sock == NULL)
+		return -1;
+
+	req->sock = sock;
+
+	if (assign_id(sock, req) < 0) {
+		list_add_tail(&sock->waiting, &req->list);
+		req->waiting = 1;
+		return 0;
+	}
+
+	if (start_server(sec, req, time(NULL)) < 0) {
+		release_id(req);
+		req->sock = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+struct radius_client_st *radius_client_new(void *pool, rc_handle *rh,
+					   const char *type, const char *weights)
+{
+	struct radius_client_st *c;
+	SERVER *servers;
+	struct addrinfo hints, *res;
+	char port[8];
+	char secret[MAX_SECRET_LENGTH + 1];
+	const char *w = weights;
+	radius_server_st *srv;
+	int i, ret;
+
+	c = talloc_zero(pool, struct radius_client_st);
+	if (c == NULL)
+		return NULL;
+
+	c->timeout = rc_conf_int(rh, "radius_timeout");
+	if (c->timeout == 0)
+		c->timeout = 1;
+	c->retries = rc_conf_int(rh, "radius_retries");
+	c->deadtime = rc_conf_int(rh, "radius_deadtime");
+
+	servers = rc_conf_srv(rh, type);
+	if (servers == NULL || servers->max == 0) {
+		fprintf(stderr, "radius: no %s is configured\n", type);
+		goto fail;
+	}
+
+	for (i = 0; i < servers->max && c->nservers < RADIUS_MAX_SERVERS; i++) {
+		srv = &c->servers[c->nservers];
+
+		if (servers->secret[i] != NULL && servers->secret[i][0] != 0) {
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_socktype = SOCK_DGRAM;
+			snprintf(port, sizeof(port), "%u", servers->port[i] ? servers->port[i] :
+				 (strcmp(type, "acctserver") == 0 ? 1813 : 1812));
+
+			ret = getaddrinfo(servers->name[i], port, &hints, &res);
+			if (ret != 0) {
+				fprintf(stderr, "radius: cannot resolve %s: %s\n",
+					servers->name[i], gai_strerror(ret));
+				continue;
+			}
+			srv->secret = talloc_strdup(c, servers->secret[i]);
+		} else {
+#ifdef LEGACY_RADIUS
+			fprintf(stderr, "radius: no secret for %s\n", servers->name[i]);
+			continue;
+#else
+			if (rc_find_server_addr(rh, servers->name[i], &res, secret,
+						strcmp(type, "acctserver") == 0 ? ACCT : AUTH) != 0) {
+				fprintf(stderr, "radius: cannot find server %s\n", servers->name[i]);
+				continue;
+			}
+			srv->secret = talloc_strdup(c, secret);
+			safe_memset(secret, 0, sizeof(secret));
+#endif
+		}
+
+		if (res->ai_addrlen > sizeof(srv->addr) || srv->secret == NULL) {
+			freeaddrinfo(res);
+			continue;
+		}
+		memcpy(&srv->addr, res->ai_addr, res->ai_addrlen);
+		srv->addr_len = res->ai_addrlen;
+		freeaddrinfo(res);
+
+		/* the client uses a single socket */
+		if (c->nservers > 0 && srv->addr.ss_family != c->servers[0].addr.ss_family) {
+			fprintf(stderr, "radius: ignoring %s; all servers must be of the same address family\n",
+				servers->name[i]);
+			continue;
+		}
+
+		srv->name = talloc_strdup(c, servers->name[i]);
+		srv->weight = 1;
+		if (w != NULL && *w != 0) {
+			srv->weight = atoi(w);
+			if (srv->weight == 0)
+				srv->weight = 1;
+			w = strchr(w, ':');
+			if (w != NULL)
+				w++;
+		}
+
+		c->nservers++;
+	}
+
+	if (c->nservers == 0)
+		goto fail;
+
+	return c;
+ fail:
+	talloc_free(c);
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_RADIUS_CLIENT_H
+# define OC_RADIUS_CLIENT_H
+
+# include <sec-mod.h>
+
+# ifdef HAVE_RADIUS
+
+#  ifdef LEGACY_RADIUS
+#   include <freeradius-client.h>
+#  else
+#   include <radcli/radcli.h>
+#  endif
+
+/* An asynchronous RADIUS client served by the sec-mod loop. The requests
+ * of all the clients share one UDP socket per address family, and are
+ * told apart by their identifier, so up to 256 requests per socket are
+ * outstanding at a time; more wait for an identifier to be released.
+ *
+ * A client uses the servers of the radcli configuration. Each request is
+ * sent to a server chosen at random in proportion to its weight, among
+ * those which are not considered dead. A server which does not reply to
+ * 'radius_retries' retransmissions is considered dead for
+ * 'radius_deadtime' seconds, and the request fails over to another one.
+ */
+
+#define RADIUS_CODE_ACCESS_REQUEST 1
+#define RADIUS_CODE_ACCESS_ACCEPT 2
+#define RADIUS_CODE_ACCESS_REJECT 3
+#define RADIUS_CODE_ACCOUNTING_REQUEST 4
+#define RADIUS_CODE_ACCOUNTING_RESPONSE 5
+#define RADIUS_CODE_ACCESS_CHALLENGE 11
+/* given to the reply callback when no server replied */
+#define RADIUS_CODE_TIMEOUT 0
+
+#define RADIUS_HDR_SIZE 20
+#define RADIUS_MAX_PACKET 4096
+#define RADIUS_MAX_PASSWORD 128
+#define RADIUS_MAX_SERVERS 8
+
+#define RADIUS_ATTR_USER_PASSWORD 2
+#define RADIUS_ATTR_MESSAGE_AUTHENTICATOR 80
+
+/* Called from the sec-mod loop with the reply attributes; the request
+ * may be released in the callback. */
+typedef void (*radius_reply_func)(sec_mod_st *sec, void *priv, unsigned code,
+				  const uint8_t *attrs, unsigned attrs_len);
+
+struct radius_client_st;
+struct radius_req_st;
+
+/* Reads the servers of @type ("authserver" or "acctserver") and their
+ * timeouts from the radcli configuration. @weights is an optional
+ * colon-separated list of weights, in the order of the servers. */
+struct radius_client_st *radius_client_new(void *pool, rc_handle *rh,
+					   const char *type, const char *weights);
+
+struct radius_req_st *radius_req_new(void *pool, struct radius_client_st *client,
+				     unsigned code, radius_reply_func func, void *priv);
+int radius_req_add(struct radius_req_st *req, unsigned type, const void *data, unsigned len);
+int radius_req_add_raw(struct radius_req_st *req, const uint8_t *attrs, unsigned len);
+int radius_req_set_password(struct radius_req_st *req, const void *pass, unsigned len);
+
+/* Encodes the attributes of @vp, other than User-Password, in @out;
+ * returns the encoded length or -1. */
+int radius_avpairs_encode(VALUE_PAIR *vp, uint8_t *out, unsigned out_size);
+
+/* Adds the attributes of @vp to the request; a User-Password is hidden
+ * on transmission. */
+int radius_req_add_avpairs(struct radius_req_st *req, VALUE_PAIR *vp);
+
+/* Queues the request; it is cancelled when released */
+int radius_req_send(struct radius_req_st *req);
+
+# endif
+#endif
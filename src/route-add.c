@@ -33,6 +33,14 @@
 #include <main.h>
 #include <str.h>
 #include <common.h>
+#include <ip-util.h>
+#include <tun-mq.h>
+
+#ifdef __linux__
+# include <net/if.h>
+# include <linux/rtnetlink.h>
+# include <rtnl.h>
+#endif
 
 static
 int call_script(main_server_st *s, proc_st *proc, const char *cmd)
@@ -156,6 +164,102 @@ int route_del(struct main_server_st* s, proc_st *proc, const char* route, const
 	return route_adddel(s, proc, GETCONFIG(s)->route_del_cmd, route, dev);
 }
 
+#ifdef __linux__
+/* Adds or removes the iroutes of @proc in a single netlink batch. The
+ * routes for which @skip is non-zero are left as they are. The result
+ * for each route is set in @errors, if given; it is zero only if the
+ * route was changed.
+ */
+static
+int iroutes_netlink(struct main_server_st* s, struct proc_st *proc, int cmd,
+		    const int *skip, int *errors)
+{
+const char *op = (cmd == RTM_NEWROUTE) ? "add" : "remove";
+struct sockaddr_storage dst;
+rtnl_batch_st b;
+unsigned i, prefix;
+unsigned *idx;
+int ifindex, ret, e;
+
+	for (i=0;errors && i<proc->config->n_iroutes;i++)
+		errors[i] = EIO;
+
+	ifindex = if_nametoindex(proc->tun_lease.name);
+	if (ifindex == 0) {
+		e = errno;
+		mslog(s, proc, LOG_ERR, "could not find interface %s: %s",
+		      proc->tun_lease.name, strerror(e));
+		return ERR_EXEC;
+	}
+
+	/* the route of each request */
+	idx = talloc_array(proc, unsigned, proc->config->n_iroutes);
+	if (idx == NULL)
+		return ERR_MEM;
+
+	rtnl_batch_init(&b, proc);
+	for (i=0;i<proc->config->n_iroutes;i++) {
+		if (skip && skip[i] != 0)
+			continue;
+
+		if (ip_route_parse(proc->config->iroutes[i], &dst, &prefix) < 0) {
+			mslog(s, proc, LOG_ERR, "cannot parse iroute '%s'",
+			      proc->config->iroutes[i]);
+			ret = ERR_PARSING;
+			goto cleanup;
+		}
+
+		ret = rtnl_batch_add_route(&b, cmd, &dst, prefix, ifindex);
+		if (ret < 0)
+			goto cleanup;
+		idx[ret] = i;
+	}
+
+	ret = rtnl_batch_commit(&b);
+	if (ret < 0) {
+		e = errno;
+		mslog(s, proc, LOG_ERR, "could not %s routes via netlink: %s",
+		      op, strerror(e));
+		ret = ERR_EXEC;
+	} else if (ret > 0) {
+		ret = ERR_EXEC;
+	}
+
+	for (i=0;b.errors && i<b.count;i++) {
+		if (errors)
+			errors[idx[i]] = b.errors[i];
+		if (b.errors[i] != 0 && b.errors[i] != EIO)
+			mslog(s, proc, LOG_INFO, "could not %s route %s: %s", op,
+			      proc->config->iroutes[idx[i]], strerror(b.errors[i]));
+	}
+
+ cleanup:
+	rtnl_batch_deinit(&b);
+	talloc_free(idx);
+	return ret;
+}
+
+static
+int apply_iroutes_netlink(struct main_server_st* s, struct proc_st *proc)
+{
+int *errors;
+int ret;
+
+	errors = talloc_array(proc, int, proc->config->n_iroutes);
+	if (errors == NULL)
+		return ERR_MEM;
+
+	ret = iroutes_netlink(s, proc, RTM_NEWROUTE, NULL, errors);
+	if (ret < 0) {
+		/* remove the routes which were added */
+		iroutes_netlink(s, proc, RTM_DELROUTE, errors, NULL);
+	}
+
+	talloc_free(errors);
+	return ret;
+}
+#endif
+
 /* Executes the commands required to apply all the configured routes
  * for this client locally.
  */
@@ -167,6 +271,20 @@ int ret;
 	if (proc->config->n_iroutes == 0)
 		return 0;
 
+#ifdef __linux__
+	/* the device is shared; the routes are only part of the way */
+	if (proc->tun_lease.mq_slot != 0 && tun_mq_steer_iroutes(s, proc) < 0)
+		return -1;
+
+	if (GETCONFIG(s)->route_netlink) {
+		ret = apply_iroutes_netlink(s, proc);
+		if (ret < 0)
+			return -1;
+		proc->applied_iroutes = 1;
+		return 0;
+	}
+#endif
+
 	for (i=0;i<proc->config->n_iroutes;i++) {
 		ret = route_add(s, proc, proc->config->iroutes[i], proc->tun_lease.name);
 		if (ret < 0)
@@ -192,6 +310,14 @@ unsigned i;
 	if (proc->config == NULL || proc->config->n_iroutes == 0 || proc->applied_iroutes == 0)
 		return;
 
+#ifdef __linux__
+	if (GETCONFIG(s)->route_netlink) {
+		iroutes_netlink(s, proc, RTM_DELROUTE, NULL, NULL);
+		proc->applied_iroutes = 0;
+		return;
+	}
+#endif
+
 	for (i=0;i<proc->config->n_iroutes;i++) {
 		route_del(s, proc, proc->config->iroutes[i], proc->tun_lease.name);
 	}
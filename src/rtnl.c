@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <talloc.h>
+#include <sys/time.h>
+
+#ifdef __linux__
+
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#include <defs.h>
+#include <ip-util.h>
+#include <rtnl.h>
+
+#ifndef NETLINK_CAP_ACK
+# define NETLINK_CAP_ACK 10
+#endif
+
+/* The requests are sent in chunks of that many, and their replies are
+ * read before the next chunk is sent, so that they fit the socket buffer */
+#define RTNL_MAX_CHUNK 128
+
+/* how long the kernel is waited for before the batch fails */
+#define RTNL_TIMEOUT_SECS 5
+
+void rtnl_batch_init(rtnl_batch_st *b, void *pool)
+{
+	memset(b, 0, sizeof(*b));
+	b->pool = pool;
+}
+
+void rtnl_batch_deinit(rtnl_batch_st *b)
+{
+	talloc_free(b->buf);
+	talloc_free(b->errors);
+	memset(b, 0, sizeof(*b));
+}
+
+/* Returns @len zeroed bytes at the end of the batch; the pointers into
+ * the batch are invalidated. The caller accounts them in the length of
+ * the request. */
+static void *batch_reserve(rtnl_batch_st *b, size_t len)
+{
+	uint8_t *p;
+	size_t size;
+
+	if (b->failed)
+		return NULL;
+
+	len = NLMSG_ALIGN(len);
+	if (b->len + len > b->size) {
+		size = b->size ? b->size * 2 : 1024;
+		while (size < b->len + len)
+			size *= 2;
+
+		p = talloc_realloc_size(b->pool, b->buf, size);
+		if (p == NULL) {
+			b->failed = 1;
+			return NULL;
+		}
+		b->buf = p;
+		b->size = size;
+	}
+
+	p = b->buf + b->len;
+	memset(p, 0, len);
+	b->len += len;
+
+	return p;
+}
+
+static void *attr_reserve(rtnl_batch_st *b, size_t len)
+{
+	void *p;
+
+	p = batch_reserve(b, len);
+	if (p != NULL)
+		((struct nlmsghdr *)(b->buf + b->msg_off))->nlmsg_len = b->len - b->msg_off;
+
+	return p;
+}
+
+int rtnl_batch_msg(rtnl_batch_st *b, int type, int flags, const void *hdr, size_t hdr_len)
+{
+	struct nlmsghdr *nh;
+	size_t off = b->len;
+
+	nh = batch_reserve(b, NLMSG_LENGTH(hdr_len));
+	if (nh == NULL)
+		return ERR_MEM;
+
+	nh->nlmsg_len = NLMSG_LENGTH(hdr_len);
+	nh->nlmsg_type = type;
+	nh->nlmsg_flags = flags;
+	nh->nlmsg_seq = b->count + 1;
+	memcpy(NLMSG_DATA(nh), hdr, hdr_len);
+
+	b->msg_off = off;
+	if (flags & NLM_F_ACK)
+		b->ack_seq = nh->nlmsg_seq;
+
+	return b->count++;
+}
+
+void rtnl_batch_ack(rtnl_batch_st *b)
+{
+	struct nlmsghdr *nh;
+
+	if (b->failed || b->count == 0)
+		return;
+
+	nh = (struct nlmsghdr *)(b->buf + b->msg_off);
+	nh->nlmsg_flags |= NLM_F_ACK;
+	b->ack_seq = nh->nlmsg_seq;
+}
+
+void rtnl_batch_attr(rtnl_batch_st *b, int type, const void *data, size_t len)
+{
+	struct rtattr *rta;
+
+	rta = attr_reserve(b, RTA_LENGTH(len));
+	if (rta == NULL)
+		return;
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+}
+
+void rtnl_batch_attr_u32(rtnl_batch_st *b, int type, uint32_t val)
+{
+	rtnl_batch_attr(b, type, &val, sizeof(val));
+}
+
+void rtnl_batch_attr_str(rtnl_batch_st *b, int type, const char *str)
+{
+	rtnl_batch_attr(b, type, str, strlen(str) + 1);
+}
+
+size_t rtnl_batch_nest_start(rtnl_batch_st *b, int type)
+{
+	size_t off = b->len;
+	struct rtattr *rta;
+
+	rta = attr_reserve(b, RTA_LENGTH(0));
+	if (rta != NULL)
+		rta->rta_type = type | NLA_F_NESTED;
+
+	return off;
+}
+
+void rtnl_batch_nest_end(rtnl_batch_st *b, size_t nest)
+{
+	if (b->failed)
+		return;
+
+	((struct rtattr *)(b->buf + nest))->rta_len = b->len - nest;
+}
+
+static int batch_route(rtnl_batch_st *b, int cmd, int flags, const struct sockaddr_storage *dst,
+		       unsigned prefix, const struct sockaddr_storage *src, int ifindex,
+		       unsigned mtu)
+{
+	struct rtmsg rt;
+	size_t nest;
+	int ret;
+
+	memset(&rt, 0, sizeof(rt));
+	rt.rtm_family = dst->ss_family;
+	rt.rtm_dst_len = prefix;
+	rt.rtm_table = RT_TABLE_MAIN;
+
+	/* as 'ip route add/del <dst> dev <dev>' */
+	if (cmd == RTM_NEWROUTE) {
+		rt.rtm_protocol = RTPROT_BOOT;
+		rt.rtm_scope = RT_SCOPE_LINK;
+		rt.rtm_type = RTN_UNICAST;
+	} else {
+		rt.rtm_scope = RT_SCOPE_NOWHERE;
+	}
+
+	ret = rtnl_batch_msg(b, cmd, NLM_F_REQUEST | NLM_F_ACK | flags, &rt, sizeof(rt));
+	if (ret < 0)
+		return ret;
+
+	if (dst->ss_family == AF_INET)
+		rtnl_batch_attr(b, RTA_DST, SA_IN_P(dst), sizeof(struct in_addr));
+	else
+		rtnl_batch_attr(b, RTA_DST, SA_IN6_P(dst), sizeof(struct in6_addr));
+	rtnl_batch_attr_u32(b, RTA_OIF, ifindex);
+
+	if (src != NULL && src->ss_family == AF_INET)
+		rtnl_batch_attr(b, RTA_PREFSRC, SA_IN_P(src), sizeof(struct in_addr));
+	else if (src != NULL && src->ss_family == AF_INET6)
+		rtnl_batch_attr(b, RTA_PREFSRC, SA_IN6_P(src), sizeof(struct in6_addr));
+
+	if (mtu != 0) {
+		nest = rtnl_batch_nest_start(b, RTA_METRICS);
+		rtnl_batch_attr_u32(b, RTAX_MTU, mtu);
+		rtnl_batch_nest_end(b, nest);
+	}
+
+	if (b->failed)
+		return ERR_MEM;
+
+	return ret;
+}
+
+int rtnl_batch_add_route(rtnl_batch_st *b, int cmd, const struct sockaddr_storage *dst,
+			 unsigned prefix, int ifindex)
+{
+	return batch_route(b, cmd, (cmd == RTM_NEWROUTE) ? NLM_F_CREATE | NLM_F_EXCL : 0,
+			   dst, prefix, NULL, ifindex, 0);
+}
+
+int rtnl_batch_replace_route(rtnl_batch_st *b, const struct sockaddr_storage *dst,
+			     unsigned prefix, const struct sockaddr_storage *src,
+			     int ifindex, unsigned mtu)
+{
+	return batch_route(b, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE,
+			   dst, prefix, src, ifindex, mtu);
+}
+
+int rtnl_batch_add_addr(rtnl_batch_st *b, int cmd, const struct sockaddr_storage *local,
+			const struct sockaddr_storage *peer, unsigned prefix, int ifindex)
+{
+	struct ifaddrmsg ifa;
+	int flags = NLM_F_REQUEST | NLM_F_ACK;
+	size_t len;
+	int ret;
+
+	memset(&ifa, 0, sizeof(ifa));
+	ifa.ifa_family = local->ss_family;
+	ifa.ifa_prefixlen = prefix;
+	ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+	ifa.ifa_index = ifindex;
+
+	/* there is no neighbour to detect on a tun device */
+	if (local->ss_family == AF_INET6)
+		ifa.ifa_flags = IFA_F_NODAD;
+
+	/* adding an address which is already set is not an error */
+	if (cmd == RTM_NEWADDR)
+		flags |= NLM_F_CREATE | NLM_F_REPLACE;
+
+	ret = rtnl_batch_msg(b, cmd, flags, &ifa, sizeof(ifa));
+	if (ret < 0)
+		return ret;
+
+	len = (local->ss_family == AF_INET) ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+	if (peer == NULL)
+		peer = local;
+
+	if (local->ss_family == AF_INET) {
+		rtnl_batch_attr(b, IFA_LOCAL, SA_IN_P(local), len);
+		rtnl_batch_attr(b, IFA_ADDRESS, SA_IN_P(peer), len);
+	} else {
+		rtnl_batch_attr(b, IFA_LOCAL, SA_IN6_P(local), len);
+		rtnl_batch_attr(b, IFA_ADDRESS, SA_IN6_P(peer), len);
+	}
+
+	if (b->failed)
+		return ERR_MEM;
+
+	return ret;
+}
+
+static int open_socket(int protocol)
+{
+	struct timeval tv = { .tv_sec = RTNL_TIMEOUT_SECS };
+	int fd, one = 1;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+	if (fd == -1)
+		return -1;
+
+	/* the errors don't need to carry the requests */
+	setsockopt(fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	return fd;
+}
+
+/* Reads the replies to the requests up to @last, which were sent after
+ * @first */
+static int read_replies(int fd, rtnl_batch_st *b, unsigned first, unsigned last)
+{
+	union {
+		struct nlmsghdr nh;
+		uint8_t data[8192];
+	} buf;
+	struct nlmsghdr *nh;
+	struct nlmsgerr *err;
+	unsigned pending = last - first;
+	ssize_t ret;
+	size_t len;
+
+	while (pending > 0) {
+		ret = recv(fd, &buf, sizeof(buf), 0);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		len = ret;
+		for (nh = &buf.nh; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_type != NLMSG_ERROR ||
+			    nh->nlmsg_seq <= first || nh->nlmsg_seq > last)
+				continue;
+
+			err = NLMSG_DATA(nh);
+			b->errors[nh->nlmsg_seq - 1] = -err->error;
+			pending--;
+		}
+	}
+
+	return 0;
+}
+
+int rtnl_batch_commit(rtnl_batch_st *b)
+{
+	struct sockaddr_nl sa;
+	struct nlmsghdr *nh;
+	size_t start, pos;
+	unsigned first, last, i;
+	int fd, ret, e;
+
+	if (b->failed)
+		return ERR_MEM;
+	if (b->count == 0)
+		return 0;
+
+	talloc_free(b->errors);
+	b->errors = talloc_array(b->pool, int, b->count);
+	if (b->errors == NULL)
+		return ERR_MEM;
+	for (i = 0; i < b->count; i++)
+		b->errors[i] = EIO;
+
+	fd = open_socket(NETLINK_ROUTE);
+	if (fd == -1)
+		return -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+
+	pos = 0;
+	last = 0;
+	while (pos < b->len) {
+		start = pos;
+		first = last;
+
+		/* whole requests, up to the size of a chunk; a reply is
+		 * read for each */
+		do {
+			nh = (struct nlmsghdr *)(b->buf + pos);
+			nh->nlmsg_flags |= NLM_F_ACK;
+			pos += NLMSG_ALIGN(nh->nlmsg_len);
+			last++;
+		} while (pos < b->len && last - first < RTNL_MAX_CHUNK);
+
+		do {
+			ret = sendto(fd, b->buf + start, pos - start, 0,
+				     (struct sockaddr *)&sa, sizeof(sa));
+		} while (ret == -1 && errno == EINTR);
+
+		if (ret == -1 || read_replies(fd, b, first, last) < 0) {
+			e = errno;
+			close(fd);
+			errno = e;
+			return -1;
+		}
+	}
+
+	close(fd);
+
+	ret = 0;
+	for (i = 0; i < b->count; i++) {
+		if (b->errors[i] != 0)
+			ret++;
+	}
+
+	return ret;
+}
+
+int rtnl_batch_commit_atomic(rtnl_batch_st *b, int protocol)
+{
+	union {
+		struct nlmsghdr nh;
+		uint8_t data[8192];
+	} buf;
+	struct sockaddr_nl sa;
+	struct nlmsghdr *nh;
+	struct nlmsgerr *err;
+	unsigned done = 0, i;
+	ssize_t ret;
+	size_t len;
+	int fd, e;
+
+	if (b->failed)
+		return ERR_MEM;
+	if (b->count == 0)
+		return 0;
+
+	talloc_free(b->errors);
+	b->errors = talloc_zero_array(b->pool, int, b->count);
+	if (b->errors == NULL)
+		return ERR_MEM;
+
+	fd = open_socket(protocol);
+	if (fd == -1)
+		return -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+
+	do {
+		ret = sendto(fd, b->buf, b->len, 0, (struct sockaddr *)&sa, sizeof(sa));
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1)
+		goto fail;
+
+	/* the errors are reported before the acknowledgement of the last
+	 * request which asked for one; as the batch is applied as a whole
+	 * there is no need to wait past an error */
+	while (!done && b->ack_seq != 0) {
+		ret = recv(fd, &buf, sizeof(buf), 0);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+
+		len = ret;
+		for (nh = &buf.nh; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_type != NLMSG_ERROR ||
+			    nh->nlmsg_seq == 0 || nh->nlmsg_seq > b->count)
+				continue;
+
+			err = NLMSG_DATA(nh);
+			b->errors[nh->nlmsg_seq - 1] = -err->error;
+			if (nh->nlmsg_seq == b->ack_seq || err->error != 0)
+				done = 1;
+		}
+	}
+
+	close(fd);
+
+	ret = 0;
+	for (i = 0; i < b->count; i++) {
+		if (b->errors[i] != 0)
+			ret++;
+	}
+
+	return ret;
+
+ fail:
+	e = errno;
+	close(fd);
+	errno = e;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_RTNL_H
+# define OC_RTNL_H
+
+# include <stdint.h>
+# include <sys/socket.h>
+
+/* A batch of netlink requests. They are sent to the kernel in as few
+ * messages as possible; the result of every request is available once
+ * the batch is committed. With rtnl_batch_commit() the requests are
+ * independent, i.e., a failed one does not prevent the following ones
+ * from being applied, while rtnl_batch_commit_atomic() is for the
+ * subsystems which apply a batch as a whole, such as nf_tables.
+ */
+typedef struct rtnl_batch_st {
+	void *pool;
+	uint8_t *buf;
+	size_t len;
+	size_t size;
+	size_t msg_off; /* the request which is being built */
+	unsigned failed; /* a request could not be added */
+
+	unsigned count;
+	unsigned ack_seq; /* the last request asking for an acknowledgement */
+	int *errors; /* zero or the errno of each request, once committed */
+} rtnl_batch_st;
+
+void rtnl_batch_init(rtnl_batch_st *b, void *pool);
+void rtnl_batch_deinit(rtnl_batch_st *b);
+
+/* Starts a request with the given netlink type and flags, followed by
+ * the @hdr_len bytes of the family header. Returns the index of the
+ * request or a negative error code. */
+int rtnl_batch_msg(rtnl_batch_st *b, int type, int flags, const void *hdr, size_t hdr_len);
+
+/* Requests an acknowledgement for the last request */
+void rtnl_batch_ack(rtnl_batch_st *b);
+
+/* Append attributes to the last request. A failure is recorded in the
+ * batch and reported when it is committed. */
+void rtnl_batch_attr(rtnl_batch_st *b, int type, const void *data, size_t len);
+void rtnl_batch_attr_u32(rtnl_batch_st *b, int type, uint32_t val);
+void rtnl_batch_attr_str(rtnl_batch_st *b, int type, const char *str);
+
+/* The attributes added in between are nested in the @type one */
+size_t rtnl_batch_nest_start(rtnl_batch_st *b, int type);
+void rtnl_batch_nest_end(rtnl_batch_st *b, size_t nest);
+
+/* Adds a request to add (RTM_NEWROUTE) or remove (RTM_DELROUTE) the
+ * route to @dst/@prefix via the interface @ifindex. Returns the index
+ * of the request or a negative error code. */
+int rtnl_batch_add_route(rtnl_batch_st *b, int cmd, const struct sockaddr_storage *dst,
+			 unsigned prefix, int ifindex);
+
+/* Adds a request to set the route to @dst/@prefix via @ifindex, which
+ * replaces the existing route to @dst/@prefix if any. The preferred
+ * source address @src and the @mtu of the route are set unless NULL or
+ * zero. Returns the index of the request or a negative error code. */
+int rtnl_batch_replace_route(rtnl_batch_st *b, const struct sockaddr_storage *dst,
+			     unsigned prefix, const struct sockaddr_storage *src,
+			     int ifindex, unsigned mtu);
+
+/* Adds a request to set (RTM_NEWADDR) or remove (RTM_DELADDR) the
+ * address @local/@prefix of the interface @ifindex, with @peer as the
+ * address of the other end of a point-to-point link if not NULL. Setting
+ * an address which is already set succeeds. Returns the index of the
+ * request or a negative error code. */
+int rtnl_batch_add_addr(rtnl_batch_st *b, int cmd, const struct sockaddr_storage *local,
+			const struct sockaddr_storage *peer, unsigned prefix, int ifindex);
+
+/* Sends the requests, each with NLM_F_ACK, and waits for their results.
+ * Returns the number of requests which failed, or a negative error code
+ * if the batch could not be sent or the kernel did not reply in time;
+ * the requests which were not acknowledged then have EIO as their
+ * error. */
+int rtnl_batch_commit(rtnl_batch_st *b);
+
+/* Sends the requests on a @protocol netlink socket in a single message
+ * and waits for the acknowledgement of the last request asking for one,
+ * or for the first error. Returns the number of requests which reported an error, or a negative
+ * error code if the batch could not be sent or the kernel did not reply
+ * in time. */
+int rtnl_batch_commit_atomic(rtnl_batch_st *b, int protocol);
+
+#endif
@@ -52,6 +52,7 @@
 #include <sec-mod-sup-config.h>
 #include <sec-mod-acct.h>
 #include <hmac.h>
+#include <gettime.h>
 
 #ifdef HAVE_GSSAPI
 # include <gssapi/gssapi.h>
@@ -130,10 +131,202 @@ static void update_auth_time_stats(sec_mod_st * sec, time_t secs)
 	sec->avg_auth_time = ((uint64_t)sec->avg_auth_time*((uint64_t)(sec->total_authentications-1))+secs) / (uint64_t)sec->total_authentications;
 }
 
+void auth_latency_add(auth_latency_st *tbl, unsigned *size, const char *module,
+		      uint32_t count, uint64_t total_usecs, uint32_t max_usecs)
+{
+	unsigned i;
+
+	if (module == NULL)
+		return;
+
+	for (i = 0; i < *size; i++) {
+		if (strcmp(tbl[i].module, module) == 0)
+			break;
+	}
+
+	if (i == *size) {
+		if (*size >= MAX_AUTH_LATENCY_MODULES)
+			return;
+		memset(&tbl[i], 0, sizeof(tbl[i]));
+		strlcpy(tbl[i].module, module, sizeof(tbl[i].module));
+		(*size)++;
+	}
+
+	tbl[i].count += count;
+	tbl[i].total_usecs += total_usecs;
+	if (max_usecs > tbl[i].max_usecs)
+		tbl[i].max_usecs = max_usecs;
+}
+
+/* records the time the module took to check the password given in
+ * the last auth cont */
+static void update_auth_latency_stats(sec_mod_st *sec, client_entry_st *e)
+{
+	struct timespec now;
+	uint64_t usecs;
+
+	gettime_realtime(&now);
+	usecs = timespec_sub_us(&now, &e->auth_pass_start);
+	if (usecs > UINT32_MAX)
+		usecs = UINT32_MAX;
+
+	auth_latency_add(sec->auth_latency, &sec->auth_latency_size,
+			 e->module_name, 1, usecs, usecs);
+}
+
+/* Seals the state of the session in a cookie which any instance can
+ * resume; returns its size, or 0 if the session can only be resumed
+ * by this instance. */
+static unsigned issue_stateless_cookie(sec_mod_st *sec, client_entry_st *e,
+				       uint8_t *cookie, size_t cookie_size)
+{
+	CookieStateMsg msg = COOKIE_STATE_MSG__INIT;
+	uint8_t state[MAX_COOKIE_SIZE];
+	time_t now = time(NULL);
+	time_t lifetime;
+	size_t size;
+	int ret;
+
+	if (sec->cookie_revocations == NULL)
+		return 0;
+
+	lifetime = e->vhost->perm_config.config->session_timeout;
+	if (lifetime == 0)
+		lifetime = STATELESS_COOKIE_LIFETIME;
+
+	msg.username = e->acct_info.username;
+	msg.groupname = e->acct_info.groupname;
+	msg.vhost = e->vhost->name;
+	msg.auth_type = e->auth_type;
+	msg.tls_auth_ok = e->tls_auth_ok;
+	msg.created = e->created;
+	msg.issued = now;
+	msg.expires = now + e->vhost->perm_config.config->cookie_timeout + AUTH_SLACK_TIME + lifetime;
+	msg.user_agent = e->acct_info.user_agent;
+	msg.device_type = e->acct_info.device_type;
+	msg.device_platform = e->acct_info.device_platform;
+	msg.our_ip = e->acct_info.our_ip;
+	msg.remote_ip = e->acct_info.remote_ip;
+
+	size = cookie_state_msg__get_packed_size(&msg);
+	if (size > MIN(sizeof(state), cookie_size - STATELESS_COOKIE_OVERHEAD)) {
+		seclog(sec, LOG_WARNING, "session state of user '%s' "SESSION_STR" is too large for a stateless cookie",
+		       e->acct_info.username, e->acct_info.safe_id);
+		return 0;
+	}
+	cookie_state_msg__pack(&msg, state);
+
+	ret = stateless_cookie_seal(sec->cookie_key, e->sid, state, size, cookie, cookie_size);
+	safe_memset(state, 0, size);
+	if (ret < 0) {
+		seclog(sec, LOG_ERR, "error sealing the stateless cookie of user '%s' "SESSION_STR,
+		       e->acct_info.username, e->acct_info.safe_id);
+		return 0;
+	}
+
+	e->cookie_expires = msg.expires;
+	return ret;
+}
+
+/* Returns a new entry for the session of a stateless cookie which was
+ * issued by another instance, or NULL */
+static client_entry_st *resume_stateless_cookie(sec_mod_st *sec, const SecmSessionOpenMsg *req)
+{
+	uint8_t state[MAX_COOKIE_SIZE];
+	CookieStateMsg *msg = NULL;
+	client_entry_st *e = NULL;
+	vhost_cfg_st *vhost;
+	time_t now = time(NULL);
+	unsigned i;
+	int size;
+	PROTOBUF_ALLOCATOR(pa, sec);
+
+	if (sec->cookie_revocations == NULL || !req->has_cookie ||
+	    req->cookie.len <= SID_SIZE || memcmp(req->cookie.data, req->sid.data, SID_SIZE) != 0)
+		return NULL;
+
+	size = stateless_cookie_open(sec->cookie_key, req->cookie.data, req->cookie.len,
+				     state, sizeof(state));
+	if (size < 0) {
+		seclog(sec, LOG_INFO, "session open with an invalid stateless cookie");
+		return NULL;
+	}
+
+	msg = cookie_state_msg__unpack(&pa, size, state);
+	safe_memset(state, 0, size);
+	if (msg == NULL) {
+		seclog(sec, LOG_ERR, "error unpacking the state of a stateless cookie");
+		return NULL;
+	}
+
+	if ((time_t)msg->expires <= now) {
+		seclog(sec, LOG_INFO, "stateless cookie of user '%s' has expired", msg->username);
+		goto cleanup;
+	}
+
+	if ((time_t)msg->issued <= cookie_revocations_horizon(sec->cookie_revocations) ||
+	    cookie_revocations_check(sec->cookie_revocations, req->sid.data, now)) {
+		seclog(sec, LOG_INFO, "stateless cookie of user '%s' is not valid; the session was invalidated", msg->username);
+		goto cleanup;
+	}
+
+	vhost = find_vhost(sec->vconfig, msg->vhost);
+	if (msg->vhost != NULL && (vhost->name == NULL || strcasecmp(vhost->name, msg->vhost) != 0)) {
+		seclog(sec, LOG_INFO, "stateless cookie of user '%s' is for unknown virtual host '%s'", msg->username, msg->vhost);
+		goto cleanup;
+	}
+
+	for (i = 0; i < vhost->perm_config.auth_methods; i++) {
+		if (vhost->perm_config.auth[i].enabled && vhost->perm_config.auth[i].type == msg->auth_type)
+			break;
+	}
+	if (i == vhost->perm_config.auth_methods) {
+		seclog(sec, LOG_INFO, "%sstateless cookie of user '%s' is for a method which is not enabled", PREFIX_VHOST(vhost), msg->username);
+		goto cleanup;
+	}
+
+	e = restore_client_entry(sec, vhost, req->sid.data);
+	if (e == NULL) {
+		seclog(sec, LOG_ERR, "cannot initialize memory");
+		goto cleanup;
+	}
+
+	e->module = vhost->perm_config.auth[i].amod;
+	e->module_name = vhost->perm_config.auth[i].name;
+	e->auth_type = vhost->perm_config.auth[i].type;
+	e->vhost_auth_ctx = vhost->perm_config.auth[i].auth_ctx;
+	e->vhost_acct_ctx = vhost->perm_config.acct.acct_ctx;
+
+	strlcpy(e->acct_info.username, msg->username, sizeof(e->acct_info.username));
+	strlcpy(e->acct_info.groupname, msg->groupname, sizeof(e->acct_info.groupname));
+	strlcpy(e->acct_info.remote_ip, msg->remote_ip, sizeof(e->acct_info.remote_ip));
+	if (msg->user_agent)
+		strlcpy(e->acct_info.user_agent, msg->user_agent, sizeof(e->acct_info.user_agent));
+	if (msg->device_type)
+		strlcpy(e->acct_info.device_type, msg->device_type, sizeof(e->acct_info.device_type));
+	if (msg->device_platform)
+		strlcpy(e->acct_info.device_platform, msg->device_platform, sizeof(e->acct_info.device_platform));
+	if (msg->our_ip)
+		strlcpy(e->acct_info.our_ip, msg->our_ip, sizeof(e->acct_info.our_ip));
+
+	e->tls_auth_ok = msg->tls_auth_ok;
+	e->created = msg->created;
+	e->cookie_expires = msg->expires;
+	e->status = PS_AUTH_COMPLETED;
+
+	seclog(sec, LOG_INFO, "%sresuming session of user '%s' "SESSION_STR" issued by instance %u",
+	       PREFIX_VHOST(vhost), e->acct_info.username, e->acct_info.safe_id, (unsigned)req->sid.data[0]);
+
+ cleanup:
+	cookie_state_msg__free_unpacked(msg, &pa);
+	return e;
+}
+
 static
 int send_sec_auth_reply(int cfd, sec_mod_st * sec, client_entry_st * entry, AUTHREP r)
 {
 	SecAuthReplyMsg msg = SEC_AUTH_REPLY_MSG__INIT;
+	uint8_t cookie[MAX_COOKIE_SIZE];
 	int ret;
 
 	if (r == AUTH__REP__OK) {
@@ -153,6 +346,13 @@ int send_sec_auth_reply(int cfd, sec_mod_st * sec, client_entry_st * entry, AUTH
 		msg.sid.data = entry->sid;
 		msg.sid.len = sizeof(entry->sid);
 
+		ret = issue_stateless_cookie(sec, entry, cookie, sizeof(cookie));
+		if (ret > 0) {
+			msg.has_cookie = 1;
+			msg.cookie.data = cookie;
+			msg.cookie.len = ret;
+		}
+
 		msg.has_dtls_session_id = 1;
 		msg.dtls_session_id.data = entry->dtls_session_id;
 		msg.dtls_session_id.len = sizeof(entry->dtls_session_id);
@@ -458,11 +658,23 @@ int handle_secm_session_open_cmd(sec_mod_st *sec, int fd, const SecmSessionOpenM
 	}
 
 	e = find_client_entry(sec, req->sid.data);
+	if (e == NULL)
+		e = resume_stateless_cookie(sec, req);
 	if (e == NULL) {
 		seclog(sec, LOG_INFO, "session open but with non-existing SID!");
 		return send_failed_session_open_reply(sec, fd);
 	}
 
+	/* the session may have been invalidated by the instance which
+	 * resumed it */
+	if (e->cookie_expires != 0 && sec->cookie_revocations != NULL &&
+	    cookie_revocations_check(sec->cookie_revocations, e->sid, time(NULL))) {
+		seclog(sec, LOG_INFO, "session of user '%s' "SESSION_STR" was invalidated; denied session",
+		       e->acct_info.username, e->acct_info.safe_id);
+		e->status = PS_AUTH_FAILED;
+		return send_failed_session_open_reply(sec, fd);
+	}
+
 	if (e->status != PS_AUTH_COMPLETED) {
 		seclog(sec, LOG_ERR, "session open received in unauthenticated client %s "SESSION_STR"!", e->acct_info.username, e->acct_info.safe_id);
 		return send_failed_session_open_reply(sec, fd);
@@ -585,6 +797,10 @@ int handle_secm_session_close_cmd(sec_mod_st *sec, int fd, const SecmSessionClos
 		e->discon_reason = REASON_SERVER_DISCONNECT;
 	}
 
+	if (req->has_moved && req->moved) {
+		e->moved = 1;
+	}
+
 	/* send reply */
 	rep.bytes_in = e->stats.bytes_in;
 	rep.bytes_out = e->stats.bytes_out;
@@ -719,11 +935,25 @@ int handle_sec_auth_cont(int cfd, sec_mod_st * sec, const SecAuthContMsg * req)
 		goto cleanup;
 	}
 
+	if (e->pending_cfd != -1) {
+		seclog(sec, LOG_ERR, "auth cont received for %s "SESSION_STR" while waiting for a previous one",
+		       e->acct_info.username, e->acct_info.safe_id);
+		return -1;
+	}
+
 	e->status = PS_AUTH_CONT;
 
+	gettime_realtime(&e->auth_pass_start);
 	ret =
 	    e->module->auth_pass(e->auth_ctx, req->password,
 			      strlen(req->password));
+	if (ret == ERR_WAIT_FOR_AUTH) {
+		/* the module calls sec_auth_resume() once it completes */
+		e->pending_cfd = cfd;
+		return SEC_REPLY_DEFERRED;
+	}
+	update_auth_latency_stats(sec, e);
+
 	if (ret < 0) {
 		if (ret != ERR_AUTH_CONTINUE) {
 			seclog(sec, LOG_DEBUG,
@@ -737,6 +967,26 @@ int handle_sec_auth_cont(int cfd, sec_mod_st * sec, const SecAuthContMsg * req)
 	return handle_sec_auth_res(cfd, sec, e, ret);
 }
 
+void sec_auth_resume(sec_mod_st *sec, void *pool, int result)
+{
+	client_entry_st *e = pool;
+	int cfd = e->pending_cfd;
+
+	if (cfd == -1)
+		return;
+	e->pending_cfd = -1;
+	update_auth_latency_stats(sec, e);
+
+	if (result < 0 && result != ERR_AUTH_CONTINUE) {
+		seclog(sec, LOG_DEBUG,
+		       "error in password given in auth cont for user '%s' "SESSION_STR,
+		       e->acct_info.username, e->acct_info.safe_id);
+	}
+
+	handle_sec_auth_res(cfd, sec, e, result);
+	close(cfd);
+}
+
 static
 int set_module(sec_mod_st * sec, vhost_cfg_st *vhost, client_entry_st *e, unsigned auth_type)
 {
@@ -750,6 +1000,7 @@ int set_module(sec_mod_st * sec, vhost_cfg_st *vhost, client_entry_st *e, unsign
 	for (i=0;i<vhost->perm_config.auth_methods;i++) {
 		if (vhost->perm_config.auth[i].enabled && (vhost->perm_config.auth[i].type & auth_type) == auth_type) {
 			e->module = vhost->perm_config.auth[i].amod;
+			e->module_name = vhost->perm_config.auth[i].name;
 			e->auth_type = vhost->perm_config.auth[i].type;
 			e->vhost_auth_ctx = vhost->perm_config.auth[i].auth_ctx;
 			e->vhost_acct_ctx = vhost->perm_config.acct.acct_ctx;
@@ -46,6 +46,15 @@ typedef struct auth_mod_st {
 	void (*group_list)(void *pool, void *additional, char ***groupname, unsigned *groupname_size);
 } auth_mod_st;
 
+/* Completes an authentication step for which auth_pass() returned
+ * ERR_WAIT_FOR_AUTH; @pool is the pool given to auth_init(). */
+void sec_auth_resume(sec_mod_st *sec, void *pool, int result);
+
+/* Adds @count password checks by @module, which took @total_usecs, to
+ * the table @tbl of @size entries */
+void auth_latency_add(auth_latency_st *tbl, unsigned *size, const char *module,
+		      uint32_t count, uint64_t total_usecs, uint32_t max_usecs);
+
 void main_auth_init(main_server_st *s);
 void proc_auth_deinit(main_server_st* s, struct proc_st* proc);
 
@@ -41,7 +41,7 @@
 #include <base64-helper.h>
 #include <tlslib.h>
 #include <sec-mod.h>
-#include <ccan/hash/hash.h>
+#include <keyed-hash.h>
 #include <ccan/htable/htable.h>
 
 #include <gnutls/gnutls.h>
@@ -51,7 +51,7 @@ static size_t rehash(const void *_e, void *unused)
 {
 	const client_entry_st *e = _e;
 
-	return hash_any(e->sid, sizeof(e->sid), 0);
+	return keyed_hash(e->sid, sizeof(e->sid));
 }
 
 void *sec_mod_client_db_init(sec_mod_st *sec)
@@ -62,6 +62,7 @@ void *sec_mod_client_db_init(sec_mod_st *sec)
 
 	htable_init(db, rehash, NULL);
 	sec->client_db = db;
+	timer_wheel_init(&sec->client_expiry, time(NULL));
 
 	return db;
 }
@@ -85,13 +86,42 @@ struct htable *db = sec->client_db;
 		return 0;
 }
 
+/* Schedules the removal of the entry at its expiration. Entries in use
+ * are not scheduled; they are once released, in expire_client_entry(). */
+static void schedule_client_entry(sec_mod_st *sec, client_entry_st *e)
+{
+	if (e->exptime == -1 || e->in_use > 0)
+		timer_wheel_del(&sec->client_expiry, &e->expiry);
+	else
+		timer_wheel_add(&sec->client_expiry, &e->expiry, e->exptime);
+}
+
+/* Adds the entry with its SID set */
+static int add_client_entry(sec_mod_st *sec, client_entry_st *e)
+{
+	time_t now;
+
+	calc_safe_id(e->sid, SID_SIZE, (char *)e->acct_info.safe_id, sizeof(e->acct_info.safe_id));
+	now = time(NULL);
+	e->exptime = now + e->vhost->perm_config.config->cookie_timeout + AUTH_SLACK_TIME;
+	e->created = now;
+
+	if (htable_add(sec->client_db, rehash(e, NULL), e) == 0) {
+		seclog(sec, LOG_ERR,
+		       "could not add client entry to hash table");
+		return -1;
+	}
+	schedule_client_entry(sec, e);
+
+	return 0;
+}
+
 client_entry_st *new_client_entry(sec_mod_st *sec, struct vhost_cfg_st *vhost, const char *ip, unsigned pid)
 {
 	struct htable *db = sec->client_db;
 	client_entry_st *e, *te;
 	int ret;
 	int retries = 3;
-	time_t now;
 
 	e = talloc_zero(db, client_entry_st);
 	if (e == NULL) {
@@ -102,6 +132,7 @@ client_entry_st *new_client_entry(sec_mod_st *sec, struct vhost_cfg_st *vhost, c
 		strlcpy(e->acct_info.remote_ip, ip, sizeof(e->acct_info.remote_ip));
 	e->acct_info.id = pid;
 	e->vhost = vhost;
+	e->pending_cfd = -1;
 
 	do {
 		ret = gnutls_rnd(GNUTLS_RND_RANDOM, e->sid, sizeof(e->sid));
@@ -123,16 +154,8 @@ client_entry_st *new_client_entry(sec_mod_st *sec, struct vhost_cfg_st *vhost, c
 		goto fail;
 	}
 
-	calc_safe_id(e->sid, SID_SIZE, (char *)e->acct_info.safe_id, sizeof(e->acct_info.safe_id));
-	now = time(NULL);
-	e->exptime = now + vhost->perm_config.config->cookie_timeout + AUTH_SLACK_TIME;
-	e->created = now;
-
-	if (htable_add(db, rehash(e, NULL), e) == 0) {
-		seclog(sec, LOG_ERR,
-		       "could not add client entry to hash table");
+	if (add_client_entry(sec, e) < 0)
 		goto fail;
-	}
 
 	return e;
 
@@ -141,6 +164,29 @@ client_entry_st *new_client_entry(sec_mod_st *sec, struct vhost_cfg_st *vhost, c
 	return NULL;
 }
 
+/* Creates the entry of a session issued by another instance, from its
+ * stateless cookie */
+client_entry_st *restore_client_entry(sec_mod_st *sec, struct vhost_cfg_st *vhost, const uint8_t sid[SID_SIZE])
+{
+	client_entry_st *e;
+
+	e = talloc_zero(sec->client_db, client_entry_st);
+	if (e == NULL) {
+		return NULL;
+	}
+
+	e->vhost = vhost;
+	e->pending_cfd = -1;
+	memcpy(e->sid, sid, SID_SIZE);
+
+	if (add_client_entry(sec, e) < 0) {
+		talloc_free(e);
+		return NULL;
+	}
+
+	return e;
+}
+
 static bool client_entry_cmp(const void *_c1, void *_c2)
 {
 	const struct client_entry_st *c1 = _c1;
@@ -163,26 +209,51 @@ client_entry_st *find_client_entry(sec_mod_st *sec, uint8_t sid[SID_SIZE])
 
 static void clean_entry(sec_mod_st *sec, client_entry_st * e)
 {
+	timer_wheel_del(&sec->client_expiry, &e->expiry);
+
+	/* an asynchronous step is cancelled with the module context */
+	if (e->pending_cfd != -1)
+		close(e->pending_cfd);
 	sec_auth_user_deinit(sec, e);
 	talloc_free(e->msg_str);
 	talloc_free(e);
 }
 
+void update_expiry_lag(sec_mod_st *sec, time_t now, time_t expires)
+{
+	time_t lag = now > expires ? now - expires : 0;
+
+	sec->expired++;
+	sec->expiry_lag_total += lag;
+	if (lag > sec->expiry_lag_max)
+		sec->expiry_lag_max = lag;
+}
+
+/* Removes the entries which are due; only these are visited */
 void cleanup_client_entries(sec_mod_st *sec)
 {
 	struct htable *db = sec->client_db;
 	client_entry_st *t;
-	struct htable_iter iter;
+	timer_wheel_entry_st *w;
+	struct list_head due;
 	time_t now = time(NULL);
 
-	t = htable_first(db, &iter);
-	while (t != NULL) {
+	list_head_init(&due);
+	if (timer_wheel_advance(&sec->client_expiry, now, &due) == 0)
+		return;
+
+	while ((w = list_top(&due, timer_wheel_entry_st, list)) != NULL) {
+		list_del(&w->list);
+		t = container_of(w, client_entry_st, expiry);
+
 		if IS_CLIENT_ENTRY_EXPIRED_FULL(sec, t, now, 1) {
-			htable_delval(db, &iter);
+			update_expiry_lag(sec, now, t->exptime);
+			htable_del(db, rehash(t, NULL), t);
 			clean_entry(sec, t);
+		} else {
+			/* extended, or in use */
+			schedule_client_entry(sec, t);
 		}
-		t = htable_next(db, &iter);
-
 	}
 }
 
@@ -205,6 +276,12 @@ void expire_client_entry(sec_mod_st *sec, client_entry_st * e)
 		    e->discon_reason == REASON_SESSION_TIMEOUT || (e->session_is_open && e->discon_reason == REASON_USER_DISCONNECT))) {
 			seclog(sec, LOG_INFO, "invalidating session of user '%s' "SESSION_STR,
 			       e->acct_info.username, e->acct_info.safe_id);
+
+			/* so that no instance resumes it from the cookie */
+			if (sec->cookie_revocations != NULL && e->cookie_expires != 0 && e->moved == 0)
+				cookie_revocations_add(sec->cookie_revocations, e->sid,
+						       e->cookie_expires, time(NULL));
+
 			/* immediately disconnect the user */
 			del_client_entry(sec, e);
 		} else {
@@ -219,6 +296,7 @@ void expire_client_entry(sec_mod_st *sec, client_entry_st * e)
 			} else {
 				e->exptime = now + e->vhost->perm_config.config->cookie_timeout + AUTH_SLACK_TIME;
 			}
+			schedule_client_entry(sec, e);
 			seclog(sec, LOG_INFO, "temporarily closing session for %s "SESSION_STR, e->acct_info.username, e->acct_info.safe_id);
 		}
 	}
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#include <common.h>
+#include <sec-mod.h>
+#include <sec-mod-key-ops.h>
+#include <ipc.pb-c.h>
+#include <cloexec.h>
+#include <ccan/list/list.h>
+
+int sec_mod_key_op(unsigned cmd, gnutls_privkey_t key, unsigned sig,
+		   const gnutls_datum_t *data, gnutls_datum_t *out)
+{
+	switch (cmd) {
+#if GNUTLS_VERSION_NUMBER >= 0x030600
+	case CMD_SEC_SIGN_DATA:
+		return gnutls_privkey_sign_data2(key, sig, 0, data, out);
+	case CMD_SEC_SIGN_HASH:
+		return gnutls_privkey_sign_hash2(key, sig, 0, data, out);
+#endif
+	case CMD_SEC_DECRYPT:
+		return gnutls_privkey_decrypt_data(key, 0, data, out);
+	case CMD_SEC_SIGN:
+		return gnutls_privkey_sign_hash(key, 0,
+						GNUTLS_PRIVKEY_SIGN_FLAG_TLS1_RSA,
+						data, out);
+	default:
+		return GNUTLS_E_INVALID_REQUEST;
+	}
+}
+
+#ifdef HAVE_PTHREAD
+
+/* The operations are allocated with malloc() rather than talloc, as they
+ * are accessed by the threads. */
+struct key_op_st {
+	struct list_node list;
+	int cfd;
+	unsigned cmd;
+	gnutls_privkey_t key;
+	unsigned sig;
+	gnutls_datum_t data;
+	gnutls_datum_t out;
+	int ret;
+};
+
+struct sec_mod_key_ops_st {
+	pthread_mutex_t lock;
+	pthread_cond_t queued; /* an operation was queued, or exiting was set */
+	pthread_cond_t idle; /* pending dropped to zero */
+	struct list_head queue; /* waiting for a thread */
+	struct list_head done; /* waiting for their reply to be sent */
+	unsigned pending; /* queued or running */
+	unsigned exiting;
+
+	int pipe[2]; /* written by the threads when done becomes non-empty */
+
+	pthread_t *threads;
+	unsigned nthreads;
+};
+
+static void key_op_free(struct key_op_st *op)
+{
+	if (op->data.data) {
+		safe_memset(op->data.data, 0, op->data.size);
+		free(op->data.data);
+	}
+	free(op);
+}
+
+static void *key_op_thread(void *arg)
+{
+	struct sec_mod_key_ops_st *ko = arg;
+	struct key_op_st *op;
+	unsigned notify;
+	ssize_t ret;
+	char c = 0;
+
+	pthread_mutex_lock(&ko->lock);
+	for (;;) {
+		while (!ko->exiting && list_empty(&ko->queue))
+			pthread_cond_wait(&ko->queued, &ko->lock);
+		if (ko->exiting)
+			break;
+
+		op = list_top(&ko->queue, struct key_op_st, list);
+		list_del(&op->list);
+		pthread_mutex_unlock(&ko->lock);
+
+		op->ret = sec_mod_key_op(op->cmd, op->key, op->sig, &op->data, &op->out);
+
+		pthread_mutex_lock(&ko->lock);
+		notify = list_empty(&ko->done);
+		list_add_tail(&ko->done, &op->list);
+		if (--ko->pending == 0)
+			pthread_cond_broadcast(&ko->idle);
+
+		/* the pipe is non-blocking; if it is full the loop is
+		 * going to be woken up anyway */
+		if (notify) {
+			ret = write(ko->pipe[1], &c, 1);
+			(void)ret;
+		}
+	}
+	pthread_mutex_unlock(&ko->lock);
+
+	return NULL;
+}
+
+static void stop_threads(struct sec_mod_key_ops_st *ko)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&ko->lock);
+	ko->exiting = 1;
+	pthread_cond_broadcast(&ko->queued);
+	pthread_mutex_unlock(&ko->lock);
+
+	for (i = 0; i < ko->nthreads; i++)
+		pthread_join(ko->threads[i], NULL);
+	ko->nthreads = 0;
+}
+
+void sec_mod_key_ops_init(sec_mod_st *sec, unsigned threads)
+{
+	struct sec_mod_key_ops_st *ko;
+	unsigned i;
+	int ret;
+
+	if (threads == 0)
+		return;
+
+	if (threads > KEY_OPS_MAX_THREADS)
+		threads = KEY_OPS_MAX_THREADS;
+
+	ko = talloc_zero(sec, struct sec_mod_key_ops_st);
+	if (ko == NULL)
+		goto fail;
+
+	ko->threads = talloc_array(ko, pthread_t, threads);
+	if (ko->threads == NULL)
+		goto fail;
+
+	if (pipe(ko->pipe) == -1) {
+		seclog(sec, LOG_ERR, "error creating pipe: %s", strerror(errno));
+		goto fail;
+	}
+	set_cloexec_flag(ko->pipe[0], 1);
+	set_cloexec_flag(ko->pipe[1], 1);
+	set_non_block(ko->pipe[0]);
+	set_non_block(ko->pipe[1]);
+
+	pthread_mutex_init(&ko->lock, NULL);
+	pthread_cond_init(&ko->queued, NULL);
+	pthread_cond_init(&ko->idle, NULL);
+	list_head_init(&ko->queue);
+	list_head_init(&ko->done);
+
+	for (i = 0; i < threads; i++) {
+		ret = pthread_create(&ko->threads[i], NULL, key_op_thread, ko);
+		if (ret != 0) {
+			seclog(sec, LOG_ERR, "error creating key operation thread: %s",
+			       strerror(ret));
+			break;
+		}
+		ko->nthreads++;
+	}
+
+	if (ko->nthreads == 0) {
+		pthread_mutex_destroy(&ko->lock);
+		pthread_cond_destroy(&ko->queued);
+		pthread_cond_destroy(&ko->idle);
+		close(ko->pipe[0]);
+		close(ko->pipe[1]);
+		goto fail;
+	}
+
+	seclog(sec, LOG_INFO, "running private key operations in %u threads",
+	       ko->nthreads);
+	sec->key_ops_pool = ko;
+	return;
+
+ fail:
+	seclog(sec, LOG_ERR, "private key operations will not be run in threads");
+	talloc_free(ko);
+}
+
+void sec_mod_key_ops_deinit(sec_mod_st *sec)
+{
+	struct sec_mod_key_ops_st *ko = sec->key_ops_pool;
+
+	if (ko == NULL)
+		return;
+
+	sec_mod_key_ops_wait(sec);
+	stop_threads(ko);
+
+	pthread_mutex_destroy(&ko->lock);
+	pthread_cond_destroy(&ko->queued);
+	pthread_cond_destroy(&ko->idle);
+	close(ko->pipe[0]);
+	close(ko->pipe[1]);
+
+	talloc_free(ko);
+	sec->key_ops_pool = NULL;
+}
+
+int sec_mod_key_op_submit(sec_mod_st *sec, int cfd, unsigned cmd,
+			  gnutls_privkey_t key, unsigned sig,
+			  const gnutls_datum_t *data)
+{
+	struct sec_mod_key_ops_st *ko = sec->key_ops_pool;
+	struct key_op_st *op;
+	unsigned depth;
+
+	if (ko == NULL)
+		return -1;
+
+	op = calloc(1, sizeof(*op));
+	if (op == NULL)
+		return -1;
+
+	op->data.data = malloc(data->size ? data->size : 1);
+	if (op->data.data == NULL) {
+		free(op);
+		return -1;
+	}
+	memcpy(op->data.data, data->data, data->size);
+	op->data.size = data->size;
+
+	op->cfd = cfd;
+	op->cmd = cmd;
+	op->key = key;
+	op->sig = sig;
+
+	pthread_mutex_lock(&ko->lock);
+	/* the pending operations hold a descriptor each; beyond that
+	 * limit the caller runs the operation */
+	if (ko->pending >= ko->nthreads * KEY_OPS_MAX_QUEUE_PER_THREAD) {
+		pthread_mutex_unlock(&ko->lock);
+		key_op_free(op);
+		return -1;
+	}
+	list_add_tail(&ko->queue, &op->list);
+	depth = ++ko->pending;
+	pthread_cond_signal(&ko->queued);
+	pthread_mutex_unlock(&ko->lock);
+
+	if (depth > sec->key_op_queue_max)
+		sec->key_op_queue_max = depth;
+
+	return KEY_OP_QUEUED;
+}
+
+int sec_mod_key_ops_fd(sec_mod_st *sec)
+{
+	if (sec->key_ops_pool == NULL)
+		return -1;
+	return sec->key_ops_pool->pipe[0];
+}
+
+void sec_mod_key_ops_complete(sec_mod_st *sec)
+{
+	struct sec_mod_key_ops_st *ko = sec->key_ops_pool;
+	struct key_op_st *op;
+	char buf[64];
+	int ret;
+
+	if (ko == NULL)
+		return;
+
+	while (read(ko->pipe[0], buf, sizeof(buf)) > 0)
+		;
+
+	for (;;) {
+		pthread_mutex_lock(&ko->lock);
+		op = list_top(&ko->done, struct key_op_st, list);
+		if (op != NULL)
+			list_del(&op->list);
+		pthread_mutex_unlock(&ko->lock);
+
+		if (op == NULL)
+			break;
+
+		if (op->ret < 0) {
+			seclog(sec, LOG_INFO, "error in crypto operation: %s",
+			       gnutls_strerror(op->ret));
+		} else {
+			SecOpMsg msg = SEC_OP_MSG__INIT;
+
+			msg.data.data = op->out.data;
+			msg.data.len = op->out.size;
+
+			ret = send_msg(sec, op->cfd, op->cmd, &msg,
+				       (pack_size_func) sec_op_msg__get_packed_size,
+				       (pack_func) sec_op_msg__pack);
+			if (ret < 0) {
+				seclog(sec, LOG_WARNING, "sec-mod error in sending reply");
+			}
+			gnutls_free(op->out.data);
+		}
+
+		close(op->cfd);
+		key_op_free(op);
+	}
+}
+
+void sec_mod_key_ops_wait(sec_mod_st *sec)
+{
+	struct sec_mod_key_ops_st *ko = sec->key_ops_pool;
+
+	if (ko == NULL)
+		return;
+
+	pthread_mutex_lock(&ko->lock);
+	while (ko->pending > 0)
+		pthread_cond_wait(&ko->idle, &ko->lock);
+	pthread_mutex_unlock(&ko->lock);
+
+	sec_mod_key_ops_complete(sec);
+}
+
+#else
+
+void sec_mod_key_ops_init(sec_mod_st *sec, unsigned threads)
+{
+	if (threads != 0)
+		seclog(sec, LOG_WARNING, "'sec-mod-key-threads' is set but threads are not supported");
+}
+
+void sec_mod_key_ops_deinit(sec_mod_st *sec)
+{
+}
+
+int sec_mod_key_op_submit(sec_mod_st *sec, int cfd, unsigned cmd,
+			  gnutls_privkey_t key, unsigned sig,
+			  const gnutls_datum_t *data)
+{
+	return -1;
+}
+
+int sec_mod_key_ops_fd(sec_mod_st *sec)
+{
+	return -1;
+}
+
+void sec_mod_key_ops_complete(sec_mod_st *sec)
+{
+}
+
+void sec_mod_key_ops_wait(sec_mod_st *sec)
+{
+}
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_SEC_MOD_KEY_OPS_H
+# define OC_SEC_MOD_KEY_OPS_H
+
+# include <sec-mod.h>
+# include <gnutls/abstract.h>
+
+/* When 'sec-mod-key-threads' is set, the private key operations requested
+ * by the workers are run by a pool of threads, so that a slow operation
+ * (e.g., on a token) does not block sec-mod. The threads only run the
+ * gnutls_privkey_* calls; the replies are sent by the sec-mod loop, in
+ * the order the operations complete.
+ */
+
+/* returned by sec_mod_key_op_submit() when the operation was queued; the
+ * connection is owned by the pool until the reply is sent. */
+#define KEY_OP_QUEUED SEC_REPLY_DEFERRED
+
+#define KEY_OPS_MAX_THREADS 64
+#define KEY_OPS_MAX_QUEUE_PER_THREAD 256
+
+/* Runs a CMD_SEC_SIGN, CMD_SEC_DECRYPT, CMD_SEC_SIGN_DATA or
+ * CMD_SEC_SIGN_HASH operation; @out must be released with gnutls_free(). */
+int sec_mod_key_op(unsigned cmd, gnutls_privkey_t key, unsigned sig,
+		   const gnutls_datum_t *data, gnutls_datum_t *out);
+
+void sec_mod_key_ops_init(sec_mod_st *sec, unsigned threads);
+void sec_mod_key_ops_deinit(sec_mod_st *sec);
+
+/* Returns KEY_OP_QUEUED, or a negative value if the operation could not
+ * be queued and must be run by the caller. */
+int sec_mod_key_op_submit(sec_mod_st *sec, int cfd, unsigned cmd,
+			  gnutls_privkey_t key, unsigned sig,
+			  const gnutls_datum_t *data);
+
+/* The descriptor which becomes readable when operations complete, or -1 */
+int sec_mod_key_ops_fd(sec_mod_st *sec);
+
+/* Sends the replies of the completed operations */
+void sec_mod_key_ops_complete(sec_mod_st *sec);
+
+/* Waits until all queued operations complete and their replies are sent;
+ * called before the keys are reloaded or released. */
+void sec_mod_key_ops_wait(sec_mod_st *sec);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <talloc.h>
+#ifdef HAVE_EPOLL_PWAIT
+# include <sys/epoll.h>
+#else
+# include <poll.h>
+#endif
+#include <sec-mod-poll.h>
+
+#ifdef HAVE_EPOLL_PWAIT
+
+struct sec_mod_poll_st {
+	int fd;
+};
+
+static int poll_destructor(struct sec_mod_poll_st *p)
+{
+	if (p->fd != -1)
+		close(p->fd);
+	return 0;
+}
+
+sec_mod_poll_st *sec_mod_poll_new(void *pool)
+{
+	struct sec_mod_poll_st *p;
+
+	p = talloc_zero(pool, struct sec_mod_poll_st);
+	if (p == NULL)
+		return NULL;
+
+	p->fd = epoll_create1(EPOLL_CLOEXEC);
+	if (p->fd == -1) {
+		talloc_free(p);
+		return NULL;
+	}
+	talloc_set_destructor(p, poll_destructor);
+
+	return p;
+}
+
+int sec_mod_poll_add(sec_mod_poll_st *p, int fd, void *data)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = data;
+
+	return epoll_ctl(p->fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void sec_mod_poll_del(sec_mod_poll_st *p, int fd)
+{
+	struct epoll_event ev;
+
+	/* a non-NULL event for kernels before 2.6.9 */
+	memset(&ev, 0, sizeof(ev));
+	epoll_ctl(p->fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+int sec_mod_poll_wait(sec_mod_poll_st *p, void **ready, unsigned max,
+		      int timeout_ms, const sigset_t *sigmask)
+{
+	struct epoll_event events[SEC_MOD_POLL_MAX_EVENTS];
+	int ret, i;
+
+	if (max > SEC_MOD_POLL_MAX_EVENTS)
+		max = SEC_MOD_POLL_MAX_EVENTS;
+
+	ret = epoll_pwait(p->fd, events, max, timeout_ms, sigmask);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < ret; i++)
+		ready[i] = events[i].data.ptr;
+
+	return ret;
+}
+
+#else
+
+struct sec_mod_poll_st {
+	struct pollfd *fds;
+	void **data;
+	unsigned count;
+	unsigned size;
+};
+
+sec_mod_poll_st *sec_mod_poll_new(void *pool)
+{
+	return talloc_zero(pool, struct sec_mod_poll_st);
+}
+
+int sec_mod_poll_add(sec_mod_poll_st *p, int fd, void *data)
+{
+	struct pollfd *fds;
+	void **d;
+
+	if (p->count == p->size) {
+		unsigned size = p->size ? p->size * 2 : 16;
+
+		fds = talloc_realloc(p, p->fds, struct pollfd, size);
+		if (fds == NULL)
+			return -1;
+		p->fds = fds;
+
+		d = talloc_realloc(p, p->data, void *, size);
+		if (d == NULL)
+			return -1;
+		p->data = d;
+
+		p->size = size;
+	}
+
+	p->fds[p->count].fd = fd;
+	p->fds[p->count].events = POLLIN;
+	p->fds[p->count].revents = 0;
+	p->data[p->count] = data;
+	p->count++;
+
+	return 0;
+}
+
+void sec_mod_poll_del(sec_mod_poll_st *p, int fd)
+{
+	unsigned i;
+
+	for (i = 0; i < p->count; i++) {
+		if (p->fds[i].fd == fd) {
+			p->count--;
+			p->fds[i] = p->fds[p->count];
+			p->data[i] = p->data[p->count];
+			return;
+		}
+	}
+}
+
+int sec_mod_poll_wait(sec_mod_poll_st *p, void **ready, unsigned max,
+		      int timeout_ms, const sigset_t *sigmask)
+{
+	unsigned i, n = 0;
+	int ret;
+#ifdef HAVE_PPOLL
+	struct timespec ts;
+
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+
+	ret = ppoll(p->fds, p->count, &ts, sigmask);
+#else
+	sigset_t old;
+
+	sigprocmask(SIG_SETMASK, sigmask, &old);
+	ret = poll(p->fds, p->count, timeout_ms);
+	sigprocmask(SIG_SETMASK, &old, NULL);
+#endif
+	if (ret <= 0)
+		return ret;
+
+	for (i = 0; i < p->count && n < max; i++) {
+		if (p->fds[i].revents != 0)
+			ready[n++] = p->data[i];
+	}
+
+	return n;
+}
+
+#endif
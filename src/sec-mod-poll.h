@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_SEC_MOD_POLL_H
+# define OC_SEC_MOD_POLL_H
+
+# include <signal.h>
+
+/* A level-triggered readiness poller for the descriptors of sec-mod. It
+ * uses epoll when available, and ppoll() or poll() otherwise. Each
+ * descriptor is registered with an opaque pointer which is returned
+ * when it becomes readable.
+ */
+typedef struct sec_mod_poll_st sec_mod_poll_st;
+
+#define SEC_MOD_POLL_MAX_EVENTS 64
+
+sec_mod_poll_st *sec_mod_poll_new(void *pool);
+
+int sec_mod_poll_add(sec_mod_poll_st *p, int fd, void *data);
+void sec_mod_poll_del(sec_mod_poll_st *p, int fd);
+
+/* Waits up to @timeout_ms with the signal mask set to @sigmask and
+ * stores in @ready the data of up to @max readable descriptors. Returns
+ * their number, or -1 with errno set. */
+int sec_mod_poll_wait(sec_mod_poll_st *p, void **ready, unsigned max,
+		      int timeout_ms, const sigset_t *sigmask);
+
+#endif
@@ -31,7 +31,7 @@
 #include <sys/ioctl.h>
 #include <gnutls/gnutls.h>
 #include <gnutls/crypto.h>
-#include <ccan/hash/hash.h>
+#include <keyed-hash.h>
 
 #include <main.h>
 #include <sec-mod-resume.h>
@@ -46,7 +46,7 @@ int handle_resume_delete_req(sec_mod_st *sec,
 	struct htable_iter iter;
 	size_t key;
 
-	key = hash_any(req->session_id.data, req->session_id.len, 0);
+	key = keyed_hash(req->session_id.data, req->session_id.len);
 
 	cache = htable_firstval(sec->tls_db.ht, &iter, key);
 	while (cache != NULL) {
@@ -58,6 +58,7 @@ int handle_resume_delete_req(sec_mod_st *sec,
 			cache->session_id_size = 0;
 
 			htable_delval(sec->tls_db.ht, &iter);
+			timer_wheel_del(&sec->tls_expiry, &cache->expiry);
 			talloc_free(cache);
 			sec->tls_db.entries--;
 			return 0;
@@ -79,7 +80,7 @@ int handle_resume_fetch_req(sec_mod_st *sec,
 
 	rep->reply = SESSION_RESUME_REPLY_MSG__RESUME__REP__FAILED;
 
-	key = hash_any(req->session_id.data, req->session_id.len, 0);
+	key = keyed_hash(req->session_id.data, req->session_id.len);
 
 	cache = htable_firstval(sec->tls_db.ht, &iter, key);
 	while (cache != NULL) {
@@ -120,6 +121,17 @@ int handle_resume_fetch_req(sec_mod_st *sec,
 
 }
 
+/* The time after which the session can no longer be resumed */
+static time_t tls_session_expires(sec_mod_st *sec, tls_cache_st *cache)
+{
+	gnutls_datum_t d;
+
+	d.data = (void *)cache->session_data;
+	d.size = cache->session_data_size;
+
+	return gnutls_db_check_entry_time(&d) + TLS_SESSION_EXPIRATION_TIME(GETCONFIG(sec)) + 1;
+}
+
 int handle_resume_store_req(sec_mod_st *sec,
 			    const SessionResumeStoreReqMsg *req)
 {
@@ -146,9 +158,9 @@ int handle_resume_store_req(sec_mod_st *sec,
 		return -1;
 	}
 
-	key = hash_any(req->session_id.data, req->session_id.len, 0);
+	key = keyed_hash(req->session_id.data, req->session_id.len);
 
-	cache = talloc(sec->tls_db.ht, tls_cache_st);
+	cache = talloc_zero(sec->tls_db.ht, tls_cache_st);
 	if (cache == NULL)
 		return -1;
 
@@ -171,6 +183,7 @@ int handle_resume_store_req(sec_mod_st *sec,
 		talloc_free(cache);
 	} else {
 		sec->tls_db.entries++;
+		timer_wheel_add(&sec->tls_expiry, &cache->expiry, tls_session_expires(sec, cache));
 
 		seclog_hex(sec, LOG_DEBUG, "TLS session DB storing",
 					req->session_id.data,
@@ -180,32 +193,38 @@ int handle_resume_store_req(sec_mod_st *sec,
 	return 0;
 }
 
+/* Removes the sessions which are due; only these are visited */
 void expire_tls_sessions(sec_mod_st *sec)
 {
 	tls_cache_st *cache;
-	struct htable_iter iter;
+	timer_wheel_entry_st *w;
+	struct list_head due;
 	time_t now, exp;
 
 	now = time(NULL);
 
-	cache = htable_first(sec->tls_db.ht, &iter);
-	while (cache != NULL) {
-		gnutls_datum_t d;
-
-		d.data = (void *)cache->session_data;
-		d.size = cache->session_data_size;
+	list_head_init(&due);
+	if (timer_wheel_advance(&sec->tls_expiry, now, &due) == 0)
+		return;
 
-		exp = gnutls_db_check_entry_time(&d);
+	while ((w = list_top(&due, timer_wheel_entry_st, list)) != NULL) {
+		list_del(&w->list);
+		cache = container_of(w, tls_cache_st, expiry);
 
-		if (now - exp > TLS_SESSION_EXPIRATION_TIME(GETCONFIG(sec))) {
-			cache->session_id_size = 0;
+		/* the expiration time may have changed on reload */
+		exp = tls_session_expires(sec, cache);
+		if (now < exp) {
+			timer_wheel_add(&sec->tls_expiry, &cache->expiry, exp);
+			continue;
+		}
 
-			htable_delval(sec->tls_db.ht, &iter);
+		update_expiry_lag(sec, now, exp);
+		htable_del(sec->tls_db.ht,
+			   keyed_hash(cache->session_id, cache->session_id_size), cache);
+		cache->session_id_size = 0;
 
-			safe_memset(cache->session_data, 0, cache->session_data_size);
-			talloc_free(cache);
-			sec->tls_db.entries--;
-		}
-		cache = htable_next(sec->tls_db.ht, &iter);
+		safe_memset(cache->session_data, 0, cache->session_data_size);
+		talloc_free(cache);
+		sec->tls_db.entries--;
 	}
 }
@@ -41,7 +41,11 @@
 #include <tlslib.h>
 #include <ipc.pb-c.h>
 #include <sec-mod-sup-config.h>
+#include <sup-config/file.h>
 #include <sec-mod-resume.h>
+#include <sec-mod-key-ops.h>
+#include <sec-mod-poll.h>
+#include "acct/radius-queue.h"
 #include <cloexec.h>
 #include <assert.h>
 
@@ -252,47 +256,13 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 
 		return ret;
 
-	case CMD_SEC_SIGN_DATA:
-	case CMD_SEC_SIGN_HASH:
-		op = sec_op_msg__unpack(&pa, data.size, data.data);
-		if (op == NULL) {
-			seclog(sec, LOG_INFO, "error unpacking sec op\n");
-			return -1;
-		}
-
-		vhost = find_vhost(sec->vconfig, op->vhost);
-		assert(vhost != NULL);
-
-		i = op->key_idx;
-		if (op->has_key_idx == 0 || i >= vhost->key_size) {
-			seclog(sec, LOG_INFO,
-			       "%sreceived out-of-bounds key index (%d); have %d keys", PREFIX_VHOST(vhost), i, vhost->key_size);
-			return -1;
-		}
-
-		data.data = op->data.data;
-		data.size = op->data.len;
-
-		if (cmd == CMD_SEC_SIGN_DATA) {
-			ret = gnutls_privkey_sign_data2(vhost->key[i], op->sig, 0, &data, &out);
-		} else {
-			ret = gnutls_privkey_sign_hash2(vhost->key[i], op->sig, 0, &data, &out);
-		}
-		sec_op_msg__free_unpacked(op, &pa);
-
-		if (ret < 0) {
-			seclog(sec, LOG_INFO, "error in crypto operation: %s",
-			       gnutls_strerror(ret));
-			return -1;
-		}
-
-		ret = handle_op(pool, cfd, sec, cmd, out.data, out.size);
-		gnutls_free(out.data);
-
-		return ret;
 #endif
 	case CMD_SEC_SIGN:
 	case CMD_SEC_DECRYPT:
+#if GNUTLS_VERSION_NUMBER >= 0x030600
+	case CMD_SEC_SIGN_DATA:
+	case CMD_SEC_SIGN_HASH:
+#endif
 		op = sec_op_msg__unpack(&pa, data.size, data.data);
 		if (op == NULL) {
 			seclog(sec, LOG_INFO, "error unpacking sec op\n");
@@ -311,17 +281,16 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 
 		data.data = op->data.data;
 		data.size = op->data.len;
+		sec->key_ops++;
 
-		if (cmd == CMD_SEC_DECRYPT) {
-			ret =
-			    gnutls_privkey_decrypt_data(vhost->key[i], 0, &data,
-							&out);
-		} else {
-			ret =
-			    gnutls_privkey_sign_hash(vhost->key[i], 0,
-						     GNUTLS_PRIVKEY_SIGN_FLAG_TLS1_RSA,
-						     &data, &out);
+		/* when queued, the reply is sent once the operation completes */
+		ret = sec_mod_key_op_submit(sec, cfd, cmd, vhost->key[i], op->sig, &data);
+		if (ret == KEY_OP_QUEUED) {
+			sec_op_msg__free_unpacked(op, &pa);
+			return ret;
 		}
+
+		ret = sec_mod_key_op(cmd, vhost->key[i], op->sig, &data, &out);
 		sec_op_msg__free_unpacked(op, &pa);
 
 		if (ret < 0) {
@@ -579,8 +548,11 @@ static void handle_sigterm(int signo)
 static void send_stats_to_main(sec_mod_st *sec)
 {
 	int ret;
+	unsigned i;
 	time_t now = time(NULL);
 	SecmStatsMsg msg = SECM_STATS_MSG__INIT;
+	AuthLatencyMsg latency[MAX_AUTH_LATENCY_MODULES];
+	AuthLatencyMsg *platency[MAX_AUTH_LATENCY_MODULES];
 
 	if (GETPCONFIG(sec)->stats_reset_time != 0 &&
 	    now - sec->last_stats_reset > GETPCONFIG(sec)->stats_reset_time) {
@@ -595,8 +567,45 @@ static void send_stats_to_main(sec_mod_st *sec)
 	msg.secmod_auth_failures = sec->auth_failures;
 	msg.secmod_avg_auth_time = sec->avg_auth_time;
 	msg.secmod_max_auth_time = sec->max_auth_time;
-	/* we only report the number of failures since last call */
+	msg.has_secmod_key_ops = 1;
+	msg.secmod_key_ops = sec->key_ops;
+	msg.has_secmod_key_op_queue_max = 1;
+	msg.secmod_key_op_queue_max = sec->key_op_queue_max;
+#ifdef HAVE_RADIUS
+	acct_queue_get_stats(&msg.secmod_acct_sent, &msg.secmod_acct_dropped,
+			     &msg.secmod_acct_backlog);
+	msg.has_secmod_acct_sent = 1;
+	msg.has_secmod_acct_dropped = 1;
+	msg.has_secmod_acct_backlog = 1;
+#endif
+	for (i = 0; i < sec->auth_latency_size; i++) {
+		auth_latency_msg__init(&latency[i]);
+		latency[i].module = sec->auth_latency[i].module;
+		latency[i].count = sec->auth_latency[i].count;
+		latency[i].total_usecs = sec->auth_latency[i].total_usecs;
+		latency[i].max_usecs = sec->auth_latency[i].max_usecs;
+		platency[i] = &latency[i];
+	}
+	msg.secmod_auth_latency = platency;
+	msg.n_secmod_auth_latency = sec->auth_latency_size;
+	sup_config_file_get_stats(&msg.secmod_sup_config_hits, &msg.secmod_sup_config_misses);
+	msg.has_secmod_sup_config_hits = 1;
+	msg.has_secmod_sup_config_misses = 1;
+	msg.secmod_expired = sec->expired;
+	msg.has_secmod_expired = 1;
+	msg.secmod_expiry_lag_total = sec->expiry_lag_total;
+	msg.has_secmod_expiry_lag_total = 1;
+	msg.secmod_expiry_lag_max = sec->expiry_lag_max;
+	msg.has_secmod_expiry_lag_max = 1;
+
+	/* we only report the number of failures and key operations since last call */
 	sec->auth_failures = 0;
+	sec->key_ops = 0;
+	sec->key_op_queue_max = 0;
+	sec->auth_latency_size = 0;
+	sec->expired = 0;
+	sec->expiry_lag_total = 0;
+	sec->expiry_lag_max = 0;
 
 	/* the following two are not resettable */
 	msg.secmod_client_entries = sec_mod_client_db_elems(sec);
@@ -616,6 +625,9 @@ static void reload_server(sec_mod_st *sec)
 	vhost_cfg_st *vhost = NULL;
 
 	seclog(sec, LOG_DEBUG, "reloading configuration");
+	/* the keys may be replaced */
+	sec_mod_key_ops_wait(sec);
+
 	reload_cfg_file(sec, sec->vconfig, 1);
 	load_keys(sec, 0);
 
@@ -634,6 +646,8 @@ static void check_other_work(sec_mod_st *sec)
 	if (need_exit) {
 		unsigned i;
 
+		sec_mod_key_ops_deinit(sec);
+
 		list_for_each(sec->vconfig, vhost, list) {
 			for (i = 0; i < vhost->key_size; i++) {
 				gnutls_privkey_deinit(vhost->key[i]);
@@ -653,10 +667,12 @@ static void check_other_work(sec_mod_st *sec)
 		reload_server(sec);
 	}
 
+	/* cheap unless entries are due */
+	cleanup_client_entries(sec);
+	expire_tls_sessions(sec);
+
 	if (need_maintainance) {
 		seclog(sec, LOG_DEBUG, "performing maintenance");
-		cleanup_client_entries(sec);
-		expire_tls_sessions(sec);
 		send_stats_to_main(sec);
 		seclog(sec, LOG_DEBUG, "active sessions %d",
 			sec_mod_client_db_elems(sec));
@@ -665,13 +681,135 @@ static void check_other_work(sec_mod_st *sec)
 	}
 }
 
+/* Every descriptor in the poll set is described by a sec_conn_st; for
+ * the worker connections it also holds the request being received. */
+#define SEC_FD_MAIN 1
+#define SEC_FD_MAIN_SYNC 2
+#define SEC_FD_LISTEN 3
+#define SEC_FD_KEY_OPS 4
+#define SEC_FD_WORKER 5
+#define SEC_FD_WATCH 6
+
+/* connections beyond that wait in the listen backlog */
+#define MAX_WORKER_CONNS 1024
+#define BUFFER_POOL_SIZE 32
+
+typedef struct sec_conn_st {
+	unsigned type; /* SEC_FD_; first as in sec_mod_watch_st */
+	struct list_node list;
+	int fd;
+	pid_t pid;
+	time_t deadline; /* the request must be received by then */
+
+	uint8_t hdr[5]; /* cmd and length */
+	uint8_t *buffer; /* the body; allocated once the header is received */
+	size_t length;
+	size_t pos; /* bytes received of hdr or buffer */
+} sec_conn_st;
+
+typedef struct sec_server_st {
+	sec_mod_poll_st *poll;
+	sec_conn_st listener;
+	unsigned listening; /* whether the listener is in the poll set */
+
+	/* the worker connections in accept order, and thus by deadline */
+	struct list_head conns;
+	unsigned nconns;
+
+	/* message buffers are recycled rather than allocated per request */
+	uint8_t *buffers[BUFFER_POOL_SIZE];
+	unsigned nbuffers;
+
+	struct list_head watches;
+	sec_mod_st *sec; /* passed to the watches */
+} sec_server_st;
+
+static sec_server_st *sec_server;
+
+/* the watches added before the loop starts */
+static LIST_HEAD(early_watches);
+
+int sec_mod_watch_add(sec_mod_watch_st *w)
+{
+	w->type = SEC_FD_WATCH;
+
+	if (sec_server == NULL) {
+		list_add_tail(&early_watches, &w->list);
+		return 0;
+	}
+
+	if (w->fd != -1 && sec_mod_poll_add(sec_server->poll, w->fd, w) < 0)
+		return -1;
+
+	list_add_tail(&sec_server->watches, &w->list);
+	return 0;
+}
+
+sec_mod_st *sec_mod_watch_sec(void)
+{
+	return sec_server ? sec_server->sec : NULL;
+}
+
+void sec_mod_watch_del(sec_mod_watch_st *w)
+{
+	if (sec_server != NULL && w->fd != -1)
+		sec_mod_poll_del(sec_server->poll, w->fd);
+	list_del(&w->list);
+}
+
+/* Processes the expired timers of the watches; returns the milliseconds
+ * until the next one, or -1 if there is none. */
+static int expire_watches(sec_mod_st *sec, sec_server_st *srv)
+{
+	time_t now = time(NULL);
+	sec_mod_watch_st *w, *next;
+	int ret, secs = -1;
+
+	list_for_each_safe(&srv->watches, w, next, list) {
+		if (w->expire == NULL)
+			continue;
+
+		ret = w->expire(sec, w, now);
+		if (ret >= 0 && (secs == -1 || ret < secs))
+			secs = ret;
+	}
+
+	return (secs == -1) ? -1 : secs * 1000;
+}
+
+static uint8_t *get_buffer(sec_mod_st *sec, sec_server_st *srv)
+{
+	if (srv->nbuffers > 0)
+		return srv->buffers[--srv->nbuffers];
+	return talloc_size(sec, MAX_MSG_SIZE);
+}
+
+static void put_buffer(sec_server_st *srv, uint8_t *buffer, size_t used)
+{
+	/* the requests may contain passwords */
+	safe_memset(buffer, 0, used);
+
+	if (srv->nbuffers < BUFFER_POOL_SIZE)
+		srv->buffers[srv->nbuffers++] = buffer;
+	else
+		talloc_free(buffer);
+}
+
 static
-int serve_request_main(sec_mod_st *sec, int fd, uint8_t *buffer, unsigned buffer_size)
+int serve_request_main(sec_mod_st *sec, sec_server_st *srv, int fd)
 {
 	int ret, e;
 	uint8_t cmd;
-	size_t length;
-	void *pool = buffer;
+	size_t length = 0;
+	uint8_t *buffer;
+	void *pool;
+
+	buffer = get_buffer(sec, srv);
+	pool = talloc_new(sec);
+	if (buffer == NULL || pool == NULL) {
+		seclog(sec, LOG_ERR, "error in memory allocation");
+		exit(EXIT_FAILURE);
+	}
 
 	/* read request */
 	ret = recv_msg_headers(fd, &cmd, MAIN_SEC_MOD_TIMEOUT);
@@ -687,11 +825,14 @@ int serve_request_main(sec_mod_st *sec, int fd, uint8_t *buffer, unsigned buffer
 	if (cmd <= MIN_SECM_CMD || cmd >= MAX_SECM_CMD) {
 		seclog(sec, LOG_ERR, "received invalid message from main of %u bytes (cmd: %u)\n",
 		      (unsigned)length, (unsigned)cmd);
-		return ERR_BAD_COMMAND;
+		length = 0;
+		ret = ERR_BAD_COMMAND;
+		goto leave;
 	}
 
-	if (length > buffer_size) {
+	if (length > MAX_MSG_SIZE) {
 		seclog(sec, LOG_ERR, "received too big message (%d)", (int)length);
+		length = 0;
 		ret = ERR_BAD_COMMAND;
 		goto leave;
 	}
@@ -712,49 +853,215 @@ int serve_request_main(sec_mod_st *sec, int fd, uint8_t *buffer, unsigned buffer
 	}
 
  leave:
+	talloc_free(pool);
+	put_buffer(srv, buffer, length);
 	return ret;
 }
 
-static
-int serve_request_worker(sec_mod_st *sec, int cfd, pid_t pid, uint8_t *buffer, unsigned buffer_size)
+static void listener_update(sec_server_st *srv)
 {
-	int ret, e;
-	uint8_t cmd;
-	size_t length;
-	void *pool = buffer;
+	if (srv->listening && srv->nconns >= MAX_WORKER_CONNS) {
+		sec_mod_poll_del(srv->poll, srv->listener.fd);
+		srv->listening = 0;
+	} else if (!srv->listening && srv->nconns < MAX_WORKER_CONNS) {
+		if (sec_mod_poll_add(srv->poll, srv->listener.fd, &srv->listener) == 0)
+			srv->listening = 1;
+	}
+}
 
-	/* read request */
-	ret = recv_msg_headers(cfd, &cmd, MAX_WAIT_SECS);
-	if (ret < 0) {
-		seclog(sec, LOG_DEBUG, "error receiving msg head from worker");
-		goto leave;
+static void conn_close(sec_server_st *srv, sec_conn_st *c)
+{
+	if (c->fd != -1) {
+		sec_mod_poll_del(srv->poll, c->fd);
+		close(c->fd);
 	}
 
-	length = ret;
+	if (c->buffer)
+		put_buffer(srv, c->buffer, c->pos);
 
-	if (length > buffer_size) {
-		seclog(sec, LOG_INFO, "too big message (%d)", (int)length);
-		ret = -1;
-		goto leave;
+	list_del(&c->list);
+	srv->nconns--;
+	talloc_free(c);
+
+	listener_update(srv);
+}
+
+/* Accepts all the pending connections */
+static void conn_accept(sec_mod_st *sec, sec_server_st *srv)
+{
+	struct sockaddr_un sa;
+	socklen_t sa_len;
+	sec_conn_st *c;
+	uid_t uid;
+	pid_t pid;
+	int cfd, ret;
+
+	while (srv->nconns < MAX_WORKER_CONNS) {
+		sa_len = sizeof(sa);
+		cfd = accept(srv->listener.fd, (struct sockaddr *)&sa, &sa_len);
+		if (cfd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				seclog(sec, LOG_DEBUG,
+				       "sec-mod error accepting connection: %s",
+				       strerror(errno));
+			break;
+		}
+		set_cloexec_flag(cfd, 1);
+
+		/* do not allow unauthorized processes to issue commands
+		 */
+		ret = check_upeer_id("sec-mod", GETPCONFIG(sec)->debug, cfd,
+				     GETPCONFIG(sec)->uid, GETPCONFIG(sec)->gid,
+				     &uid, &pid);
+		if (ret < 0) {
+			seclog(sec, LOG_INFO, "rejected unauthorized connection");
+			close(cfd);
+			continue;
+		}
+
+		c = talloc_zero(sec, sec_conn_st);
+		if (c == NULL) {
+			seclog(sec, LOG_ERR, "error in memory allocation");
+			close(cfd);
+			break;
+		}
+
+		set_non_block(cfd);
+		c->type = SEC_FD_WORKER;
+		c->fd = cfd;
+		c->pid = pid;
+		c->deadline = time(NULL) + MAX_WAIT_SECS;
+
+		if (sec_mod_poll_add(srv->poll, cfd, c) < 0) {
+			seclog(sec, LOG_ERR, "error adding connection to poll set: %s",
+			       strerror(errno));
+			close(cfd);
+			talloc_free(c);
+			break;
+		}
+
+		list_add_tail(&srv->conns, &c->list);
+		srv->nconns++;
 	}
 
-	/* read the body */
-	ret = force_read_timeout(cfd, buffer, length, MAX_WAIT_SECS);
+	listener_update(srv);
+}
+
+/* Returns 1 when the request is complete, 0 if more data are expected
+ * and -1 on error.
+ */
+static int conn_read(sec_mod_st *sec, sec_server_st *srv, sec_conn_st *c)
+{
+	uint32_t l32;
+	ssize_t ret;
+
+	if (c->buffer == NULL) {
+		ret = recv(c->fd, c->hdr + c->pos, sizeof(c->hdr) - c->pos, 0);
+		if (ret == 0)
+			return -1;
+		if (ret < 0)
+			goto check_err;
+
+		c->pos += ret;
+		if (c->pos < sizeof(c->hdr))
+			return 0;
+
+		memcpy(&l32, &c->hdr[1], 4);
+		if (l32 > MAX_MSG_SIZE) {
+			seclog(sec, LOG_INFO, "too big message (%d)", (int)l32);
+			return -1;
+		}
+
+		c->buffer = get_buffer(sec, srv);
+		if (c->buffer == NULL) {
+			seclog(sec, LOG_ERR, "error in memory allocation");
+			return -1;
+		}
+		c->length = l32;
+		c->pos = 0;
+
+		if (c->length == 0)
+			return 1;
+		/* the body usually follows the header */
+	}
+
+	ret = recv(c->fd, c->buffer + c->pos, c->length - c->pos, 0);
+	if (ret == 0) {
+		seclog(sec, LOG_INFO, "error receiving msg body: peer terminated");
+		return -1;
+	}
+	if (ret < 0)
+		goto check_err;
+
+	c->pos += ret;
+	return (c->pos == c->length) ? 1 : 0;
+
+ check_err:
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		return 0;
+	seclog(sec, LOG_INFO, "error receiving msg from worker: %s",
+	       strerror(errno));
+	return -1;
+}
+
+static void conn_serve(sec_mod_st *sec, sec_server_st *srv, sec_conn_st *c)
+{
+	uint8_t cmd = c->hdr[0];
+	void *pool;
+	int ret;
+
+	ret = conn_read(sec, srv, c);
+	if (ret == 0)
+		return;
+
 	if (ret < 0) {
-		e = errno;
-		seclog(sec, LOG_INFO, "error receiving msg body: %s",
-		       strerror(e));
-		ret = -1;
-		goto leave;
+		seclog(sec, LOG_DEBUG, "error receiving request from worker");
+		conn_close(srv, c);
+		return;
 	}
 
-	ret = process_worker_packet(pool, cfd, pid, sec, cmd, buffer, ret);
+	pool = talloc_new(sec);
+	if (pool == NULL) {
+		conn_close(srv, c);
+		return;
+	}
+
+	/* the replies are short and the worker waits for them */
+	sec_mod_poll_del(srv->poll, c->fd);
+	set_block(c->fd);
+
+	ret = process_worker_packet(pool, c->fd, c->pid, sec, cmd, c->buffer, c->length);
 	if (ret < 0) {
 		seclog(sec, LOG_DEBUG, "error processing '%s' command (%d)", cmd_request_to_str(cmd), ret);
 	}
+	talloc_free(pool);
 
- leave:
-	return ret;
+	/* when deferred, the descriptor is closed once replied */
+	if (ret != SEC_REPLY_DEFERRED)
+		close(c->fd);
+	c->fd = -1;
+	conn_close(srv, c);
+}
+
+/* Closes the connections whose request was not received in time; returns
+ * the milliseconds until the next deadline, or -1 if there is none. */
+static int expire_conns(sec_mod_st *sec, sec_server_st *srv)
+{
+	time_t now = time(NULL);
+	sec_conn_st *c;
+
+	while ((c = list_top(&srv->conns, sec_conn_st, list)) != NULL) {
+		if (c->deadline > now)
+			return (c->deadline - now) * 1000;
+
+		seclog(sec, LOG_DEBUG, "timed out waiting for request from worker %d",
+		       (int)c->pid);
+		conn_close(srv, c);
+	}
+
+	return -1;
 }
 
 #define CHECK_LOOP_ERR(x) { \
@@ -895,26 +1202,23 @@ static int load_keys(sec_mod_st *sec, unsigned force)
 void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfig,
 		    const char *socket_file, int cmd_fd, int cmd_fd_sync,
 		    size_t  hmac_key_length, const uint8_t * hmac_key,
-			const uint8_t instance_id)
+			const uint8_t instance_id,
+			struct cookie_revocations_st *cookie_revocations)
 {
 	struct sockaddr_un sa;
-	socklen_t sa_len;
-	int cfd, ret, e, n;
-	unsigned buffer_size;
-	uid_t uid;
-	uint8_t *buffer;
+	int ret, e, n, i;
 	int sd;
+	int key_ops_fd, timeout;
 	sec_mod_st *sec;
 	void *sec_mod_pool;
 	vhost_cfg_st *vhost = NULL;
-	fd_set rd_set;
-	pid_t pid;
-#ifdef HAVE_PSELECT
-	struct timespec ts;
-#else
-	struct timeval ts;
-#endif
+	sec_server_st *srv;
+	sec_conn_st main_conn, main_sync_conn, key_ops_conn;
+	void *ready[SEC_MOD_POLL_MAX_EVENTS];
+	sec_conn_st *c;
+	sec_mod_watch_st *w;
 	sigset_t emptyset, blockset;
+	hmac_component_st cookie_key_label;
 
 #ifdef DEBUG_LEAKS
 	talloc_enable_leak_report_full();
@@ -944,7 +1248,16 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 	memcpy((uint8_t*)sec->hmac_key, hmac_key, hmac_key_length);
 	sec->sec_mod_instance_id = instance_id;
 
+	/* the same in all instances */
+	sec->cookie_revocations = cookie_revocations;
+	if (cookie_revocations != NULL) {
+		cookie_key_label.data = "ocserv stateless cookie";
+		cookie_key_label.length = strlen(cookie_key_label.data);
+		generate_hmac(hmac_key_length, hmac_key, 1, &cookie_key_label, sec->cookie_key);
+	}
+
 	tls_cache_init(sec, &sec->tls_db);
+	timer_wheel_init(&sec->tls_expiry, time(NULL));
 	sup_config_init(sec);
 
 	memset(&sa, 0, sizeof(sa));
@@ -1014,103 +1327,120 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 	}
 
 	sigprocmask(SIG_BLOCK, &blockset, &sig_default_set);
-	alarm(MAINTAINANCE_TIME);
-	seclog(sec, LOG_INFO, "sec-mod initialized (socket: %s)", SOCKET_FILE);
 
+	/* started with the signals blocked, so that they are handled by
+	 * the main thread */
+	sec_mod_key_ops_init(sec, GETPCONFIG(sec)->sec_mod_key_threads);
+	key_ops_fd = sec_mod_key_ops_fd(sec);
 
-	for (;;) {
-		check_other_work(sec);
+	srv = talloc_zero(sec, sec_server_st);
+	if (srv == NULL) {
+		seclog(sec, LOG_ERR, "error in memory allocation");
+		exit(EXIT_FAILURE);
+	}
+	list_head_init(&srv->conns);
+	list_head_init(&srv->watches);
 
-		FD_ZERO(&rd_set);
-		n = 0;
+	srv->poll = sec_mod_poll_new(srv);
+	if (srv->poll == NULL) {
+		seclog(sec, LOG_ERR, "error initializing poll set: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
 
-		FD_SET(cmd_fd, &rd_set);
-		n = MAX(n, cmd_fd);
+	memset(&main_conn, 0, sizeof(main_conn));
+	main_conn.type = SEC_FD_MAIN;
+	main_conn.fd = cmd_fd;
 
-		FD_SET(cmd_fd_sync, &rd_set);
-		n = MAX(n, cmd_fd_sync);
+	memset(&main_sync_conn, 0, sizeof(main_sync_conn));
+	main_sync_conn.type = SEC_FD_MAIN_SYNC;
+	main_sync_conn.fd = cmd_fd_sync;
 
-		FD_SET(sd, &rd_set);
-		n = MAX(n, sd);
+	memset(&key_ops_conn, 0, sizeof(key_ops_conn));
+	key_ops_conn.type = SEC_FD_KEY_OPS;
+	key_ops_conn.fd = key_ops_fd;
 
-#ifdef HAVE_PSELECT
-		ts.tv_nsec = 0;
-		ts.tv_sec = 120;
-		ret = pselect(n + 1, &rd_set, NULL, NULL, &ts, &emptyset);
-#else
-		ts.tv_usec = 0;
-		ts.tv_sec = 120;
-		sigprocmask(SIG_UNBLOCK, &blockset, NULL);
-		ret = select(n + 1, &rd_set, NULL, NULL, &ts);
-		sigprocmask(SIG_BLOCK, &blockset, NULL);
-#endif
-		if (ret == 0 || (ret == -1 && errno == EINTR))
-			continue;
+	srv->listener.type = SEC_FD_LISTEN;
+	srv->listener.fd = sd;
+	set_non_block(sd);
 
-		if (ret < 0) {
-			e = errno;
-			seclog(sec, LOG_ERR, "Error in pselect(): %s",
-			       strerror(e));
+	if (sec_mod_poll_add(srv->poll, cmd_fd, &main_conn) < 0 ||
+	    sec_mod_poll_add(srv->poll, cmd_fd_sync, &main_sync_conn) < 0 ||
+	    (key_ops_fd != -1 && sec_mod_poll_add(srv->poll, key_ops_fd, &key_ops_conn) < 0)) {
+		seclog(sec, LOG_ERR, "error adding to poll set: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	listener_update(srv);
+	srv->sec = sec;
+	sec_server = srv;
+
+	while ((w = list_top(&early_watches, sec_mod_watch_st, list)) != NULL) {
+		list_del(&w->list);
+		if (sec_mod_watch_add(w) < 0) {
+			seclog(sec, LOG_ERR, "error adding to poll set: %s", strerror(errno));
 			exit(EXIT_FAILURE);
 		}
+	}
 
-		/* we do a new allocation, to also use it as pool for the
-		 * parsers to use */
-		buffer_size = MAX_MSG_SIZE;
-		buffer = talloc_size(sec, buffer_size);
-		if (buffer == NULL) {
-			seclog(sec, LOG_ERR, "error in memory allocation");
-			exit(EXIT_FAILURE);
-		}
+	alarm(MAINTAINANCE_TIME);
+	seclog(sec, LOG_INFO, "sec-mod initialized (socket: %s)", SOCKET_FILE);
 
-		/* we use two fds for communication with main. The synchronous is for
-		 * ping-pong communication where each request is answered immediately. The
-		 * async is for messages sent back and forth in no particular order */
-		if (FD_ISSET(cmd_fd_sync, &rd_set)) {
-			ret = serve_request_main(sec, cmd_fd_sync, buffer, buffer_size);
-			if (ret < 0 && ret == ERR_BAD_COMMAND) {
-				seclog(sec, LOG_ERR, "error processing sync command from main");
-				exit(EXIT_FAILURE);
-			}
-		}
 
-		if (FD_ISSET(cmd_fd, &rd_set)) {
-			ret = serve_request_main(sec, cmd_fd, buffer, buffer_size);
-			if (ret < 0 && ret == ERR_BAD_COMMAND) {
-				seclog(sec, LOG_ERR, "error processing async command from main");
-				exit(EXIT_FAILURE);
-			}
+	for (;;) {
+		check_other_work(sec);
+
+		timeout = expire_conns(sec, srv);
+		ret = expire_watches(sec, srv);
+		if (ret >= 0 && (timeout < 0 || ret < timeout))
+			timeout = ret;
+		if (timeout < 0 || timeout > 120 * 1000)
+			timeout = 120 * 1000;
+
+		n = sec_mod_poll_wait(srv->poll, ready, SEC_MOD_POLL_MAX_EVENTS,
+				      timeout, &emptyset);
+		if (n == 0 || (n == -1 && errno == EINTR))
+			continue;
+
+		if (n < 0) {
+			e = errno;
+			seclog(sec, LOG_ERR, "Error in poll: %s",
+			       strerror(e));
+			exit(EXIT_FAILURE);
 		}
 
-		if (FD_ISSET(sd, &rd_set)) {
-			sa_len = sizeof(sa);
-			cfd = accept(sd, (struct sockaddr *)&sa, &sa_len);
-			if (cfd == -1) {
-				e = errno;
-				if (e != EINTR) {
-					seclog(sec, LOG_DEBUG,
-					       "sec-mod error accepting connection: %s",
-					       strerror(e));
-					goto cont;
+		for (i = 0; i < n; i++) {
+			c = ready[i];
+
+			switch (c->type) {
+			/* we use two fds for communication with main. The synchronous is for
+			 * ping-pong communication where each request is answered immediately. The
+			 * async is for messages sent back and forth in no particular order */
+			case SEC_FD_MAIN_SYNC:
+				ret = serve_request_main(sec, srv, cmd_fd_sync);
+				if (ret < 0 && ret == ERR_BAD_COMMAND) {
+					seclog(sec, LOG_ERR, "error processing sync command from main");
+					exit(EXIT_FAILURE);
 				}
+				break;
+			case SEC_FD_MAIN:
+				ret = serve_request_main(sec, srv, cmd_fd);
+				if (ret < 0 && ret == ERR_BAD_COMMAND) {
+					seclog(sec, LOG_ERR, "error processing async command from main");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case SEC_FD_KEY_OPS:
+				sec_mod_key_ops_complete(sec);
+				break;
+			case SEC_FD_LISTEN:
+				conn_accept(sec, srv);
+				break;
+			case SEC_FD_WATCH:
+				((sec_mod_watch_st *)c)->read(sec, (sec_mod_watch_st *)c);
+				break;
+			default:
+				conn_serve(sec, srv, c);
 			}
-			set_cloexec_flag (cfd, 1);
-
-			/* do not allow unauthorized processes to issue commands
-			 */
-			ret = check_upeer_id("sec-mod", GETPCONFIG(sec)->debug, cfd,
-					     GETPCONFIG(sec)->uid, GETPCONFIG(sec)->gid,
-					     &uid, &pid);
-			if (ret < 0) {
-				seclog(sec, LOG_INFO, "rejected unauthorized connection");
-			} else {
-				memset(buffer, 0, buffer_size);
-				serve_request_worker(sec, cfd, pid, buffer, buffer_size);
-			}
-			close(cfd);
 		}
- cont:
-		talloc_free(buffer);
 #ifdef DEBUG_LEAKS
 		talloc_report_full(sec, stderr);
 #endif
@@ -27,6 +27,8 @@
 #include <tlslib.h>
 #include <hmac.h>
 #include "common/common.h"
+#include "stateless-cookie.h"
+#include "timer-wheel.h"
 
 #include "vhost.h"
 
@@ -43,13 +45,27 @@ typedef struct sec_mod_st {
 	int cmd_fd_sync;
 
 	tls_sess_db_st tls_db;
+	/* the client entries and TLS sessions, by expiration */
+	timer_wheel_st client_expiry;
+	timer_wheel_st tls_expiry;
+	uint64_t expired; /* entries expired since the last update */
+	uint64_t expiry_lag_total; /* their delay past expiration, in seconds */
+	uint32_t expiry_lag_max;
 	uint64_t auth_failures; /* auth failures since the last update (SECM_CLI_STATS) we sent to main */
 	uint32_t max_auth_time; /* the maximum time spent in (successful) authentication */
 	uint32_t avg_auth_time; /* the average time spent in (successful) authentication */
 	uint32_t total_authentications; /* successful authentications: to calculate the average above */
+	uint64_t key_ops; /* private key operations since the last update we sent to main */
+	uint32_t key_op_queue_max; /* the maximum key operations pending since the last update */
+	struct sec_mod_key_ops_st *key_ops_pool; /* NULL unless sec-mod-key-threads is set */
+	auth_latency_st auth_latency[MAX_AUTH_LATENCY_MODULES]; /* since the last update */
+	unsigned auth_latency_size;
 	time_t last_stats_reset;
 	const uint8_t hmac_key[HMAC_DIGEST_SIZE];
 	uint32_t sec_mod_instance_id;
+	/* NULL unless stateless-cookies is set */
+	struct cookie_revocations_st *cookie_revocations;
+	uint8_t cookie_key[STATELESS_COOKIE_KEY_SIZE];
 } sec_mod_st;
 
 typedef struct stats_st {
@@ -110,6 +126,13 @@ typedef struct client_entry_st {
 	time_t created;
 	/* The time this client entry is supposed to expire */
 	time_t exptime;
+	/* scheduled at exptime unless in use */
+	timer_wheel_entry_st expiry;
+	/* The expiration of the stateless cookie of the session, or 0 */
+	time_t cookie_expires;
+	/* non-zero if the session was resumed by another instance; it is
+	 * then not revoked when this entry is removed */
+	unsigned moved;
 
 	/* the auth type associated with the user */
 	unsigned auth_type;
@@ -125,21 +148,29 @@ typedef struct client_entry_st {
 
 	/* the module this entry is using */
 	const struct auth_mod_st *module;
+	const char *module_name;
 	void *vhost_auth_ctx;
 	void *vhost_acct_ctx;
 
 	/* the vhost this user is associated with */
 	vhost_cfg_st *vhost;
+
+	/* the worker connection waiting for the result of an asynchronous
+	 * authentication step, or -1 */
+	int pending_cfd;
+	struct timespec auth_pass_start; /* when the module was given the password */
 } client_entry_st;
 
 void *sec_mod_client_db_init(sec_mod_st *sec);
 void sec_mod_client_db_deinit(sec_mod_st *sec);
 unsigned sec_mod_client_db_elems(sec_mod_st *sec);
 client_entry_st * new_client_entry(sec_mod_st *sec, struct vhost_cfg_st *, const char *ip, unsigned pid);
+client_entry_st * restore_client_entry(sec_mod_st *sec, struct vhost_cfg_st *vhost, const uint8_t sid[SID_SIZE]);
 client_entry_st * find_client_entry(sec_mod_st *sec, uint8_t sid[SID_SIZE]);
 void del_client_entry(sec_mod_st *sec, client_entry_st * e);
 void expire_client_entry(sec_mod_st *sec, client_entry_st * e);
 void cleanup_client_entries(sec_mod_st *sec);
+void update_expiry_lag(sec_mod_st *sec, time_t now, time_t expires);
 
 #ifdef __GNUC__
 # define seclog(sec, prio, fmt, ...) { \
@@ -167,10 +198,36 @@ int handle_secm_session_close_cmd(sec_mod_st *sec, int fd, const SecmSessionClos
 int handle_sec_auth_stats_cmd(sec_mod_st * sec, const CliStatsMsg * req, pid_t pid);
 void sec_auth_user_deinit(sec_mod_st *sec, client_entry_st *e);
 
+/* Returned by the request handlers when the reply is sent later; the
+ * connection is then owned by the handler. */
+#define SEC_REPLY_DEFERRED 1
+
+/* Descriptors and timers of sec-mod components, e.g., the asynchronous
+ * RADIUS client, served by the sec-mod loop. */
+typedef struct sec_mod_watch_st {
+	unsigned type; /* must be first; set by sec_mod_watch_add() */
+	int fd;
+	/* called when fd is readable */
+	void (*read)(sec_mod_st *sec, struct sec_mod_watch_st *w);
+	/* optional; called on every loop iteration to process the expired
+	 * timers; returns the seconds until the next one, or -1 */
+	int (*expire)(sec_mod_st *sec, struct sec_mod_watch_st *w, time_t now);
+	struct list_node list;
+} sec_mod_watch_st;
+
+/* Watches added before the sec-mod loop runs are registered when it starts */
+int sec_mod_watch_add(sec_mod_watch_st *w);
+void sec_mod_watch_del(sec_mod_watch_st *w);
+
+/* The instance the watches are called with, for the code which runs in
+ * the sec-mod loop without being given it; NULL before the loop starts */
+sec_mod_st *sec_mod_watch_sec(void);
+
 void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfig,
 		    const char *socket_file,
 		    int cmd_fd, int cmd_fd_sync,
 			size_t  hmac_key_length, const uint8_t * hmac_key,
-			const uint8_t instance_id);
+			const uint8_t instance_id,
+			struct cookie_revocations_st *cookie_revocations);
 
 #endif
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <common.h>
+#include <stateless-cookie.h>
+
+static int cookie_cipher_init(gnutls_cipher_hd_t *h, const uint8_t *key,
+			      const uint8_t *nonce, const uint8_t *sid)
+{
+	gnutls_datum_t k, iv;
+	int ret;
+
+	k.data = (void *)key;
+	k.size = STATELESS_COOKIE_KEY_SIZE;
+	iv.data = (void *)nonce;
+	iv.size = STATELESS_COOKIE_NONCE_SIZE;
+
+	ret = gnutls_cipher_init(h, GNUTLS_CIPHER_AES_256_GCM, &k, &iv);
+	if (ret < 0)
+		return -1;
+
+	ret = gnutls_cipher_add_auth(*h, sid, SID_SIZE);
+	if (ret < 0) {
+		gnutls_cipher_deinit(*h);
+		return -1;
+	}
+
+	return 0;
+}
+
+int stateless_cookie_seal(const uint8_t key[STATELESS_COOKIE_KEY_SIZE],
+			  const uint8_t sid[SID_SIZE],
+			  const uint8_t *state, size_t state_size,
+			  uint8_t *cookie, size_t cookie_size)
+{
+	gnutls_cipher_hd_t h;
+	uint8_t *nonce, *ct;
+	int ret;
+
+	if (state_size > cookie_size ||
+	    cookie_size - state_size < STATELESS_COOKIE_OVERHEAD)
+		return -1;
+
+	memcpy(cookie, sid, SID_SIZE);
+	nonce = cookie + SID_SIZE;
+	ct = nonce + STATELESS_COOKIE_NONCE_SIZE;
+
+	ret = gnutls_rnd(GNUTLS_RND_NONCE, nonce, STATELESS_COOKIE_NONCE_SIZE);
+	if (ret < 0)
+		return -1;
+
+	if (cookie_cipher_init(&h, key, nonce, sid) < 0)
+		return -1;
+
+	ret = gnutls_cipher_encrypt2(h, state, state_size, ct, state_size);
+	if (ret >= 0)
+		ret = gnutls_cipher_tag(h, ct + state_size, STATELESS_COOKIE_TAG_SIZE);
+	gnutls_cipher_deinit(h);
+
+	if (ret < 0)
+		return -1;
+
+	return state_size + STATELESS_COOKIE_OVERHEAD;
+}
+
+int stateless_cookie_open(const uint8_t key[STATELESS_COOKIE_KEY_SIZE],
+			  const uint8_t *cookie, size_t cookie_size,
+			  uint8_t *state, size_t state_size)
+{
+	gnutls_cipher_hd_t h;
+	const uint8_t *nonce, *ct;
+	uint8_t tag[STATELESS_COOKIE_TAG_SIZE];
+	size_t ct_size;
+	unsigned diff = 0, i;
+	int ret;
+
+	if (cookie_size < STATELESS_COOKIE_OVERHEAD)
+		return -1;
+
+	ct_size = cookie_size - STATELESS_COOKIE_OVERHEAD;
+	if (ct_size > state_size)
+		return -1;
+
+	nonce = cookie + SID_SIZE;
+	ct = nonce + STATELESS_COOKIE_NONCE_SIZE;
+
+	if (cookie_cipher_init(&h, key, nonce, cookie) < 0)
+		return -1;
+
+	ret = gnutls_cipher_decrypt2(h, ct, ct_size, state, ct_size);
+	if (ret >= 0)
+		ret = gnutls_cipher_tag(h, tag, sizeof(tag));
+	gnutls_cipher_deinit(h);
+
+	if (ret < 0)
+		return -1;
+
+	/* in constant time */
+	for (i = 0; i < sizeof(tag); i++)
+		diff |= tag[i] ^ ct[ct_size + i];
+
+	if (diff != 0) {
+		safe_memset(state, 0, ct_size);
+		return -1;
+	}
+
+	return ct_size;
+}
+
+/* the SID is random, except for its first byte */
+static uint64_t sid_to_id(const uint8_t sid[SID_SIZE])
+{
+	uint64_t id;
+
+	memcpy(&id, sid + 8, sizeof(id));
+	return id != 0 ? id : 1;
+}
+
+cookie_revocations_st *cookie_revocations_new(unsigned max_entries, int *fd)
+{
+	cookie_revocations_st *r;
+	unsigned slots;
+	size_t size;
+	void *p;
+
+	for (slots = COOKIE_REVOCATIONS_MIN_SLOTS; slots < 2 * max_entries && slots < (1U << 24); slots <<= 1)
+		;
+
+	size = sizeof(cookie_revocations_st) + (size_t)slots * sizeof(cookie_revocation_st);
+
+	*fd = -1;
+#ifdef HAVE_MEMFD_CREATE
+	*fd = memfd_create("ocserv-revocations", MFD_CLOEXEC);
+	if (*fd != -1 && ftruncate(*fd, size) == -1) {
+		close(*fd);
+		*fd = -1;
+	}
+#endif
+
+	/* shared with the processes forked afterwards; zeroed */
+	if (*fd != -1)
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+	else
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		if (*fd != -1)
+			close(*fd);
+		*fd = -1;
+		return NULL;
+	}
+
+	r = p;
+	r->slots = slots;
+
+	return r;
+}
+
+cookie_revocations_st *cookie_revocations_open(int fd)
+{
+	cookie_revocations_st *r;
+	struct stat st;
+	void *p;
+
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(cookie_revocations_st))
+		return NULL;
+
+	p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	r = p;
+	if (r->slots < COOKIE_REVOCATIONS_MIN_SLOTS || (r->slots & (r->slots - 1)) != 0 ||
+	    sizeof(cookie_revocations_st) + (size_t)r->slots * sizeof(cookie_revocation_st) !=
+	    (size_t)st.st_size) {
+		munmap(p, st.st_size);
+		return NULL;
+	}
+
+	return r;
+}
+
+static void atomic_max(uint64_t *p, uint64_t v)
+{
+	uint64_t cur = __atomic_load_n(p, __ATOMIC_ACQUIRE);
+
+	while (cur < v) {
+		if (__atomic_compare_exchange_n(p, &cur, v, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			break;
+	}
+}
+
+void cookie_revocations_add(cookie_revocations_st *r, const uint8_t sid[SID_SIZE],
+			    time_t expires, time_t now)
+{
+	uint64_t id = sid_to_id(sid);
+	uint64_t cur;
+	cookie_revocation_st *e;
+	unsigned i;
+
+	if (expires <= now)
+		return;
+
+	for (i = 0; i < COOKIE_REVOCATIONS_PROBES; i++) {
+		e = &r->entries[(id + i) & (r->slots - 1)];
+
+		cur = __atomic_load_n(&e->expires, __ATOMIC_ACQUIRE);
+		if (cur > (uint64_t)now) {
+			if (__atomic_load_n(&e->id, __ATOMIC_ACQUIRE) == id) {
+				atomic_max(&e->expires, expires);
+				return;
+			}
+			continue;
+		}
+
+		/* free; another process may claim it first */
+		if (__atomic_compare_exchange_n(&e->expires, &cur, (uint64_t)expires, 0,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&e->id, id, __ATOMIC_RELEASE);
+			return;
+		}
+	}
+
+	atomic_max(&r->horizon, now);
+}
+
+unsigned cookie_revocations_check(cookie_revocations_st *r, const uint8_t sid[SID_SIZE],
+				  time_t now)
+{
+	uint64_t id = sid_to_id(sid);
+	cookie_revocation_st *e;
+	unsigned i;
+
+	/* slots are freed as they expire; all the probes are checked */
+	for (i = 0; i < COOKIE_REVOCATIONS_PROBES; i++) {
+		e = &r->entries[(id + i) & (r->slots - 1)];
+
+		if (__atomic_load_n(&e->id, __ATOMIC_ACQUIRE) == id &&
+		    __atomic_load_n(&e->expires, __ATOMIC_ACQUIRE) > (uint64_t)now)
+			return 1;
+	}
+
+	return 0;
+}
+
+time_t cookie_revocations_horizon(cookie_revocations_st *r)
+{
+	return __atomic_load_n(&r->horizon, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_STATELESS_COOKIE_H
+# define OC_STATELESS_COOKIE_H
+
+# include <stdint.h>
+# include <time.h>
+# include <vpn.h>
+
+/* With 'stateless-cookies' the cookie given to a client carries the
+ * state of its session, so that any sec-mod instance can resume it:
+ *
+ *   SID || nonce || AES-256-GCM(state) || tag
+ *
+ * The SID is authenticated as additional data; the state is a packed
+ * CookieStateMsg. The key is derived from the key main shares with all
+ * the sec-mod instances.
+ */
+#define STATELESS_COOKIE_KEY_SIZE 32
+#define STATELESS_COOKIE_NONCE_SIZE 12
+#define STATELESS_COOKIE_TAG_SIZE 16
+#define STATELESS_COOKIE_OVERHEAD (SID_SIZE + STATELESS_COOKIE_NONCE_SIZE + STATELESS_COOKIE_TAG_SIZE)
+
+/* How long a cookie can be resumed, after 'cookie-timeout', when there
+ * is no 'session-timeout' */
+#define STATELESS_COOKIE_LIFETIME (24*60*60)
+
+/* Writes the cookie of @sid and @state to @cookie; returns its size,
+ * or -1 if it does not fit or on error. */
+int stateless_cookie_seal(const uint8_t key[STATELESS_COOKIE_KEY_SIZE],
+			  const uint8_t sid[SID_SIZE],
+			  const uint8_t *state, size_t state_size,
+			  uint8_t *cookie, size_t cookie_size);
+
+/* Writes the state of the cookie to @state; returns its size, or -1
+ * if the cookie was not sealed with @key or was modified. The SID is
+ * the first SID_SIZE bytes of the cookie. */
+int stateless_cookie_open(const uint8_t key[STATELESS_COOKIE_KEY_SIZE],
+			  const uint8_t *cookie, size_t cookie_size,
+			  uint8_t *state, size_t state_size);
+
+/* The sessions which were invalidated before their cookie expires.
+ * The set is an open addressing table in a shared mapping which main
+ * creates before the sec-mod instances are started; the instances
+ * update it with atomic operations. A slot is free once the cookie it
+ * refers to has expired. Where memory files are supported the mapping
+ * is of one, so that main can hand it over on an upgrade.
+ *
+ * When no slot is free within the probe limit, the revocation is not
+ * recorded; instead the horizon is moved, and cookies issued up to it
+ * are no longer resumed by instances that do not hold their session.
+ */
+#define COOKIE_REVOCATIONS_MIN_SLOTS 1024
+#define COOKIE_REVOCATIONS_PROBES 16
+
+typedef struct cookie_revocation_st {
+	uint64_t id; /* from the SID */
+	uint64_t expires; /* the expiration of the cookie, or 0 */
+} cookie_revocation_st;
+
+typedef struct cookie_revocations_st {
+	uint64_t horizon;
+	uint32_t slots; /* a power of two */
+	uint32_t reserved;
+	cookie_revocation_st entries[];
+} cookie_revocations_st;
+
+/* Returns NULL if the mapping cannot be created. @fd is set to the
+ * descriptor of its memory file, or to -1. */
+cookie_revocations_st *cookie_revocations_new(unsigned max_entries, int *fd);
+
+/* Maps the set in the memory file @fd; returns NULL if it is not one */
+cookie_revocations_st *cookie_revocations_open(int fd);
+
+void cookie_revocations_add(cookie_revocations_st *r, const uint8_t sid[SID_SIZE],
+			    time_t expires, time_t now);
+
+/* Returns non-zero if the session of @sid was revoked */
+unsigned cookie_revocations_check(cookie_revocations_st *r, const uint8_t sid[SID_SIZE],
+				  time_t now);
+
+/* Cookies issued up to the returned time are only resumed by the
+ * instance which holds their session */
+time_t cookie_revocations_horizon(cookie_revocations_st *r);
+
+#endif
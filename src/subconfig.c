@@ -242,6 +242,20 @@ void *radius_get_brackets_string(void *pool, struct perm_cfg_st *config, const c
 			} else if (strcasecmp(vals[i].name, "groupconfig") == 0) {
 				if (CHECK_TRUE(vals[i].value))
 					config->sup_config_type = SUP_CONFIG_RADIUS;
+			} else if (strcasecmp(vals[i].name, "async") == 0) {
+				additional->async = CHECK_TRUE(vals[i].value);
+			} else if (strcasecmp(vals[i].name, "weights") == 0) {
+				additional->weights = vals[i].value;
+				vals[i].value = NULL;
+			} else if (strcasecmp(vals[i].name, "spool") == 0) {
+				additional->spool = vals[i].value;
+				vals[i].value = NULL;
+			} else if (strcasecmp(vals[i].name, "queue-size") == 0) {
+				additional->queue_size = atoi(vals[i].value);
+				if (additional->queue_size == 0) {
+					fprintf(stderr, "Invalid value for '%s': %s\n", vals[i].name, vals[i].value);
+					exit(EXIT_FAILURE);
+				}
 			} else {
 				fprintf(stderr, "unknown option '%s'\n", vals[i].name);
 				exit(EXIT_FAILURE);
@@ -280,6 +294,8 @@ void *pam_get_brackets_string(void *pool, struct perm_cfg_st *config, const char
 				fprintf(stderr, "error in gid-min value: %d\n", additional->gid_min);
 				exit(EXIT_FAILURE);
 			}
+		} else if (strcasecmp(vals[i].name, "threads") == 0) {
+			additional->threads = atoi(vals[i].value);
 		} else {
 			fprintf(stderr, "unknown option '%s'\n", vals[i].name);
 			exit(EXIT_FAILURE);
@@ -27,9 +27,13 @@
 #include <grp.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <sys/stat.h>
 #include <common.h>
 #include <ip-util.h>
 #include <ctype.h>
+#include <ccan/hash/hash.h>
+#include <ccan/htable/htable.h>
+#include <ccan/list/list.h>
 
 #include "inih/ini.h"
 
@@ -37,6 +41,7 @@
 #include <main.h>
 #include <common-config.h>
 #include <sec-mod-sup-config.h>
+#include <sup-config/file.h>
 
 #define READ_RAW_MULTI_LINE(varname, num) \
 	_add_multi_line_val(pool, &varname, &num, value)
@@ -257,29 +262,180 @@ int parse_group_cfg_file(struct cfg_st *global_config,
 	return ret;
 }
 
-static int read_sup_config_file(struct cfg_st *global_config,
-				SecmSessionReplyMsg *msg, void *pool,
-				const char *file, const char *fallback, const char *type)
+/* The files are parsed once, each into an empty group_cfg_st, which is
+ * kept packed and reloaded when the file is modified. When both a group
+ * and a user file apply, their packed forms are concatenated and unpacked
+ * together; that merges them as when the user file is parsed over the
+ * group one: its repeated values are appended, and its single values
+ * replace those of the group file.
+ */
+#define SUP_CONFIG_CACHE_SIZE 4096
+
+typedef struct sup_config_cache_st {
+	char *file;
+	struct list_node list; /* most recently used first */
+
+	/* the parsed file, to detect changes */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	time_t ctime;
+
+	uint8_t *data; /* packed group_cfg_st */
+	size_t data_size;
+	int error;
+} sup_config_cache_st;
+
+static size_t cache_rehash(const void *_e, void *unused);
+
+static struct htable cache_ht = HTABLE_INITIALIZER(cache_ht, cache_rehash, NULL);
+static LIST_HEAD(cache_lru);
+static unsigned cache_entries;
+static uint64_t cache_hits;
+static uint64_t cache_misses;
+
+static size_t cache_rehash(const void *_e, void *unused)
 {
+	const sup_config_cache_st *e = _e;
+
+	return hash_any(e->file, strlen(e->file), 0);
+}
+
+static sup_config_cache_st *cache_find(const char *file)
+{
+	struct htable_iter iter;
+	size_t hash = hash_any(file, strlen(file), 0);
+	sup_config_cache_st *e;
+
+	e = htable_firstval(&cache_ht, &iter, hash);
+	while (e != NULL) {
+		if (strcmp(e->file, file) == 0)
+			return e;
+		e = htable_nextval(&cache_ht, &iter, hash);
+	}
+	return NULL;
+}
+
+static void cache_remove(sup_config_cache_st *e)
+{
+	htable_del(&cache_ht, cache_rehash(e, NULL), e);
+	list_del(&e->list);
+	cache_entries--;
+	talloc_free(e);
+}
+
+static sup_config_cache_st *cache_load(const char *file, struct stat *st)
+{
+	sup_config_cache_st *e;
+	SecmSessionReplyMsg msg = SECM_SESSION_REPLY_MSG__INIT;
+	GroupCfgSt cfg = GROUP_CFG_ST__INIT;
+	void *pool;
 	int ret;
 
+	e = talloc_zero(NULL, sup_config_cache_st);
+	if (e == NULL)
+		return NULL;
+
+	e->file = talloc_strdup(e, file);
+	if (e->file == NULL)
+		goto fail;
+
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->size = st->st_size;
+	e->mtime = st->st_mtime;
+	e->ctime = st->st_ctime;
+
+	pool = talloc_new(e);
+	if (pool == NULL)
+		goto fail;
+
+	msg.config = &cfg;
+	ret = parse_group_cfg_file(NULL, &msg, pool, file);
+	if (ret < 0) {
+		e->error = ERR_READ_CONFIG;
+	} else {
+		e->data_size = group_cfg_st__get_packed_size(&cfg);
+		e->data = talloc_size(e, e->data_size);
+		if (e->data == NULL)
+			goto fail;
+		group_cfg_st__pack(&cfg, e->data);
+	}
+	talloc_free(pool);
+
+	if (cache_entries >= SUP_CONFIG_CACHE_SIZE)
+		cache_remove(list_tail(&cache_lru, sup_config_cache_st, list));
+
+	if (!htable_add(&cache_ht, cache_rehash(e, NULL), e))
+		goto fail;
+	list_add(&cache_lru, &e->list);
+	cache_entries++;
+
+	return e;
+ fail:
+	talloc_free(e);
+	return NULL;
+}
+
+/* Returns the parsed config of the file, or NULL if it cannot be read */
+static sup_config_cache_st *cache_get(const char *file)
+{
+	sup_config_cache_st *e;
+	struct stat st;
+
+	if (stat(file, &st) == -1) {
+		syslog(LOG_ERR, "cannot load config file %s", file);
+		return NULL;
+	}
+
+	e = cache_find(file);
+	if (e != NULL) {
+		if (st.st_ino == e->ino && st.st_dev == e->dev &&
+		    st.st_size == e->size && st.st_mtime == e->mtime &&
+		    st.st_ctime == e->ctime) {
+			cache_hits++;
+			list_del(&e->list);
+			list_add(&cache_lru, &e->list);
+			return e;
+		}
+		cache_remove(e);
+	}
+
+	cache_misses++;
+	return cache_load(file, &st);
+}
+
+void sup_config_file_get_stats(uint64_t *hits, uint64_t *misses)
+{
+	*hits = cache_hits;
+	*misses = cache_misses;
+	cache_hits = 0;
+	cache_misses = 0;
+}
+
+static int read_sup_config_file(sup_config_cache_st **entry,
+				const char *file, const char *fallback, const char *type)
+{
+	sup_config_cache_st *e = NULL;
+
 	if (access(file, R_OK) == 0) {
 		syslog(LOG_DEBUG, "Loading %s configuration '%s'", type,
 		      file);
 
-		ret = parse_group_cfg_file(global_config, msg, pool, file);
-		if (ret < 0)
-			return ERR_READ_CONFIG;
+		e = cache_get(file);
 	} else {
 		if (fallback != NULL) {
 			syslog(LOG_DEBUG, "Loading default %s configuration '%s'", type, fallback);
 
-			ret = parse_group_cfg_file(global_config, msg, pool, fallback);
-			if (ret < 0)
-				return ERR_READ_CONFIG;
+			e = cache_get(fallback);
 		}
 	}
 
+	if (e != NULL && e->error < 0)
+		return ERR_READ_CONFIG;
+
+	*entry = e;
 	return 0;
 }
 
@@ -287,13 +443,18 @@ static int get_sup_config(struct cfg_st *cfg, client_entry_st *entry,
 			  SecmSessionReplyMsg *msg, void *pool)
 {
 	char file[_POSIX_PATH_MAX];
+	sup_config_cache_st *group = NULL, *user = NULL;
+	GroupCfgSt *config;
+	uint8_t *data;
+	size_t size;
 	int ret;
+	PROTOBUF_ALLOCATOR(pa, pool);
 
 	if (cfg->per_group_dir != NULL && entry->acct_info.groupname[0] != 0) {
 		snprintf(file, sizeof(file), "%s/%s", cfg->per_group_dir,
 			 entry->acct_info.groupname);
 
-		ret = read_sup_config_file(cfg, msg, pool, file, cfg->default_group_conf, "group");
+		ret = read_sup_config_file(&group, file, cfg->default_group_conf, "group");
 		if (ret < 0)
 			return ret;
 	}
@@ -301,11 +462,29 @@ static int get_sup_config(struct cfg_st *cfg, client_entry_st *entry,
 	if (cfg->per_user_dir != NULL) {
 		snprintf(file, sizeof(file), "%s/%s", cfg->per_user_dir,
 			 entry->acct_info.username);
-		ret = read_sup_config_file(cfg, msg, pool, file, cfg->default_user_conf, "user");
+		ret = read_sup_config_file(&user, file, cfg->default_user_conf, "user");
 		if (ret < 0)
 			return ret;
 	}
 
+	size = (group ? group->data_size : 0) + (user ? user->data_size : 0);
+	if (size == 0)
+		return 0;
+
+	/* the entries may be replaced by the next call; they are copied */
+	data = talloc_size(pool, size);
+	if (data == NULL)
+		return ERR_MEM;
+	if (group)
+		memcpy(data, group->data, group->data_size);
+	if (user)
+		memcpy(data + (group ? group->data_size : 0), user->data, user->data_size);
+
+	config = group_cfg_st__unpack(&pa, size, data);
+	if (config == NULL)
+		return ERR_READ_CONFIG;
+
+	msg->config = config;
 	return 0;
 }
 
@@ -25,4 +25,8 @@
 
 extern struct config_mod_st file_sup_config;
 
+/* Returns the hits and misses of the cache of parsed files since the
+ * last call */
+void sup_config_file_get_stats(uint64_t *hits, uint64_t *misses);
+
 #endif
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <timer-wheel.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(l) (TIMER_WHEEL_BITS * (l))
+
+void timer_wheel_init(timer_wheel_st *w, time_t now)
+{
+	unsigned l, i;
+
+	w->next = now;
+	w->entries = 0;
+	for (l = 0; l < TIMER_WHEEL_LEVELS; l++)
+		for (i = 0; i < TIMER_WHEEL_SLOTS; i++)
+			list_head_init(&w->slots[l][i]);
+}
+
+/* Places @e in the slot of its expiration, relative to the next second */
+static void place(timer_wheel_st *w, timer_wheel_entry_st *e)
+{
+	time_t expires = e->expires;
+	time_t delta = expires - w->next;
+	unsigned l;
+
+	if (delta < 0) {
+		expires = w->next;
+		delta = 0;
+	} else if (delta >= TIMER_WHEEL_SPAN) {
+		/* moved again once reached */
+		expires = w->next + TIMER_WHEEL_SPAN - 1;
+		delta = TIMER_WHEEL_SPAN - 1;
+	}
+
+	for (l = 0; l < TIMER_WHEEL_LEVELS - 1; l++) {
+		if (delta < ((time_t)1 << LEVEL_SHIFT(l + 1)))
+			break;
+	}
+
+	list_add_tail(&w->slots[l][(expires >> LEVEL_SHIFT(l)) & SLOT_MASK], &e->list);
+}
+
+void timer_wheel_add(timer_wheel_st *w, timer_wheel_entry_st *e, time_t expires)
+{
+	if (e->scheduled)
+		list_del(&e->list);
+	else
+		w->entries++;
+
+	e->expires = expires;
+	e->scheduled = 1;
+	place(w, e);
+}
+
+void timer_wheel_del(timer_wheel_st *w, timer_wheel_entry_st *e)
+{
+	if (!e->scheduled)
+		return;
+
+	list_del(&e->list);
+	e->scheduled = 0;
+	w->entries--;
+}
+
+/* Moves the entries of a slot to the lower levels */
+static void cascade(timer_wheel_st *w, struct list_head *slot)
+{
+	struct list_head tmp;
+	timer_wheel_entry_st *e;
+
+	list_head_init(&tmp);
+	while ((e = list_top(slot, timer_wheel_entry_st, list)) != NULL) {
+		list_del(&e->list);
+		list_add_tail(&tmp, &e->list);
+	}
+
+	while ((e = list_top(&tmp, timer_wheel_entry_st, list)) != NULL) {
+		list_del(&e->list);
+		place(w, e);
+	}
+}
+
+static unsigned move_due(timer_wheel_st *w, struct list_head *slot, struct list_head *due)
+{
+	timer_wheel_entry_st *e;
+	unsigned n = 0;
+
+	while ((e = list_top(slot, timer_wheel_entry_st, list)) != NULL) {
+		list_del(&e->list);
+		e->scheduled = 0;
+		list_add_tail(due, &e->list);
+		n++;
+	}
+
+	w->entries -= n;
+	return n;
+}
+
+unsigned timer_wheel_advance(timer_wheel_st *w, time_t now, struct list_head *due)
+{
+	struct list_head all;
+	timer_wheel_entry_st *e;
+	unsigned n = 0, l, i;
+
+	/* after a jump of the clock every slot would be visited */
+	if (now - w->next >= TIMER_WHEEL_SPAN) {
+		list_head_init(&all);
+		for (l = 0; l < TIMER_WHEEL_LEVELS; l++)
+			for (i = 0; i < TIMER_WHEEL_SLOTS; i++)
+				while ((e = list_top(&w->slots[l][i], timer_wheel_entry_st, list)) != NULL) {
+					list_del(&e->list);
+					list_add_tail(&all, &e->list);
+				}
+
+		w->next = now + 1;
+		while ((e = list_top(&all, timer_wheel_entry_st, list)) != NULL) {
+			list_del(&e->list);
+			if (e->expires <= now) {
+				e->scheduled = 0;
+				w->entries--;
+				list_add_tail(due, &e->list);
+				n++;
+			} else {
+				place(w, e);
+			}
+		}
+		return n;
+	}
+
+	while (w->next <= now) {
+		if (w->entries == 0) {
+			w->next = now + 1;
+			break;
+		}
+
+		i = w->next & SLOT_MASK;
+		for (l = 1; i == 0 && l < TIMER_WHEEL_LEVELS; l++) {
+			i = (w->next >> LEVEL_SHIFT(l)) & SLOT_MASK;
+			cascade(w, &w->slots[l][i]);
+		}
+
+		n += move_due(w, &w->slots[0][w->next & SLOT_MASK], due);
+		w->next++;
+	}
+
+	return n;
+}
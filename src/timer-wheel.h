@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_TIMER_WHEEL_H
+# define OC_TIMER_WHEEL_H
+
+# include <time.h>
+# include <stdint.h>
+# include <ccan/list/list.h>
+
+/* A hierarchical timing wheel with a resolution of one second. Level 0
+ * has a slot per second for the next TIMER_WHEEL_SLOTS seconds, and each
+ * following level has slots TIMER_WHEEL_SLOTS times as long; the slots of
+ * a level are moved to the lower levels as the wheel reaches them. Entries
+ * due after the span of the wheel are kept in its last slots and moved
+ * again when reached.
+ *
+ * Advancing the wheel touches the entries which are due and those of the
+ * slots which are moved, rather than every entry. The entries are embedded
+ * in the structures they expire.
+ */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SPAN ((time_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+typedef struct timer_wheel_entry_st {
+	struct list_node list;
+	time_t expires;
+	unsigned scheduled;
+} timer_wheel_entry_st;
+
+typedef struct timer_wheel_st {
+	time_t next; /* the next second to expire */
+	unsigned entries;
+	struct list_head slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_st;
+
+void timer_wheel_init(timer_wheel_st *w, time_t now);
+
+/* Schedules @e to expire at @expires, or at the next second if that is
+ * earlier; an entry which is already scheduled is moved. */
+void timer_wheel_add(timer_wheel_st *w, timer_wheel_entry_st *e, time_t expires);
+
+/* Removes @e from the wheel, if it is scheduled */
+void timer_wheel_del(timer_wheel_st *w, timer_wheel_entry_st *e);
+
+/* Moves the entries which are due at @now to @due, and returns their
+ * number. The entries are no longer scheduled. */
+unsigned timer_wheel_advance(timer_wheel_st *w, time_t now, struct list_head *due);
+
+#endif
@@ -35,7 +35,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include <tlslib.h>
-#include <ccan/hash/hash.h>
+#include <keyed-hash.h>
 #include <vpn.h>
 #include <main.h>
 #include <worker.h>
@@ -398,7 +398,7 @@ static size_t rehash(const void *_e, void *unused)
 {
 	const tls_cache_st *e = _e;
 
-	return hash_any(e->session_id, e->session_id_size, 0);
+	return keyed_hash(e->session_id, e->session_id_size);
 }
 
 void tls_cache_init(void *pool, tls_sess_db_st* db)
@@ -1111,6 +1111,90 @@ void tls_reload_crl(main_server_st* s, struct vhost_cfg_st *vhost, unsigned forc
 }
 #endif /* UNDER_TEST */
 
+/* Generates the master key of the TLS session tickets when it is older
+ * than 'tls-session-ticket-key-rotation'. The workers get the current key
+ * at startup, so a ticket can be used with any of them. The replaced key
+ * is kept, until the next rotation, for the tickets which were issued
+ * with it; see tls_ticket_key_issued().
+ */
+void tls_rotate_ticket_key(main_server_st *s, unsigned force)
+{
+	gnutls_datum_t key;
+	time_t now = time(NULL);
+	int ret;
+
+	if (!GETPCONFIG(s)->tls_session_tickets)
+		return;
+
+	if (!force && s->ticket_key.size > 0 &&
+	    (GETPCONFIG(s)->tls_ticket_key_rotation == 0 ||
+	     now - s->ticket_key_time < GETPCONFIG(s)->tls_ticket_key_rotation))
+		return;
+
+	ret = gnutls_session_ticket_key_generate(&key);
+	if (ret < 0) {
+		/* the previous key, if any, remains in use */
+		mslog(s, NULL, LOG_ERR, "error generating the TLS session ticket key: %s",
+		      gnutls_strerror(ret));
+		return;
+	}
+
+	if (s->prev_ticket_key.data != NULL) {
+		safe_memset(s->prev_ticket_key.data, 0, s->prev_ticket_key.size);
+		gnutls_free(s->prev_ticket_key.data);
+	}
+
+	if (s->ticket_key.data != NULL)
+		mslog(s, NULL, LOG_INFO, "rotated the TLS session ticket key");
+
+	s->prev_ticket_key = s->ticket_key;
+	s->ticket_key = key;
+	s->ticket_key_time = now;
+}
+
+/* Returns non-zero if @key_name, the first bytes of a session ticket,
+ * names a key derived from the master @key. GnuTLS encrypts the tickets
+ * with a key derived from the master key and the current period of 3
+ * times the session @expiration, and accepts those of the previous
+ * period too; older versions use the master key itself.
+ */
+unsigned tls_ticket_key_issued(const gnutls_datum_t *key, unsigned expiration,
+			       const uint8_t *key_name)
+{
+	uint8_t buf[8 + 64];
+	uint8_t digest[64];
+	uint64_t t;
+	unsigned i, j;
+
+	if (key->size < TLS_TICKET_KEY_NAME_SIZE || key->size > sizeof(buf) - 8)
+		return 0;
+
+	if (memcmp(key->data, key_name, TLS_TICKET_KEY_NAME_SIZE) == 0)
+		return 1;
+
+	if (expiration == 0)
+		return 0;
+
+	t = time(NULL) / (3 * (uint64_t)expiration);
+	memcpy(&buf[8], key->data, key->size);
+
+	for (i = 0; i < 2; i++, t--) {
+		for (j = 0; j < 8; j++)
+			buf[j] = t >> (56 - 8 * j);
+
+		if (gnutls_hash_fast(GNUTLS_DIG_SHA3_512, buf, 8 + key->size, digest) < 0)
+			break;
+
+		if (memcmp(digest, key_name, TLS_TICKET_KEY_NAME_SIZE) == 0) {
+			safe_memset(buf, 0, sizeof(buf));
+			return 1;
+		}
+	}
+
+	safe_memset(buf, 0, sizeof(buf));
+	return 0;
+}
+
 void tls_cork(gnutls_session_t session)
 {
 	gnutls_record_cork(session);
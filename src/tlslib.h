@@ -26,6 +26,7 @@
 #include <gnutls/pkcs11.h>
 #include <vpn.h>
 #include <ccan/htable/htable.h>
+#include <timer-wheel.h>
 #include <errno.h>
 
 # if GNUTLS_VERSION_NUMBER < 0x030200
@@ -58,6 +59,12 @@ typedef struct tls_st {
 struct vhost_cfg_st;
 
 void tls_reload_crl(struct main_server_st* s, struct vhost_cfg_st *vhost, unsigned force);
+void tls_rotate_ticket_key(struct main_server_st *s, unsigned force);
+
+/* the size of the key name which a session ticket starts with */
+#define TLS_TICKET_KEY_NAME_SIZE 16
+unsigned tls_ticket_key_issued(const gnutls_datum_t *key, unsigned expiration,
+			       const uint8_t *key_name);
 void tls_global_init(void);
 void tls_vhost_init(struct vhost_cfg_st *vhost);
 void tls_vhost_deinit(struct vhost_cfg_st *vhost);
@@ -124,6 +131,9 @@ typedef struct
   unsigned int session_data_size;
 
   char *vhostname;
+
+  /* in the tls_expiry wheel of sec-mod */
+  timer_wheel_entry_st expiry;
 } tls_cache_st;
 
 #define TLS_SESSION_EXPIRATION_TIME(config) ((config)->cookie_timeout)
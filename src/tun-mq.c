@@ -0,0 +1,888 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <talloc.h>
+
+#ifdef __linux__
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_tun.h>
+#include <linux/bpf.h>
+#include <linux/rtnetlink.h>
+#include <vpn.h>
+#include <main.h>
+#include <ip-lease.h>
+#include <ip-util.h>
+#include <rtnl.h>
+#include <tun-mq.h>
+
+#ifndef TUNSETSTEERINGEBPF
+# define TUNSETSTEERINGEBPF _IOR('T', 224, int)
+#endif
+
+/* the maximum number of queues of a tun device (MAX_TAP_QUEUES) */
+#define TUN_MQ_QUEUES 256
+
+/* the map is not pre-allocated, that is only a limit */
+#define TUN_MQ_MAP_ENTRIES (1 << 20)
+
+/* The key of the steering map; the IPv4 addresses are mapped to IPv6
+ * ones (::ffff:a.b.c.d) */
+struct mq_key_st {
+	uint32_t prefixlen;
+	uint8_t addr[16];
+};
+
+struct mq_value_st {
+	uint32_t queue; /* read by the steering program */
+	uint32_t owner; /* the slot which set the entry */
+};
+
+/* an entry of the map set for a session */
+struct mq_entry_st {
+	struct mq_key_st key;
+	unsigned route; /* the host route of the session was added for it */
+};
+
+struct mq_queue_st {
+	int fd; /* -1 when not attached */
+	struct mq_entry_st *entries;
+	unsigned n_entries;
+};
+
+struct mq_dev_st {
+	struct tun_mq_st *mq;
+	char name[IFNAMSIZ];
+	int ifindex;
+	unsigned n_queues; /* the attached ones; the first is the sink */
+	struct mq_queue_st queues[TUN_MQ_QUEUES];
+
+	/* the local addresses set on the device */
+	struct sockaddr_storage *locals;
+	unsigned n_locals;
+
+	ev_io sink_io;
+};
+
+struct tun_mq_st {
+	main_server_st *s;
+	int map_fd;
+	int prog_fd;
+
+	struct mq_dev_st **devs;
+	unsigned n_devs;
+	unsigned next_name; /* the number of the next device */
+
+	/* the slots which were released, as dev * TUN_MQ_QUEUES + queue */
+	uint32_t *free;
+	unsigned n_free;
+
+	/* the slots released while their worker could still be running */
+	struct list_head held;
+};
+
+/* A slot whose queue may still be read through the duplicate held by the
+ * worker of its last session; it is not given to another session before
+ * that worker is reaped */
+struct mq_held_st {
+	struct list_node list;
+	struct tun_mq_st *mq;
+	unsigned slot;
+	ev_child child;
+};
+
+#define SLOT_DEV(mq, slot) ((mq)->devs[(slot) / TUN_MQ_QUEUES])
+#define SLOT_QUEUE(mq, slot) (&SLOT_DEV(mq, slot)->queues[(slot) % TUN_MQ_QUEUES])
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int map_update(struct tun_mq_st *mq, const struct mq_key_st *key,
+		      const struct mq_value_st *value)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = mq->map_fd;
+	attr.key = (uintptr_t)key;
+	attr.value = (uintptr_t)value;
+	attr.flags = BPF_ANY;
+
+	return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+/* Removes the entry of @key if it was set by @owner; a session may have
+ * been given the addresses of another one in the meantime */
+static unsigned map_release(struct tun_mq_st *mq, const struct mq_key_st *key,
+			    uint32_t owner)
+{
+	struct mq_value_st value;
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = mq->map_fd;
+	attr.key = (uintptr_t)key;
+	attr.value = (uintptr_t)&value;
+
+	/* the lookup of an LPM map is by longest prefix, not exact */
+	if (sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr) < 0 || value.owner != owner)
+		return 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = mq->map_fd;
+	attr.key = (uintptr_t)key;
+
+	return sys_bpf(BPF_MAP_DELETE_ELEM, &attr) == 0;
+}
+
+#define INSN(c, d, s, o, i) \
+	((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+#define MOV64_REG(d, s) INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV64_IMM(d, i) INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ADD64_IMM(d, i) INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define RSH64_IMM(d, i) INSN(BPF_ALU64 | BPF_RSH | BPF_K, d, 0, 0, i)
+#define LDX_MEM(sz, d, s, o) INSN(BPF_LDX | BPF_MEM | (sz), d, s, o, 0)
+#define ST_MEM(sz, d, o, i) INSN(BPF_ST | BPF_MEM | (sz), d, 0, o, i)
+#define JMP_IMM(op, d, i, o) INSN(BPF_JMP | (op) | BPF_K, d, 0, o, i)
+#define JMP_A(o) INSN(BPF_JMP | BPF_JA, 0, 0, o, 0)
+#define CALL(f) INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define EXIT() INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+#define LD_MAP_FD(d, fd) \
+	INSN(BPF_LD | BPF_DW | BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), INSN(0, 0, 0, 0, 0)
+
+/* The steering program; it returns the queue for the destination of the
+ * packet, or zero. The key is built on the stack at fp-24, with the first
+ * byte of the packet read at fp-32. */
+static int load_prog(main_server_st *s, int map_fd)
+{
+	struct bpf_insn insns[] = {
+		/* 0 */ MOV64_REG(BPF_REG_6, BPF_REG_1),
+		MOV64_IMM(BPF_REG_2, 0),
+		MOV64_REG(BPF_REG_3, BPF_REG_10),
+		ADD64_IMM(BPF_REG_3, -32),
+		MOV64_IMM(BPF_REG_4, 1),
+		/* 5 */ CALL(BPF_FUNC_skb_load_bytes),
+		JMP_IMM(BPF_JNE, BPF_REG_0, 0, 29), /* miss */
+		LDX_MEM(BPF_B, BPF_REG_7, BPF_REG_10, -32),
+		RSH64_IMM(BPF_REG_7, 4),
+		ST_MEM(BPF_W, BPF_REG_10, -24, 128),
+		/* 10 */ JMP_IMM(BPF_JEQ, BPF_REG_7, 6, 10), /* ipv6 */
+		JMP_IMM(BPF_JNE, BPF_REG_7, 4, 24), /* miss */
+		/* ipv4: ::ffff:<daddr> */
+		ST_MEM(BPF_W, BPF_REG_10, -20, 0),
+		ST_MEM(BPF_W, BPF_REG_10, -16, 0),
+		ST_MEM(BPF_W, BPF_REG_10, -12, htonl(0xffff)),
+		/* 15 */ MOV64_REG(BPF_REG_1, BPF_REG_6),
+		MOV64_IMM(BPF_REG_2, 16),
+		MOV64_REG(BPF_REG_3, BPF_REG_10),
+		ADD64_IMM(BPF_REG_3, -8),
+		MOV64_IMM(BPF_REG_4, 4),
+		/* 20 */ JMP_A(5), /* lookup */
+		/* ipv6: daddr */
+		MOV64_REG(BPF_REG_1, BPF_REG_6),
+		MOV64_IMM(BPF_REG_2, 24),
+		MOV64_REG(BPF_REG_3, BPF_REG_10),
+		ADD64_IMM(BPF_REG_3, -20),
+		/* 25 */ MOV64_IMM(BPF_REG_4, 16),
+		/* lookup */
+		CALL(BPF_FUNC_skb_load_bytes),
+		JMP_IMM(BPF_JNE, BPF_REG_0, 0, 8), /* miss */
+		LD_MAP_FD(BPF_REG_1, map_fd),
+		/* 30 */ MOV64_REG(BPF_REG_2, BPF_REG_10),
+		ADD64_IMM(BPF_REG_2, -24),
+		CALL(BPF_FUNC_map_lookup_elem),
+		JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 2), /* miss */
+		LDX_MEM(BPF_W, BPF_REG_0, BPF_REG_0, offsetof(struct mq_value_st, queue)),
+		/* 35 */ EXIT(),
+		/* miss */
+		MOV64_IMM(BPF_REG_0, 0),
+		EXIT()
+	};
+	static const char license[] = "GPL";
+	char log[4096];
+	union bpf_attr attr;
+	int fd, e;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+	attr.insns = (uintptr_t)insns;
+	attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+	attr.license = (uintptr_t)license;
+
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd >= 0)
+		return fd;
+	e = errno;
+
+	/* load it again for the verifier log */
+	log[0] = 0;
+	attr.log_buf = (uintptr_t)log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd >= 0)
+		return fd;
+
+	mslog(s, NULL, LOG_ERR, "could not load the tun steering program: %s", strerror(e));
+	if (log[0] != 0)
+		mslog(s, NULL, LOG_DEBUG, "verifier: %s", log);
+	errno = e;
+	return -1;
+}
+
+static void key_set(struct mq_key_st *key, const struct sockaddr_storage *addr,
+		    unsigned prefix)
+{
+	memset(key, 0, sizeof(*key));
+	if (addr->ss_family == AF_INET) {
+		key->addr[10] = 0xff;
+		key->addr[11] = 0xff;
+		memcpy(&key->addr[12], SA_IN_P(addr), 4);
+		key->prefixlen = 96 + prefix;
+	} else {
+		memcpy(key->addr, SA_IN6_P(addr), 16);
+		key->prefixlen = prefix;
+	}
+}
+
+static void key_get(const struct mq_key_st *key, struct sockaddr_storage *addr,
+		    unsigned *prefix)
+{
+	static const uint8_t mapped[12] = { 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
+
+	memset(addr, 0, sizeof(*addr));
+	if (key->prefixlen >= 96 && memcmp(key->addr, mapped, sizeof(mapped)) == 0) {
+		addr->ss_family = AF_INET;
+		memcpy(SA_IN_P(addr), &key->addr[12], 4);
+		*prefix = key->prefixlen - 96;
+	} else {
+		addr->ss_family = AF_INET6;
+		memcpy(SA_IN6_P(addr), key->addr, 16);
+		*prefix = key->prefixlen;
+	}
+}
+
+/* Discards the packets queued on @fd */
+static void queue_drain(int fd, unsigned max)
+{
+	static uint8_t buf[65536];
+	unsigned i;
+	ssize_t ret;
+
+	for (i = 0; i < max; i++) {
+		ret = read(fd, buf, sizeof(buf));
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+	}
+}
+
+static void sink_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	queue_drain(w->fd, 64);
+}
+
+/* Attaches to the next queue of the device @name, creating it if this
+ * is the first one */
+static int queue_attach(main_server_st *s, const char name[IFNAMSIZ])
+{
+	struct ifreq ifr;
+	int fd, e;
+
+	fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "Can't open /dev/net/tun: %s\n", strerror(e));
+		errno = e;
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+	memcpy(ifr.ifr_name, name, IFNAMSIZ);
+
+	if (ioctl(fd, TUNSETIFF, (void *)&ifr) < 0) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "%s: TUNSETIFF: %s\n", name, strerror(e));
+		close(fd);
+		errno = e;
+		return -1;
+	}
+
+	return fd;
+}
+
+static void dev_free(struct mq_dev_st *dev)
+{
+	unsigned i;
+
+	if (main_loop)
+		ev_io_stop(main_loop, &dev->sink_io);
+
+	for (i = 0; i < dev->n_queues; i++)
+		close(dev->queues[i].fd);
+
+	talloc_free(dev);
+}
+
+static struct mq_dev_st *dev_new(struct tun_mq_st *mq)
+{
+	main_server_st *s = mq->s;
+	struct mq_dev_st *dev, **devs;
+	struct ifreq ifr;
+	unsigned i;
+	int fd, ret, e;
+
+	devs = talloc_realloc(mq, mq->devs, struct mq_dev_st *, mq->n_devs + 1);
+	if (devs == NULL)
+		return NULL;
+	mq->devs = devs;
+
+	dev = talloc_zero(mq, struct mq_dev_st);
+	if (dev == NULL)
+		return NULL;
+	dev->mq = mq;
+	for (i = 0; i < TUN_MQ_QUEUES; i++)
+		dev->queues[i].fd = -1;
+
+	/* the queues of an existing device would not be in order */
+	do {
+		ret = snprintf(dev->name, sizeof(dev->name), "%smq%u",
+			       GETCONFIG(s)->network.name, mq->next_name++);
+		if (ret < 0 || ret >= sizeof(dev->name)) {
+			mslog(s, NULL, LOG_ERR, "Truncation error in tun name: %smq%u; adjust 'device' option\n",
+			      GETCONFIG(s)->network.name, mq->next_name - 1);
+			goto fail;
+		}
+	} while (if_nametoindex(dev->name) != 0);
+
+	fd = queue_attach(s, dev->name);
+	if (fd < 0)
+		goto fail;
+	dev->queues[0].fd = fd;
+	dev->n_queues = 1;
+
+	if (ioctl(fd, TUNSETSTEERINGEBPF, (void *)&mq->prog_fd) < 0) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "%s: TUNSETSTEERINGEBPF: %s\n", dev->name, strerror(e));
+		goto fail;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		goto fail;
+
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, dev->name, IFNAMSIZ);
+	ifr.ifr_flags = IFF_UP | IFF_RUNNING;
+	ret = ioctl(fd, SIOCSIFFLAGS, &ifr);
+	e = errno;
+	close(fd);
+	if (ret != 0) {
+		mslog(s, NULL, LOG_ERR, "%s: Could not bring up interface: %s\n",
+		      dev->name, strerror(e));
+		goto fail;
+	}
+
+	dev->ifindex = if_nametoindex(dev->name);
+	if (dev->ifindex == 0)
+		goto fail;
+
+	ev_io_init(&dev->sink_io, sink_cb, dev->queues[0].fd, EV_READ);
+	ev_io_start(main_loop, &dev->sink_io);
+
+	mq->devs[mq->n_devs++] = dev;
+	mslog(s, NULL, LOG_INFO, "created multi-queue tun device %s", dev->name);
+
+	return dev;
+ fail:
+	dev_free(dev);
+	return NULL;
+}
+
+/* Returns the slot of a queue which is not in use, or -1 */
+static int slot_get(struct tun_mq_st *mq)
+{
+	struct mq_dev_st *dev;
+	int fd, slot;
+
+	if (mq->n_free > 0) {
+		slot = mq->free[--mq->n_free];
+
+		/* the packets left for the previous session */
+		queue_drain(SLOT_QUEUE(mq, slot)->fd, TUN_MQ_QUEUES * 8);
+		return slot;
+	}
+
+	dev = (mq->n_devs > 0) ? mq->devs[mq->n_devs - 1] : NULL;
+	if (dev == NULL || dev->n_queues == TUN_MQ_QUEUES) {
+		dev = dev_new(mq);
+		if (dev == NULL)
+			return -1;
+	}
+
+	fd = queue_attach(mq->s, dev->name);
+	if (fd < 0)
+		return -1;
+
+	slot = (mq->n_devs - 1) * TUN_MQ_QUEUES + dev->n_queues;
+	dev->queues[dev->n_queues++].fd = fd;
+
+	return slot;
+}
+
+/* Sets the map entry for @addr/@prefix to the queue of @slot */
+static int slot_steer(struct tun_mq_st *mq, unsigned slot,
+		      const struct sockaddr_storage *addr, unsigned prefix,
+		      unsigned route)
+{
+	struct mq_queue_st *q = SLOT_QUEUE(mq, slot);
+	struct mq_entry_st *entries;
+	struct mq_value_st value;
+	struct mq_key_st key;
+
+	key_set(&key, addr, prefix);
+	value.queue = slot % TUN_MQ_QUEUES;
+	value.owner = slot;
+
+	entries = talloc_realloc(mq, q->entries, struct mq_entry_st, q->n_entries + 1);
+	if (entries == NULL)
+		return ERR_MEM;
+	q->entries = entries;
+
+	if (map_update(mq, &key, &value) < 0)
+		return -1;
+
+	entries[q->n_entries].key = key;
+	entries[q->n_entries].route = route;
+	q->n_entries++;
+
+	return 0;
+}
+
+/* Sets the local address of the session on the device, unless already
+ * set, and the route to its remote address */
+static int session_routes(struct tun_mq_st *mq, rtnl_batch_st *b, struct mq_dev_st *dev,
+			  struct ip_lease_st *lease, unsigned prefix, unsigned mtu,
+			  unsigned *new_local)
+{
+	unsigned i;
+	int ret;
+
+	*new_local = 1;
+	for (i = 0; i < dev->n_locals; i++) {
+		if (dev->locals[i].ss_family == lease->lip.ss_family &&
+		    memcmp(SA_IN_P_TYPE(&dev->locals[i], lease->lip.ss_family),
+			   SA_IN_P_TYPE(&lease->lip, lease->lip.ss_family),
+			   SA_IN_SIZE(lease->lip_len)) == 0) {
+			*new_local = 0;
+			break;
+		}
+	}
+
+	if (*new_local) {
+		ret = rtnl_batch_add_addr(b, RTM_NEWADDR, &lease->lip, NULL,
+					  (lease->lip.ss_family == AF_INET) ? 32 : 128,
+					  dev->ifindex);
+		if (ret < 0)
+			return ret;
+	}
+
+	return rtnl_batch_replace_route(b, &lease->rip, prefix, &lease->lip,
+					dev->ifindex, mtu);
+}
+
+static int session_set(struct tun_mq_st *mq, struct proc_st *proc, unsigned slot)
+{
+	main_server_st *s = mq->s;
+	struct mq_dev_st *dev = SLOT_DEV(mq, slot);
+	struct sockaddr_storage *locals;
+	struct ip_lease_st *leases[2];
+	unsigned prefix[2], new_local[2] = { 0, 0 };
+	rtnl_batch_st b;
+	unsigned i, n = 0;
+	int ret, e;
+
+	if (proc->ipv4 && proc->ipv4->lip_len > 0 && proc->ipv4->rip_len > 0) {
+		leases[n] = proc->ipv4;
+		prefix[n++] = 32;
+	}
+	if (proc->ipv6 && proc->ipv6->lip_len > 0 && proc->ipv6->rip_len > 0) {
+		leases[n] = proc->ipv6;
+		prefix[n++] = proc->ipv6->prefix;
+	}
+
+	if (n == 0) {
+		mslog(s, NULL, LOG_ERR, "%s: Could not set any IP.\n", dev->name);
+		return -1;
+	}
+
+	locals = talloc_realloc(dev, dev->locals, struct sockaddr_storage, dev->n_locals + n);
+	if (locals == NULL)
+		return ERR_MEM;
+	dev->locals = locals;
+
+	rtnl_batch_init(&b, proc);
+	for (i = 0; i < n; i++) {
+		ret = session_routes(mq, &b, dev, leases[i], prefix[i], 0, &new_local[i]);
+		if (ret < 0)
+			goto cleanup;
+	}
+
+	ret = rtnl_batch_commit(&b);
+	if (ret != 0) {
+		e = errno;
+		if (ret < 0)
+			mslog(s, proc, LOG_ERR, "%s: could not set the routes via netlink: %s",
+			      dev->name, strerror(e));
+		for (i = 0; b.errors && i < b.count; i++) {
+			if (b.errors[i] != 0 && b.errors[i] != EIO)
+				mslog(s, proc, LOG_ERR, "%s: could not set the addresses or routes: %s",
+				      dev->name, strerror(b.errors[i]));
+		}
+		ret = -1;
+		goto cleanup;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (new_local[i])
+			dev->locals[dev->n_locals++] = leases[i]->lip;
+
+		ret = slot_steer(mq, slot, &leases[i]->rip, prefix[i], 1);
+		if (ret < 0) {
+			e = errno;
+			mslog(s, proc, LOG_ERR, "%s: could not update the steering map: %s",
+			      dev->name, strerror(e));
+			ret = -1;
+			goto cleanup;
+		}
+	}
+
+	ret = 0;
+ cleanup:
+	rtnl_batch_deinit(&b);
+	return ret;
+}
+
+/* Removes the map entries of the session in @slot, and the routes to its
+ * addresses; the ones which were given to another session are left */
+static void slot_release(struct tun_mq_st *mq, unsigned slot)
+{
+	struct mq_dev_st *dev = SLOT_DEV(mq, slot);
+	struct mq_queue_st *q = SLOT_QUEUE(mq, slot);
+	struct sockaddr_storage addr;
+	rtnl_batch_st b;
+	unsigned i, prefix;
+
+	rtnl_batch_init(&b, mq);
+	for (i = 0; i < q->n_entries; i++) {
+		if (!map_release(mq, &q->entries[i].key, slot) || !q->entries[i].route)
+			continue;
+
+		key_get(&q->entries[i].key, &addr, &prefix);
+		rtnl_batch_add_route(&b, RTM_DELROUTE, &addr, prefix, dev->ifindex);
+	}
+	rtnl_batch_commit(&b);
+	rtnl_batch_deinit(&b);
+
+	talloc_free(q->entries);
+	q->entries = NULL;
+	q->n_entries = 0;
+}
+
+static void slot_free(struct tun_mq_st *mq, unsigned slot)
+{
+	/* there is always room, as the slot was taken from there or is new */
+	mq->free[mq->n_free++] = slot;
+}
+
+static void held_free(struct mq_held_st *h)
+{
+	ev_child_stop(main_loop, &h->child);
+	list_del(&h->list);
+	talloc_free(h);
+}
+
+static void held_child_cb(struct ev_loop *loop, ev_child *w, int revents)
+{
+	struct mq_held_st *h = container_of(w, struct mq_held_st, child);
+
+	slot_free(h->mq, h->slot);
+	held_free(h);
+}
+
+/* Keeps @slot out of the free list until the worker @pid exits */
+static void slot_hold(struct tun_mq_st *mq, unsigned slot, pid_t pid)
+{
+	struct mq_held_st *h;
+
+	h = talloc_zero(mq, struct mq_held_st);
+	if (h == NULL) {
+		/* the queue is leaked rather than shared */
+		mslog(mq->s, NULL, LOG_ERR, "could not hold queue %u of tun device %s",
+		      slot % TUN_MQ_QUEUES, SLOT_DEV(mq, slot)->name);
+		return;
+	}
+	h->mq = mq;
+	h->slot = slot;
+
+	ev_child_init(&h->child, held_child_cb, pid, 0);
+	ev_child_start(main_loop, &h->child);
+	list_add_tail(&mq->held, &h->list);
+}
+
+void tun_mq_init(main_server_st *s)
+{
+	struct tun_mq_st *mq;
+	union bpf_attr attr;
+	int e;
+
+	if (!GETPCONFIG(s)->tun_multi_queue)
+		return;
+
+	mq = talloc_zero(s, struct tun_mq_st);
+	if (mq == NULL)
+		return;
+	mq->s = s;
+	mq->prog_fd = -1;
+	list_head_init(&mq->held);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_LPM_TRIE;
+	attr.key_size = sizeof(struct mq_key_st);
+	attr.value_size = sizeof(struct mq_value_st);
+	attr.max_entries = TUN_MQ_MAP_ENTRIES;
+	attr.map_flags = BPF_F_NO_PREALLOC;
+
+	mq->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (mq->map_fd < 0) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "could not create the tun steering map: %s", strerror(e));
+		goto fail;
+	}
+
+	mq->prog_fd = load_prog(s, mq->map_fd);
+	if (mq->prog_fd < 0)
+		goto fail;
+
+	/* the steering program is attached on the first device; that is
+	 * not supported before Linux 4.16, even when it loads */
+	if (dev_new(mq) == NULL)
+		goto fail;
+
+	s->tun_mq = mq;
+	return;
+
+ fail:
+	mslog(s, NULL, LOG_ERR, "tun-multi-queue is not available; using a tun device per session");
+	if (mq->prog_fd >= 0)
+		close(mq->prog_fd);
+	if (mq->map_fd >= 0)
+		close(mq->map_fd);
+	talloc_free(mq);
+}
+
+void tun_mq_deinit(main_server_st *s)
+{
+	struct tun_mq_st *mq = s->tun_mq;
+	struct mq_held_st *h, *hpos;
+	unsigned i;
+
+	if (mq == NULL)
+		return;
+
+	list_for_each_safe(&mq->held, h, hpos, list)
+		held_free(h);
+
+	/* the devices are removed with their last queue */
+	for (i = 0; i < mq->n_devs; i++)
+		dev_free(mq->devs[i]);
+
+	close(mq->prog_fd);
+	close(mq->map_fd);
+	talloc_free(mq);
+	s->tun_mq = NULL;
+}
+
+int tun_mq_open(main_server_st *s, struct proc_st *proc)
+{
+	struct tun_mq_st *mq = s->tun_mq;
+	uint32_t *free;
+	int slot, fd, ret, e;
+
+	ret = get_ip_leases(s, proc);
+	if (ret < 0)
+		return ret;
+
+	/* the room for the slot in the free list */
+	free = talloc_realloc(mq, mq->free, uint32_t, mq->n_devs * TUN_MQ_QUEUES + TUN_MQ_QUEUES);
+	if (free == NULL)
+		return ERR_MEM;
+	mq->free = free;
+
+	slot = slot_get(mq);
+	if (slot < 0) {
+		mslog(s, NULL, LOG_ERR, "Can't attach to a tun queue\n");
+		return -1;
+	}
+
+	fd = fcntl(SLOT_QUEUE(mq, slot)->fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "Can't duplicate tun queue: %s\n", strerror(e));
+		mq->free[mq->n_free++] = slot;
+		return -1;
+	}
+
+	memcpy(proc->tun_lease.name, SLOT_DEV(mq, slot)->name, IFNAMSIZ);
+	proc->tun_lease.mq_slot = slot + 1;
+	proc->tun_lease.fd = fd;
+
+	ret = session_set(mq, proc, slot);
+	if (ret < 0) {
+		/* the worker did not receive the queue */
+		tun_mq_close(s, proc, -1);
+		return -1;
+	}
+
+	mslog(s, proc, LOG_DEBUG, "assigning queue %u of tun device %s\n",
+	      slot % TUN_MQ_QUEUES, proc->tun_lease.name);
+
+	return 0;
+}
+
+void tun_mq_close(main_server_st *s, struct proc_st *proc, pid_t pid)
+{
+	unsigned slot;
+
+	if (proc->tun_lease.fd >= 0) {
+		close(proc->tun_lease.fd);
+		proc->tun_lease.fd = -1;
+	}
+
+	if (proc->tun_lease.mq_slot == 0 || s->tun_mq == NULL)
+		return;
+
+	slot = proc->tun_lease.mq_slot - 1;
+	slot_release(s->tun_mq, slot);
+	if (pid > 0)
+		slot_hold(s->tun_mq, slot, pid);
+	else
+		slot_free(s->tun_mq, slot);
+	proc->tun_lease.mq_slot = 0;
+}
+
+int tun_mq_set_mtu(main_server_st *s, struct proc_st *proc, unsigned mtu)
+{
+	struct tun_mq_st *mq = s->tun_mq;
+	struct mq_dev_st *dev;
+	struct ip_lease_st *lease;
+	struct mq_value_st value;
+	struct mq_key_st key;
+	union bpf_attr attr;
+	unsigned i, slot, unused;
+	rtnl_batch_st b;
+	int ret, e;
+
+	if (mq == NULL || proc->tun_lease.mq_slot == 0)
+		return -1;
+
+	slot = proc->tun_lease.mq_slot - 1;
+	dev = SLOT_DEV(mq, slot);
+
+	mslog(s, proc, LOG_DEBUG, "setting the MTU of the routes via %s to %u", dev->name, mtu);
+
+	rtnl_batch_init(&b, proc);
+	for (i = 0; i < 2; i++) {
+		lease = (i == 0) ? proc->ipv4 : proc->ipv6;
+		if (lease == NULL || lease->lip_len == 0 || lease->rip_len == 0)
+			continue;
+
+		/* unless the address was given to another session */
+		key_set(&key, &lease->rip, (i == 0) ? 32 : lease->prefix);
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = mq->map_fd;
+		attr.key = (uintptr_t)&key;
+		attr.value = (uintptr_t)&value;
+		if (sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr) < 0 || value.owner != slot)
+			continue;
+
+		ret = session_routes(mq, &b, dev, lease, (i == 0) ? 32 : lease->prefix,
+				     mtu, &unused);
+		if (ret < 0)
+			goto cleanup;
+	}
+
+	ret = rtnl_batch_commit(&b);
+	if (ret != 0) {
+		e = errno;
+		mslog(s, proc, LOG_INFO, "could not set the MTU of the routes to %u: %s",
+		      mtu, (ret < 0) ? strerror(e) : "netlink error");
+		ret = -1;
+	}
+
+ cleanup:
+	rtnl_batch_deinit(&b);
+	return ret;
+}
+
+int tun_mq_steer_iroutes(main_server_st *s, struct proc_st *proc)
+{
+	struct tun_mq_st *mq = s->tun_mq;
+	struct sockaddr_storage addr;
+	unsigned i, prefix;
+	int ret, e;
+
+	if (mq == NULL || proc->tun_lease.mq_slot == 0)
+		return 0;
+
+	for (i = 0; i < proc->config->n_iroutes; i++) {
+		if (ip_route_parse(proc->config->iroutes[i], &addr, &prefix) < 0) {
+			mslog(s, proc, LOG_ERR, "cannot parse iroute '%s'",
+			      proc->config->iroutes[i]);
+			return ERR_PARSING;
+		}
+
+		ret = slot_steer(mq, proc->tun_lease.mq_slot - 1, &addr, prefix, 0);
+		if (ret < 0) {
+			e = errno;
+			mslog(s, proc, LOG_ERR, "could not steer iroute '%s': %s",
+			      proc->config->iroutes[i], strerror(e));
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+#endif
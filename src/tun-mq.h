@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_TUN_MQ_H
+# define OC_TUN_MQ_H
+
+#include <main.h>
+
+/* The shared multi-queue tun mode (tun-multi-queue). Rather than a
+ * device per session, the sessions use the queues of a few multi-queue
+ * devices, named after the 'device' option as vpnsmq0, vpnsmq1, etc.
+ * Each worker gets a queue; main holds every queue it attached so that
+ * their indices don't change, and programs a host route per session via
+ * the shared device. The packets sent to the device are delivered to the
+ * queue of their destination by an eBPF steering program, which looks up
+ * the queue in a map of the tunnel addresses and iroutes; the packets to
+ * unknown destinations go to the first queue of each device, which main
+ * discards.
+ */
+
+#ifdef __linux__
+
+void tun_mq_init(main_server_st *s);
+void tun_mq_deinit(main_server_st *s);
+
+/* Leases the addresses of @proc and attaches it to a queue, as with
+ * open_tun() */
+int tun_mq_open(main_server_st *s, struct proc_st *proc);
+
+/* Detaches @proc from its queue. When @pid is set, the queue is not
+ * given to another session before that worker, which may still hold
+ * it, is reaped */
+void tun_mq_close(main_server_st *s, struct proc_st *proc, pid_t pid);
+
+/* The MTU of the session is set on its routes, as the device is shared */
+int tun_mq_set_mtu(main_server_st *s, struct proc_st *proc, unsigned mtu);
+
+/* Steers the traffic to the iroutes of @proc to its queue */
+int tun_mq_steer_iroutes(main_server_st *s, struct proc_st *proc);
+
+#else
+
+#define tun_mq_init(s)
+#define tun_mq_deinit(s)
+#define tun_mq_open(s, proc) (-1)
+#define tun_mq_close(s, proc, pid)
+#define tun_mq_set_mtu(s, proc, mtu) (-1)
+#define tun_mq_steer_iroutes(s, proc) (-1)
+
+#endif
+
+#endif
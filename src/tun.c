@@ -64,6 +64,8 @@
 
 #include <net/route.h>
 #include <linux/types.h>
+#include <linux/rtnetlink.h>
+#include <rtnl.h>
 
 struct in6_ifreq {
 	struct in6_addr ifr6_addr;
@@ -71,94 +73,6 @@ struct in6_ifreq {
 	unsigned int ifr6_ifindex;
 };
 
-static
-int os_set_ipv6_addr(main_server_st * s, struct proc_st *proc)
-{
-	int fd, e, ret;
-	struct in6_ifreq ifr6;
-	struct in6_rtmsg rt6;
-	struct ifreq ifr;
-	unsigned idx;
-
-	fd = socket(AF_INET6, SOCK_STREAM, 0);
-	if (fd == -1) {
-		e = errno;
-		mslog(s, NULL, LOG_ERR, "%s: Error socket(AF_INET6): %s\n",
-		      proc->tun_lease.name, strerror(e));
-		return -1;
-	}
-
-	memset(&ifr, 0, sizeof(ifr));
-	strlcpy(ifr.ifr_name, proc->tun_lease.name, IFNAMSIZ);
-
-	ret = ioctl(fd, SIOGIFINDEX, &ifr);
-	if (ret != 0) {
-		e = errno;
-		mslog(s, NULL, LOG_ERR, "%s: Error in SIOGIFINDEX: %s\n",
-		      proc->tun_lease.name, strerror(e));
-		ret = -1;
-		goto cleanup;
-	}
-
-	idx = ifr.ifr_ifindex;
-
-	memset(&ifr6, 0, sizeof(ifr6));
-	memcpy(&ifr6.ifr6_addr, SA_IN6_P(&proc->ipv6->lip),
-	       SA_IN_SIZE(proc->ipv6->lip_len));
-	ifr6.ifr6_ifindex = idx;
-	ifr6.ifr6_prefixlen = 128;
-
-	ret = ioctl(fd, SIOCSIFADDR, &ifr6);
-	if (ret != 0) {
-		e = errno;
-		mslog(s, NULL, LOG_ERR, "%s: Error setting IPv6: %s\n",
-		      proc->tun_lease.name, strerror(e));
-		ret = -1;
-		goto cleanup;
-	}
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_addr.sa_family = AF_INET6;
-	ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
-	strlcpy(ifr.ifr_name, proc->tun_lease.name, IFNAMSIZ);
-
-	ret = ioctl(fd, SIOCSIFFLAGS, &ifr);
-	if (ret != 0) {
-		e = errno;
-		mslog(s, NULL, LOG_ERR,
-		      "%s: Could not bring up IPv6 interface: %s\n",
-		      proc->tun_lease.name, strerror(e));
-		ret = -1;
-		goto cleanup;
-	}
-
-	/* route to our remote address */
-	memset(&rt6, 0, sizeof(rt6));
-	memcpy(&rt6.rtmsg_dst, SA_IN6_P(&proc->ipv6->rip),
-	       SA_IN_SIZE(proc->ipv6->rip_len));
-	rt6.rtmsg_ifindex = idx;
-	rt6.rtmsg_dst_len = proc->ipv6->prefix;
-	rt6.rtmsg_metric = 1;
-
-	/* the ioctl() parameters in linux for ipv6 are
-	 * well hidden. For that one we use SIOCADDRT as
-	 * in busybox. */
-	ret = ioctl(fd, SIOCADDRT, &rt6);
-	if (ret != 0) {
-		e = errno;
-		mslog(s, NULL, LOG_ERR, "%s: Error setting route to remote IPv6: %s\n",
-		      proc->tun_lease.name, strerror(e));
-		ret = -1;
-		goto cleanup;
-	}
-
-	ret = 0;
- cleanup:
-	close(fd);
-
-	return ret;
-}
-
 static void os_reset_ipv6_addr(struct proc_st *proc)
 {
 	int fd, ret;
@@ -323,6 +237,98 @@ static void os_reset_ipv6_addr(struct proc_st *proc)
 
 #endif
 
+#ifdef __linux__
+/* Brings the device up, and sets its addresses and the route to the IPv6
+ * network of the client, in a single netlink batch. As with the other
+ * systems, a failure to set IPv6 only drops the IPv6 lease. */
+static int set_network_info(main_server_st * s, struct proc_st *proc)
+{
+	struct ifinfomsg ifi;
+	rtnl_batch_st b;
+	int ifindex, link, v4 = -1, v6_addr = -1, v6_route = -1;
+	int ret, e;
+
+	ifindex = if_nametoindex(proc->tun_lease.name);
+	if (ifindex == 0) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "%s: Error in SIOGIFINDEX: %s\n",
+		      proc->tun_lease.name, strerror(e));
+		return -1;
+	}
+
+	rtnl_batch_init(&b, proc);
+
+	memset(&ifi, 0, sizeof(ifi));
+	ifi.ifi_family = AF_UNSPEC;
+	ifi.ifi_index = ifindex;
+	ifi.ifi_flags = IFF_UP;
+	ifi.ifi_change = IFF_UP;
+	link = rtnl_batch_msg(&b, RTM_NEWLINK, NLM_F_REQUEST | NLM_F_ACK, &ifi, sizeof(ifi));
+
+	if (proc->ipv4 && proc->ipv4->lip_len > 0 && proc->ipv4->rip_len > 0)
+		v4 = rtnl_batch_add_addr(&b, RTM_NEWADDR, &proc->ipv4->lip,
+					 &proc->ipv4->rip, 32, ifindex);
+
+	if (proc->ipv6 && proc->ipv6->lip_len > 0 && proc->ipv6->rip_len > 0) {
+		v6_addr = rtnl_batch_add_addr(&b, RTM_NEWADDR, &proc->ipv6->lip,
+					      NULL, 128, ifindex);
+		v6_route = rtnl_batch_add_route(&b, RTM_NEWROUTE, &proc->ipv6->rip,
+						proc->ipv6->prefix, ifindex);
+		rtnl_batch_attr_u32(&b, RTA_PRIORITY, 1);
+	}
+
+	ret = rtnl_batch_commit(&b);
+	if (ret < 0) {
+		e = errno;
+		if (ret == -1)
+			mslog(s, NULL, LOG_ERR, "%s: could not configure interface via netlink: %s\n",
+			      proc->tun_lease.name, strerror(e));
+		else
+			mslog(s, NULL, LOG_ERR, "%s: could not configure interface via netlink\n",
+			      proc->tun_lease.name);
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (b.errors[link] != 0) {
+		mslog(s, NULL, LOG_ERR, "%s: Could not bring up interface: %s\n",
+		      proc->tun_lease.name, strerror(b.errors[link]));
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (v4 >= 0 && b.errors[v4] != 0) {
+		mslog(s, NULL, LOG_ERR, "%s: Error setting IPv4: %s\n",
+		      proc->tun_lease.name, strerror(b.errors[v4]));
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (v6_addr >= 0 && (b.errors[v6_addr] != 0 || b.errors[v6_route] != 0)) {
+		if (b.errors[v6_addr] != 0)
+			mslog(s, NULL, LOG_ERR, "%s: Error setting IPv6: %s\n",
+			      proc->tun_lease.name, strerror(b.errors[v6_addr]));
+		else
+			mslog(s, NULL, LOG_ERR, "%s: Error setting route to remote IPv6: %s\n",
+			      proc->tun_lease.name, strerror(b.errors[v6_route]));
+		remove_ip_lease(s, proc->ipv6);
+		proc->ipv6 = NULL;
+	}
+
+	if (proc->ipv6 == 0 && proc->ipv4 == 0) {
+		mslog(s, NULL, LOG_ERR, "%s: Could not set any IP.\n",
+		      proc->tun_lease.name);
+		ret = -1;
+		goto cleanup;
+	}
+
+	ret = 0;
+
+ cleanup:
+	rtnl_batch_deinit(&b);
+	return ret;
+}
+#else
 static int set_network_info(main_server_st * s, struct proc_st *proc)
 {
 	int fd = -1, ret, e;
@@ -433,6 +439,7 @@ static int set_network_info(main_server_st * s, struct proc_st *proc)
 		close(fd);
 	return ret;
 }
+#endif
 
 #include <ccan/hash/hash.h>
 
@@ -632,21 +639,17 @@ static int os_open_tun(main_server_st * s, struct proc_st *proc)
 }
 #elif defined(__linux__)
 /* Linux version */
-static int os_open_tun(main_server_st * s, struct proc_st *proc)
+
+/* Attaches to the tun device @name, creating it if needed; a name with
+ * %d is completed by the kernel. The device lasts after its last
+ * descriptor is closed when @persist is set. On EBUSY, i.e., when the
+ * device is already attached, nothing is logged. */
+static int tun_attach(main_server_st * s, char name[IFNAMSIZ], unsigned persist)
 {
 	int tunfd, ret, e;
 	struct ifreq ifr;
 	unsigned int t;
 
-	ret = snprintf(proc->tun_lease.name, sizeof(proc->tun_lease.name), "%s%%d",
-		       GETCONFIG(s)->network.name);
-	if (ret != strlen(proc->tun_lease.name)) {
-		mslog(s, NULL, LOG_ERR, "Truncation error in tun name: %s; adjust 'device' option\n",
-		      proc->tun_lease.name);
-		return -1;
-	}
-
-	/* Obtain a free tun device */
 	tunfd = open("/dev/net/tun", O_RDWR);
 	if (tunfd < 0) {
 		int e = errno;
@@ -658,23 +661,22 @@ static int os_open_tun(main_server_st * s, struct proc_st *proc)
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
 
-	memcpy(ifr.ifr_name, proc->tun_lease.name, IFNAMSIZ);
+	memcpy(ifr.ifr_name, name, IFNAMSIZ);
 
 	if (ioctl(tunfd, TUNSETIFF, (void *)&ifr) < 0) {
 		e = errno;
-		mslog(s, NULL, LOG_ERR, "%s: TUNSETIFF: %s\n",
-		      proc->tun_lease.name, strerror(e));
+		if (e != EBUSY)
+			mslog(s, NULL, LOG_ERR, "%s: TUNSETIFF: %s\n",
+			      name, strerror(e));
 		goto fail;
 	}
-	memcpy(proc->tun_lease.name, ifr.ifr_name, IFNAMSIZ);
-	mslog(s, proc, LOG_DEBUG, "assigning tun device %s\n",
-	      proc->tun_lease.name);
+	memcpy(name, ifr.ifr_name, IFNAMSIZ);
 
-	/* we no longer use persistent tun */
-	if (ioctl(tunfd, TUNSETPERSIST, (void *)0) < 0) {
+	/* only the devices of the pool are persistent */
+	if (ioctl(tunfd, TUNSETPERSIST, (void *)(long)persist) < 0) {
 		e = errno;
 		mslog(s, NULL, LOG_ERR, "%s: TUNSETPERSIST: %s\n",
-		      proc->tun_lease.name, strerror(e));
+		      name, strerror(e));
 		goto fail;
 	}
 
@@ -684,7 +686,7 @@ static int os_open_tun(main_server_st * s, struct proc_st *proc)
 		if (ret < 0) {
 			e = errno;
 			mslog(s, NULL, LOG_INFO, "%s: TUNSETOWNER: %s\n",
-			      proc->tun_lease.name, strerror(e));
+			      name, strerror(e));
 			goto fail;
 		}
 	}
@@ -695,7 +697,7 @@ static int os_open_tun(main_server_st * s, struct proc_st *proc)
 		if (ret < 0) {
 			e = errno;
 			mslog(s, NULL, LOG_ERR, "%s: TUNSETGROUP: %s\n",
-			      proc->tun_lease.name, strerror(e));
+			      name, strerror(e));
 			/* kernels prior to 2.6.23 do not have this ioctl()
 			 * and return this error. In that case we ignore the
 			 * error. */
@@ -708,8 +710,278 @@ static int os_open_tun(main_server_st * s, struct proc_st *proc)
 	return tunfd;
  fail:
 	close(tunfd);
+	errno = e;
+	return -1;
+}
+
+/* The pool of pre-created devices (tun-pool-size). Its devices are named
+ * <device>p<n>, so that the ones left by a previous instance, e.g., after
+ * an upgrade, are adopted. They are persistent, and kept up and without
+ * addresses while in the pool; a connection only attaches to one and sets
+ * its addresses, rather than creating a new network device. The devices
+ * in use are scrubbed and put back on disconnection, and the missing
+ * ones are created one at a time when the main loop is idle.
+ */
+enum {
+	TUN_SLOT_EMPTY, /* not created, or in an unknown state */
+	TUN_SLOT_READY,
+	TUN_SLOT_USED
+};
+
+struct tun_pool_st {
+	main_server_st *s;
+	char prefix[IFNAMSIZ];
+	unsigned size;
+	uint8_t *slots;
+	unsigned next; /* where the search for a ready device starts */
+	ev_idle refill;
+};
+
+static int pool_name(struct tun_pool_st *p, unsigned i, char name[IFNAMSIZ])
+{
+	int ret;
+
+	memset(name, 0, IFNAMSIZ);
+	ret = snprintf(name, IFNAMSIZ, "%sp%u", p->prefix, i);
+	if (ret < 0 || ret >= IFNAMSIZ)
+		return -1;
+
+	return 0;
+}
+
+/* Returns the slot of a device of the pool or -1 */
+static int pool_slot(struct tun_pool_st *p, const char *name)
+{
+	size_t len = strlen(p->prefix);
+	unsigned long i;
+	char *end;
+
+	if (strncmp(name, p->prefix, len) != 0 || name[len] != 'p' ||
+	    name[len+1] < '0' || name[len+1] > '9')
+		return -1;
+
+	i = strtoul(name + len + 1, &end, 10);
+	if (*end != 0 || i >= p->size)
+		return -1;
+
+	return i;
+}
+
+/* Removes the addresses and routes the device got while in use, and
+ * leaves it up */
+static void tun_scrub(const char *name)
+{
+	struct ifreq ifr;
+	struct sockaddr_in *sin;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		return;
+
+	/* setting the unspecified address removes the IPv4 one */
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, name, IFNAMSIZ);
+	sin = (struct sockaddr_in *)&ifr.ifr_addr;
+	sin->sin_family = AF_INET;
+	(void)ioctl(fd, SIOCSIFADDR, &ifr);
+
+	/* taking it down flushes its routes and IPv6 addresses */
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, name, IFNAMSIZ);
+	(void)ioctl(fd, SIOCSIFFLAGS, &ifr);
+
+	ifr.ifr_flags = IFF_UP | IFF_RUNNING;
+	(void)ioctl(fd, SIOCSIFFLAGS, &ifr);
+
+	close(fd);
+}
+
+static void tun_pool_refill_cb(struct ev_loop *loop, ev_idle *w, int revents)
+{
+	struct tun_pool_st *p = w->data;
+	char name[IFNAMSIZ];
+	unsigned i;
+	int fd;
+
+	for (i = 0; i < p->size; i++) {
+		if (p->slots[i] == TUN_SLOT_EMPTY)
+			break;
+	}
+
+	if (i == p->size) {
+		ev_idle_stop(loop, w);
+		return;
+	}
+
+	if (pool_name(p, i, name) < 0) {
+		/* the names of the following devices don't fit either */
+		mslog(p->s, NULL, LOG_ERR, "Truncation error in tun pool device name: %sp%u; adjust 'device' option\n",
+		      p->prefix, i);
+		p->size = i;
+		return;
+	}
+
+	fd = tun_attach(p->s, name, 1);
+	if (fd < 0) {
+		if (errno == EBUSY) {
+			/* used by a session of the previous instance */
+			p->slots[i] = TUN_SLOT_USED;
+			return;
+		}
+
+		mslog(p->s, NULL, LOG_ERR, "could not create tun pool device %s; the pool is limited to %u devices\n",
+		      name, i);
+		p->size = i;
+		return;
+	}
+	close(fd);
+
+	tun_scrub(name);
+	p->slots[i] = TUN_SLOT_READY;
+}
+
+void tun_pool_init(main_server_st * s)
+{
+	struct tun_pool_st *p;
+
+	/* the sessions don't have their own devices */
+	if (GETPCONFIG(s)->tun_pool_size == 0 || s->tun_mq != NULL)
+		return;
+
+	p = talloc_zero(s, struct tun_pool_st);
+	if (p == NULL)
+		return;
+
+	p->slots = talloc_zero_array(p, uint8_t, GETPCONFIG(s)->tun_pool_size);
+	if (p->slots == NULL) {
+		talloc_free(p);
+		return;
+	}
+
+	p->s = s;
+	p->size = GETPCONFIG(s)->tun_pool_size;
+	strlcpy(p->prefix, GETCONFIG(s)->network.name, sizeof(p->prefix));
+
+	ev_idle_init(&p->refill, tun_pool_refill_cb);
+	p->refill.data = p;
+	ev_idle_start(main_loop, &p->refill);
+
+	s->tun_pool = p;
+}
+
+void tun_pool_deinit(main_server_st * s, unsigned destroy)
+{
+	struct tun_pool_st *p = s->tun_pool;
+	char name[IFNAMSIZ];
+	unsigned i;
+	int fd;
+
+	if (p == NULL)
+		return;
+
+	if (main_loop)
+		ev_idle_stop(main_loop, &p->refill);
+
+	/* the devices still in use are left to the next instance */
+	for (i = 0; destroy && i < p->size; i++) {
+		if (p->slots[i] != TUN_SLOT_READY || pool_name(p, i, name) < 0)
+			continue;
+
+		fd = tun_attach(s, name, 0);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	talloc_free(p);
+	s->tun_pool = NULL;
+}
+
+/* Attaches to a ready device of the pool; returns -1 if none is */
+static int tun_pool_get(main_server_st * s, struct proc_st *proc)
+{
+	struct tun_pool_st *p = s->tun_pool;
+	char name[IFNAMSIZ];
+	unsigned n, i;
+	int fd;
+
+	if (p == NULL)
+		return -1;
+
+	for (n = 0; n < p->size; n++) {
+		i = (p->next + n) % p->size;
+		if (p->slots[i] != TUN_SLOT_READY || pool_name(p, i, name) < 0)
+			continue;
+
+		fd = tun_attach(s, name, 1);
+		if (fd < 0) {
+			/* the previous worker did not exit yet */
+			if (errno == EBUSY)
+				continue;
+
+			p->slots[i] = TUN_SLOT_EMPTY;
+			ev_idle_start(main_loop, &p->refill);
+			continue;
+		}
+
+		p->slots[i] = TUN_SLOT_USED;
+		p->next = i + 1;
+		memcpy(proc->tun_lease.name, name, IFNAMSIZ);
+		return fd;
+	}
+
 	return -1;
 }
+
+/* Scrubs a device of the pool and makes it available again; returns
+ * zero if the device is not one of the pool */
+static unsigned tun_pool_put(main_server_st * s, struct proc_st *proc)
+{
+	struct tun_pool_st *p = s->tun_pool;
+	int i;
+
+	if (p == NULL)
+		return 0;
+
+	i = pool_slot(p, proc->tun_lease.name);
+	if (i < 0)
+		return 0;
+
+	tun_scrub(proc->tun_lease.name);
+	p->slots[i] = TUN_SLOT_READY;
+
+	return 1;
+}
+
+static int os_open_tun(main_server_st * s, struct proc_st *proc)
+{
+	int tunfd, ret;
+
+	tunfd = tun_pool_get(s, proc);
+	if (tunfd >= 0) {
+		mslog(s, proc, LOG_DEBUG, "assigning tun device %s from the pool\n",
+		      proc->tun_lease.name);
+		return tunfd;
+	}
+
+	ret = snprintf(proc->tun_lease.name, sizeof(proc->tun_lease.name), "%s%%d",
+		       GETCONFIG(s)->network.name);
+	if (ret != strlen(proc->tun_lease.name)) {
+		mslog(s, NULL, LOG_ERR, "Truncation error in tun name: %s; adjust 'device' option\n",
+		      proc->tun_lease.name);
+		return -1;
+	}
+
+	/* Obtain a free tun device */
+	tunfd = tun_attach(s, proc->tun_lease.name, 0);
+	if (tunfd < 0)
+		return -1;
+
+	mslog(s, proc, LOG_DEBUG, "assigning tun device %s\n",
+	      proc->tun_lease.name);
+
+	return tunfd;
+}
 #endif /* __linux__ */
 
 int open_tun(main_server_st * s, struct proc_st *proc)
@@ -751,6 +1023,16 @@ int open_tun(main_server_st * s, struct proc_st *proc)
 	return -1;
 }
 
+#ifndef __linux__
+void tun_pool_init(main_server_st * s)
+{
+}
+
+void tun_pool_deinit(main_server_st * s, unsigned destroy)
+{
+}
+#endif
+
 void close_tun(main_server_st * s, struct proc_st *proc)
 {
 
@@ -759,6 +1041,11 @@ void close_tun(main_server_st * s, struct proc_st *proc)
 		proc->tun_lease.fd = -1;
 	}
 
+#ifdef __linux__
+	if (proc->tun_lease.name[0] != 0 && tun_pool_put(s, proc))
+		return;
+#endif
+
 #ifdef SIOCIFDESTROY
 	int fd = -1;
 	int e, ret;
@@ -826,7 +1113,8 @@ static void reset_ipv4_addr(struct proc_st *proc)
 
 void reset_tun(struct proc_st* proc)
 {
-	if (proc->tun_lease.name[0] != 0) {
+	/* the local addresses of a shared device are not the session's */
+	if (proc->tun_lease.name[0] != 0 && proc->tun_lease.mq_slot == 0) {
 		reset_ipv4_addr(proc);
 		os_reset_ipv6_addr(proc);
 	}
@@ -31,6 +31,9 @@ struct tun_lease_st {
 
         /* this is used temporarily. */
 	int fd;
+
+	/* non-zero when on a queue of a shared device (see tun-mq.c) */
+	unsigned mq_slot;
 };
 
 ssize_t tun_write(int sockfd, const void *buf, size_t len);
@@ -155,6 +155,8 @@ extern int syslog_open;
 
 #define MAX_CIPHERSUITE_NAME 64
 #define SID_SIZE 32
+/* a cookie is the SID, or with 'stateless-cookies' the SID and the session state */
+#define MAX_COOKIE_SIZE 768
 
 
 struct vpn_st {
@@ -186,6 +188,16 @@ struct vpn_st {
 };
 
 #define MAX_AUTH_METHODS 4
+
+/* The time taken by the authentication modules to check the passwords,
+ * collected by sec-mod per module */
+#define MAX_AUTH_LATENCY_MODULES 8
+typedef struct auth_latency_st {
+	char module[32];
+	uint32_t count;
+	uint64_t total_usecs;
+	uint32_t max_usecs;
+} auth_latency_st;
 #define MAX_KRB_REALMS 16
 
 typedef struct auth_struct_st {
@@ -222,6 +234,8 @@ typedef struct kkdcp_st {
 	unsigned realms_size;
 } kkdcp_st;
 
+/* a pointer added here or to perm_cfg_st is to be serialized, or
+ * cleared, in config-blob.c */
 struct cfg_st {
 	unsigned int is_dyndns;
 	unsigned int listen_proxy_proto;
@@ -264,6 +278,7 @@ struct cfg_st {
 
 	unsigned int append_routes; /* whether to append global routes to per-user config */
 	unsigned restrict_user_to_routes; /* whether the firewall script will be run for the user */
+	unsigned firewall_nftables; /* apply the restrictions via nf_tables rather than ocserv-fw */
 	unsigned deny_roaming; /* whether a cookie is restricted to a single IP */
 	time_t cookie_timeout;	/* in seconds */
 	time_t session_timeout;	/* in seconds */
@@ -322,10 +337,12 @@ struct cfg_st {
 
 	char *route_add_cmd;
 	char *route_del_cmd;
+	unsigned route_netlink; /* set the iroutes via netlink rather than the commands */
 
 	char *connect_script;
 	char *host_update_script;
 	char *disconnect_script;
+	char *event_sink; /* the socket of a helper receiving the script events */
 
 	char *cgroup;
 	char *proxy_url;
@@ -377,6 +394,9 @@ struct perm_cfg_st {
 	char *chroot_dir;	/* where the xml files are served from */
 	char* occtl_socket_file;
 	char* socket_file_prefix;
+	char *ban_db_file; /* if set, the ban DB is persisted there */
+	char *lease_journal_file; /* if set, the addresses of users are recorded there */
+	unsigned lease_journal_expiry; /* how long the recorded addresses are kept */
 
 	uid_t uid;
 	gid_t gid;
@@ -409,6 +429,12 @@ struct perm_cfg_st {
 	unsigned int udp_port;
 
 	unsigned int sec_mod_scale;
+	unsigned int sec_mod_key_threads;
+	unsigned stateless_cookies; /* any sec-mod instance can resume a session */
+	unsigned tls_session_tickets;
+	unsigned tls_ticket_key_rotation; /* in seconds */
+	unsigned tun_pool_size; /* the number of pre-created tun devices */
+	unsigned tun_multi_queue; /* the sessions share multi-queue devices */
 
 	/* for testing ocserv only */
 	unsigned debug_no_secmod_stats;
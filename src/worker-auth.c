@@ -742,8 +742,7 @@ static int recv_cookie_auth_reply(worker_st * ws)
 	return ret;
 }
 
-/* returns the fd */
-int connect_to_secmod(worker_st * ws)
+static int connect_to_secmod_addr(worker_st * ws, struct sockaddr_un *addr, socklen_t addr_len)
 {
 	int sd, ret, e;
 
@@ -756,19 +755,38 @@ int connect_to_secmod(worker_st * ws)
 	}
 
 	ret =
-	    connect(sd, (struct sockaddr *)&ws->secmod_addr,
-		    ws->secmod_addr_len);
+	    connect(sd, (struct sockaddr *)addr, addr_len);
 	if (ret < 0) {
 		e = errno;
 		close(sd);
 		oclog(ws, LOG_ERR,
 		      "error connecting to sec-mod socket '%s': %s",
-		      ws->secmod_addr.sun_path, strerror(e));
+		      addr->sun_path, strerror(e));
 		return -1;
 	}
 	return sd;
 }
 
+/* returns the fd */
+int connect_to_secmod(worker_st * ws)
+{
+	return connect_to_secmod_addr(ws, &ws->secmod_addr, ws->secmod_addr_len);
+}
+
+/* Connects to the instance which holds the authentication state of our
+ * SID. With stateless cookies the instances are selected by load, and
+ * an authentication may continue in a connection to another worker. */
+int connect_to_secmod_auth(worker_st * ws)
+{
+	unsigned idx;
+
+	if (ws->secmod_addrs_size == 0 || ws->sid_set == 0)
+		return connect_to_secmod(ws);
+
+	idx = ws->sid[0] % ws->secmod_addrs_size;
+	return connect_to_secmod_addr(ws, &ws->secmod_addrs[idx], ws->secmod_addrs_len[idx]);
+}
+
 int recv_auth_reply(worker_st * ws, int sd, char **txt, unsigned *pcounter)
 {
 	int ret;
@@ -825,14 +843,26 @@ int recv_auth_reply(worker_st * ws, int sd, char **txt, unsigned *pcounter)
 		}
 
 		if (msg->has_sid == 0 ||
-		    msg->sid.len != sizeof(ws->cookie) ||
+		    msg->sid.len != SID_SIZE ||
 		    msg->dtls_session_id.len != sizeof(ws->session_id)) {
 
 			ret = ERR_AUTH_FAIL;
 			goto cleanup;
 		}
 
-		memcpy(ws->cookie, msg->sid.data, msg->sid.len);
+		/* a stateless cookie starts with the SID */
+		if (msg->has_cookie) {
+			if (msg->cookie.len <= SID_SIZE || msg->cookie.len > sizeof(ws->cookie) ||
+			    memcmp(msg->cookie.data, msg->sid.data, SID_SIZE) != 0) {
+				ret = ERR_AUTH_FAIL;
+				goto cleanup;
+			}
+			memcpy(ws->cookie, msg->cookie.data, msg->cookie.len);
+			ws->cookie_size = msg->cookie.len;
+		} else {
+			memcpy(ws->cookie, msg->sid.data, msg->sid.len);
+			ws->cookie_size = msg->sid.len;
+		}
 		ws->cookie_set = 1;
 
 		memcpy(ws->session_id, msg->dtls_session_id.data,
@@ -914,7 +944,7 @@ void cookie_authenticate_or_exit(worker_st *ws)
 
 	/* we have authenticated against sec-mod, we need to complete
 	 * our authentication by forwarding our cookie to main. */
-	ret = auth_cookie(ws, ws->cookie, sizeof(ws->cookie));
+	ret = auth_cookie(ws, ws->cookie, ws->cookie_size);
 	if (ret < 0) {
 		oclog(ws, LOG_WARNING, "failed cookie authentication attempt");
 		if (WSCONFIG(ws)->camouflage && ws->camouflage_check_passed == 0)
@@ -1021,7 +1051,7 @@ int post_common_handler(worker_st * ws, unsigned http_ver, const char *imsg)
 		success_msg_foot_size = strlen(success_msg_foot);
 	}
 
-	oc_base64_encode((char *)ws->cookie, sizeof(ws->cookie),
+	oc_base64_encode((char *)ws->cookie, ws->cookie_size,
 		      (char *)str_cookie, str_cookie_size);
 
 	/* reply */
@@ -1665,7 +1695,7 @@ int post_auth_handler(worker_st * ws, unsigned http_ver)
 				areq.sid.len = sizeof(ws->sid);
 			}
 
-			sd = connect_to_secmod(ws);
+			sd = connect_to_secmod_auth(ws);
 			if (sd == -1) {
 				reason = MSG_INTERNAL_ERROR;
 				oclog(ws, LOG_ERR,
@@ -647,7 +647,7 @@ void header_value_check(struct worker_st *ws, struct http_req_st *req)
 				/* we allow for BASE64_DECODE_LENGTH reporting few bytes more
 				 * than the expected */
 				nlen = BASE64_DECODE_LENGTH(tmplen);
-				if (nlen < sizeof(ws->cookie) || nlen > sizeof(ws->cookie)+8)
+				if (nlen < SID_SIZE || nlen > sizeof(ws->cookie)+8)
 					return;
 
 				/* we assume that - should be build time optimized */
@@ -657,13 +657,14 @@ void header_value_check(struct worker_st *ws, struct http_req_st *req)
 				ret =
 				    oc_base64_decode((uint8_t*)p, tmplen,
 						  ws->buffer, &nlen);
-				if (ret == 0 || nlen != sizeof(ws->cookie)) {
+				if (ret == 0 || nlen < SID_SIZE || nlen > sizeof(ws->cookie)) {
 					oclog(ws, LOG_INFO,
 					      "could not decode cookie: %.*s",
 					      tmplen, p);
 					ws->cookie_set = 0;
 				} else {
-					memcpy(ws->cookie, ws->buffer, sizeof(ws->cookie));
+					memcpy(ws->cookie, ws->buffer, nlen);
+					ws->cookie_size = nlen;
 					ws->auth_state = S_AUTH_COOKIE;
 					ws->cookie_set = 1;
 				}
@@ -248,7 +248,7 @@ int post_svc_handler(worker_st *ws, unsigned http_ver)
 	oclog(ws, LOG_HTTP_DEBUG, "user '%s' obtained cookie", ws->username);
 	ws->auth_state = S_AUTH_COOKIE;
 
-	oc_base64_encode((char *)ws->cookie, sizeof(ws->cookie),
+	oc_base64_encode((char *)ws->cookie, ws->cookie_size,
 			 cookie, sizeof(cookie));
 
 	/* reply */
@@ -619,14 +619,15 @@ static int hello_hook_func(gnutls_session_t session, unsigned int htype,
 
 {
 	ssize_t ret;
-	size_t pos;
+	size_t pos, end;
 	size_t hsize;
 	struct worker_st *ws = gnutls_session_get_ptr(session);
+	const uint8_t *ticket_key_name = NULL;
 
 	if (htype != GNUTLS_HANDSHAKE_CLIENT_HELLO || when != GNUTLS_HOOK_PRE)
 		goto finish;
 
-	/* find the server name extension */
+	/* find the server name and session ticket extensions */
 
 	pos = HANDSHAKE_SESSION_ID_POS;
 	if (msg->size <= pos)
@@ -658,6 +659,7 @@ static int hello_hook_func(gnutls_session_t session, unsigned int htype,
 
 		if (type == 0) { /* server name ext */
 			SKIP16(pos, msg->size);
+			end = pos + ((msg->data[pos-2] << 8) | msg->data[pos-1]);
 			SKIP16(pos, msg->size); /* we don't support anything but a single name */
 
 			SKIP8(pos, msg->size);
@@ -688,7 +690,22 @@ static int hello_hook_func(gnutls_session_t session, unsigned int htype,
 				      "client requested hostname %s does not match known vhost", (char*)ws->buffer);
 			}
 
-			goto finish;
+			pos = end;
+		} else if (type == 35 || type == 41) { /* session ticket, pre-shared key ext */
+			SKIP16(pos, msg->size);
+			end = pos + ((msg->data[pos-2] << 8) | msg->data[pos-1]);
+
+			if (type == 41) {
+				/* the first identity */
+				SKIP16(pos, msg->size);
+				SKIP16(pos, msg->size);
+			}
+
+			if (ticket_key_name == NULL && end <= msg->size &&
+			    pos + TLS_TICKET_KEY_NAME_SIZE <= end)
+				ticket_key_name = &msg->data[pos];
+
+			pos = end;
 		} else {
 			SKIP_V16(pos, msg->size);
 		}
@@ -699,6 +716,15 @@ static int hello_hook_func(gnutls_session_t session, unsigned int htype,
 	 * as they have not been previously set. */
 	SET_VHOST_CREDS;
 
+	/* a ticket issued before the last key rotation */
+	if (ticket_key_name != NULL && ws->prev_ticket_key.size > 0 &&
+	    tls_ticket_key_issued(&ws->prev_ticket_key,
+				  TLS_SESSION_EXPIRATION_TIME(WSCONFIG(ws)),
+				  ticket_key_name)) {
+		ret = gnutls_session_ticket_enable_server(session, &ws->prev_ticket_key);
+		GNUTLS_FATAL_ERR(ret);
+	}
+
 	return 0;
 }
 
@@ -879,6 +905,13 @@ void vpn_server(struct worker_st *ws)
 		set_resume_db_funcs(session);
 		gnutls_db_set_ptr(session, ws);
 
+		/* the key is shared by all the workers; with it a session can
+		 * be resumed without a round trip to sec-mod */
+		if (ws->ticket_key.size > 0) {
+			ret = gnutls_session_ticket_enable_server(session, &ws->ticket_key);
+			GNUTLS_FATAL_ERR(ret);
+		}
+
 		gnutls_handshake_set_timeout(session, GNUTLS_DEFAULT_HANDSHAKE_TIMEOUT);
 		gnutls_transport_set_pull_timeout_function(session, tls_pull_timeout);
 		do {
@@ -1980,7 +2013,10 @@ static int connect_handler(worker_st * ws)
 		strlcpy(ws->req.hostname, ws->user_config->hostname, sizeof(ws->req.hostname));
 	}
 
-	FUZZ(ws->user_config->interim_update_secs, 5, rnd);
+	/* spread the interim updates of sessions which connected at the
+	 * same time, e.g., after a restart, by up to 10% of the interval */
+	FUZZ(ws->user_config->interim_update_secs,
+	     (int)MAX(5, ws->user_config->interim_update_secs / 10), rnd);
 	FUZZ(WSCONFIG(ws)->rekey_time, 30, rnd);
 
 	/* Connected. Turn of the alarm */
@@ -48,6 +48,7 @@ extern struct snapshot_t *config_snapshot;
 int syslog_open = 0;
 sigset_t sig_default_set;
 static unsigned allow_broken_clients = 0;
+static int config_blob_fd = -1;
 
 static int set_ws_from_env(worker_st * ws);
 
@@ -146,10 +147,20 @@ int main(int argc, char **argv)
 	}
 	list_head_init(s->vconfig);
 
-	ret = cmd_parser(config_pool, argc, argv, s->vconfig, true);
+	/* the blob is not used when main and this binary differ, e.g.,
+	 * after a package update */
+	ret = -1;
+	if (config_blob_fd != -1) {
+		ret = load_cfg_blob(config_pool, config_blob_fd, s->vconfig);
+		close(config_blob_fd);
+	}
+
 	if (ret < 0) {
-		fprintf(stderr, "Error in arguments\n");
-		exit(EXIT_FAILURE);
+		ret = cmd_parser(config_pool, argc, argv, s->vconfig, true);
+		if (ret < 0) {
+			fprintf(stderr, "Error in arguments\n");
+			exit(EXIT_FAILURE);
+		}
 	}
 
 	snapshot_terminate(config_snapshot);
@@ -287,6 +298,25 @@ static int set_ws_from_env(worker_st * ws)
 	ws->secmod_addr_len = msg->secmod_addr.len;
 	memcpy(&ws->secmod_addr, msg->secmod_addr.data, msg->secmod_addr.len);
 
+	if (msg->n_secmod_addrs > 0) {
+		ws->secmod_addrs = talloc_zero_array(ws, struct sockaddr_un, msg->n_secmod_addrs);
+		ws->secmod_addrs_len = talloc_zero_array(ws, socklen_t, msg->n_secmod_addrs);
+		if (ws->secmod_addrs == NULL || ws->secmod_addrs_len == NULL) {
+			fprintf(stderr, "memory allocation error\n");
+			goto cleanup;
+		}
+
+		for (index = 0; index < msg->n_secmod_addrs; index++) {
+			if (msg->secmod_addrs[index].len > sizeof(ws->secmod_addrs[index])) {
+				fprintf(stderr, "msg->secmod_addrs[%u].len too large\n", (unsigned)index);
+				goto cleanup;
+			}
+			memcpy(&ws->secmod_addrs[index], msg->secmod_addrs[index].data, msg->secmod_addrs[index].len);
+			ws->secmod_addrs_len[index] = msg->secmod_addrs[index].len;
+		}
+		ws->secmod_addrs_size = msg->n_secmod_addrs;
+	}
+
 	ws->cmd_fd = msg->cmd_fd;
 	ws->conn_fd = msg->conn_fd;
 	ws->conn_type = (sock_type_t) msg->conn_type;
@@ -299,12 +329,34 @@ static int set_ws_from_env(worker_st * ws)
 	memcpy((void *)ws->sec_auth_init_hmac, msg->sec_auth_init_hmac.data,
 	       msg->sec_auth_init_hmac.len);
 
+	if (msg->has_tls_ticket_key && msg->tls_ticket_key.len > 0) {
+		ws->ticket_key.data = talloc_memdup(ws, msg->tls_ticket_key.data, msg->tls_ticket_key.len);
+		if (ws->ticket_key.data == NULL) {
+			fprintf(stderr, "memory allocation error\n");
+			goto cleanup;
+		}
+		ws->ticket_key.size = msg->tls_ticket_key.len;
+	}
+
+	if (msg->has_tls_previous_ticket_key && msg->tls_previous_ticket_key.len > 0) {
+		ws->prev_ticket_key.data = talloc_memdup(ws, msg->tls_previous_ticket_key.data,
+							 msg->tls_previous_ticket_key.len);
+		if (ws->prev_ticket_key.data == NULL) {
+			fprintf(stderr, "memory allocation error\n");
+			goto cleanup;
+		}
+		ws->prev_ticket_key.size = msg->tls_previous_ticket_key.len;
+	}
+
 	strlcpy(ws->remote_ip_str, msg->remote_ip_str,
 		sizeof(ws->remote_ip_str));
 	strlcpy(ws->orig_remote_ip_str, msg->remote_ip_str,
 		sizeof(ws->orig_remote_ip_str));
 	strlcpy(ws->our_ip_str, msg->our_ip_str, sizeof(ws->our_ip_str));
 
+	if (msg->has_config_blob_fd)
+		config_blob_fd = msg->config_blob_fd;
+
 	for (index = 0; index < msg->n_snapshot_entries; index++) {
 		int fd = msg->snapshot_entries[index]->file_descriptor;
 		const char *file_name = msg->snapshot_entries[index]->file_name;
@@ -330,11 +382,17 @@ static int set_ws_from_env(worker_st * ws)
 		goto cleanup;
 	gssapi_auth_group_list_size = (unsigned)msg->n_gssapi_auth_group_list;
 
+	/* the variable is readable in /proc while the worker runs */
+	if (ws->ticket_key.size > 0)
+		safe_memset((char *)string_buffer, 0, string_size);
+
 	ret = 1;
 
  cleanup:
-	if (msg_buffer)
+	if (msg_buffer) {
+		safe_memset(msg_buffer, 0, msg_size);
 		talloc_free(msg_buffer);
+	}
 
 	if (msg)
 		worker_startup_msg__free_unpacked(msg, &pa);
@@ -217,6 +217,10 @@ typedef struct worker_st {
 
 	struct sockaddr_un secmod_addr;	/* sec-mod unix address */
 	socklen_t secmod_addr_len;
+	/* with stateless cookies, the addresses of all the instances */
+	struct sockaddr_un *secmod_addrs;
+	socklen_t *secmod_addrs_len;
+	unsigned secmod_addrs_size;
 
 	struct sockaddr_storage our_addr;	/* our address */
 	socklen_t our_addr_len;
@@ -230,6 +234,11 @@ typedef struct worker_st {
 	char orig_remote_ip_str[MAX_IP_STR];
 	const uint8_t sec_auth_init_hmac[HMAC_DIGEST_SIZE];
 
+	/* the master key of the TLS session tickets, if enabled */
+	gnutls_datum_t ticket_key;
+	/* the key before the last rotation, whose tickets are still accepted */
+	gnutls_datum_t prev_ticket_key;
+
 	int proto; /* AF_INET or AF_INET6 */
 
 	time_t session_start_time;
@@ -295,7 +304,8 @@ typedef struct worker_st {
 	unsigned cert_groups_size;
 
 	char hostname[MAX_HOSTNAME_SIZE];
-	uint8_t cookie[SID_SIZE];
+	uint8_t cookie[MAX_COOKIE_SIZE];
+	unsigned cookie_size;
 
 	unsigned int cookie_set;
 
@@ -412,6 +422,7 @@ int ws_switch_auth_to_next(struct worker_st *ws);
 void ws_add_score_to_ip(worker_st *ws, unsigned points, unsigned final, unsigned discon_reason);
 
 int connect_to_secmod(worker_st * ws);
+int connect_to_secmod_auth(worker_st * ws);
 inline static
 int send_msg_to_secmod(worker_st * ws, int sd, uint8_t cmd,
 		       const void *msg, pack_size_func get_size, pack_func pack)
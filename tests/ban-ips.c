@@ -24,11 +24,14 @@
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 #include "../src/main.h"
 #include "../src/main-ban.h"
 #include "../src/ip-util.h"
+#include "../src/mmap-table.c"
 #include "../src/main-ban.c"
+#include "../src/common/keyed-hash.c"
 
 /* Test the IP banning functionality */
 static
@@ -172,6 +175,102 @@ int main(void)
 	}
 
 	main_ban_db_deinit(s);
+
+	/* check that the DB persists in a file */
+	{
+		char file[] = "./ban-ips.XXXXXX";
+		ban_entry_st *e;
+		unsigned iter, i, found;
+		int fd;
+
+		fd = mkstemp(file);
+		if (fd == -1) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+		close(fd);
+		remove(file);
+
+		vhost->perm_config.ban_db_file = file;
+		main_ban_db_init(s);
+
+		add_str_ip_to_ban_list(s, "192.168.4.1", 40);
+		add_str_ip_to_ban_list(s, "fdc0:c81f:22ab:23a2:4479:f107:1855:bf50", 40);
+		/* force the table to be rebuilt */
+		for (i = 0; i < 4*BAN_DB_MIN_SLOTS; i++) {
+			char ip[32];
+			snprintf(ip, sizeof(ip), "10.0.%u.%u", i/256, i%256);
+			add_str_ip_to_ban_list(s, ip, 1);
+		}
+
+		main_ban_db_deinit(s);
+
+		main_ban_db_init(s);
+		if (s->ban_db->hdr->clean != 0 || s->ban_db->hdr->used != 4*BAN_DB_MIN_SLOTS+2) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+
+		if (check_if_banned_str(s, "192.168.4.1") == 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+
+		if (check_if_banned_str(s, "fdc0:c81f:22ab:23a2:4479:f107:1855:bf51") == 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+
+		/* import merges with the existing entries */
+		e = main_ban_db_first(s, &iter);
+		found = 0;
+		while (e != NULL) {
+			if (e->ip.size == 4 && memcmp(e->ip.ip, "\xc0\xa8\x04\x01", 4) == 0) {
+				if (main_ban_db_import(s, e->ip.ip, e->ip.size, 1, e->expires + 100, e->last_reset) < 0) {
+					fprintf(stderr, "error in %d\n", __LINE__);
+					exit(1);
+				}
+				if (e->score < 40) {
+					fprintf(stderr, "error in %d\n", __LINE__);
+					exit(1);
+				}
+				found++;
+			}
+			e = main_ban_db_next(s, &iter);
+		}
+
+		if (found != 1) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+
+		main_ban_db_deinit(s);
+
+		/* a file which cannot be loaded is kept aside */
+		{
+			char bad[sizeof(file) + 4];
+			struct stat st;
+
+			snprintf(bad, sizeof(bad), "%s.bad", file);
+			fd = open(file, O_WRONLY);
+			if (fd == -1 || write(fd, "XXXX", 4) != 4) {
+				fprintf(stderr, "error in %d\n", __LINE__);
+				exit(1);
+			}
+			close(fd);
+
+			main_ban_db_init(s);
+			if (s->ban_db->file == NULL || s->ban_db->hdr->used != 0 ||
+			    stat(bad, &st) != 0 || (size_t)st.st_size < sizeof(mmap_table_hdr_st)) {
+				fprintf(stderr, "error in %d\n", __LINE__);
+				exit(1);
+			}
+			main_ban_db_deinit(s);
+			remove(bad);
+		}
+		remove(file);
+	}
+
 	talloc_free(s);
 	return 0;
 }
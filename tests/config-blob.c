@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/config-blob.c"
+#include "test-common.h"
+
+/* Round trip of config_blob_create() and config_blob_load() for a default
+ * and a named virtual host: each field set by add_vhost() must be read back
+ * after the original pool is freed, while the state which is private to a
+ * process (auth modules, usage counts, firewall ports) must come back
+ * reset. The memory file must be sealed, and a truncated blob or one with
+ * a tampered header refused. With 'bench', times loads of 16 to 16384
+ * routes.
+ */
+#ifdef HAVE_MEMFD_CREATE
+
+#define CHECK_STR(a, b) \
+	if ((a) == NULL || strcmp((a), (b)) != 0) { \
+		fprintf(stderr, "%d: '%s' is not '%s'\n", __LINE__, (a) ? (a) : "(null)", (b)); \
+		exit(1); \
+	}
+
+static char **str_array(void *pool, const char *prefix, unsigned n)
+{
+	char **arr = talloc_array(pool, char *, n);
+	unsigned i;
+
+	for (i = 0; i < n; i++)
+		arr[i] = talloc_asprintf(arr, "%s%u", prefix, i);
+	return arr;
+}
+
+static vhost_cfg_st *add_vhost(void *pool, struct list_head *head, const char *name,
+			       unsigned routes)
+{
+	vhost_cfg_st *vhost = talloc_zero(pool, vhost_cfg_st);
+	struct cfg_st *config;
+
+	vhost->pool = vhost;
+	if (name)
+		vhost->name = talloc_strdup(vhost, name);
+	list_head_init(&vhost->perm_config.attic);
+
+	config = vhost->perm_config.config = talloc_zero(vhost, struct cfg_st);
+	config->usage_count = talloc_zero(config, int);
+	*config->usage_count = 3;
+
+	vhost->perm_config.auth[0].name = talloc_strdup(vhost, "plain");
+	vhost->perm_config.auth[0].additional = talloc_strdup(vhost, "/etc/ocpasswd");
+	vhost->perm_config.auth[0].type = 5;
+	vhost->perm_config.auth[0].enabled = 1;
+	vhost->perm_config.auth[0].amod = (void *)vhost;
+	vhost->perm_config.auth_methods = 1;
+	vhost->perm_config.cert = str_array(vhost, "/etc/cert", 2);
+	vhost->perm_config.cert_size = 2;
+	vhost->perm_config.udp_port = 443;
+	vhost->auth_size = 1;
+	vhost->auth = str_array(vhost, "plain", 1);
+
+	config->banner = talloc_strdup(config, "Welcome");
+	config->max_clients = 16;
+	config->network.ipv4_network = talloc_strdup(config, "192.168.1.0");
+	config->network.routes = str_array(config, "10.0.0.0/", routes);
+	config->network.routes_size = routes;
+	config->network.dns = str_array(config, "192.168.1.", 2);
+	config->network.dns_size = 2;
+	config->group_list = str_array(config, "group", 3);
+	config->group_list_size = 3;
+	config->fw_ports = (void *)config;
+	config->n_fw_ports = 1;
+
+	config->kkdcp = talloc_zero_array(config, kkdcp_st, 1);
+	config->kkdcp_size = 1;
+	config->kkdcp[0].url = talloc_strdup(config, "/KdcProxy");
+	config->kkdcp[0].realms[0].realm = talloc_strdup(config, "KERBEROS.TEST");
+	config->kkdcp[0].realms[0].ai_family = AF_INET;
+	config->kkdcp[0].realms_size = 1;
+
+	list_add(head, &vhost->list);
+	return vhost;
+}
+
+static void check_vhost(vhost_cfg_st *vhost, const char *name)
+{
+	struct cfg_st *config = vhost->perm_config.config;
+
+	if (name) {
+		CHECK_STR(vhost->name, name);
+	} else {
+		CHECK(vhost->name == NULL);
+	}
+
+	CHECK(vhost->pool == vhost);
+	CHECK(list_empty(&vhost->perm_config.attic));
+	CHECK(vhost->auth == NULL && vhost->auth_size == 0);
+	CHECK_STR(vhost->perm_config.auth[0].name, "plain");
+	CHECK_STR(vhost->perm_config.auth[0].additional, "/etc/ocpasswd");
+	CHECK(vhost->perm_config.auth[0].type == 5 && vhost->perm_config.auth[0].enabled);
+	CHECK(vhost->perm_config.auth[0].amod == NULL);
+	CHECK(vhost->perm_config.auth[1].name == NULL);
+	CHECK(vhost->perm_config.cert_size == 2);
+	CHECK_STR(vhost->perm_config.cert[1], "/etc/cert1");
+	CHECK(vhost->perm_config.key == NULL);
+	CHECK(vhost->perm_config.udp_port == 443);
+
+	CHECK(config->usage_count != NULL && *config->usage_count == 0);
+	CHECK_STR(config->banner, "Welcome");
+	CHECK(config->pre_login_banner == NULL);
+	CHECK(config->max_clients == 16);
+	CHECK_STR(config->network.ipv4_network, "192.168.1.0");
+	CHECK(config->network.routes_size == 8);
+	CHECK_STR(config->network.routes[7], "10.0.0.0/7");
+	CHECK_STR(config->network.dns[1], "192.168.1.1");
+	CHECK(config->network.nbns == NULL);
+	CHECK(config->group_list_size == 3);
+	CHECK_STR(config->group_list[2], "group2");
+	CHECK(config->friendly_group_list == NULL);
+	CHECK(config->fw_ports == NULL && config->n_fw_ports == 0);
+	CHECK(config->kkdcp_size == 1);
+	CHECK_STR(config->kkdcp[0].url, "/KdcProxy");
+	CHECK_STR(config->kkdcp[0].realms[0].realm, "KERBEROS.TEST");
+	CHECK(config->kkdcp[0].realms[0].ai_family == AF_INET);
+	CHECK(config->kkdcp[0].realms[1].realm == NULL);
+
+	/* the worker changes some options */
+	config->idle_timeout = 10;
+}
+
+/* Copies the first @size bytes of the blob in @fd, with the header
+ * altered by @mod, to a new memory file */
+static int copy_blob(int fd, size_t size, void (*mod)(config_blob_hdr_st *))
+{
+	uint8_t *buf = malloc(size);
+	int out;
+
+	CHECK(buf != NULL && pread(fd, buf, size, 0) == (ssize_t)size);
+	if (mod)
+		mod((config_blob_hdr_st *)buf);
+
+	out = memfd_create("test", 0);
+	CHECK(out != -1 && write(out, buf, size) == (ssize_t)size);
+	free(buf);
+	return out;
+}
+
+static void mod_cfg_size(config_blob_hdr_st *hdr)
+{
+	hdr->cfg_size++;
+}
+
+static void mod_relocs(config_blob_hdr_st *hdr)
+{
+	hdr->relocs = (uint64_t)-1 / 8;
+}
+
+static void check_invalid(int fd, size_t size, void (*mod)(config_blob_hdr_st *))
+{
+	struct list_head head;
+	void *pool = talloc_new(NULL);
+	int bad;
+
+	list_head_init(&head);
+	bad = copy_blob(fd, size, mod);
+	if (config_blob_load(pool, bad, &head) >= 0 || !list_empty(&head)) {
+		fprintf(stderr, "an invalid blob was loaded\n");
+		exit(1);
+	}
+	close(bad);
+	talloc_free(pool);
+}
+
+static void check_blob(void)
+{
+	struct list_head head, loaded;
+	void *pool = talloc_new(NULL), *pool2 = talloc_new(NULL);
+	vhost_cfg_st *vhost;
+	struct stat st;
+	unsigned n = 0;
+	int fd;
+
+	list_head_init(&head);
+	list_head_init(&loaded);
+	add_vhost(pool, &head, NULL, 8);
+	add_vhost(pool, &head, "vhost1", 8);
+
+	fd = config_blob_create(&head);
+	CHECK(fd != -1);
+	talloc_free(pool);
+
+	/* the blob is sealed */
+	CHECK(write(fd, "x", 1) == -1);
+
+	CHECK(config_blob_load(pool2, fd, &loaded) == 0);
+	list_for_each(&loaded, vhost, list) {
+		check_vhost(vhost, n == 0 ? "vhost1" : NULL);
+		n++;
+	}
+	CHECK(n == 2);
+	/* the default host is the last */
+	CHECK(default_vhost(&loaded)->name == NULL);
+	talloc_free(pool2);
+
+	CHECK(fstat(fd, &st) == 0);
+	check_invalid(fd, st.st_size - 1, NULL);
+	check_invalid(fd, sizeof(config_blob_hdr_st) - 1, NULL);
+	check_invalid(fd, st.st_size, mod_cfg_size);
+	check_invalid(fd, st.st_size, mod_relocs);
+
+	close(fd);
+}
+
+static void bench(unsigned routes)
+{
+	struct list_head head, loaded;
+	void *pool = talloc_new(NULL), *pool2;
+	struct timespec start, end;
+	unsigned i, loads = 200;
+	double total;
+	int fd;
+
+	list_head_init(&head);
+	add_vhost(pool, &head, NULL, routes);
+	fd = config_blob_create(&head);
+	CHECK(fd != -1);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < loads; i++) {
+		pool2 = talloc_new(NULL);
+		list_head_init(&loaded);
+		CHECK(config_blob_load(pool2, fd, &loaded) == 0);
+		talloc_free(pool2);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	total = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+
+	printf("%6u routes: usecs per load %.1f\n", routes, total / loads);
+
+	close(fd);
+	talloc_free(pool);
+}
+
+int main(int argc, char **argv)
+{
+	check_blob();
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		bench(16);
+		bench(1024);
+		bench(16384);
+	}
+
+	return 0;
+}
+#else
+int main(void)
+{
+	exit(77);
+}
+#endif
@@ -35,6 +35,7 @@ static unsigned verbose = 0;
 #define force_write write
 
 #include "../src/tlslib.c"
+#include "../src/common/keyed-hash.c"
 
 int get_cert_names(worker_st * ws, const gnutls_datum_t * raw)
 {
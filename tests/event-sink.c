@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <talloc.h>
+
+#include "../src/str.c"
+#include "../src/main-event-sink.c"
+#include "test-common.h"
+
+/* Plays the helper of event-sink on a unix socket, and checks how the
+ * main process matches its replies to the pending connect events: when
+ * they come out of order, with a non-zero status, or with a line split
+ * across reads, and that the events still waiting fail when the helper
+ * closes the socket. A new event within the same second is then refused
+ * rather than queued, as documented, and the next one reconnects.
+ */
+
+struct ev_loop *main_loop = NULL;
+
+/* the status given to each session, in the order of the calls */
+static struct proc_st *done_procs[16];
+static int done_status[16];
+static unsigned n_done;
+
+void ev_io_start(struct ev_loop *loop, ev_io *w)
+{
+}
+
+void ev_io_stop(struct ev_loop *loop, ev_io *w)
+{
+}
+
+int set_cloexec_flag(int fd, bool value)
+{
+	return 0;
+}
+
+void set_non_block(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+void user_connect_event_done(main_server_st *s, struct proc_st *proc, int status)
+{
+	CHECK(n_done < 16);
+	done_procs[n_done] = proc;
+	done_status[n_done] = status;
+	n_done++;
+}
+
+static int try_event(main_server_st *s, struct proc_st *proc, const char *user)
+{
+	str_st vars;
+	int ret;
+
+	str_init(&vars, s);
+	CHECK(event_sink_append_var(&vars, "USERNAME", user) >= 0);
+	ret = event_sink_send(s, proc, &vars);
+	str_clear(&vars);
+
+	/* the loop writes the events once the socket is writable */
+	if (ret == 0)
+		sink_write_cb(main_loop, &s->event_sink->write_io, EV_WRITE);
+	return ret;
+}
+
+static void send_event(main_server_st *s, struct proc_st *proc, const char *user)
+{
+	CHECK(try_event(s, proc, user) == 0);
+}
+
+/* Reads what the main process wrote, and compares it with @expected */
+static void helper_recv(int fd, const char *expected)
+{
+	char buf[512];
+	size_t len = strlen(expected), n = 0;
+	ssize_t ret;
+
+	while (n < len) {
+		ret = read(fd, buf + n, len - n);
+		CHECK(ret > 0);
+		n += ret;
+	}
+	buf[n] = 0;
+	if (strcmp(buf, expected) != 0) {
+		fprintf(stderr, "received '%s', expected '%s'\n", buf, expected);
+		exit(1);
+	}
+}
+
+/* Writes @reply, and lets the main process read it */
+static void helper_reply(main_server_st *s, int fd, const char *reply)
+{
+	CHECK(write(fd, reply, strlen(reply)) == (ssize_t)strlen(reply));
+	sink_read_cb(main_loop, &s->event_sink->read_io, EV_READ);
+}
+
+static void check_done(unsigned n, struct proc_st *proc, int status)
+{
+	CHECK(n_done > n && done_procs[n] == proc && done_status[n] == status);
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/event-sink-XXXXXX";
+	struct sockaddr_un sa;
+	main_server_st *s;
+	struct proc_st *p[6];
+	int lfd, fd;
+	unsigned i;
+
+	CHECK(mkdtemp(dir) != NULL);
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s/sink", dir);
+
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	CHECK(lfd != -1);
+	CHECK(bind(lfd, (struct sockaddr *)&sa, SUN_LEN(&sa)) == 0);
+	CHECK(listen(lfd, 4) == 0);
+
+	s = new_server();
+	GETCONFIG(s)->event_sink = sa.sun_path;
+
+	for (i = 0; i < 6; i++)
+		p[i] = talloc_zero(s, struct proc_st);
+
+	/* the events are framed and escaped */
+	send_event(s, p[0], "a\nb\\c");
+	fd = accept(lfd, NULL, NULL);
+	CHECK(fd != -1);
+	helper_recv(fd, "EVENT 1\nUSERNAME=a\\nb\\\\c\n\n");
+
+	send_event(s, p[1], "u2");
+	send_event(s, p[2], "u3");
+	helper_recv(fd, "EVENT 2\nUSERNAME=u2\n\nEVENT 3\nUSERNAME=u3\n\n");
+
+	/* out of order replies */
+	helper_reply(s, fd, "3 0\n1 0\n");
+	CHECK(n_done == 2);
+	check_done(0, p[2], 0);
+	check_done(1, p[0], 0);
+
+	/* a connection which is refused */
+	helper_reply(s, fd, "2 5\n");
+	CHECK(n_done == 3);
+	check_done(2, p[1], 5);
+
+	/* a reply split across reads, followed by that of an event
+	 * which has no session */
+	send_event(s, p[3], "u4");
+	send_event(s, NULL, "u4");
+	helper_recv(fd, "EVENT 4\nUSERNAME=u4\n\nEVENT 5\nUSERNAME=u4\n\n");
+	helper_reply(s, fd, "4");
+	CHECK(n_done == 3);
+	helper_reply(s, fd, " 0\n5 ");
+	CHECK(n_done == 4);
+	check_done(3, p[3], 0);
+	helper_reply(s, fd, "0\n");
+	CHECK(n_done == 4);
+
+	/* a cancelled event is not completed */
+	send_event(s, p[4], "u5");
+	send_event(s, p[5], "u6");
+	CHECK(event_sink_cancel(s, p[4]) == 1);
+	CHECK(event_sink_cancel(s, p[4]) == 0);
+	helper_recv(fd, "EVENT 6\nUSERNAME=u5\n\nEVENT 7\nUSERNAME=u6\n\n");
+	helper_reply(s, fd, "6 0\n");
+	CHECK(n_done == 4);
+
+	/* the helper goes away with p[5] and then p[3] waiting */
+	send_event(s, p[3], "u4");
+	helper_recv(fd, "EVENT 8\nUSERNAME=u4\n\n");
+	close(fd);
+	sink_read_cb(main_loop, &s->event_sink->read_io, EV_READ);
+	CHECK(n_done == 6);
+	check_done(4, p[5], -1);
+	check_done(5, p[3], -1);
+	CHECK(s->event_sink->fd == -1);
+
+	/* the events are not queued until the socket is re-opened */
+	CHECK(try_event(s, NULL, "u1") < 0);
+
+	s->event_sink->last_open = 0;
+	send_event(s, p[0], "u1");
+	fd = accept(lfd, NULL, NULL);
+	CHECK(fd != -1);
+	helper_recv(fd, "EVENT 9\nUSERNAME=u1\n\n");
+	helper_reply(s, fd, "9 0\n");
+	CHECK(n_done == 7);
+	check_done(6, p[0], 0);
+
+	event_sink_deinit(s);
+	close(fd);
+	close(lfd);
+	unlink(sa.sun_path);
+	rmdir(dir);
+	talloc_free(s);
+	return 0;
+}
@@ -197,7 +197,10 @@ void generate_token(const char *output_folder, const char *token_name,
 	json_decref(claims);
 }
 
-void generate_config_files(const char *output_folder, cjose_jwk_t * key,
+/* The documents are referred to by file URIs, or under base_uri if given,
+ * e.g., to serve the output folder from a local HTTP server */
+void generate_config_files(const char *output_folder, const char *base_uri,
+			   cjose_jwk_t * key,
 			   const char *expected_audience,
 			   const char *expected_issuer,
 			   const char *user_name_claim)
@@ -226,16 +229,28 @@ void generate_config_files(const char *output_folder, cjose_jwk_t * key,
 	if (retval < 0 || retval > sizeof(openid_configuration_file)) {
 		exit(1);
 	}
-	retval =
-	    snprintf(openid_configuration_uri, sizeof(openid_configuration_uri),
-		     "file://localhost%s", openid_configuration_file);
+	if (base_uri) {
+		retval =
+		    snprintf(openid_configuration_uri, sizeof(openid_configuration_uri),
+			     "%s/openid-configuration.json", base_uri);
+	} else {
+		retval =
+		    snprintf(openid_configuration_uri, sizeof(openid_configuration_uri),
+			     "file://localhost%s", openid_configuration_file);
+	}
 	if (retval < 0 || retval > sizeof(openid_configuration_file)) {
 		exit(1);
 	}
 
-	retval =
-	    snprintf(keys_uri, sizeof(keys_uri), "file://localhost%s",
-		     keys_file);
+	if (base_uri) {
+		retval =
+		    snprintf(keys_uri, sizeof(keys_uri), "%s/keys.json",
+			     base_uri);
+	} else {
+		retval =
+		    snprintf(keys_uri, sizeof(keys_uri), "file://localhost%s",
+			     keys_file);
+	}
 	if (retval < 0 || retval > sizeof(openid_configuration_file)) {
 		exit(1);
 	}
@@ -265,6 +280,7 @@ int main(int argc, char **argv)
 	static const char user_name[] = "SomeUser";
 	static const char typ[] = "JWT";
 	static const char alg[] = "ES256";
+	const char *base_uri = (argc > 1) ? argv[1] : NULL;
 	time_t now = time(NULL);
 
 	snprintf(kid, sizeof(kid), "key_%ld", now);
@@ -277,8 +293,8 @@ int main(int argc, char **argv)
 
 	cjose_jwk_t *key = create_key(kid);
 
-	generate_config_files(working_directory, key, audience, issuer,
-			      user_name_claim);
+	generate_config_files(working_directory, base_uri, key, audience,
+			      issuer, user_name_claim);
 
 	generate_token(working_directory, "success_good", key, typ, alg, kid,
 		       audience, issuer, user_name, now - 60, now - 60,
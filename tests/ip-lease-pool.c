@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <talloc.h>
+#include <arpa/inet.h>
+
+#include "../src/main.h"
+#include "../src/icmp-ping.h"
+#include "../src/common/keyed-hash.c"
+#include "../src/ip-util.c"
+#include "../src/ip-lease.c"
+#include "../src/mmap-table.c"
+#include "../src/lease-journal.c"
+#include "test-common.h"
+
+/* Checks that IP leases can be allocated until the pool is exhausted,
+ * and that with ping-leases the first candidate nobody replies for is
+ * leased, and that the lease journal gives users their previous address
+ * after a restart. When called with 'bench', prints the cost of allocations while
+ * the pool is 99% in use.
+ */
+
+struct ping_batch_st {
+	ping_batch_func done;
+	void *priv;
+	struct sockaddr_storage addr[PING_MAX_BATCH];
+	unsigned n;
+	unsigned in_use; /* bitmask of the probes that replied */
+};
+
+static struct ping_batch_st *started_batch;
+static int resume_result = 1;
+
+static int batch_destructor(struct ping_batch_st *b)
+{
+	if (started_batch == b)
+		started_batch = NULL;
+	return 0;
+}
+
+struct ping_batch_st *ping_batch_new(main_server_st *s, void *pool,
+				     ping_batch_func done, void *priv)
+{
+	struct ping_batch_st *b = talloc_zero(pool, struct ping_batch_st);
+	if (b == NULL)
+		return NULL;
+	b->done = done;
+	b->priv = priv;
+	talloc_set_destructor(b, batch_destructor);
+	return b;
+}
+
+int ping_batch_add(struct ping_batch_st *b, const struct sockaddr_storage *addr,
+		   socklen_t addr_len)
+{
+	if (b->n >= PING_MAX_BATCH)
+		return -1;
+	memcpy(&b->addr[b->n], addr, addr_len);
+	return b->n++;
+}
+
+void ping_batch_start(struct ping_batch_st *b)
+{
+	started_batch = b;
+}
+
+unsigned ping_batch_in_use(struct ping_batch_st *b, unsigned idx)
+{
+	return (b->in_use >> idx) & 1;
+}
+
+void resume_accept_user(main_server_st *s, struct proc_st *proc, int result)
+{
+	resume_result = result;
+}
+
+void reset_tun(struct proc_st* proc)
+{
+}
+
+/* 10.1.0.0/16 minus the network, broadcast and local addresses */
+#define POOL_SIZE (65536-3)
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int get_lease(main_server_st *s, struct proc_st *proc, struct ip_lease_st **lease)
+{
+	int ret;
+
+	gnutls_rnd(GNUTLS_RND_NONCE, proc->ipv4_seed, sizeof(proc->ipv4_seed));
+
+	ret = get_ip_leases(s, proc);
+	if (ret < 0)
+		return ret;
+
+	/* keep the lease after the proc is reused */
+	*lease = talloc_steal(s, proc->ipv4);
+	proc->ipv4 = NULL;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	main_server_st *s = new_server();
+	struct proc_st *proc;
+	struct ip_lease_st **leases;
+	struct sockaddr_storage freed;
+	struct ip_lease_st *lease;
+	lease_journal_entry_st *e;
+	char journal[] = "/tmp/ocserv-lease-journal.XXXXXX";
+	int fd;
+	unsigned i, bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+	unsigned busy = POOL_SIZE * 99 / 100;
+	double start;
+
+	GETCONFIG(s)->network.ipv4 = "10.1.0.0";
+	GETCONFIG(s)->network.ipv4_netmask = "255.255.0.0";
+
+	proc = talloc_zero(s, struct proc_st);
+	if (proc == NULL)
+		exit(1);
+	proc->vhost = GETVHOST(s);
+	proc->config = talloc_zero(proc, GroupCfgSt);
+
+	leases = talloc_array(s, struct ip_lease_st *, POOL_SIZE);
+	if (leases == NULL)
+		exit(1);
+
+	ip_lease_init(&s->ip_leases);
+
+	for (i = 0; i < busy; i++) {
+		if (get_lease(s, proc, &leases[i]) < 0) {
+			fprintf(stderr, "error in %d: lease %u\n", __LINE__, i);
+			exit(1);
+		}
+	}
+
+	/* the last 1% must succeed too */
+	start = now_ns();
+	for (; i < POOL_SIZE; i++) {
+		if (get_lease(s, proc, &leases[i]) < 0) {
+			fprintf(stderr, "error in %d: lease %u\n", __LINE__, i);
+			exit(1);
+		}
+	}
+
+	if (bench)
+		printf("allocation at 99%%-100%% utilization: %.1f ns/lease\n",
+		       (now_ns() - start) / (POOL_SIZE - busy));
+
+	if (s->ip_leases.ht.elems != POOL_SIZE) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* the pool is exhausted */
+	gnutls_rnd(GNUTLS_RND_NONCE, proc->ipv4_seed, sizeof(proc->ipv4_seed));
+	if (get_ip_leases(s, proc) != ERR_NO_IP) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* a released address is found */
+	memcpy(&freed, &leases[1000]->rip, sizeof(freed));
+	talloc_free(leases[1000]);
+
+	if (get_lease(s, proc, &leases[1000]) < 0 ||
+	    ip_cmp(&freed, &leases[1000]->rip) != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* steady state at 99% */
+	for (i = 0; i < POOL_SIZE - busy; i++)
+		talloc_free(leases[i * 97]);
+
+	start = now_ns();
+	for (i = 0; i < POOL_SIZE - busy; i++) {
+		if (get_lease(s, proc, &leases[i * 97]) < 0) {
+			fprintf(stderr, "error in %d: lease %u\n", __LINE__, i);
+			exit(1);
+		}
+	}
+
+	if (bench)
+		printf("allocation at 99%% utilization: %.1f ns/lease\n",
+		       (now_ns() - start) / (POOL_SIZE - busy));
+
+	/* with ping-leases the sticky address replies, so the next
+	 * candidate of the same round is leased */
+	GETCONFIG(s)->ping_leases = 1;
+	memset(proc->ipv4_seed, 0x5a, sizeof(proc->ipv4_seed));
+	talloc_free(leases[0]);
+	talloc_free(leases[1]);
+	talloc_free(leases[2]);
+	talloc_free(leases[3]);
+	talloc_free(leases[4]);
+
+	if (get_ip_leases(s, proc) != ERR_WAIT_FOR_PING || proc->ipv4 != NULL ||
+	    started_batch == NULL || started_batch->n < 2) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* the candidates are reserved while probed */
+	if (ip_lease_exists(s, &started_batch->addr[0], sizeof(struct sockaddr_in)) == 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	memcpy(&freed, &started_batch->addr[1], sizeof(freed));
+	started_batch->in_use = 1;
+	started_batch->done(s, started_batch, started_batch->priv);
+
+	if (resume_result != 0 || started_batch != NULL || proc->ipv4 == NULL ||
+	    ip_cmp(&freed, &proc->ipv4->rip) != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* continuing the connection keeps the checked lease */
+	if (get_ip_leases(s, proc) != 0 || ip_cmp(&freed, &proc->ipv4->rip) != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* the rejected candidates were released */
+	if (s->ip_leases.ht.elems != POOL_SIZE - 5 + 1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* the journal survives a restart */
+	GETCONFIG(s)->ping_leases = 0;
+	fd = mkstemp(journal);
+	if (fd == -1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	close(fd);
+	GETPCONFIG(s)->lease_journal_file = journal;
+	GETPCONFIG(s)->lease_journal_expiry = 3600;
+	strcpy(proc->username, "journal-user");
+
+	lease_journal_init(s);
+	if (s->lease_journal == NULL || get_lease(s, proc, &lease) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	memcpy(&freed, &lease->rip, sizeof(freed));
+	talloc_free(lease);
+	lease_journal_deinit(s);
+
+	lease_journal_init(s);
+	if (s->lease_journal == NULL || s->lease_journal->hdr->used != 1 ||
+	    get_lease(s, proc, &lease) < 0 || ip_cmp(&freed, &lease->rip) != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	talloc_free(lease);
+
+	/* expired entries are not used and are removed */
+	i = 0;
+	while ((e = mmap_table_next(s->lease_journal, &i)) != NULL)
+		e->expires = 0;
+	lease_journal_cleanup(s);
+	if (s->lease_journal->hdr->used != 0 ||
+	    lease_journal_get(s, proc->username, AF_INET, (uint8_t *)&freed) == 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	lease_journal_deinit(s);
+	remove(journal);
+
+	ip_lease_deinit(&s->ip_leases);
+	talloc_free(s);
+	return 0;
+}
@@ -23,6 +23,27 @@
 #include "../src/ip-util.h"
 #include "../src/ip-util.c"
 
+static void check_route_parse(unsigned line, const char *route, const char *addr, int prefix)
+{
+	struct sockaddr_storage ss;
+	char str[MAX_IP_STR];
+	unsigned p;
+
+	if (ip_route_parse(route, &ss, &p) < 0) {
+		if (prefix < 0)
+			return;
+		fprintf(stderr, "error in %u: %s not parsed\n", line, route);
+		exit(1);
+	}
+
+	if (prefix < 0 || ss.ss_family != AF_INET || p != (unsigned)prefix ||
+	    inet_ntop(AF_INET, SA_IN_P(&ss), str, sizeof(str)) == NULL ||
+	    strcmp(str, addr) != 0) {
+		fprintf(stderr, "error in %u: %s parsed as %u\n", line, route, p);
+		exit(1);
+	}
+}
+
 int main(void)
 {
 	char *p;
@@ -119,5 +140,16 @@ int main(void)
 	}
 	talloc_free(p);
 
+	/* Check ip_route_parse */
+	check_route_parse(__LINE__, "192.168.5.0/255.255.255.0", "192.168.5.0", 24);
+	check_route_parse(__LINE__, "10.0.0.0/255.0.0.0", "10.0.0.0", 8);
+	check_route_parse(__LINE__, "10.1.0.0/16", "10.1.0.0", 16);
+	check_route_parse(__LINE__, "0.0.0.0/0.0.0.0", "0.0.0.0", 0);
+	check_route_parse(__LINE__, "10.1.2.3", "10.1.2.3", 32);
+	check_route_parse(__LINE__, "10.1.0.0/255.0.255.0", NULL, -1);
+	check_route_parse(__LINE__, "10.1.0.0/33", NULL, -1);
+	check_route_parse(__LINE__, "10.1.0.0/", NULL, -1);
+	check_route_parse(__LINE__, "10.1.0/16", NULL, -1);
+
 	return 0;
 }
@@ -36,6 +36,27 @@ static char* my_ipv6_prefix_to_mask(char str[MAX_IP_STR], unsigned prefix)
 	return str;
 }
 
+static void check_route_parse(unsigned line, const char *route, const char *addr, int prefix)
+{
+	struct sockaddr_storage ss;
+	char str[MAX_IP_STR];
+	unsigned p;
+
+	if (ip_route_parse(route, &ss, &p) < 0) {
+		if (prefix < 0)
+			return;
+		fprintf(stderr, "error in %u: %s not parsed\n", line, route);
+		exit(1);
+	}
+
+	if (prefix < 0 || ss.ss_family != AF_INET6 || p != (unsigned)prefix ||
+	    inet_ntop(AF_INET6, SA_IN6_P(&ss), str, sizeof(str)) == NULL ||
+	    strcmp(str, addr) != 0) {
+		fprintf(stderr, "error in %u: %s parsed as %u\n", line, route, p);
+		exit(1);
+	}
+}
+
 int main(void)
 {
 	char *p;
@@ -107,5 +128,12 @@ int main(void)
 		exit(1);
 	}
 
+	check_route_parse(__LINE__, "fd91:6d87:7341:db6a::/64", "fd91:6d87:7341:db6a::", 64);
+	check_route_parse(__LINE__, "2001:db8::1", "2001:db8::1", 128);
+	check_route_parse(__LINE__, "::/0", "::", 0);
+	check_route_parse(__LINE__, "2001:db8::/129", NULL, -1);
+	check_route_parse(__LINE__, "2001:db8::/ffff::", NULL, -1);
+	check_route_parse(__LINE__, "2001:db8:::/64", NULL, -1);
+
 	return 0;
 }
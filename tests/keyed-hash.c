@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ccan/hash/hash.h>
+#include <ccan/htable/htable.h>
+
+#include "../src/common/keyed-hash.c"
+
+/* Checks the SipHash implementation against the reference vectors, and
+ * when called with 'bench' compares the cost of table lookups using
+ * hash_any() and keyed_hash().
+ */
+
+/* SipHash-2-4 with key 00..0f over messages 00..(len-1) */
+static const uint64_t siphash24_vectors[] = {
+	0x726fdb47dd0e0e31ULL, 0x74f839c593dc67fdULL, 0x0d6c8009d9a94f5aULL,
+	0x85676696d7fb7e2dULL, 0xcf2794e0277187b7ULL, 0x18765564cd99a68dULL,
+	0xcbc9466e58fee3ceULL, 0xab0200f58b01d137ULL, 0x93f5f5799a932462ULL,
+	0x9e0082df0ba9e4b0ULL, 0x7a5dbbc594ddb9f3ULL, 0xf4b32f46226bada7ULL,
+	0x751e8fbc860ee5fbULL, 0x14ea5627c0843d90ULL, 0xf723ca908e7af2eeULL,
+	0xa129ca6149be45e5ULL, 0x3f2acc7f57c29bdbULL
+};
+
+#define BENCH_ENTRIES (64*1024)
+#define BENCH_LOOKUPS (4*1024*1024)
+
+struct entry_st {
+	uint8_t ip[16];
+	unsigned size;
+};
+
+static size_t rehash_any(const void *_e, void *unused)
+{
+	const struct entry_st *e = _e;
+	return hash_any(e->ip, e->size, 0);
+}
+
+static size_t rehash_keyed(const void *_e, void *unused)
+{
+	const struct entry_st *e = _e;
+	return keyed_hash(e->ip, e->size);
+}
+
+static bool entry_cmp(const void *_c1, void *_c2)
+{
+	const struct entry_st *c1 = _c1, *c2 = _c2;
+	return c1->size == c2->size && memcmp(c1->ip, c2->ip, c1->size) == 0;
+}
+
+static double timespec_diff(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void bench(const char *name, size_t (*h)(const void *, void *), unsigned size)
+{
+	struct htable ht;
+	struct entry_st *entries;
+	struct timespec start, end;
+	unsigned i, found = 0;
+
+	entries = calloc(BENCH_ENTRIES, sizeof(*entries));
+	if (entries == NULL)
+		exit(1);
+
+	htable_init(&ht, h, NULL);
+	for (i = 0; i < BENCH_ENTRIES; i++) {
+		entries[i].size = size;
+		memcpy(entries[i].ip, &i, sizeof(i));
+		entries[i].ip[size-1] = 0x17;
+		htable_add(&ht, h(&entries[i], NULL), &entries[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_LOOKUPS; i++) {
+		struct entry_st *e = &entries[(i * 40503) % BENCH_ENTRIES];
+		if (htable_get(&ht, h(e, NULL), entry_cmp, e) != NULL)
+			found++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (found != BENCH_LOOKUPS) {
+		fprintf(stderr, "%s: lookups failed\n", name);
+		exit(1);
+	}
+
+	printf("%-10s %2u bytes: %6.1f ns/lookup\n", name, size,
+	       timespec_diff(&start, &end) / BENCH_LOOKUPS);
+
+	htable_clear(&ht);
+	free(entries);
+}
+
+int main(int argc, char **argv)
+{
+	keyed_hash_key_st key, key2;
+	uint8_t msg[64];
+	unsigned i;
+	uint64_t h;
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = i;
+
+	key.k0 = load_le64(msg);
+	key.k1 = load_le64(msg + 8);
+
+	for (i = 0; i < sizeof(siphash24_vectors)/sizeof(siphash24_vectors[0]); i++) {
+		h = siphash_cd(&key, msg, i, 2, 4);
+		if (h != siphash24_vectors[i]) {
+			fprintf(stderr, "error in %d: vector %u: %016llx\n", __LINE__,
+				i, (unsigned long long)h);
+			exit(1);
+		}
+	}
+
+	/* the output must depend on the key */
+	if (!keyed_hash_init_key(&key2)) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	if (siphash13(&key, msg, 16) == siphash13(&key2, msg, 16) ||
+	    siphash13(&key, msg, 16) != siphash13(&key, msg, 16)) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	if (keyed_hash(msg, 4) != keyed_hash(msg, 4) ||
+	    keyed_hash(msg, 4) == keyed_hash(msg, 5)) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		bench("hash_any", rehash_any, 4);
+		bench("keyed_hash", rehash_keyed, 4);
+		bench("hash_any", rehash_any, 16);
+		bench("keyed_hash", rehash_keyed, 16);
+	}
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <talloc.h>
+
+#ifdef __linux__
+# include <sched.h>
+# include "../src/ip-util.c"
+# include "../src/rtnl.c"
+# include "../src/nft-fw.c"
+#endif
+
+/* Drives nft_fw_add() and nft_fw_remove() against the kernel of a private
+ * network namespace: routes restricted with allowed and with denied ports,
+ * re-adding a device whose chains were left over, an invalid route which
+ * must fail with ERR_PARSING before anything is sent, and removing a device
+ * which has no chains. Only the replies of nf_tables are checked, not how
+ * packets are filtered. Exits with 77 without nf_tables.
+ */
+#ifdef __linux__
+static void check(int ret, const char *op, const char *device)
+{
+	if (ret != 0) {
+		fprintf(stderr, "%s %s failed: %d: %s\n", op, device, ret, strerror(errno));
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	char *dns[] = { "192.168.1.1", "fd00::53" };
+	char *routes[] = { "10.0.0.0/8", "192.168.5.0/255.255.255.0", "fd00:1::/48" };
+	char *no_routes[] = { "10.1.0.0/16", "fd00:1:1::/64" };
+	char *bad_routes[] = { "10.0.0.0/33" };
+	FwPortSt ports[3] = {
+		{ .proto = PROTO_TCP, .port = 443 },
+		{ .proto = PROTO_UDP, .port = 1194 },
+		{ .proto = PROTO_ICMP }
+	};
+	FwPortSt *port_list[3] = { &ports[0], &ports[1], &ports[2] };
+	GroupCfgSt config;
+	void *pool;
+	int fd, ret;
+
+	if (unshare(CLONE_NEWNET) == -1) {
+		fprintf(stderr, "cannot create a network namespace; skipping\n");
+		exit(77);
+	}
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_NETFILTER);
+	if (fd == -1) {
+		fprintf(stderr, "nfnetlink is not available; skipping\n");
+		exit(77);
+	}
+	close(fd);
+
+	pool = talloc_new(NULL);
+
+	/* restricted to routes, allowed ports */
+	memset(&config, 0, sizeof(config));
+	config.dns = dns;
+	config.n_dns = 2;
+	config.routes = routes;
+	config.n_routes = 3;
+	config.no_routes = no_routes;
+	config.n_no_routes = 2;
+	config.restrict_user_to_routes = 1;
+	config.fw_ports = port_list;
+	config.n_fw_ports = 3;
+
+	ret = nft_fw_add(pool, "vpns0", &config);
+	if (ret == -1 && (errno == EOPNOTSUPP || errno == EPROTONOSUPPORT)) {
+		fprintf(stderr, "nf_tables is not available; skipping\n");
+		exit(77);
+	}
+	check(ret, "add", "vpns0");
+
+	/* leftover chains of the device are replaced */
+	check(nft_fw_add(pool, "vpns0", &config), "re-add", "vpns0");
+
+	/* denied ports, default route */
+	ports[0].negate = ports[1].negate = ports[2].negate = 1;
+	config.restrict_user_to_routes = 0;
+	config.n_routes = 0;
+	check(nft_fw_add(pool, "vpns1", &config), "add", "vpns1");
+
+	/* only the default route */
+	config.restrict_user_to_routes = 1;
+	config.n_fw_ports = 0;
+	config.n_dns = 0;
+	check(nft_fw_add(pool, "vpns2", &config), "add", "vpns2");
+
+	/* an invalid route fails before anything is applied */
+	config.routes = bad_routes;
+	config.n_routes = 1;
+	if (nft_fw_add(pool, "vpns3", &config) != ERR_PARSING) {
+		fprintf(stderr, "invalid route was accepted\n");
+		exit(1);
+	}
+
+	check(nft_fw_remove(pool, "vpns0"), "remove", "vpns0");
+	check(nft_fw_remove(pool, "vpns1"), "remove", "vpns1");
+
+	/* removal succeeds when there is nothing to remove */
+	check(nft_fw_remove(pool, "vpns1"), "re-remove", "vpns1");
+	check(nft_fw_remove(pool, "vpns3"), "remove", "vpns3");
+
+	/* the chains of the other devices are still in use */
+	config.routes = routes;
+	config.n_routes = 3;
+	check(nft_fw_add(pool, "vpns2", &config), "re-add", "vpns2");
+	check(nft_fw_remove(pool, "vpns2"), "remove", "vpns2");
+
+	talloc_free(pool);
+	return 0;
+}
+#else
+int main(void)
+{
+	exit(77);
+}
+#endif
@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../src/auth/plain-index.c"
+
+/* Checks the index of the plain password file against the rules of the
+ * scan in read_auth_pass(), and when called with 'bench' compares the
+ * lookups per second of the index and of the scan for several numbers
+ * of users.
+ */
+
+#define BENCH_LOOKUPS (64*1024)
+
+static char passwd_file[] = "plain-passwd-index.XXXXXX";
+
+static void write_file(const char *name, const char *data)
+{
+	FILE *fp;
+
+	fp = fopen(name, "w");
+	if (fp == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	fputs(data, fp);
+	fclose(fp);
+}
+
+static void check_entry(plain_passwd_st *db, const char *user,
+			const char *egroups, const char *epass)
+{
+	const char *groups, *cpass;
+	int ret;
+
+	ret = plain_passwd_lookup(db, user, &groups, &cpass);
+	if (egroups == NULL) {
+		if (ret == 0) {
+			fprintf(stderr, "%s: found unexpected entry\n", user);
+			exit(1);
+		}
+		return;
+	}
+
+	if (ret != 0) {
+		fprintf(stderr, "%s: entry not found\n", user);
+		exit(1);
+	}
+
+	if (strcmp(groups, egroups) != 0 || strcmp(cpass, epass) != 0) {
+		fprintf(stderr, "%s: got '%s' '%s', expected '%s' '%s'\n",
+			user, groups, cpass, egroups, epass);
+		exit(1);
+	}
+}
+
+/* the lookup of read_auth_pass() */
+static int scan_file(const char *file, const char *username, char *cpass, size_t cpass_size)
+{
+	FILE *fp;
+	char line[512];
+	ssize_t ll;
+	char *p, *sp;
+	int ret = -1;
+
+	fp = fopen(file, "r");
+	if (fp == NULL)
+		return -1;
+
+	line[sizeof(line)-1] = 0;
+	while ((p=fgets(line, sizeof(line)-1, fp)) != NULL) {
+		ll = strlen(p);
+
+		if (ll <= 4)
+			continue;
+
+		if (line[ll - 1] == '\n') {
+			ll--;
+			line[ll] = 0;
+		}
+		if (line[ll - 1] == '\r') {
+			ll--;
+			line[ll] = 0;
+		}
+
+		sp = line;
+		p = strsep(&sp, ":");
+
+		if (p != NULL && strcmp(username, p) == 0) {
+			p = strsep(&sp, ":");
+			if (p != NULL) {
+				p = strsep(&sp, ":");
+				if (p != NULL) {
+					snprintf(cpass, cpass_size, "%s", p);
+					ret = 0;
+					break;
+				}
+			}
+		}
+	}
+
+	fclose(fp);
+	return ret;
+}
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void bench(unsigned users)
+{
+	plain_passwd_st *db;
+	const char *groups, *cpass;
+	char user[32], pass[128];
+	struct timespec start;
+	unsigned i, lookups;
+	double t, scan_rate, index_rate;
+	FILE *fp;
+
+	fp = fopen(passwd_file, "w");
+	if (fp == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	for (i = 0; i < users; i++)
+		fprintf(fp, "user%u:group%u:$5$saltsaltsaltsalt$%043u\n", i, i % 16, i);
+	fclose(fp);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	db = plain_passwd_load(NULL, passwd_file);
+	t = elapsed(&start);
+	if (db == NULL || db->entries != users) {
+		fprintf(stderr, "could not load %u users\n", users);
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_LOOKUPS; i++) {
+		snprintf(user, sizeof(user), "user%u", (i * 7919) % users);
+		if (plain_passwd_changed(db, passwd_file) ||
+		    plain_passwd_lookup(db, user, &groups, &cpass) != 0) {
+			fprintf(stderr, "lookup of %s failed\n", user);
+			exit(1);
+		}
+	}
+	index_rate = BENCH_LOOKUPS / elapsed(&start);
+
+	/* the scan is slow; it is given a time limit */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (lookups = 0; lookups < BENCH_LOOKUPS && (lookups < 8 || elapsed(&start) < 1); lookups++) {
+		snprintf(user, sizeof(user), "user%u", (lookups * 7919) % users);
+		if (scan_file(passwd_file, user, pass, sizeof(pass)) != 0) {
+			fprintf(stderr, "scan of %s failed\n", user);
+			exit(1);
+		}
+	}
+	scan_rate = lookups / elapsed(&start);
+
+	printf("%7u users: load %.1f ms; lookups/sec: index %.0f, scan %.0f\n",
+	       users, t * 1000, index_rate, scan_rate);
+
+	talloc_free(db);
+}
+
+int main(int argc, char **argv)
+{
+	plain_passwd_st *db, *db2;
+	int fd;
+
+	fd = mkstemp(passwd_file);
+	if (fd == -1) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+
+	write_file(passwd_file,
+		   "# a comment\n"
+		   "\n"
+		   "tst\n"
+		   "user1:group1,group2:$5$hash1\n"
+		   "user2:*:$5$hash2\r\n"
+		   "user3:group3\n"
+		   "user3:group4:$5$hash3:extra\n"
+		   "user1:group5:$5$other\n"
+		   "user4::\n"
+		   "user5:group5:$5$last");
+
+	db = plain_passwd_load(NULL, passwd_file);
+	if (db == NULL) {
+		fprintf(stderr, "could not load the file\n");
+		return 1;
+	}
+
+	check_entry(db, "user1", "group1,group2", "$5$hash1");
+	check_entry(db, "user2", "*", "$5$hash2");
+	/* incomplete entries are skipped */
+	check_entry(db, "user3", "group4", "$5$hash3");
+	check_entry(db, "user4", "", "");
+	check_entry(db, "user5", "group5", "$5$last");
+	check_entry(db, "user", NULL, NULL);
+	check_entry(db, "tst", NULL, NULL);
+	check_entry(db, "# a comment", NULL, NULL);
+	if (db->entries != 5) {
+		fprintf(stderr, "unexpected number of entries: %u\n", db->entries);
+		return 1;
+	}
+
+	if (plain_passwd_changed(db, passwd_file)) {
+		fprintf(stderr, "file detected as changed\n");
+		return 1;
+	}
+
+	/* a replaced file is detected */
+	write_file("plain-passwd-index.tmp", "user6:group6:$5$hash6\n");
+	if (rename("plain-passwd-index.tmp", passwd_file) != 0) {
+		perror("rename");
+		return 1;
+	}
+	if (!plain_passwd_changed(db, passwd_file)) {
+		fprintf(stderr, "replaced file not detected\n");
+		return 1;
+	}
+
+	db2 = plain_passwd_load(NULL, passwd_file);
+	if (db2 == NULL) {
+		fprintf(stderr, "could not reload the file\n");
+		return 1;
+	}
+	check_entry(db2, "user6", "group6", "$5$hash6");
+	check_entry(db2, "user1", NULL, NULL);
+	talloc_free(db);
+	talloc_free(db2);
+
+	if (plain_passwd_load(NULL, "/nonexistent/passwd") != NULL) {
+		fprintf(stderr, "loaded a missing file\n");
+		return 1;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		bench(1000);
+		bench(10000);
+		bench(100000);
+	}
+
+	unlink(passwd_file);
+	return 0;
+}
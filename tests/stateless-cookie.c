@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/stateless-cookie.c"
+
+/* Checks that a sealed cookie opens only with its key and unmodified,
+ * and the revocations of the shared set.
+ */
+
+static void make_sid(uint8_t sid[SID_SIZE], unsigned n)
+{
+	memset(sid, 0, SID_SIZE);
+	sid[0] = n % 4;
+	memcpy(sid + 8, &n, sizeof(n));
+	sid[20] = 0xaa;
+}
+
+static void check_cookies(void)
+{
+	uint8_t key[STATELESS_COOKIE_KEY_SIZE], key2[STATELESS_COOKIE_KEY_SIZE];
+	uint8_t sid[SID_SIZE];
+	uint8_t cookie[MAX_COOKIE_SIZE], cookie2[MAX_COOKIE_SIZE];
+	uint8_t state[256], out[256];
+	int size, ret;
+	unsigned i;
+
+	memset(key, 0x11, sizeof(key));
+	memset(key2, 0x22, sizeof(key2));
+	for (i = 0; i < sizeof(state); i++)
+		state[i] = i;
+	make_sid(sid, 1);
+
+	size = stateless_cookie_seal(key, sid, state, sizeof(state), cookie, sizeof(cookie));
+	if (size != sizeof(state) + STATELESS_COOKIE_OVERHEAD) {
+		fprintf(stderr, "could not seal the cookie: %d\n", size);
+		exit(1);
+	}
+	if (memcmp(cookie, sid, SID_SIZE) != 0) {
+		fprintf(stderr, "the cookie does not start with the SID\n");
+		exit(1);
+	}
+
+	ret = stateless_cookie_open(key, cookie, size, out, sizeof(out));
+	if (ret != sizeof(state) || memcmp(out, state, sizeof(state)) != 0) {
+		fprintf(stderr, "could not open the cookie: %d\n", ret);
+		exit(1);
+	}
+
+	/* every byte is authenticated */
+	for (i = 0; i < (unsigned)size; i++) {
+		memcpy(cookie2, cookie, size);
+		cookie2[i] ^= 0x01;
+		if (stateless_cookie_open(key, cookie2, size, out, sizeof(out)) != -1) {
+			fprintf(stderr, "opened a cookie modified at %u\n", i);
+			exit(1);
+		}
+	}
+
+	if (stateless_cookie_open(key2, cookie, size, out, sizeof(out)) != -1) {
+		fprintf(stderr, "opened a cookie with another key\n");
+		exit(1);
+	}
+
+	if (stateless_cookie_open(key, cookie, size - 1, out, sizeof(out)) != -1 ||
+	    stateless_cookie_open(key, cookie, SID_SIZE, out, sizeof(out)) != -1 ||
+	    stateless_cookie_open(key, cookie, size, out, sizeof(out) - 1) != -1) {
+		fprintf(stderr, "opened a truncated cookie\n");
+		exit(1);
+	}
+
+	/* the nonce differs */
+	size = stateless_cookie_seal(key, sid, state, sizeof(state), cookie2, sizeof(cookie2));
+	if (size < 0 || memcmp(cookie, cookie2, size) == 0) {
+		fprintf(stderr, "the same cookie was sealed twice\n");
+		exit(1);
+	}
+
+	if (stateless_cookie_seal(key, sid, state, sizeof(state), cookie,
+				  sizeof(state) + STATELESS_COOKIE_OVERHEAD - 1) != -1) {
+		fprintf(stderr, "sealed a cookie larger than the buffer\n");
+		exit(1);
+	}
+}
+
+static void check_revocations(void)
+{
+	cookie_revocations_st *r;
+	uint8_t sid[SID_SIZE];
+	time_t now = 1000;
+	unsigned i;
+	int fd;
+
+	r = cookie_revocations_new(10, &fd);
+	if (r == NULL || r->slots != COOKIE_REVOCATIONS_MIN_SLOTS) {
+		fprintf(stderr, "could not create the set\n");
+		exit(1);
+	}
+
+	make_sid(sid, 1);
+	if (cookie_revocations_check(r, sid, now)) {
+		fprintf(stderr, "found an unrevoked session\n");
+		exit(1);
+	}
+
+	cookie_revocations_add(r, sid, now + 100, now);
+	if (!cookie_revocations_check(r, sid, now)) {
+		fprintf(stderr, "revoked session not found\n");
+		exit(1);
+	}
+
+	/* another instance byte is the same session */
+	sid[0] = 3;
+	if (!cookie_revocations_check(r, sid, now + 99)) {
+		fprintf(stderr, "revoked session not found\n");
+		exit(1);
+	}
+	if (cookie_revocations_check(r, sid, now + 100)) {
+		fprintf(stderr, "found a revocation after the cookie expired\n");
+		exit(1);
+	}
+
+	/* an expired cookie is not recorded */
+	make_sid(sid, 2);
+	cookie_revocations_add(r, sid, now, now);
+	if (cookie_revocations_check(r, sid, now - 1)) {
+		fprintf(stderr, "recorded an expired cookie\n");
+		exit(1);
+	}
+
+	/* fill the probes of a slot; the next revocation moves the horizon */
+	for (i = 0; i < COOKIE_REVOCATIONS_PROBES; i++) {
+		make_sid(sid, 16 + i * r->slots);
+		cookie_revocations_add(r, sid, now + 100, now);
+	}
+	if (cookie_revocations_horizon(r) != 0) {
+		fprintf(stderr, "the horizon moved early\n");
+		exit(1);
+	}
+	for (i = 0; i < COOKIE_REVOCATIONS_PROBES; i++) {
+		make_sid(sid, 16 + i * r->slots);
+		if (!cookie_revocations_check(r, sid, now)) {
+			fprintf(stderr, "revoked session %u not found\n", i);
+			exit(1);
+		}
+	}
+
+	make_sid(sid, 16 + COOKIE_REVOCATIONS_PROBES * r->slots);
+	cookie_revocations_add(r, sid, now + 100, now + 10);
+	if (cookie_revocations_horizon(r) != now + 10) {
+		fprintf(stderr, "the horizon did not move\n");
+		exit(1);
+	}
+
+	/* once expired, the slots are reused */
+	cookie_revocations_add(r, sid, now + 300, now + 200);
+	if (!cookie_revocations_check(r, sid, now + 200)) {
+		fprintf(stderr, "an expired slot was not reused\n");
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	check_cookies();
+	check_revocations();
+
+	return 0;
+}
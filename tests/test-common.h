@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_TESTS_TEST_COMMON_H
+# define OC_TESTS_TEST_COMMON_H
+
+/* The fixtures of the unit tests which include the sources of main;
+ * included after the sources under test. */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <talloc.h>
+# include <arpa/inet.h>
+# include <main.h>
+# include <ip-lease.h>
+
+# define CHECK(cond) \
+	if (!(cond)) { \
+		fprintf(stderr, "%d: check failed: %s\n", __LINE__, #cond); \
+		exit(1); \
+	}
+
+/* Returns a server with a default virtual host and an empty
+ * configuration, and no listeners, sessions or sec-mod instances */
+static __attribute__((unused))
+main_server_st *new_server(void)
+{
+	main_server_st *s = talloc_zero(NULL, main_server_st);
+	vhost_cfg_st *vhost;
+
+	CHECK(s != NULL);
+	s->vconfig = talloc(s, struct list_head);
+	vhost = talloc_zero(s, vhost_cfg_st);
+	CHECK(s->vconfig != NULL && vhost != NULL);
+	vhost->perm_config.config = talloc_zero(vhost, struct cfg_st);
+	CHECK(vhost->perm_config.config != NULL);
+	vhost->perm_config.uid = -1;
+	vhost->perm_config.gid = -1;
+	list_head_init(s->vconfig);
+	list_add_tail(s->vconfig, &vhost->list);
+
+	list_head_init(&s->listen_list.head);
+	list_head_init(&s->proc_list.head);
+	s->ctl_fd = -1;
+	s->cookie_revocations_fd = -1;
+
+	return s;
+}
+
+static __attribute__((unused))
+int parse_addr(const char *addr, struct sockaddr_storage *ss, socklen_t *len)
+{
+	int family = strchr(addr, ':') ? AF_INET6 : AF_INET;
+
+	memset(ss, 0, sizeof(*ss));
+	ss->ss_family = family;
+	if (family == AF_INET) {
+		*len = sizeof(struct sockaddr_in);
+		CHECK(inet_pton(family, addr, SA_IN_P(ss)) == 1);
+	} else {
+		*len = sizeof(struct sockaddr_in6);
+		CHECK(inet_pton(family, addr, SA_IN6_P(ss)) == 1);
+	}
+	return family;
+}
+
+/* Returns a lease of the local address @lip and the client address
+ * @rip, of either family */
+static __attribute__((unused))
+struct ip_lease_st *new_lease(void *pool, const char *lip, const char *rip, unsigned prefix)
+{
+	struct ip_lease_st *lease = talloc_zero(pool, struct ip_lease_st);
+
+	CHECK(lease != NULL);
+	parse_addr(lip, &lease->lip, &lease->lip_len);
+	parse_addr(rip, &lease->rip, &lease->rip_len);
+	lease->prefix = prefix;
+
+	return lease;
+}
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <gnutls/gnutls.h>
+
+#define force_write write
+
+#include "../src/tlslib.c"
+#include "../src/common/keyed-hash.c"
+#include "test-common.h"
+
+/* Rotates the session ticket key twice, and checks over TLS 1.2 and 1.3
+ * that a ticket is resumed by a server which has a newer key when the
+ * ticket's key is the previous one, as the worker does by looking up the
+ * key name of the ticket in the client hello, but not when it is older.
+ */
+
+#define EXPIRATION 300
+
+static gnutls_certificate_credentials_t server_cred, client_cred;
+static gnutls_datum_t server_key, server_prev_key;
+
+int get_cert_names(worker_st *ws, const gnutls_datum_t *raw)
+{
+	return 0;
+}
+
+/* the test does not parse the hello; the key name of a ticket is found
+ * at any position */
+static int hello_hook(gnutls_session_t session, unsigned int htype,
+		      unsigned when, unsigned int incoming,
+		      const gnutls_datum_t *msg)
+{
+	unsigned i;
+
+	if (htype != GNUTLS_HANDSHAKE_CLIENT_HELLO || when != GNUTLS_HOOK_PRE ||
+	    server_prev_key.size == 0)
+		return 0;
+
+	for (i = 0; i + TLS_TICKET_KEY_NAME_SIZE <= msg->size; i++) {
+		if (tls_ticket_key_issued(&server_prev_key, EXPIRATION, &msg->data[i])) {
+			CHECK(gnutls_session_ticket_enable_server(session, &server_prev_key) >= 0);
+			break;
+		}
+	}
+	return 0;
+}
+
+static int handshake(gnutls_session_t session)
+{
+	int ret;
+
+	do {
+		ret = gnutls_handshake(session);
+	} while (ret < 0 && gnutls_error_is_fatal(ret) == 0);
+	return ret;
+}
+
+static void server(int fd, const char *prio)
+{
+	gnutls_session_t session;
+
+	CHECK(gnutls_init(&session, GNUTLS_SERVER) >= 0);
+	CHECK(gnutls_priority_set_direct(session, prio, NULL) >= 0);
+	CHECK(gnutls_credentials_set(session, GNUTLS_CRD_CERTIFICATE, server_cred) >= 0);
+	CHECK(gnutls_session_ticket_enable_server(session, &server_key) >= 0);
+	gnutls_db_set_cache_expiration(session, EXPIRATION);
+	gnutls_handshake_set_hook_function(session, GNUTLS_HANDSHAKE_CLIENT_HELLO,
+					   GNUTLS_HOOK_PRE, hello_hook);
+	gnutls_transport_set_int(session, fd);
+
+	CHECK(handshake(session) >= 0);
+	/* TLS 1.3 tickets are sent after the handshake */
+	CHECK(gnutls_record_send(session, "x", 1) == 1);
+	gnutls_bye(session, GNUTLS_SHUT_WR);
+	gnutls_deinit(session);
+}
+
+/* Connects to a server with the given keys, resuming @ticket if it is
+ * not empty, or storing a new one in it. Returns whether the session
+ * was resumed. */
+static unsigned connect_to(const char *prio, const gnutls_datum_t *key,
+			   const gnutls_datum_t *prev_key, gnutls_datum_t *ticket)
+{
+	gnutls_session_t session;
+	int sv[2], status, ret;
+	unsigned resumed;
+	char c;
+	pid_t pid;
+
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+	server_key = *key;
+	server_prev_key = *prev_key;
+	pid = fork();
+	CHECK(pid != -1);
+	if (pid == 0) {
+		close(sv[1]);
+		server(sv[0], prio);
+		exit(0);
+	}
+	close(sv[0]);
+
+	CHECK(gnutls_init(&session, GNUTLS_CLIENT) >= 0);
+	CHECK(gnutls_priority_set_direct(session, prio, NULL) >= 0);
+	CHECK(gnutls_credentials_set(session, GNUTLS_CRD_CERTIFICATE, client_cred) >= 0);
+	if (ticket->size > 0)
+		CHECK(gnutls_session_set_data(session, ticket->data, ticket->size) >= 0);
+	gnutls_transport_set_int(session, sv[1]);
+
+	CHECK(handshake(session) >= 0);
+	do {
+		ret = gnutls_record_recv(session, &c, 1);
+	} while (ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED);
+	CHECK(ret == 1);
+	resumed = gnutls_session_is_resumed(session);
+	if (ticket->size == 0)
+		CHECK(gnutls_session_get_data2(session, ticket) >= 0);
+
+	gnutls_deinit(session);
+	close(sv[1]);
+	CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+	      WEXITSTATUS(status) == 0);
+	return resumed;
+}
+
+static void check_rotation(main_server_st *s, const char *prio)
+{
+	gnutls_datum_t t1 = {NULL, 0}, t2 = {NULL, 0};
+	gnutls_datum_t k1;
+
+	gnutls_free(s->ticket_key.data);
+	gnutls_free(s->prev_ticket_key.data);
+	s->ticket_key.size = s->prev_ticket_key.size = 0;
+	s->ticket_key.data = s->prev_ticket_key.data = NULL;
+
+	/* the first key */
+	tls_rotate_ticket_key(s, 1);
+	CHECK(s->ticket_key.size > 0 && s->prev_ticket_key.size == 0);
+	CHECK(connect_to(prio, &s->ticket_key, &s->prev_ticket_key, &t1) == 0);
+	CHECK(connect_to(prio, &s->ticket_key, &s->prev_ticket_key, &t1) == 1);
+
+	/* the key is kept until it is older than the rotation period */
+	k1 = s->ticket_key;
+	tls_rotate_ticket_key(s, 0);
+	CHECK(s->ticket_key.data == k1.data);
+
+	s->ticket_key_time -= 61;
+	tls_rotate_ticket_key(s, 0);
+	CHECK(s->ticket_key.size > 0 && s->prev_ticket_key.data == k1.data);
+	CHECK(memcmp(s->ticket_key.data, k1.data, k1.size) != 0);
+
+	/* the ticket of the previous key is accepted, unless the server
+	 * does not know it */
+	CHECK(connect_to(prio, &s->ticket_key, &s->prev_ticket_key, &t1) == 1);
+	CHECK(connect_to(prio, &s->ticket_key, &(gnutls_datum_t){NULL, 0}, &t1) == 0);
+	CHECK(connect_to(prio, &s->ticket_key, &s->prev_ticket_key, &t2) == 0);
+
+	/* after another rotation only the ticket of the previous key is */
+	tls_rotate_ticket_key(s, 1);
+	CHECK(connect_to(prio, &s->ticket_key, &s->prev_ticket_key, &t1) == 0);
+	CHECK(connect_to(prio, &s->ticket_key, &s->prev_ticket_key, &t2) == 1);
+
+	gnutls_free(t1.data);
+	gnutls_free(t2.data);
+}
+
+int main(void)
+{
+	main_server_st *s = new_server();
+	const char *srcdir = getenv("srcdir");
+	char cert[256], key[256];
+	gnutls_datum_t name = {NULL, 0};
+
+	if (srcdir == NULL)
+		srcdir = ".";
+
+	/* the server may still be writing when the client is done */
+	signal(SIGPIPE, SIG_IGN);
+	snprintf(cert, sizeof(cert), "%s/certs/server-cert.pem", srcdir);
+	snprintf(key, sizeof(key), "%s/certs/server-key.pem", srcdir);
+
+	GETPCONFIG(s)->tls_session_tickets = 1;
+	GETPCONFIG(s)->tls_ticket_key_rotation = 60;
+
+	CHECK(gnutls_global_init() >= 0);
+	CHECK(gnutls_certificate_allocate_credentials(&server_cred) >= 0);
+	CHECK(gnutls_certificate_allocate_credentials(&client_cred) >= 0);
+	CHECK(gnutls_certificate_set_x509_key_file(server_cred, cert, key,
+						   GNUTLS_X509_FMT_PEM) >= 0);
+
+	/* a key whose derived keys are unknown still matches its own
+	 * name, as with older GnuTLS versions */
+	CHECK(gnutls_session_ticket_key_generate(&name) >= 0);
+	CHECK(tls_ticket_key_issued(&name, EXPIRATION, name.data) == 1);
+	CHECK(tls_ticket_key_issued(&name, EXPIRATION, &name.data[1]) == 0);
+	gnutls_free(name.data);
+
+	check_rotation(s, "NORMAL:-VERS-ALL:+VERS-TLS1.2");
+	check_rotation(s, "NORMAL:-VERS-ALL:+VERS-TLS1.3");
+
+	gnutls_certificate_free_credentials(server_cred);
+	gnutls_certificate_free_credentials(client_cred);
+	talloc_free(s);
+	return 0;
+}
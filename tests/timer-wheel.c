@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/timer-wheel.c"
+
+/* Checks that the entries of the wheel expire on the first advance at or
+ * after their expiration, with random additions, moves and removals, and
+ * when called with 'bench' compares the cost of a maintenance cycle with
+ * the wheel and with a scan of all the entries.
+ */
+
+#define ENTRIES 20000
+
+struct item {
+	timer_wheel_entry_st t;
+	time_t expires; /* as expected; 0 if not scheduled */
+	unsigned fired;
+};
+
+static struct item items[ENTRIES];
+
+static void check_due(struct list_head *due, time_t prev, time_t now)
+{
+	timer_wheel_entry_st *e;
+	struct item *it;
+	unsigned i;
+
+	while ((e = list_top(due, timer_wheel_entry_st, list)) != NULL) {
+		list_del(&e->list);
+		it = container_of(e, struct item, t);
+
+		if (it->expires == 0 || it->fired) {
+			fprintf(stderr, "entry %u expired twice or when not scheduled\n",
+				(unsigned)(it - items));
+			exit(1);
+		}
+		if (it->expires > now) {
+			fprintf(stderr, "entry %u expired early: %ld > %ld\n",
+				(unsigned)(it - items), (long)it->expires, (long)now);
+			exit(1);
+		}
+		it->fired = 1;
+		it->expires = 0;
+	}
+
+	/* none is late */
+	for (i = 0; i < ENTRIES; i++) {
+		if (items[i].expires != 0 && items[i].expires <= now) {
+			fprintf(stderr, "entry %u did not expire at %ld (%ld, advanced from %ld)\n",
+				i, (long)now, (long)items[i].expires, (long)prev);
+			exit(1);
+		}
+	}
+}
+
+static void check_random(time_t start)
+{
+	timer_wheel_st w;
+	struct list_head due;
+	time_t now = start, prev, exp;
+	unsigned i, j, round, scheduled;
+
+	memset(items, 0, sizeof(items));
+	timer_wheel_init(&w, now);
+	list_head_init(&due);
+
+	for (round = 0; round < 400; round++) {
+		for (j = 0; j < 200; j++) {
+			i = random() % ENTRIES;
+			switch (random() % 4) {
+			case 0:
+				timer_wheel_del(&w, &items[i].t);
+				items[i].expires = 0;
+				break;
+			case 1:
+				/* beyond the span of the wheel */
+				exp = now + TIMER_WHEEL_SPAN + random() % (2 * TIMER_WHEEL_SPAN);
+				goto add;
+			default:
+				exp = now - 5 + random() % (1 << (random() % 22));
+ add:
+				timer_wheel_add(&w, &items[i].t, exp);
+				/* the earliest is the next second to expire */
+				items[i].expires = exp > w.next ? exp : w.next;
+				items[i].fired = 0;
+				break;
+			}
+		}
+
+		prev = now;
+		switch (random() % 3) {
+		case 0:
+			now += random() % 3;
+			break;
+		case 1:
+			now += random() % 400;
+			break;
+		default:
+			now += random() % (1 << (random() % 24));
+			break;
+		}
+		timer_wheel_advance(&w, now, &due);
+		check_due(&due, prev, now);
+
+		scheduled = 0;
+		for (i = 0; i < ENTRIES; i++)
+			if (items[i].expires != 0)
+				scheduled++;
+		if (scheduled != w.entries) {
+			fprintf(stderr, "%u entries scheduled, the wheel has %u\n", scheduled, w.entries);
+			exit(1);
+		}
+	}
+
+	/* a jump of the clock */
+	prev = now;
+	now += 3 * TIMER_WHEEL_SPAN;
+	timer_wheel_advance(&w, now, &due);
+	check_due(&due, prev, now);
+}
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* A client entry is large, and allocated on its own */
+struct bench_entry {
+	time_t exptime;
+	char data[1024];
+	timer_wheel_entry_st t;
+};
+
+/* entries expiring over a day, with a maintenance cycle every 310 secs */
+static void bench(unsigned n)
+{
+	struct bench_entry **e = calloc(n, sizeof(*e));
+	struct list_head due;
+	timer_wheel_st w;
+	struct timespec start;
+	time_t now = 1000000;
+	unsigned i, cycles = 0, expired = 0, scanned = 0;
+	double scan = 0, wheel = 0;
+
+	if (e == NULL) {
+		fprintf(stderr, "memory error\n");
+		exit(1);
+	}
+
+	timer_wheel_init(&w, now);
+	list_head_init(&due);
+	for (i = 0; i < n; i++) {
+		e[i] = calloc(1, sizeof(struct bench_entry));
+		if (e[i] == NULL) {
+			fprintf(stderr, "memory error\n");
+			exit(1);
+		}
+		e[i]->exptime = now + (i * 7919ULL) % (24 * 60 * 60);
+		timer_wheel_add(&w, &e[i]->t, e[i]->exptime);
+	}
+
+	for (now += 310; w.entries > 0; now += 310) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < n; i++) {
+			if (e[i]->exptime != 0 && e[i]->exptime <= now) {
+				e[i]->exptime = 0;
+				scanned++;
+			}
+		}
+		scan += elapsed(&start);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		expired += timer_wheel_advance(&w, now, &due);
+		list_head_init(&due);
+		wheel += elapsed(&start);
+		cycles++;
+	}
+
+	if (expired != n || scanned != n) {
+		fprintf(stderr, "%u and %u of %u entries expired\n", expired, scanned, n);
+		exit(1);
+	}
+
+	printf("%7u entries: usecs per cycle: wheel %.1f, scan %.1f\n",
+	       n, wheel * 1e6 / cycles, scan * 1e6 / cycles);
+
+	for (i = 0; i < n; i++)
+		free(e[i]);
+	free(e);
+}
+
+int main(int argc, char **argv)
+{
+	srandom(1);
+	check_random(1000);
+	/* with the lower slots of every level in use */
+	check_random(((time_t)1 << 30) - 3);
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		bench(10000);
+		bench(100000);
+		bench(1000000);
+	}
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OC_TESTS_TUN_COMMON_H
+# define OC_TESTS_TUN_COMMON_H
+
+/* The fixtures of the tests which create tun devices in a network
+ * namespace; included after the sources under test. */
+
+# include <sched.h>
+# include "test-common.h"
+
+/* the main process is not running its loop */
+struct ev_loop *main_loop = NULL;
+
+void ev_io_start(struct ev_loop *loop, ev_io *w)
+{
+}
+
+void ev_io_stop(struct ev_loop *loop, ev_io *w)
+{
+}
+
+void ev_idle_start(struct ev_loop *loop, ev_idle *w)
+{
+}
+
+void ev_idle_stop(struct ev_loop *loop, ev_idle *w)
+{
+}
+
+void ev_child_start(struct ev_loop *loop, ev_child *w)
+{
+}
+
+void ev_child_stop(struct ev_loop *loop, ev_child *w)
+{
+}
+
+/* the leases are given by the tests */
+int get_ip_leases(main_server_st *s, struct proc_st *proc)
+{
+	return 0;
+}
+
+/* Moves the process to a new network namespace, or exits with the
+ * skip status if it cannot create tun devices there */
+static void enter_netns(void)
+{
+	if (unshare(CLONE_NEWNET) == -1 || access("/dev/net/tun", R_OK | W_OK) != 0) {
+		fprintf(stderr, "cannot create tun devices in a network namespace; skipping\n");
+		exit(77);
+	}
+}
+
+/* Returns a server whose default virtual host names its devices after
+ * @device */
+static main_server_st *new_tun_server(const char *device)
+{
+	main_server_st *s = new_server();
+
+	snprintf(GETCONFIG(s)->network.name, sizeof(GETCONFIG(s)->network.name), "%s", device);
+	return s;
+}
+
+/* Sends a UDP packet to @addr, port 9 */
+static void send_to(const char *addr)
+{
+	struct sockaddr_storage ss;
+	socklen_t len;
+	int family = parse_addr(addr, &ss, &len);
+	int fd;
+
+	if (family == AF_INET)
+		((struct sockaddr_in *)&ss)->sin_port = htons(9);
+	else
+		((struct sockaddr_in6 *)&ss)->sin6_port = htons(9);
+
+	fd = socket(family, SOCK_DGRAM, 0);
+	if (fd == -1 || sendto(fd, "x", 1, 0, (struct sockaddr *)&ss, len) != 1) {
+		fprintf(stderr, "could not send to %s: %s\n", addr, strerror(errno));
+		exit(1);
+	}
+	close(fd);
+}
+
+/* Checks that the next UDP packet read from the non-blocking @fd, within
+ * a second, is for @addr; the other packets of the kernel, such as
+ * neighbor discovery, are skipped */
+static void expect(int fd, const char *addr)
+{
+	struct sockaddr_storage ss;
+	socklen_t len;
+	uint8_t buf[2048];
+	unsigned i;
+	ssize_t ret;
+	int family = parse_addr(addr, &ss, &len);
+
+	for (i = 0; i < 100; i++) {
+		ret = read(fd, buf, sizeof(buf));
+		if (ret == -1 && errno == EAGAIN) {
+			usleep(10000);
+			continue;
+		}
+
+		if (ret >= 20 && (buf[0] >> 4) == 4 && buf[9] == IPPROTO_UDP &&
+		    family == AF_INET && memcmp(&buf[16], SA_IN_P(&ss), 4) == 0)
+			return;
+		if (ret >= 40 && (buf[0] >> 4) == 6 && buf[6] == IPPROTO_UDP &&
+		    family == AF_INET6 && memcmp(&buf[24], SA_IN6_P(&ss), 16) == 0)
+			return;
+		if (ret > 0 && buf[(buf[0] >> 4) == 4 ? 9 : 6] == IPPROTO_UDP) {
+			fprintf(stderr, "unexpected packet while waiting for %s\n", addr);
+			exit(1);
+		}
+	}
+
+	fprintf(stderr, "no packet to %s\n", addr);
+	exit(1);
+}
+
+#endif
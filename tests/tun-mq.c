@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <talloc.h>
+
+#ifdef __linux__
+# include "../src/ip-util.c"
+# include "../src/rtnl.c"
+# include "../src/tun-mq.c"
+# include "tun-common.h"
+#endif
+
+/* Exercises the eBPF steering program of tun-multi-queue: packets to the
+ * addresses and iroutes of each session must come out of its own queue
+ * of the shared vpnsmq0 device, an address handed to another session
+ * follows it, the iroute leaves with its session, and a queue is only
+ * re-used after the ev_child watcher of its former worker has fired.
+ * Exits with 77 when the kernel cannot attach a steering program.
+ */
+
+#ifdef __linux__
+int main(void)
+{
+	char *iroutes[] = { "10.77.0.0/16" };
+	struct sockaddr_storage dst;
+	struct proc_st *p1, *p2;
+	GroupCfgSt group;
+	main_server_st *s;
+	struct mq_held_st *held;
+	rtnl_batch_st b;
+	unsigned prefix, slot;
+	int sink;
+
+	enter_netns();
+
+	s = new_tun_server("vpns");
+	GETPCONFIG(s)->tun_multi_queue = 1;
+
+	tun_mq_init(s);
+	if (s->tun_mq == NULL) {
+		fprintf(stderr, "eBPF tun steering is not available; skipping\n");
+		exit(77);
+	}
+
+	p1 = talloc_zero(s, struct proc_st);
+	p2 = talloc_zero(s, struct proc_st);
+	p1->ipv4 = new_lease(p1, "192.168.99.1", "192.168.99.2", 32);
+	p2->ipv4 = new_lease(p2, "192.168.99.1", "192.168.99.3", 32);
+	p2->ipv6 = new_lease(p2, "fd00::1", "fd00::2", 128);
+
+	memset(&group, 0, sizeof(group));
+	group.iroutes = iroutes;
+	group.n_iroutes = 1;
+	p1->config = &group;
+
+	if (tun_mq_open(s, p1) != 0 || tun_mq_open(s, p2) != 0) {
+		fprintf(stderr, "could not attach the sessions\n");
+		exit(1);
+	}
+
+	if (strcmp(p1->tun_lease.name, "vpnsmq0") != 0 ||
+	    strcmp(p2->tun_lease.name, "vpnsmq0") != 0 ||
+	    p1->tun_lease.mq_slot == p2->tun_lease.mq_slot) {
+		fprintf(stderr, "unexpected queues: %s %u, %s %u\n",
+			p1->tun_lease.name, p1->tun_lease.mq_slot,
+			p2->tun_lease.name, p2->tun_lease.mq_slot);
+		exit(1);
+	}
+	sink = s->tun_mq->devs[0]->queues[0].fd;
+
+	/* the route of an iroute is added as with route-netlink */
+	if (tun_mq_steer_iroutes(s, p1) != 0)
+		exit(1);
+	ip_route_parse(iroutes[0], &dst, &prefix);
+	rtnl_batch_init(&b, s);
+	rtnl_batch_add_route(&b, RTM_NEWROUTE, &dst, prefix, s->tun_mq->devs[0]->ifindex);
+	if (rtnl_batch_commit(&b) != 0) {
+		fprintf(stderr, "could not add the iroute\n");
+		exit(1);
+	}
+	rtnl_batch_deinit(&b);
+
+	if (tun_mq_set_mtu(s, p2, 1300) != 0) {
+		fprintf(stderr, "could not set the MTU\n");
+		exit(1);
+	}
+
+	send_to("192.168.99.2");
+	expect(p1->tun_lease.fd, "192.168.99.2");
+	send_to("10.77.3.4");
+	expect(p1->tun_lease.fd, "10.77.3.4");
+	send_to("192.168.99.3");
+	expect(p2->tun_lease.fd, "192.168.99.3");
+	send_to("fd00::2");
+	expect(p2->tun_lease.fd, "fd00::2");
+
+	/* the queue of the second session is re-used, once its worker is
+	 * reaped, for a session which takes the address of the first */
+	slot = p2->tun_lease.mq_slot;
+	tun_mq_close(s, p2, 4242);
+	held = list_top(&s->tun_mq->held, struct mq_held_st, list);
+	if (s->tun_mq->n_free != 0 || held == NULL || held->slot != slot - 1) {
+		fprintf(stderr, "the queue was released before its worker exited\n");
+		exit(1);
+	}
+	held_child_cb(main_loop, &held->child, EV_CHILD);
+	if (s->tun_mq->n_free != 1 || !list_empty(&s->tun_mq->held))
+		exit(1);
+
+	p2->ipv4 = new_lease(p2, "192.168.99.1", "192.168.99.2", 32);
+	p2->ipv6 = NULL;
+	if (tun_mq_open(s, p2) != 0 || p2->tun_lease.mq_slot != slot)
+		exit(1);
+
+	send_to("192.168.99.2");
+	expect(p2->tun_lease.fd, "192.168.99.2");
+
+	/* the address stays with the second session, the iroute is gone */
+	tun_mq_close(s, p1, -1);
+	send_to("192.168.99.2");
+	expect(p2->tun_lease.fd, "192.168.99.2");
+	send_to("10.77.3.4");
+	expect(sink, "10.77.3.4");
+
+	tun_mq_close(s, p2, 4243);
+	tun_mq_deinit(s);
+	if (if_nametoindex("vpnsmq0") != 0) {
+		fprintf(stderr, "the device was not removed\n");
+		exit(1);
+	}
+
+	talloc_free(s);
+	return 0;
+}
+#else
+int main(void)
+{
+	exit(77);
+}
+#endif
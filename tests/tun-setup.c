@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <talloc.h>
+
+#ifdef __linux__
+# include "../src/rtnl.c"
+# include "../src/tun.c"
+# include "tun-common.h"
+#endif
+
+/* Gives each of SESSIONS connections its own tun device through
+ * os_open_tun() and set_network_info(), then sends a datagram to the
+ * IPv4 and IPv6 client address of every session and reads it back from
+ * that session's descriptor. A last session reusing the IPv6 address of
+ * the first must lose its IPv6 lease, with the lease returned, while its
+ * IPv4 route works. 'bench' sets up BENCH_SESSIONS devices and reports
+ * the mean set up time. Needs CAP_NET_ADMIN and /dev/net/tun.
+ */
+
+#ifdef __linux__
+#define SESSIONS 16
+#define BENCH_SESSIONS 512
+
+static unsigned removed_leases;
+
+void remove_ip_lease(main_server_st *s, struct ip_lease_st *lease)
+{
+	removed_leases++;
+}
+
+ssize_t force_write(int sockfd, const void *buf, size_t len)
+{
+	return write(sockfd, buf, len);
+}
+
+int set_cloexec_flag(int fd, bool value)
+{
+	return 0;
+}
+
+#ifndef HAVE_STRLCPY
+size_t oc_strlcpy(char *dst, char const *src, size_t siz)
+{
+	size_t len = strlen(src);
+
+	if (siz > 0) {
+		if (len >= siz)
+			siz--;
+		else
+			siz = len;
+		memcpy(dst, src, siz);
+		dst[siz] = 0;
+	}
+	return len;
+}
+#endif
+
+/* the client address of session @i, in 10.0.0.0/8 or fd00::/16 */
+static const char *client_addr(int family, unsigned i, char buf[64])
+{
+	if (family == AF_INET)
+		snprintf(buf, 64, "10.%u.%u.2", i >> 8, i & 0xff);
+	else
+		snprintf(buf, 64, "fd00:%x::2", i);
+	return buf;
+}
+
+static struct proc_st *new_session(main_server_st *s, unsigned i, int *fd)
+{
+	struct proc_st *proc = talloc_zero(s, struct proc_st);
+	char lip[64], rip[64];
+
+	if (proc == NULL)
+		exit(1);
+
+	snprintf(lip, sizeof(lip), "10.%u.%u.1", i >> 8, i & 0xff);
+	proc->ipv4 = new_lease(proc, lip, client_addr(AF_INET, i, rip), 32);
+	snprintf(lip, sizeof(lip), "fd00:%x::1", i);
+	proc->ipv6 = new_lease(proc, lip, client_addr(AF_INET6, i, rip), 128);
+
+	*fd = os_open_tun(s, proc);
+	if (*fd < 0) {
+		fprintf(stderr, "cannot create tun devices; skipping\n");
+		exit(77);
+	}
+
+	return proc;
+}
+
+/* Checks that a packet sent to the client address of session @i is
+ * read from @fd */
+static void check_route(int fd, int family, unsigned i)
+{
+	char addr[64];
+
+	send_to(client_addr(family, i, addr));
+	expect(fd, addr);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned i, n, bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+	struct proc_st **procs;
+	main_server_st *s;
+	double start, total = 0;
+	int *fds;
+
+	enter_netns();
+	s = new_tun_server("vpns");
+
+	n = bench ? BENCH_SESSIONS : SESSIONS;
+	procs = talloc_array(s, struct proc_st *, n + 1);
+	fds = talloc_array(s, int, n + 1);
+
+	for (i = 0; i < n; i++) {
+		procs[i] = new_session(s, i, &fds[i]);
+
+		start = now_ns();
+		if (set_network_info(s, procs[i]) != 0) {
+			fprintf(stderr, "could not set up %s\n", procs[i]->tun_lease.name);
+			exit(1);
+		}
+		total += now_ns() - start;
+	}
+
+	if (bench)
+		printf("tun device set up: %.1f us/connection\n", total / n / 1000);
+
+	for (i = 0; i < n; i++) {
+		fcntl(fds[i], F_SETFL, O_NONBLOCK);
+		check_route(fds[i], AF_INET, i);
+		check_route(fds[i], AF_INET6, i);
+	}
+
+	/* the route to the IPv6 address of the first session exists */
+	procs[n] = new_session(s, 0, &fds[n]);
+	procs[n]->ipv4 = new_lease(procs[n], "11.0.0.1", "11.0.0.2", 32);
+	if (set_network_info(s, procs[n]) != 0 || procs[n]->ipv6 != NULL ||
+	    removed_leases != 1) {
+		fprintf(stderr, "the IPv6 failure was not handled\n");
+		exit(1);
+	}
+	fcntl(fds[n], F_SETFL, O_NONBLOCK);
+	send_to("11.0.0.2");
+	expect(fds[n], "11.0.0.2");
+
+	for (i = 0; i <= n; i++)
+		close(fds[i]);
+
+	talloc_free(s);
+	return 0;
+}
+#else
+int main(void)
+{
+	exit(77);
+}
+#endif
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2026 ocserv contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <talloc.h>
+
+#include "../src/mmap-table.c"
+#include "../src/main-ban.c"
+#include "../src/common/keyed-hash.c"
+#include "../src/stateless-cookie.c"
+#include "../src/main-upgrade.c"
+#include "test-common.h"
+
+/* Hands the state of a main process over as main_upgrade() does, short
+ * of the exec: pack_state() and the state file on one side, and
+ * main_upgrade_load() and the restore functions on the other. The new
+ * process must end up with the same listeners, sec-mod instances, ban
+ * entries, ticket keys and session, and with the cookie revocations
+ * mapped from the same memory as the instances which keep running.
+ */
+
+char **worker_argv;
+sigset_t sig_default_set;
+struct snapshot_t *config_snapshot;
+
+static char secmod_name[_POSIX_PATH_MAX] = "/run/ocserv-sm";
+static unsigned table_procs, pooled_leases;
+
+void add_listener(void *pool, struct listen_list_st *list,
+		  int fd, int family, int socktype, int protocol,
+		  struct sockaddr *addr, socklen_t addr_len)
+{
+	struct listener_st *l = talloc_zero(pool, struct listener_st);
+
+	CHECK(l != NULL);
+	l->fd = fd;
+	l->family = family;
+	l->sock_type = socktype;
+	l->protocol = protocol;
+	memcpy(&l->addr, addr, addr_len);
+	l->addr_len = addr_len;
+	list_add_tail(&list->head, &l->list);
+	list->total++;
+}
+
+const char *secmod_socket_file_name(struct perm_cfg_st *perm_config)
+{
+	return secmod_name;
+}
+
+void restore_secmod_socket_file_name(const char *save_path)
+{
+	strlcpy(secmod_name, save_path, sizeof(secmod_name));
+}
+
+int add_ip_lease(main_server_st *s, struct ip_lease_st *lease)
+{
+	pooled_leases++;
+	return 0;
+}
+
+int proc_table_add(main_server_st *s, struct proc_st *proc)
+{
+	table_procs++;
+	return 0;
+}
+
+int proc_table_update_dtls_ip(main_server_st *s, struct proc_st *proc,
+			      struct sockaddr_storage *addr, unsigned addr_size)
+{
+	return 0;
+}
+
+void remove_proc(main_server_st *s, struct proc_st *proc, unsigned flags)
+{
+	CHECK(0);
+}
+
+void lease_journal_init(main_server_st *s)
+{
+}
+
+void lease_journal_deinit(main_server_st *s)
+{
+}
+
+int snapshot_first(struct snapshot_t *snapshot, struct htable_iter *iter,
+		   int *fd, const char **file_name)
+{
+	return -1;
+}
+
+int snapshot_next(struct snapshot_t *snapshot, struct htable_iter *iter,
+		  int *fd, const char **file_name)
+{
+	return -1;
+}
+
+/* a server with an in-memory ban DB */
+static main_server_st *upgrade_server(void)
+{
+	main_server_st *s = new_server();
+
+	GETCONFIG(s)->max_ban_score = 20;
+	main_ban_db_init(s);
+	return s;
+}
+
+static void set_key(gnutls_datum_t *key, uint8_t c)
+{
+	key->data = gnutls_malloc(64);
+	CHECK(key->data != NULL);
+	memset(key->data, c, 64);
+	key->size = 64;
+}
+
+/* the state of the old main process */
+static main_server_st *old_server(uint8_t sid[SID_SIZE], GroupCfgSt *config)
+{
+	main_server_st *s = upgrade_server();
+	struct sockaddr_in sa;
+	struct proc_st *proc;
+	uint8_t ip[4] = { 192, 168, 7, 7 };
+	int i, fd[2];
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(4443);
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == 0);
+	add_listener(s, &s->listen_list, fd[0], AF_INET, SOCK_TYPE_TCP, 0,
+		     (struct sockaddr *)&sa, sizeof(sa));
+	close(fd[1]);
+
+	s->sec_mod_instance_count = 2;
+	s->sec_mod_instances = talloc_zero_array(s, sec_mod_instance_st, 2);
+	CHECK(s->sec_mod_instances != NULL);
+	for (i = 0; i < 2; i++) {
+		s->sec_mod_instances[i].sec_mod_pid = 100 + i;
+		CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == 0);
+		s->sec_mod_instances[i].sec_mod_fd = fd[0];
+		s->sec_mod_instances[i].sec_mod_fd_sync = fd[1];
+		snprintf(s->sec_mod_instances[i].socket_file,
+			 sizeof(s->sec_mod_instances[i].socket_file), "/run/ocserv-sm.%d", i);
+		snprintf(s->sec_mod_instances[i].full_socket_file,
+			 sizeof(s->sec_mod_instances[i].full_socket_file), "/run/ocserv-sm.%d.full", i);
+	}
+
+	CHECK(main_ban_db_import(s, ip, 4, 15, time(NULL) + 300, time(NULL)) == 0);
+
+	set_key(&s->ticket_key, 0x11);
+	set_key(&s->prev_ticket_key, 0x22);
+	s->ticket_key_time = 1234;
+	s->stats.start_time = 4321;
+	s->stats.total_auth_failures = 3;
+
+	s->cookie_revocations = cookie_revocations_new(10, &s->cookie_revocations_fd);
+	CHECK(s->cookie_revocations != NULL);
+	if (s->cookie_revocations_fd == -1) {
+		fprintf(stderr, "the revocations are not in a memory file; skipping\n");
+		exit(77);
+	}
+	cookie_revocations_add(s->cookie_revocations, sid, time(NULL) + 600, time(NULL));
+
+	proc = talloc_zero(s, struct proc_st);
+	CHECK(proc != NULL);
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == 0);
+	proc->pid = 4242;
+	proc->fd = fd[0];
+	proc->status = PS_AUTH_COMPLETED;
+	proc->sec_mod_instance_index = 1;
+	proc->conn_time = 5000;
+	memcpy(&proc->remote_addr, &sa, sizeof(sa));
+	proc->remote_addr_len = sizeof(sa);
+	memcpy(proc->sid, sid, SID_SIZE);
+	proc->active_sid = 1;
+	strcpy(proc->username, "user1");
+	strcpy(proc->groupname, "group1");
+	strcpy(proc->tls_ciphersuite, "(TLS1.3)-(ECDHE-X25519)");
+	strcpy(proc->tun_lease.name, "vpns0");
+	proc->mtu = 1400;
+	proc->ipv4_seed[0] = 0x5a;
+	proc->ipv4 = new_lease(proc, "10.0.0.1", "10.0.0.2", 32);
+	proc->ipv4->db = &s->ip_leases;
+	proc->ipv6 = new_lease(proc, "fd00::1", "fd00::2", 128);
+	proc->config = config;
+	proc->bytes_in = 1 << 20;
+	proc->bytes_out = 1 << 21;
+	list_add(&s->proc_list.head, &proc->list);
+	s->stats.active_clients = 1;
+
+	return s;
+}
+
+static UpgradeMsg *hand_over(main_server_st *s, void *pool)
+{
+	UpgradeMsg msg = UPGRADE_MSG__INIT;
+	char fd_str[16];
+	uint8_t *buf;
+	size_t size;
+	FILE *fp;
+
+	CHECK(pack_state(s, pool, &msg) == 0);
+	size = upgrade_msg__get_packed_size(&msg);
+	buf = talloc_size(pool, size);
+	CHECK(buf != NULL);
+	upgrade_msg__pack(&msg, buf);
+
+	fp = tmpfile();
+	CHECK(fp != NULL);
+	CHECK(fwrite(buf, 1, size, fp) == size && fflush(fp) == 0);
+	CHECK(lseek(fileno(fp), 0, SEEK_SET) == 0);
+	snprintf(fd_str, sizeof(fd_str), "%d", dup(fileno(fp)));
+	fclose(fp);
+	setenv(OCSERV_ENV_UPGRADE_FD, fd_str, 1);
+
+	/* the descriptors which are passed are inherited */
+	set_upgrade_cloexec(s, 1);
+
+	strcpy(secmod_name, "unset");
+	return main_upgrade_load(pool);
+}
+
+int main(void)
+{
+	char *routes[] = { "10.10.0.0/16" };
+	uint8_t sid[SID_SIZE], sid2[SID_SIZE];
+	GroupCfgSt config = GROUP_CFG_ST__INIT;
+	main_server_st *s, *s2;
+	struct listener_st *l;
+	struct proc_st *proc;
+	ban_entry_st *e;
+	UpgradeMsg *msg;
+	unsigned iter, n;
+	void *pool;
+
+	memset(sid, 0xab, sizeof(sid));
+	memset(sid2, 0xcd, sizeof(sid2));
+	config.routes = routes;
+	config.n_routes = 1;
+	config.has_rx_per_sec = 1;
+	config.rx_per_sec = 1000;
+
+	s = old_server(sid, &config);
+	pool = talloc_new(NULL);
+	msg = hand_over(s, pool);
+	CHECK(msg != NULL && getenv(OCSERV_ENV_UPGRADE_FD) == NULL);
+	CHECK(strcmp(secmod_name, "/run/ocserv-sm") == 0);
+
+	/* as in main() of the new process */
+	s2 = upgrade_server();
+	CHECK(main_upgrade_restore_listeners(s2, msg) == 0);
+	s2->sec_mod_instance_count = msg->n_sec_mods;
+	s2->sec_mod_instances = talloc_zero_array(s2, sec_mod_instance_st, msg->n_sec_mods);
+	CHECK(s2->sec_mod_instances != NULL);
+	main_upgrade_restore_sec_mod(s2, msg);
+	main_upgrade_restore_bans(s2, msg);
+	main_upgrade_restore_procs(s2, msg);
+
+	CHECK(s2->listen_list.total == 1);
+	l = list_top(&s2->listen_list.head, struct listener_st, list);
+	CHECK(l->fd == list_top(&s->listen_list.head, struct listener_st, list)->fd);
+	CHECK(l->family == AF_INET && l->sock_type == SOCK_TYPE_TCP);
+	CHECK(GETPCONFIG(s2)->port == 4443);
+
+	CHECK(s2->sec_mod_instance_count == 2);
+	for (n = 0; n < 2; n++) {
+		CHECK(s2->sec_mod_instances[n].sec_mod_pid == 100 + (pid_t)n);
+		CHECK(s2->sec_mod_instances[n].sec_mod_fd == s->sec_mod_instances[n].sec_mod_fd);
+		CHECK(s2->sec_mod_instances[n].sec_mod_fd_sync == s->sec_mod_instances[n].sec_mod_fd_sync);
+		CHECK(strcmp(s2->sec_mod_instances[n].full_socket_file,
+			     s->sec_mod_instances[n].full_socket_file) == 0);
+	}
+	CHECK(s2->sec_mod_instances[1].workers == 1);
+	CHECK(s2->stats.start_time == 4321 && s2->stats.total_auth_failures == 3);
+
+	CHECK(s2->ticket_key.size == 64 && memcmp(s2->ticket_key.data, s->ticket_key.data, 64) == 0);
+	CHECK(s2->ticket_key_time == 1234);
+	CHECK(s2->prev_ticket_key.size == 64 &&
+	      memcmp(s2->prev_ticket_key.data, s->prev_ticket_key.data, 64) == 0);
+
+	n = 0;
+	for (e = main_ban_db_first(s2, &iter); e != NULL; e = main_ban_db_next(s2, &iter)) {
+		CHECK(e->ip.size == 4 && e->score == 15);
+		n++;
+	}
+	CHECK(n == 1);
+
+	/* the revocations are those the running instances update */
+	CHECK(s2->cookie_revocations != NULL && s2->cookie_revocations != s->cookie_revocations);
+	CHECK(s2->cookie_revocations_fd == s->cookie_revocations_fd);
+	CHECK(cookie_revocations_check(s2->cookie_revocations, sid, time(NULL)));
+	CHECK(!cookie_revocations_check(s2->cookie_revocations, sid2, time(NULL)));
+	cookie_revocations_add(s->cookie_revocations, sid2, time(NULL) + 600, time(NULL));
+	CHECK(cookie_revocations_check(s2->cookie_revocations, sid2, time(NULL)));
+
+	CHECK(s2->stats.active_clients == 1 && table_procs == 1 && pooled_leases == 1);
+	proc = list_top(&s2->proc_list.head, struct proc_st, list);
+	CHECK(proc->pid == 4242 && proc->status == PS_AUTH_COMPLETED);
+	CHECK(proc->sec_mod_instance_index == 1 && proc->conn_time == 5000);
+	CHECK(memcmp(proc->sid, sid, SID_SIZE) == 0 && proc->active_sid);
+	CHECK(strcmp(proc->username, "user1") == 0 && strcmp(proc->groupname, "group1") == 0);
+	CHECK(strcmp(proc->tls_ciphersuite, "(TLS1.3)-(ECDHE-X25519)") == 0);
+	CHECK(strcmp(proc->tun_lease.name, "vpns0") == 0 && proc->tun_lease.fd == -1);
+	CHECK(proc->mtu == 1400 && proc->ipv4_seed[0] == 0x5a);
+	CHECK(proc->remote_addr_len == sizeof(struct sockaddr_in));
+	CHECK(proc->ipv4 != NULL && proc->ipv4->db == &s2->ip_leases);
+	CHECK(SA_IN_P(&proc->ipv4->rip)->s_addr == htonl(0x0a000002));
+	CHECK(proc->ipv6 != NULL && proc->ipv6->db == NULL && proc->ipv6->prefix == 128);
+	CHECK(proc->config != NULL && proc->config->n_routes == 1 &&
+	      strcmp(proc->config->routes[0], "10.10.0.0/16") == 0);
+	CHECK(proc->config->has_rx_per_sec && proc->config->rx_per_sec == 1000);
+	CHECK(proc->bytes_in == 1 << 20 && proc->bytes_out == 1 << 21);
+
+	talloc_free(pool);
+	talloc_free(s2);
+	talloc_free(s);
+	return 0;
+}